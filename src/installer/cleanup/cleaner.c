@@ -20,7 +20,7 @@ void emergency_cleanup() {
 
 // Cleanup function
 void cleanup_ncurses() {
-    if (log_win) delwin(log_win);
+    log_close_window();
     if (status_win) delwin(status_win);
     endwin();
 }
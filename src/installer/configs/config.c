@@ -40,6 +40,7 @@ void show_configuration_menu(void) {
         return;
     }
 
+    log_pause();
     int selected = 0;
     int max_y, max_x;
     getmaxyx(stdscr, max_y, max_x);
@@ -200,11 +201,13 @@ void show_configuration_menu(void) {
                     log_message("Selected configuration: %s", selected_id);
                 }
                 lua_close(L);
+                log_resume();
                 return;
             }
             break;
             case 27: // ESC
                 lua_close(L);
+                log_resume();
                 return;
         }
     }
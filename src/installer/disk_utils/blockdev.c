@@ -0,0 +1,331 @@
+/**
+ * @file blockdev.c
+ * @brief cached block device inventory read straight from sysfs
+ *
+ * Every attribute is read with openat() relative to the device's
+ * /sys/class/block entry, so a full scan costs a few hundred small
+ * reads and no process spawns. Partitions share the request queue of
+ * their disk, so queue attributes are copied from the parent.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "blockdev.h"
+
+#define SYS_CLASS_BLOCK "/sys/class/block"
+#define SCSI_CDROM_MAJOR 11
+#define UEVENT_BUF 8192
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static BlockDev cache[BLOCKDEV_MAX];
+static int cache_count = -1;       // -1 - not scanned yet
+
+// Read a small sysfs attribute relative to dirfd, newline stripped
+static int read_attr(int dirfd, const char *attr, char *buf, size_t len) {
+    int fd = openat(dirfd, attr, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0) return -1;
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' ')) n--;
+    buf[n] = '\0';
+    return 0;
+}
+
+static unsigned long long read_attr_ull(int dirfd, const char *attr,
+                                        unsigned long long def) {
+    char buf[32];
+    if (read_attr(dirfd, attr, buf, sizeof(buf)) != 0) return def;
+    return strtoull(buf, NULL, 10);
+}
+
+// Transport from the device's position in the sysfs device tree
+static BlockTransport transport_from_path(const char *path, const char *name) {
+    if (strstr(path, "/nvme")) return BLOCKDEV_TR_NVME;
+    if (strstr(path, "/usb")) return BLOCKDEV_TR_USB;
+    if (strstr(path, "/virtio")) return BLOCKDEV_TR_VIRTIO;
+    if (strstr(path, "/mmc") || strncmp(name, "mmcblk", 6) == 0) return BLOCKDEV_TR_MMC;
+    if (strstr(path, "/ata")) return BLOCKDEV_TR_SATA;
+    if (strstr(path, "/host")) return BLOCKDEV_TR_SCSI;
+    return BLOCKDEV_TR_UNKNOWN;
+}
+
+static void read_holders(int dirfd, BlockDev *d) {
+    int fd = openat(dirfd, "holders", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) && d->holder_count < BLOCKDEV_MAX_HOLDERS) {
+        if (de->d_name[0] == '.') continue;
+        snprintf(d->holders[d->holder_count++], sizeof(d->holders[0]), "%.31s", de->d_name);
+    }
+    closedir(dir);
+}
+
+static int scan_device(int classfd, const char *name, BlockDev *d) {
+    memset(d, 0, sizeof(*d));
+    snprintf(d->name, sizeof(d->name), "%s", name);
+
+    int dirfd = openat(classfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) return -1;
+
+    char buf[PATH_MAX];
+    if (read_attr(dirfd, "dev", buf, sizeof(buf)) != 0 ||
+        sscanf(buf, "%u:%u", &d->major, &d->minor) != 2) {
+        close(dirfd);
+        return -1;
+    }
+    d->size = read_attr_ull(dirfd, "size", 0) * 512;   // always 512-byte units
+
+    ssize_t n = readlinkat(classfd, name, buf, sizeof(buf) - 1);
+    buf[n > 0 ? n : 0] = '\0';
+    d->transport = transport_from_path(buf, name);
+
+    d->partno = (int)read_attr_ull(dirfd, "partition", 0);
+    if (d->partno > 0) {
+        // .../block/sda/sda2: the parent is the previous path component
+        d->is_partition = 1;
+        char *slash = strrchr(buf, '/');
+        if (slash) {
+            *slash = '\0';
+            slash = strrchr(buf, '/');
+            snprintf(d->parent, sizeof(d->parent), "%.31s", slash ? slash + 1 : buf);
+        }
+    } else {
+        if (read_attr(dirfd, "device/model", d->model, sizeof(d->model)) != 0)
+            d->model[0] = '\0';
+        d->rotational = (int)read_attr_ull(dirfd, "queue/rotational", 0);
+        d->removable = (int)read_attr_ull(dirfd, "removable", 0);
+        d->discard = read_attr_ull(dirfd, "queue/discard_max_bytes", 0) > 0;
+        d->write_zeroes = read_attr_ull(dirfd, "queue/write_zeroes_max_bytes", 0) > 0;
+        d->logical_sector = (unsigned)read_attr_ull(dirfd, "queue/logical_block_size", 512);
+        d->physical_sector = (unsigned)read_attr_ull(dirfd, "queue/physical_block_size",
+                                                     d->logical_sector);
+    }
+    read_holders(dirfd, d);
+    close(dirfd);
+    return 0;
+}
+
+static BlockDev *cache_find(const char *name) {
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].name, name) == 0) return &cache[i];
+    }
+    return NULL;
+}
+
+// Partitions share their disk's queue: inherit its attributes and
+// register with the disk's partition list
+static void link_partition(BlockDev *p) {
+    BlockDev *disk = cache_find(p->parent);
+    if (!disk) return;
+    p->rotational = disk->rotational;
+    p->removable = disk->removable;
+    p->discard = disk->discard;
+    p->write_zeroes = disk->write_zeroes;
+    p->logical_sector = disk->logical_sector;
+    p->physical_sector = disk->physical_sector;
+    p->transport = disk->transport;
+    snprintf(p->model, sizeof(p->model), "%s", disk->model);
+    for (int i = 0; i < disk->part_count; i++) {
+        if (strcmp(disk->partitions[i], p->name) == 0) return;
+    }
+    if (disk->part_count < BLOCKDEV_MAX_PARTS) {
+        snprintf(disk->partitions[disk->part_count++], sizeof(disk->partitions[0]),
+                 "%.31s", p->name);
+    }
+}
+
+// Caller holds cache_lock
+static void scan_locked(void) {
+    if (cache_count >= 0) return;
+    cache_count = 0;
+
+    int classfd = open(SYS_CLASS_BLOCK, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (classfd < 0) return;
+    DIR *dir = fdopendir(dup(classfd));
+    if (!dir) {
+        close(classfd);
+        return;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dir)) && cache_count < BLOCKDEV_MAX) {
+        if (de->d_name[0] == '.') continue;
+        if (scan_device(classfd, de->d_name, &cache[cache_count]) == 0) cache_count++;
+    }
+    closedir(dir);
+    close(classfd);
+
+    for (int i = 0; i < cache_count; i++) {
+        if (cache[i].is_partition) link_partition(&cache[i]);
+    }
+}
+
+static void remove_locked(const char *name) {
+    BlockDev *d = cache_find(name);
+    if (!d) return;
+
+    BlockDev *disk = d->is_partition ? cache_find(d->parent) : NULL;
+    if (disk) {
+        for (int i = 0; i < disk->part_count; i++) {
+            if (strcmp(disk->partitions[i], name) != 0) continue;
+            memmove(disk->partitions[i], disk->partitions[i + 1],
+                    (size_t)(disk->part_count - i - 1) * sizeof(disk->partitions[0]));
+            disk->part_count--;
+            break;
+        }
+    }
+    int idx = (int)(d - cache);
+    memmove(&cache[idx], &cache[idx + 1], (size_t)(cache_count - idx - 1) * sizeof(cache[0]));
+    cache_count--;
+}
+
+// Re-read one device after "add" or "change" (resize, media change)
+static void update_locked(const char *name) {
+    int classfd = open(SYS_CLASS_BLOCK, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (classfd < 0) return;
+
+    BlockDev fresh;
+    if (scan_device(classfd, name, &fresh) == 0) {
+        BlockDev *d = cache_find(name);
+        if (d) {
+            // Keep the partition list; partitions report their own events
+            memcpy(fresh.partitions, d->partitions, sizeof(fresh.partitions));
+            fresh.part_count = d->part_count;
+            *d = fresh;
+        } else if (cache_count < BLOCKDEV_MAX) {
+            d = &cache[cache_count++];
+            *d = fresh;
+        }
+        if (d && d->is_partition) {
+            link_partition(d);
+        } else if (d) {
+            for (int i = 0; i < cache_count; i++) {
+                if (cache[i].is_partition && strcmp(cache[i].parent, name) == 0)
+                    link_partition(&cache[i]);
+            }
+        }
+    }
+    close(classfd);
+}
+
+int blockdev_apply_events(int fd) {
+    char buf[UEVENT_BUF];
+    int changed = 0;
+
+    pthread_mutex_lock(&cache_lock);
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if (n <= 0) {
+            if (n < 0 && errno == ENOBUFS) {
+                // Events were lost: fall back to a full scan next time
+                cache_count = -1;
+                changed++;
+                continue;
+            }
+            break;
+        }
+        buf[n] = '\0';
+
+        // "action@devpath\0KEY=value\0..."
+        const char *action = NULL, *devname = NULL;
+        int block = 0;
+        for (char *p = buf; p < buf + n; p += strlen(p) + 1) {
+            if (strncmp(p, "ACTION=", 7) == 0) action = p + 7;
+            else if (strncmp(p, "DEVNAME=", 8) == 0) devname = p + 8;
+            else if (strcmp(p, "SUBSYSTEM=block") == 0) block = 1;
+        }
+        if (!block || !action || !devname || cache_count < 0) continue;
+        if (strncmp(devname, "/dev/", 5) == 0) devname += 5;
+
+        if (strcmp(action, "remove") == 0) {
+            remove_locked(devname);
+        } else if (strcmp(action, "add") == 0 || strcmp(action, "change") == 0) {
+            update_locked(devname);
+        } else {
+            continue;
+        }
+        changed++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return changed;
+}
+
+static int is_installable(const BlockDev *d) {
+    static const char *const virtual_prefix[] = {
+        "loop", "ram", "zram", "dm-", "md", "sr", "fd", "nbd", NULL
+    };
+    if (d->is_partition || d->size == 0 || d->major == SCSI_CDROM_MAJOR) return 0;
+    for (int i = 0; virtual_prefix[i]; i++) {
+        if (strncmp(d->name, virtual_prefix[i], strlen(virtual_prefix[i])) == 0) return 0;
+    }
+    return 1;
+}
+
+int blockdev_disks(BlockDev out[], int max) {
+    int count = 0;
+    pthread_mutex_lock(&cache_lock);
+    scan_locked();
+    for (int i = 0; i < cache_count && count < max; i++) {
+        if (is_installable(&cache[i])) out[count++] = cache[i];
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return count;
+}
+
+int blockdev_lookup(const char *name, BlockDev *out) {
+    if (strncmp(name, "/dev/", 5) == 0) name += 5;
+    pthread_mutex_lock(&cache_lock);
+    scan_locked();
+    BlockDev *d = cache_find(name);
+    if (d) *out = *d;
+    pthread_mutex_unlock(&cache_lock);
+    return d ? 0 : -1;
+}
+
+void blockdev_invalidate(void) {
+    pthread_mutex_lock(&cache_lock);
+    cache_count = -1;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+const char *blockdev_transport_name(BlockTransport t) {
+    switch (t) {
+    case BLOCKDEV_TR_SATA: return "sata";
+    case BLOCKDEV_TR_NVME: return "nvme";
+    case BLOCKDEV_TR_VIRTIO: return "virtio";
+    case BLOCKDEV_TR_USB: return "usb";
+    case BLOCKDEV_TR_MMC: return "mmc";
+    case BLOCKDEV_TR_SCSI: return "scsi";
+    default: return "unknown";
+    }
+}
+
+void blockdev_format_size(unsigned long long bytes, char *buf, size_t len) {
+    static const char units[] = "BKMGTP";
+    double v = (double)bytes;
+    int u = 0;
+    while (v >= 1024.0 && u < 5) {
+        v /= 1024.0;
+        u++;
+    }
+    if (u == 0 || v == (double)(unsigned long long)v)
+        snprintf(buf, len, "%.0f%c", v, units[u]);
+    else
+        snprintf(buf, len, "%.1f%c", v, units[u]);
+}
@@ -0,0 +1,72 @@
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#include <stddef.h>
+
+/*
+ * Block device inventory.
+ * One pass over /sys/class/block records every disk and partition with
+ * the attributes the installer cares about (size, model, rotational,
+ * sector sizes, discard, removable, transport, holders, partitions).
+ * The result is cached; callers get copies, so the cache can be
+ * refreshed at any time with blockdev_invalidate(), or kept current
+ * from kernel uevents with blockdev_apply_events().
+ */
+
+#define BLOCKDEV_MAX 64
+#define BLOCKDEV_MAX_PARTS 16
+#define BLOCKDEV_MAX_HOLDERS 4
+
+typedef enum {
+    BLOCKDEV_TR_UNKNOWN = 0,
+    BLOCKDEV_TR_SATA,
+    BLOCKDEV_TR_NVME,
+    BLOCKDEV_TR_VIRTIO,
+    BLOCKDEV_TR_USB,
+    BLOCKDEV_TR_MMC,
+    BLOCKDEV_TR_SCSI,
+} BlockTransport;
+
+typedef struct {
+    char name[32];                 // kernel name, "sda", "nvme0n1p2"
+    unsigned major, minor;
+    unsigned long long size;       // bytes
+    char model[64];                // "" when the device has none
+    int rotational;
+    int removable;
+    int discard;                   // discard_max_bytes > 0
+    int write_zeroes;              // write_zeroes_max_bytes > 0: zeroing offload
+    unsigned logical_sector;
+    unsigned physical_sector;
+    BlockTransport transport;
+    int is_partition;
+    int partno;                    // partitions only
+    char parent[32];               // partitions only: whole-disk name
+    char partitions[BLOCKDEV_MAX_PARTS][32];  // disks only
+    int part_count;
+    char holders[BLOCKDEV_MAX_HOLDERS][32];   // dm/md devices built on top
+    int holder_count;
+} BlockDev;
+
+// Copy the whole disks an OS can be installed on (no loop/ram/zram/dm/
+// optical/empty devices) into out. Returns the number copied.
+int blockdev_disks(BlockDev out[], int max);
+
+// Look up one device (disk or partition) by kernel name or /dev path.
+// Returns 0 and fills out, -1 when there is no such device.
+int blockdev_lookup(const char *name, BlockDev *out);
+
+// Drop the cache; the next call walks sysfs again
+void blockdev_invalidate(void);
+
+// Drain a NETLINK_KOBJECT_UEVENT socket (see devwait_open()) and apply
+// the block events to the cache: add, remove and change touch only the
+// device named in the event. Returns the number of devices changed.
+int blockdev_apply_events(int fd);
+
+const char *blockdev_transport_name(BlockTransport t);
+
+// Human readable size like lsblk prints it: "476.9G", "512M"
+void blockdev_format_size(unsigned long long bytes, char *buf, size_t len);
+
+#endif // blockdev h
@@ -0,0 +1,128 @@
+/**
+ * @file devwait.c
+ * @brief wait for device nodes using kernel uevents
+ *
+ * The kernel creates the devtmpfs node before it broadcasts the "add"
+ * uevent, so re-checking the wanted paths whenever a block event arrives
+ * returns as soon as the last one shows up, with no fixed sleeps.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "devwait.h"
+#include "../utils/log_message.h"
+
+#define UEVENT_GROUP_KERNEL 1
+#define UEVENT_BUF 8192
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int all_exist(const char *const paths[]) {
+    struct stat st;
+    for (int i = 0; paths[i]; i++) {
+        if (stat(paths[i], &st) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int devwait_open(DevWait *w) {
+    struct sockaddr_nl addr;
+
+    w->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                   NETLINK_KOBJECT_UEVENT);
+    if (w->fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_GROUP_KERNEL;
+    if (bind(w->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(w->fd);
+        w->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Drain queued uevents; returns 1 if any of them was a block device event
+static int drain_events(int fd) {
+    char buf[UEVENT_BUF];
+    int block = 0;
+
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == ENOBUFS) {
+                // Overflowed: events were lost, so re-check anyway
+                block = 1;
+                continue;
+            }
+            break;
+        }
+        buf[n] = '\0';
+
+        // "action@devpath\0KEY=value\0..."
+        for (char *p = buf; p < buf + n; p += strlen(p) + 1) {
+            if (strcmp(p, "SUBSYSTEM=block") == 0) {
+                block = 1;
+                break;
+            }
+        }
+    }
+    return block;
+}
+
+int devwait_for(DevWait *w, const char *const paths[], int timeout_ms) {
+    long long start = now_ms();
+    long long deadline = start + timeout_ms;
+    int ready = all_exist(paths);
+
+    while (!ready) {
+        long long left = deadline - now_ms();
+        if (left <= 0) {
+            return -1;
+        }
+
+        if (w->fd < 0) {
+            struct timespec ts = {0, DEVWAIT_POLL_MS * 1000000L};
+            nanosleep(&ts, NULL);
+            ready = all_exist(paths);
+            continue;
+        }
+
+        struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+        int rc = poll(&pfd, 1, (int)left);
+        if (rc < 0 && errno != EINTR) {
+            // Socket broke: finish with polling
+            close(w->fd);
+            w->fd = -1;
+        } else if (rc > 0 && drain_events(w->fd)) {
+            ready = all_exist(paths);
+        }
+    }
+
+    log_message("Device nodes ready after %lld ms", now_ms() - start);
+    return 0;
+}
+
+void devwait_close(DevWait *w) {
+    if (w->fd >= 0) {
+        close(w->fd);
+        w->fd = -1;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef DEVWAIT_H
+#define DEVWAIT_H
+
+/*
+ * Event-driven wait for device nodes.
+ * Listens to kernel uevents (NETLINK_KOBJECT_UEVENT) and re-checks the
+ * wanted paths on every block event instead of sleeping between stat()
+ * calls. Falls back to short polling when netlink is unavailable.
+ */
+
+#define DEVWAIT_POLL_MS 50     // fallback polling interval
+
+typedef struct {
+    int fd;                    // uevent socket, -1 = polling fallback
+} DevWait;
+
+// Subscribe to uevents. Open before triggering the change (e.g. writing
+// a partition table) so no event can be missed.
+int devwait_open(DevWait *w);
+
+// Wait until every path in the NULL-terminated list exists.
+// Returns 0 when they all do, -1 on timeout.
+int devwait_for(DevWait *w, const char *const paths[], int timeout_ms);
+
+void devwait_close(DevWait *w);
+
+#endif // devwait h
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <ncurses.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,29 +10,73 @@
 #include "../utils/log_message.h"
 #include "../utils/run_command.h"
 #include "../include/installer.h"
+#include "blockdev.h"
+#include "devwait.h"
+#include "gpt.h"
+#include "wipe.h"
+
+#define WIPE_VERIFY_SAMPLES 256
+
+
+// Where and as what the device major:minor is mounted, "" if it is not
+static void find_mount(unsigned major, unsigned minor, char *mnt, size_t mnt_len,
+                       char *fstype, size_t fstype_len) {
+    mnt[0] = fstype[0] = '\0';
+    FILE *fp = fopen("/proc/self/mountinfo", "r");
+    if (!fp) return;
+
+    char line[2048];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned maj, min;
+        char point[512], type[32];
+        const char *sep = strstr(line, " - ");
+        if (!sep || sscanf(line, "%*d %*d %u:%u %*s %511s", &maj, &min, point) != 3 ||
+            sscanf(sep + 3, "%31s", type) != 1) {
+            continue;
+        }
+        if (maj == major && min == minor) {
+            snprintf(mnt, mnt_len, "%s", point);
+            snprintf(fstype, fstype_len, "%s", type);
+            break;
+        }
+    }
+    fclose(fp);
+}
 
+static void show_device_row(int y, const BlockDev *dev) {
+    char size[16], mnt[512], fstype[32];
+    blockdev_format_size(dev->size, size, sizeof(size));
+    find_mount(dev->major, dev->minor, mnt, sizeof(mnt), fstype, sizeof(fstype));
+    mvprintw(y, 5, "%s%-*s %-9s %-9s %-15s %-10s %s", dev->is_partition ? "  " : "",
+             dev->is_partition ? 8 : 10, dev->name, size,
+             dev->is_partition ? "part" : "disk", mnt[0] ? mnt : "-",
+             fstype[0] ? fstype : "-", dev->is_partition ? "" : dev->model);
+}
 
 // Enhanced disk info display
 void show_disk_info() {
+    log_pause();
     clear();
 
     attron(A_BOLD | COLOR_PAIR(1));
     mvprintw(2, 5,  "STORAGE DEVICE INFORMATION");
     attroff(A_BOLD | COLOR_PAIR(1));
 
-    mvprintw(4, 5, "Device     Size      Type      Mountpoint      Filesystem");
+    mvprintw(4, 5, "Device     Size      Type      Mountpoint      Filesystem Model");
     mvprintw(5, 5, "────────────────────────────────────────────────────────────");
 
-    // Use lsblk with detailed output
-    FILE *fp = popen("lsblk -o NAME,SIZE,TYPE,MOUNTPOINT,FSTYPE,MODEL | grep -E '^[s|n|v]'", "r");
-    if (fp) {
-        char line[256];
-        int y = 6;
-        while (fgets(line, sizeof(line), fp) && y < 24) {
-            line[strcspn(line, "\n")] = 0;
-            mvprintw(y++, 5, "%s", line);
+    // Disks from the block device inventory, each followed by its partitions
+    BlockDev devs[MAX_DISKS];
+    int count = blockdev_disks(devs, MAX_DISKS);
+    int y = 6;
+    for (int i = 0; i < count && y < 24; i++) {
+        show_device_row(y++, &devs[i]);
+        for (int p = 0; p < devs[i].part_count && y < 24; p++) {
+            BlockDev part;
+            if (blockdev_lookup(devs[i].partitions[p], &part) == 0) {
+                show_device_row(y++, &part);
+            }
         }
-        pclose(fp);
     }
 
     // Show disk usage
@@ -39,18 +84,79 @@ void show_disk_info() {
     run_command("df -h / /home /boot 2>/dev/null | tail -3", 1);
 
     attron(COLOR_PAIR(4));
-    mvprintw(28, 5, "Note: Only devices starting with sd, nvme, or vd are shown");
+    mvprintw(28, 5, "Note: loop, ram, optical and empty devices are not shown");
     attroff(COLOR_PAIR(4));
 
     mvprintw(30, 5, "Press any key to continue...");
     refresh();
     getch();
+    log_resume();
+}
+
+
+
+// Fill the selection rows from the cached block device inventory
+static int load_disks(DiskInfo disks[MAX_DISKS]) {
+    BlockDev devs[MAX_DISKS];
+    int count = blockdev_disks(devs, MAX_DISKS);
+    for (int i = 0; i < count; i++) {
+        snprintf(disks[i].name, sizeof(disks[i].name), "%s", devs[i].name);
+        blockdev_format_size(devs[i].size, disks[i].size, sizeof(disks[i].size));
+        snprintf(disks[i].type, sizeof(disks[i].type), "%s",
+                 blockdev_transport_name(devs[i].transport));
+        snprintf(disks[i].model, sizeof(disks[i].model), "%s",
+                 devs[i].model[0] ? devs[i].model : "Unknown");
+    }
+    return count;
+}
+
+static void wipe_progress(unsigned long long done, unsigned long long total,
+                          double mb_per_sec, void *arg) {
+    log_message("Wiping %s: %.1f%% (%.0f MB/s)", (const char *)arg,
+                total ? done * 100.0 / total : 100.0, mb_per_sec);
 }
 
+static int run_wipe(const char *device, WipeMode mode) {
+    log_message("Performing %s wipe on %s...", wipe_mode_name(mode), device);
+
+    WipeOptions opt = {
+        .mode = mode,
+        .verify_samples = WIPE_VERIFY_SAMPLES,
+        .progress = wipe_progress,
+        .progress_arg = (void *)device,
+    };
+    return wipe_device(device, &opt, NULL);
+}
 
+// Sleep until a key press or a block uevent. Returns the key, or ERR
+// when a hotplug event changed the list (rows reloaded into disks)
+static int wait_input(DevWait *mon, DiskInfo disks[MAX_DISKS], int *count) {
+    if (mon->fd >= 0) {
+        // Keys ncurses has already read from stdin never wake poll()
+        nodelay(stdscr, TRUE);
+        int ch = getch();
+        nodelay(stdscr, FALSE);
+        if (ch != ERR) return ch;
+
+        struct pollfd pfd[2] = {
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = mon->fd, .events = POLLIN},
+        };
+        if (poll(pfd, 2, -1) < 0 && errno != EINTR) {
+            devwait_close(mon);
+        }
+        if ((pfd[1].revents & POLLIN) && blockdev_apply_events(mon->fd) > 0) {
+            *count = load_disks(disks);
+            return ERR;
+        }
+        if (!(pfd[0].revents & POLLIN)) return ERR;
+    }
+    return getch();
+}
 
 // Get target disk with enhanced safety
 void get_target_disk(char *target, size_t size) {
+    log_pause();
     clear();
 
     // Warning with enhanced visuals
@@ -80,45 +186,20 @@ void get_target_disk(char *target, size_t size) {
     mvprintw(2, 5, "Scanning storage devices...");
     refresh();
 
-    DiskInfo disks[MAX_DISKS];
-    int count = 0;
-
-    // Get disk information using lsblk
-    FILE *fp = popen("lsblk -dno NAME,SIZE,TYPE,MODEL 2>/dev/null | grep -E '^sd|^nvme|^vd'", "r");
-    if (fp) {
-        char line[256];
-        while (fgets(line, sizeof(line), fp) && count < MAX_DISKS) {
-            line[strcspn(line, "\n")] = 0;
-
-            // Parse disk information
-            char *token = strtok(line, " ");
-            if (token) strncpy(disks[count].name, token, sizeof(disks[count].name)-1);
-
-            token = strtok(NULL, " ");
-            if (token) strncpy(disks[count].size, token, sizeof(disks[count].size)-1);
+    // Subscribe before the first scan so no hotplug event slips between them
+    DevWait mon;
+    devwait_open(&mon);
 
-            token = strtok(NULL, " ");
-            if (token) strncpy(disks[count].type, token, sizeof(disks[count].type)-1);
-
-            // Get model name (rest of the line)
-            token = strtok(NULL, "\n");
-            if (token) {
-                strncpy(disks[count].model, token, sizeof(disks[count].model)-1);
-            } else {
-                strcpy(disks[count].model, "Unknown");
-            }
-
-            count++;
-        }
-        pclose(fp);
-    }
+    DiskInfo disks[MAX_DISKS];
+    int count = load_disks(disks);
 
-    if (count == 0) {
+    if (count == 0 && mon.fd < 0) {
         mvprintw(5, 5, "No suitable disks found. Please check connections.");
         mvprintw(6, 5, "Make sure you have at least one SATA, NVMe, or VirtIO disk.");
         refresh();
         sleep(3);
         strcpy(target, "");
+        log_resume();
         return;
     }
 
@@ -134,6 +215,11 @@ void get_target_disk(char *target, size_t size) {
         mvprintw(3, 5, "Use ↑/↓ to navigate, ENTER to select, ESC to cancel");
         mvprintw(4, 5, "─────────────────────────────────────────────────────");
 
+        if (count == 0) {
+            mvprintw(6, 7, "No suitable disks found. Attach a SATA, NVMe, USB or VirtIO disk,");
+            mvprintw(7, 7, "it will show up here automatically.");
+        }
+
         // Display disks
         for (int i = 0; i < count; i++) {
             if (i == selected) {
@@ -147,21 +233,35 @@ void get_target_disk(char *target, size_t size) {
             }
         }
 
-        // Show selection info
-        mvprintw(6 + count + 1, 5, "Selected: /dev/%-10s %-10s",
-                disks[selected].name, disks[selected].size);
+        if (count > 0) {
+            // Show selection info
+            mvprintw(6 + count + 1, 5, "Selected: /dev/%-10s %-10s",
+                    disks[selected].name, disks[selected].size);
 
-        // Show disk model
-        if (strlen(disks[selected].model) > 0) {
-            mvprintw(6 + count + 2, 5, "Model: %s", disks[selected].model);
-        }
+            // Show disk model
+            if (strlen(disks[selected].model) > 0) {
+                mvprintw(6 + count + 2, 5, "Model: %s", disks[selected].model);
+            }
 
-        // Show warning for selected disk
-        attron(COLOR_PAIR(3));
-        mvprintw(6 + count + 4, 5, "WARNING: All data on this disk will be lost!");
-        attroff(COLOR_PAIR(3));
+            // Show warning for selected disk
+            attron(COLOR_PAIR(3));
+            mvprintw(6 + count + 4, 5, "WARNING: All data on this disk will be lost!");
+            attroff(COLOR_PAIR(3));
+        }
+        refresh();
 
-        int ch = getch();
+        char current[64];
+        snprintf(current, sizeof(current), "%s", count > 0 ? disks[selected].name : "");
+        int ch = wait_input(&mon, disks, &count);
+        if (ch == ERR) {
+            // Keep the cursor on the same disk across hotplug
+            selected = 0;
+            for (int i = 0; i < count; i++) {
+                if (strcmp(disks[i].name, current) == 0) selected = i;
+            }
+            continue;
+        }
+        if (count == 0 && ch != 27) continue;
         switch (ch) {
             case KEY_UP:
                 selected = (selected > 0) ? selected - 1 : count - 1;
@@ -187,23 +287,30 @@ void get_target_disk(char *target, size_t size) {
                     // Optional secure wipe
                     clear();
                     mvprintw(5, 5, "Perform secure wipe before installation?");
-                    mvprintw(6, 5, "This will overwrite the first 10MB with zeros.");
-                    mvprintw(7, 5, "Type 'WIPE' to perform secure wipe, any other key to skip:");
+                    mvprintw(6, 5, "WIPE - fast erase (NVMe format or discard, else zeros)");
+                    mvprintw(7, 5, "FULL - overwrite every sector with random data and verify");
+                    mvprintw(8, 5, "Type 'WIPE' or 'FULL' to wipe, any other key to skip:");
 
                     char wipe_confirm[10];
                     echo();
-                    mvgetnstr(8, 5, wipe_confirm, sizeof(wipe_confirm)-1);
+                    mvgetnstr(9, 5, wipe_confirm, sizeof(wipe_confirm)-1);
                     noecho();
+                    log_resume();
 
                     if (strcmp(wipe_confirm, "WIPE") == 0) {
                         secure_wipe(device_path);
+                    } else if (strcmp(wipe_confirm, "FULL") == 0) {
+                        run_wipe(device_path, WIPE_RANDOM);
                     }
 
+                    devwait_close(&mon);
                     return;
                 }
                 break;
             case 27: // ESC
                 strcpy(target, "");
+                devwait_close(&mon);
+                log_resume();
                 return;
         }
     }
@@ -233,54 +340,20 @@ void create_partitions(const char *disk) {
 
     log_message("Creating partition table on %s...", dev_path);
 
-    // Clear existing partitions with multiple methods
-    char cmd[512];
-
-    // Method 1: sgdisk zap
-    snprintf(cmd, sizeof(cmd), "sgdisk --zap-all %s 2>/dev/null", dev_path);
-    if (run_command(cmd, 0) != 0) {
-        // Method 2: dd wipe partition table
-        log_message("sgdisk failed, trying alternative method...");
-        snprintf(cmd, sizeof(cmd), "dd if=/dev/zero of=%s bs=512 count=1 conv=notrunc 2>/dev/null", dev_path);
-        run_command(cmd, 0);
-
-        // Refresh kernel partition table
-        run_command("partprobe 2>/dev/null", 0);
-        sleep(2);
-    }
-
-    // Create GPT partition table
-    log_message("Creating GPT partition table...");
-    snprintf(cmd, sizeof(cmd), "sgdisk --clear %s", dev_path);
-    if (run_command(cmd, 0) != 0) {
-        log_message("Failed to create GPT, trying fallback...");
-        snprintf(cmd, sizeof(cmd), "parted -s %s mklabel gpt", dev_path);
-        run_command(cmd, 0);
-    }
-
-    // Create EFI partition (550MB)
-    log_message("Creating EFI system partition (550MB)...");
-    snprintf(cmd, sizeof(cmd), "sgdisk --new=1:0:+550M --typecode=1:ef00 %s", dev_path);
-    if (run_command(cmd, 0) != 0) {
-        snprintf(cmd, sizeof(cmd), "parted -s %s mkpart primary fat32 1MiB 551MiB", dev_path);
-        run_command(cmd, 0);
-        snprintf(cmd, sizeof(cmd), "parted -s %s set 1 esp on", dev_path);
-        run_command(cmd, 0);
-    }
-
-    // Create root partition (rest of disk)
-    log_message("Creating root partition...");
-    snprintf(cmd, sizeof(cmd), "sgdisk --new=2:0:0 --typecode=2:8304 %s", dev_path);
-    if (run_command(cmd, 0) != 0) {
-        snprintf(cmd, sizeof(cmd), "parted -s %s mkpart primary ext4 551MiB 100%%", dev_path);
-        run_command(cmd, 0);
+    // GPT: EFI system partition (550MB) + root (rest of disk), written
+    // in-process and re-read by the kernel before gpt_create() returns
+    const PartSpec parts[] = {
+        {"EFI system partition", GPT_TYPE_ESP, MBR_TYPE_ESP, 550, 0},
+        {"Linux root", GPT_TYPE_ROOT_X86_64, MBR_TYPE_LINUX, 0, 0},
+    };
+    DevWait wait;
+    devwait_open(&wait);
+    if (gpt_create(dev_path, parts, 2) != 0) {
+        log_message("Failed to create GPT on %s", dev_path);
+        devwait_close(&wait);
+        return;
     }
 
-    // Update kernel partition table
-    log_message("Updating partition table...");
-    run_command_with_fallback("partprobe", "blockdev --rereadpt");
-    sleep(3);
-
     // Verify partitions were created
     char part1[32], part2[32];
     if (strncmp(disk, "nvme", 4) == 0 || strncmp(disk, "vd", 2) == 0) {
@@ -291,17 +364,13 @@ void create_partitions(const char *disk) {
         snprintf(part2, sizeof(part2), "%s2", dev_path);
     }
 
-    int attempts = 0;
-    while ((!file_exists(part1) || !file_exists(part2)) && attempts < 15) {
-        log_message("Waiting for partitions to appear (attempt %d)...", attempts + 1);
-        sleep(1);
-        attempts++;
-        run_command("udevadm settle 2>/dev/null", 0);
-    }
-
-    if (!file_exists(part1) || !file_exists(part2)) {
+    const char *const parts_dev[] = {part1, part2, NULL};
+    int rc = devwait_for(&wait, parts_dev, 15000);
+    devwait_close(&wait);
+    if (rc != 0) {
         log_message("Partition creation failed. Expected: %s, %s", part1, part2);
         log_message("Trying manual check...");
+        char cmd[512];
         snprintf(cmd, sizeof(cmd), "ls -la %s*", dev_path);
         run_command(cmd, 1);
     } else {
@@ -332,12 +401,125 @@ int mount_with_retry(const char *source, const char *target, const char *fstype,
 
 
 
-// Secure wipe (optional)
+// Secure wipe (optional): fastest erase the disk supports
 int secure_wipe(const char *device) {
-    log_message("Performing secure wipe on %s...", device);
+    return run_wipe(device, WIPE_AUTO);
+}
+
+
+// Pick several target disks for fleet mode. Returns the number chosen
+int get_fleet_disks(char targets[][32], int max) {
+    log_pause();
+    DevWait mon;
+    devwait_open(&mon);
+
+    DiskInfo disks[MAX_DISKS];
+    int count = load_disks(disks);
+    char marked[MAX_DISKS][sizeof(((DiskInfo *)0)->name)];
+    int marked_count = 0;
+    int selected = 0;
+
+    while (1) {
+        clear();
+        attron(A_BOLD | COLOR_PAIR(1));
+        mvprintw(2, 5, "FLEET INSTALL: SELECT TARGET DISKS (up to %d)", max);
+        attroff(A_BOLD | COLOR_PAIR(1));
+        mvprintw(3, 5, "↑/↓ navigate, SPACE mark, A mark all, ENTER start, ESC cancel");
+        mvprintw(4, 5, "─────────────────────────────────────────────────────");
+
+        if (count == 0) {
+            mvprintw(6, 7, "No suitable disks found. Attach the target disks,");
+            mvprintw(7, 7, "they will show up here automatically.");
+        }
+        for (int i = 0; i < count; i++) {
+            int on = 0;
+            for (int m = 0; m < marked_count; m++) {
+                if (strcmp(marked[m], disks[i].name) == 0) on = 1;
+            }
+            if (i == selected) attron(A_REVERSE | COLOR_PAIR(8));
+            mvprintw(6 + i, 7, "[%c] /dev/%-8s %-10s %-8s %-30s", on ? 'x' : ' ',
+                     disks[i].name, disks[i].size, disks[i].type, disks[i].model);
+            if (i == selected) attroff(A_REVERSE | COLOR_PAIR(8));
+        }
+        mvprintw(6 + count + 1, 5, "Marked: %d", marked_count);
+        refresh();
+
+        char current[64];
+        snprintf(current, sizeof(current), "%s", count > 0 ? disks[selected].name : "");
+        int ch = wait_input(&mon, disks, &count);
+        if (ch == ERR) {
+            // Unplugged disks drop out of the marked set
+            selected = 0;
+            for (int m = 0; m < marked_count; m++) {
+                int present = 0;
+                for (int i = 0; i < count; i++) {
+                    if (strcmp(disks[i].name, marked[m]) == 0) present = 1;
+                }
+                if (!present) {
+                    memmove(marked[m], marked[m + 1],
+                            (size_t)(marked_count - m - 1) * sizeof(marked[0]));
+                    marked_count--;
+                    m--;
+                }
+            }
+            for (int i = 0; i < count; i++) {
+                if (strcmp(disks[i].name, current) == 0) selected = i;
+            }
+            continue;
+        }
+
+        switch (ch) {
+            case KEY_UP:
+                if (count) selected = (selected > 0) ? selected - 1 : count - 1;
+                break;
+            case KEY_DOWN:
+                if (count) selected = (selected < count - 1) ? selected + 1 : 0;
+                break;
+            case ' ': {
+                if (count == 0) break;
+                int found = -1;
+                for (int m = 0; m < marked_count; m++) {
+                    if (strcmp(marked[m], disks[selected].name) == 0) found = m;
+                }
+                if (found >= 0) {
+                    memmove(marked[found], marked[found + 1],
+                            (size_t)(marked_count - found - 1) * sizeof(marked[0]));
+                    marked_count--;
+                } else if (marked_count < max) {
+                    memcpy(marked[marked_count++], disks[selected].name, sizeof(marked[0]));
+                }
+                break;
+            }
+            case 'a':
+            case 'A':
+                marked_count = 0;
+                for (int i = 0; i < count && marked_count < max; i++) {
+                    memcpy(marked[marked_count++], disks[i].name, sizeof(marked[0]));
+                }
+                break;
+            case 10: { // ENTER
+                if (marked_count == 0) break;
+                char question[256];
+                int len = snprintf(question, sizeof(question),
+                                   "FLEET: ALL data on %d disk(s) will be deleted:",
+                                   marked_count);
+                for (int m = 0; m < marked_count && len > 0 && len < (int)sizeof(question); m++) {
+                    len += snprintf(question + len, sizeof(question) - (size_t)len, " %s",
+                                    marked[m]);
+                }
+                if (!confirm_action(question, "ERASE")) break;
 
-    // Quick wipe with dd (can be enhanced with multiple passes)
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "dd if=/dev/zero of=%s bs=1M count=10 status=progress 2>/dev/null", device);
-    return run_command(cmd, 1);
+                for (int m = 0; m < marked_count; m++) {
+                    snprintf(targets[m], 32, "%.31s", marked[m]);
+                }
+                devwait_close(&mon);
+                log_resume();
+                return marked_count;
+            }
+            case 27: // ESC
+                devwait_close(&mon);
+                log_resume();
+                return 0;
+        }
+    }
 }
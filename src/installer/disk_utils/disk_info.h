@@ -5,6 +5,7 @@
 
 
 void get_target_disk(char *target, size_t size);
+int get_fleet_disks(char targets[][32], int max);
 void show_disk_info();
 
 void create_partitions(const char *disk);
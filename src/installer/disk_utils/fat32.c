@@ -0,0 +1,231 @@
+/**
+ * @file fat32.c
+ * @brief minimal FAT32 formatter (boot sector, FSInfo, FATs, root dir)
+ *
+ * Geometry follows the Microsoft FAT specification: 2 FATs, root
+ * directory in cluster 2, FSInfo in sector 1, backups in sectors 6/7.
+ * Reserved sectors are padded so the data region starts on a cluster
+ * boundary. Three writes cover the whole layout, so a 512 MB ESP is
+ * formatted in a few milliseconds.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fat32.h"
+#include "../utils/log_message.h"
+
+static void put_le16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t off) {
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Partition start in 512-byte units from sysfs, 0 if unknown
+static uint32_t partition_start(const char *dev_path) {
+    char path[256], buf[32];
+    const char *name = strrchr(dev_path, '/');
+    unsigned long long start = 0;
+
+    snprintf(path, sizeof(path), "/sys/class/block/%s/start",
+             name ? name + 1 : dev_path);
+    FILE *fp = fopen(path, "r");
+    if (fp) {
+        if (fgets(buf, sizeof(buf), fp)) start = strtoull(buf, NULL, 10);
+        fclose(fp);
+    }
+    return start > 0xFFFFFFFFULL ? 0 : (uint32_t)start;
+}
+
+// 11-byte space padded upper-case label
+static void format_label(char out[11], const char *label) {
+    memset(out, ' ', 11);
+    if (!label || !*label) {
+        memcpy(out, "NO NAME", 7);
+        return;
+    }
+    for (int i = 0; i < 11 && label[i]; i++) {
+        char c = label[i];
+        out[i] = (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+    }
+}
+
+static void fill_boot_sector(unsigned char *bs, unsigned bps, unsigned spc,
+                             unsigned reserved, uint32_t total, uint32_t fat_sz,
+                             uint32_t hidden, uint32_t vol_id,
+                             const char label[11]) {
+    static const unsigned char jump[3] = {0xEB, 0x58, 0x90};
+    // Not bootable: cli; hlt; jmp back to hlt
+    static const unsigned char boot_code[] = {0xFA, 0xF4, 0xEB, 0xFD};
+
+    memcpy(bs, jump, 3);
+    memcpy(bs + 3, "LAINUX  ", 8);
+    put_le16(bs + 11, (uint16_t)bps);
+    bs[13] = (unsigned char)spc;
+    put_le16(bs + 14, (uint16_t)reserved);
+    bs[16] = 2;                 // number of FATs
+    put_le16(bs + 17, 0);       // root entries (FAT32: 0)
+    put_le16(bs + 19, 0);       // total sectors 16
+    bs[21] = 0xF8;              // media: fixed disk
+    put_le16(bs + 22, 0);       // FAT size 16
+    put_le16(bs + 24, 63);      // sectors per track
+    put_le16(bs + 26, 255);     // heads
+    put_le32(bs + 28, hidden);
+    put_le32(bs + 32, total);
+    put_le32(bs + 36, fat_sz);
+    put_le16(bs + 40, 0);       // flags: FATs mirrored
+    put_le16(bs + 42, 0);       // version 0.0
+    put_le32(bs + 44, 2);       // root directory cluster
+    put_le16(bs + 48, 1);       // FSInfo sector
+    put_le16(bs + 50, 6);       // backup boot sector
+    bs[64] = 0x80;              // drive number
+    bs[66] = 0x29;              // extended boot signature
+    put_le32(bs + 67, vol_id);
+    memcpy(bs + 71, label, 11);
+    memcpy(bs + 82, "FAT32   ", 8);
+    memcpy(bs + 90, boot_code, sizeof(boot_code));
+    bs[510] = 0x55;
+    bs[511] = 0xAA;
+}
+
+static void fill_fsinfo(unsigned char *fs, uint32_t free_clusters) {
+    put_le32(fs, 0x41615252);
+    put_le32(fs + 484, 0x61417272);
+    put_le32(fs + 488, free_clusters);
+    put_le32(fs + 492, 3);      // next free cluster hint
+    put_le32(fs + 508, 0xAA550000);
+}
+
+int fat32_format(const char *dev_path, const char *label) {
+    int fd = open(dev_path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        log_message("Cannot open %s: %s", dev_path, strerror(errno));
+        return -1;
+    }
+
+    int ss = 512;
+    unsigned long long bytes = 0;
+    if (ioctl(fd, BLKSSZGET, &ss) != 0 || ss < 512 || ss > 4096) ss = 512;
+    if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) {
+        off_t end = lseek(fd, 0, SEEK_END);
+        bytes = end > 0 ? (unsigned long long)end : 0;
+    }
+
+    unsigned bps = (unsigned)ss;
+    uint64_t total64 = bytes / bps;
+    if (total64 > 0xFFFFFFFFULL) total64 = 0xFFFFFFFFULL;
+    uint32_t total = (uint32_t)total64;
+
+    // Largest cluster up to 4 KiB that still gives a valid FAT32
+    unsigned spc = FAT32_CLUSTER_BYTES / bps ? FAT32_CLUSTER_BYTES / bps : 1;
+    uint32_t fat_sz = 0, clusters = 0, reserved = 0;
+    for (; spc >= 1; spc /= 2) {
+        reserved = FAT32_RESERVED_SECTORS;
+        // Over-estimate the FAT from the sector count, then settle
+        uint32_t est = total > reserved ? (total - reserved) / spc : 0;
+        for (int pass = 0; pass < 3; pass++) {
+            fat_sz = (uint32_t)((((uint64_t)est + 2) * 4 + bps - 1) / bps);
+            // Start the data region on a cluster boundary
+            uint32_t meta = FAT32_RESERVED_SECTORS + 2 * fat_sz;
+            reserved = FAT32_RESERVED_SECTORS + (spc - meta % spc) % spc;
+            uint64_t data = total > reserved + 2 * fat_sz
+                                ? total - reserved - 2 * fat_sz : 0;
+            est = (uint32_t)(data / spc);
+        }
+        clusters = est;
+        if (clusters >= FAT32_MIN_CLUSTERS || spc == 1) break;
+    }
+    if (clusters < FAT32_MIN_CLUSTERS) {
+        log_message("%s is too small for FAT32 (%u clusters)", dev_path, clusters);
+        close(fd);
+        return -1;
+    }
+
+    char vol_label[11];
+    format_label(vol_label, label);
+    uint32_t vol_id;
+    if (getrandom(&vol_id, sizeof(vol_id), 0) != sizeof(vol_id)) {
+        vol_id = (uint32_t)time(NULL);
+    }
+    uint32_t hidden = (uint32_t)((uint64_t)partition_start(dev_path) * 512 / bps);
+
+    // 1: reserved region with boot sector, FSInfo and their backups
+    size_t rsvd_len = (size_t)reserved * bps;
+    // 2: both FATs back to back
+    size_t fat_len = (size_t)fat_sz * bps;
+    // 3: root directory cluster holding the volume label entry
+    size_t root_len = (size_t)spc * bps;
+
+    unsigned char *rsvd = calloc(1, rsvd_len);
+    unsigned char *fats = calloc(2, fat_len);
+    unsigned char *root = calloc(1, root_len);
+    int rc = -1;
+
+    if (rsvd && fats && root) {
+        fill_boot_sector(rsvd, bps, spc, reserved, total, fat_sz, hidden,
+                         vol_id, vol_label);
+        fill_fsinfo(rsvd + bps, clusters - 1);
+        memcpy(rsvd + 6 * bps, rsvd, bps);
+        memcpy(rsvd + 7 * bps, rsvd + bps, bps);
+
+        for (int f = 0; f < 2; f++) {
+            unsigned char *fat = fats + f * fat_len;
+            put_le32(fat, 0x0FFFFFF8);      // media descriptor
+            put_le32(fat + 4, 0x0FFFFFFF);  // reserved, clean shutdown
+            put_le32(fat + 8, 0x0FFFFFFF);  // root directory: end of chain
+        }
+
+        if (label && *label) {
+            memcpy(root, vol_label, 11);
+            root[11] = 0x08;                // ATTR_VOLUME_ID
+        }
+
+        off_t fat_off = (off_t)reserved * bps;
+        off_t root_off = fat_off + 2 * (off_t)fat_len;
+        if (write_all(fd, rsvd, rsvd_len, 0) == 0 &&
+            write_all(fd, fats, 2 * fat_len, fat_off) == 0 &&
+            write_all(fd, root, root_len, root_off) == 0 && fsync(fd) == 0) {
+            rc = 0;
+        } else {
+            log_message("Writing FAT32 to %s failed: %s", dev_path, strerror(errno));
+        }
+    }
+    free(rsvd);
+    free(fats);
+    free(root);
+    close(fd);
+
+    if (rc == 0) {
+        log_message("FAT32 created on %s: %u clusters of %u bytes, volume id %08X",
+                    dev_path, clusters, spc * bps, vol_id);
+    }
+    return rc;
+}
@@ -0,0 +1,18 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+/*
+ * Built-in FAT32 formatter for the EFI system partition.
+ * Writes the boot sector, FSInfo, their backups, both FATs and the root
+ * directory cluster directly to the device; no dosfstools needed.
+ */
+
+#define FAT32_MIN_CLUSTERS 65525
+#define FAT32_RESERVED_SECTORS 32
+#define FAT32_CLUSTER_BYTES 4096   // preferred cluster size
+
+// Format dev_path as FAT32. label: up to 11 chars, NULL for "NO NAME".
+// Returns 0 on success.
+int fat32_format(const char *dev_path, const char *label);
+
+#endif // fat32 h
@@ -0,0 +1,387 @@
+/**
+ * @file fstab.c
+ * @brief generate /etc/fstab from the live mount table
+ *
+ * Identity comes from on-disk metadata only: filesystem superblocks for
+ * UUID/LABEL (ext2/3/4, xfs, btrfs, vfat) and the GPT entry or MBR disk
+ * signature for PARTUUID. Device class comes from sysfs queue flags.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fstab.h"
+#include "../utils/log_message.h"
+
+#define PROBE_LEN (0x10000 + 0x1000)   // up to and including the btrfs super
+
+typedef struct {
+    char source[256];      // /dev/... as mounted
+    char target[512];      // mount point inside the target
+    char fstype[32];
+    char spec[256];        // UUID=..., PARTUUID=... or the device path
+    char label[64];
+    char options[192];
+    int pass;
+    unsigned major, minor;
+} FstabEntry;
+
+static uint16_t le16(const unsigned char *p) { return (uint16_t)(p[0] | p[1] << 8); }
+static uint32_t le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static uint64_t le64(const unsigned char *p) {
+    return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+// mountinfo escapes space, tab, newline and backslash as \ooo
+static void unescape(char *s) {
+    char *out = s;
+    for (char *p = s; *p; p++) {
+        if (p[0] == '\\' && p[1] >= '0' && p[1] <= '3' && p[2] >= '0' && p[2] <= '7' &&
+            p[3] >= '0' && p[3] <= '7') {
+            *out++ = (char)((p[1] - '0') * 64 + (p[2] - '0') * 8 + (p[3] - '0'));
+            p += 3;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+// fstab fields must not contain whitespace: escape like mountinfo does
+static void escape(const char *in, char *out, size_t out_len) {
+    size_t o = 0;
+    for (; *in && o + 5 < out_len; in++) {
+        if (*in == ' ' || *in == '\t' || *in == '\n' || *in == '\\') {
+            o += (size_t)snprintf(out + o, out_len - o, "\\%03o", (unsigned char)*in);
+        } else {
+            out[o++] = *in;
+        }
+    }
+    out[o] = '\0';
+}
+
+// Mixed-endian on-disk GUID (GPT) -> text
+static void format_guid(const unsigned char *g, char *out, size_t out_len) {
+    snprintf(out, out_len,
+             "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             le32(g), le16(g + 4), le16(g + 6), g[8], g[9], g[10], g[11], g[12],
+             g[13], g[14], g[15]);
+}
+
+// Big-endian UUID as stored by ext4, xfs and btrfs
+static void format_uuid(const unsigned char *u, char *out, size_t out_len) {
+    snprintf(out, out_len,
+             "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7], u[8], u[9], u[10], u[11],
+             u[12], u[13], u[14], u[15]);
+}
+
+static void copy_label(char *out, size_t out_len, const unsigned char *p, size_t n) {
+    size_t len = 0;
+    while (len < n && p[len]) len++;
+    while (len > 0 && p[len - 1] == ' ') len--;    // FAT pads with spaces
+    if (len >= out_len) len = out_len - 1;
+    memcpy(out, p, len);
+    out[len] = '\0';
+}
+
+// UUID and label from the filesystem superblock. Returns 0 when known
+static int probe_superblock(const char *dev, const char *fstype, char *uuid,
+                            size_t uuid_len, char *label, size_t label_len) {
+    unsigned char *buf = calloc(1, PROBE_LEN);
+    int fd = open(dev, O_RDONLY | O_CLOEXEC);
+    int rc = -1;
+
+    uuid[0] = label[0] = '\0';
+    if (!buf || fd < 0) goto out;
+    ssize_t n = pread(fd, buf, PROBE_LEN, 0);
+    if (n < 4096) goto out;
+
+    if (buf[0x438] == 0x53 && buf[0x439] == 0xEF) {
+        format_uuid(buf + 0x468, uuid, uuid_len);
+        copy_label(label, label_len, buf + 0x478, 16);
+        rc = 0;
+    } else if (memcmp(buf, "XFSB", 4) == 0) {
+        format_uuid(buf + 32, uuid, uuid_len);
+        copy_label(label, label_len, buf + 108, 12);
+        rc = 0;
+    } else if (n == PROBE_LEN && memcmp(buf + 0x10040, "_BHRfS_M", 8) == 0) {
+        format_uuid(buf + 0x10020, uuid, uuid_len);
+        copy_label(label, label_len, buf + 0x1012b, 256);
+        rc = 0;
+    } else if (buf[510] == 0x55 && buf[511] == 0xAA && strcmp(fstype, "vfat") == 0) {
+        // FAT32 keeps the extended BPB at 64, FAT12/16 at 36
+        int fat32 = memcmp(buf + 82, "FAT32", 5) == 0;
+        const unsigned char *ebpb = buf + (fat32 ? 64 : 36);
+        if (ebpb[2] == 0x29) {
+            uint32_t id = le32(ebpb + 3);
+            snprintf(uuid, uuid_len, "%04X-%04X", id >> 16, id & 0xFFFF);
+            copy_label(label, label_len, ebpb + 7, 11);
+            if (strcmp(label, "NO NAME") == 0) label[0] = '\0';
+            rc = 0;
+        }
+    }
+
+out:
+    if (fd >= 0) close(fd);
+    free(buf);
+    return rc;
+}
+
+static int read_sysfs_long(const char *path, long *value) {
+    char buf[32];
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    int ok = fgets(buf, sizeof(buf), fp) != NULL;
+    fclose(fp);
+    if (!ok) return -1;
+    *value = strtol(buf, NULL, 10);
+    return 0;
+}
+
+// Whole-disk sysfs name for a block device and its partition number (0 - none)
+static int device_disk(unsigned major, unsigned minor, char *disk, size_t disk_len,
+                       long *partno) {
+    char link[64], target[PATH_MAX];
+    snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major, minor);
+    ssize_t n = readlink(link, target, sizeof(target) - 1);
+    if (n <= 0) return -1;
+    target[n] = '\0';
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/partition", link);
+    *partno = 0;
+    if (read_sysfs_long(path, partno) == 0 && *partno > 0) {
+        *strrchr(target, '/') = '\0';   // .../block/sda/sda2 -> .../block/sda
+    }
+    const char *base = strrchr(target, '/');
+    base = base ? base + 1 : target;
+    if (strlen(base) >= disk_len) return -1;
+    strcpy(disk, base);
+    return 0;
+}
+
+// PARTUUID: GPT entry GUID, or "<mbr signature>-<nn>" like blkid
+static int probe_partuuid(const char *disk, long partno, char *out, size_t out_len) {
+    char path[128];
+    long lbs = 512;
+    unsigned char hdr[512];
+
+    snprintf(path, sizeof(path), "/sys/block/%s/queue/logical_block_size", disk);
+    read_sysfs_long(path, &lbs);
+    snprintf(path, sizeof(path), "/dev/%s", disk);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    int rc = -1;
+    if (pread(fd, hdr, sizeof(hdr), lbs) == (ssize_t)sizeof(hdr) &&
+        memcmp(hdr, "EFI PART", 8) == 0) {
+        uint64_t entries_lba = le64(hdr + 72);
+        uint32_t count = le32(hdr + 80), size = le32(hdr + 84);
+        unsigned char entry[128];
+        if ((uint32_t)partno <= count && size >= sizeof(entry) &&
+            pread(fd, entry, sizeof(entry),
+                  (off_t)(entries_lba * (uint64_t)lbs + (uint64_t)(partno - 1) * size)) ==
+                (ssize_t)sizeof(entry)) {
+            format_guid(entry + 16, out, out_len);
+            rc = 0;
+        }
+    } else if (pread(fd, hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+               hdr[510] == 0x55 && hdr[511] == 0xAA && le32(hdr + 440) != 0) {
+        snprintf(out, out_len, "%08x-%02ld", le32(hdr + 440), partno);
+        rc = 0;
+    }
+    close(fd);
+    return rc;
+}
+
+static void pick_options(FstabEntry *e, const char *super_opts, int ssd) {
+    const char *atime = ssd ? "noatime" : "relatime";
+
+    if (strncmp(e->fstype, "ext", 3) == 0) {
+        if (ssd && strcmp(e->fstype, "ext4") == 0) {
+            snprintf(e->options, sizeof(e->options), "rw,noatime,commit=%d",
+                     FSTAB_SSD_COMMIT);
+        } else {
+            snprintf(e->options, sizeof(e->options), "rw,%s", atime);
+        }
+    } else if (strcmp(e->fstype, "vfat") == 0) {
+        // ESP: readable by root only, remount read-only on errors
+        snprintf(e->options, sizeof(e->options),
+                 "rw,%s,fmask=0077,dmask=0077,shortname=mixed,utf8,errors=remount-ro",
+                 atime);
+    } else if (strcmp(e->fstype, "btrfs") == 0) {
+        const char *subvol = strstr(super_opts, "subvol=");
+        size_t len = subvol ? strcspn(subvol, ",") : 0;
+        snprintf(e->options, sizeof(e->options), "rw,%s%s%s%.*s", atime,
+                 ssd ? ",ssd" : "", subvol ? "," : "", (int)len, subvol ? subvol : "");
+    } else {
+        snprintf(e->options, sizeof(e->options), "rw,%s", atime);
+    }
+}
+
+static int write_fstab(const char *root, const char *text, size_t len) {
+    char path[PATH_MAX], tmp[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/etc/fstab", root);
+    snprintf(tmp, sizeof(tmp), "%s.lainux-new", path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_message("Cannot write %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+    int rc = (write(fd, text, len) == (ssize_t)len && fsync(fd) == 0) ? 0 : -1;
+    close(fd);
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) {
+        log_message("Writing %s failed: %s", path, strerror(errno));
+        unlink(tmp);
+    }
+    return rc;
+}
+
+int fstab_generate(const char *root, const char *const swapfiles[],
+                   FstabInfo *info) {
+    FstabEntry entries[FSTAB_MAX_ENTRIES];
+    char root_path[PATH_MAX];
+    int count = 0;
+    FstabInfo local = {0, 0, 0};
+
+    if (!realpath(root, root_path)) {
+        log_message("Target root %s: %s", root, strerror(errno));
+        return -1;
+    }
+    size_t root_len = strcmp(root_path, "/") == 0 ? 0 : strlen(root_path);
+
+    FILE *fp = fopen("/proc/self/mountinfo", "r");
+    if (!fp) {
+        log_message("Cannot read mountinfo: %s", strerror(errno));
+        return -1;
+    }
+
+    char line[2048];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned major, minor;
+        char mnt_root[512], mnt_point[512], fstype[32], source[256], super_opts[512];
+        const char *sep = strstr(line, " - ");
+        if (!sep ||
+            sscanf(line, "%*d %*d %u:%u %511s %511s", &major, &minor, mnt_root,
+                   mnt_point) != 4 ||
+            sscanf(sep + 3, "%31s %255s %511s", fstype, source, super_opts) != 3) {
+            continue;
+        }
+        unescape(mnt_point);
+        unescape(mnt_root);
+        unescape(source);
+
+        // Block devices at or below the target only
+        if (strncmp(source, "/dev/", 5) != 0) continue;
+        if (root_len && (strncmp(mnt_point, root_path, root_len) != 0 ||
+                         (mnt_point[root_len] != '/' && mnt_point[root_len] != '\0'))) {
+            continue;
+        }
+        // Bind mounts of a subdirectory are not filesystems of their own
+        if (strcmp(mnt_root, "/") != 0 && strcmp(fstype, "btrfs") != 0) continue;
+
+        const char *target = mnt_point[root_len] ? mnt_point + root_len : "/";
+
+        // A later mount on the same point hides the earlier one
+        int slot = count;
+        for (int i = 0; i < count; i++) {
+            if (strcmp(entries[i].target, target) == 0) slot = i;
+        }
+        if (slot == FSTAB_MAX_ENTRIES) break;
+        if (slot == count) count++;
+
+        FstabEntry *e = &entries[slot];
+        memset(e, 0, sizeof(*e));
+        snprintf(e->source, sizeof(e->source), "%s", source);
+        snprintf(e->target, sizeof(e->target), "%s", target);
+        snprintf(e->fstype, sizeof(e->fstype), "%s", fstype);
+        e->major = major;
+        e->minor = minor;
+
+        char uuid[64], partuuid[64], disk[64], path[128];
+        long partno = 0, rotational = 1, discard_max = 0;
+        if (probe_superblock(source, fstype, uuid, sizeof(uuid), e->label,
+                             sizeof(e->label)) == 0) {
+            snprintf(e->spec, sizeof(e->spec), "UUID=%s", uuid);
+        }
+
+        if (device_disk(major, minor, disk, sizeof(disk), &partno) == 0) {
+            if (!e->spec[0] && partno > 0 &&
+                probe_partuuid(disk, partno, partuuid, sizeof(partuuid)) == 0) {
+                snprintf(e->spec, sizeof(e->spec), "PARTUUID=%s", partuuid);
+            }
+            snprintf(path, sizeof(path), "/sys/block/%s/queue/rotational", disk);
+            read_sysfs_long(path, &rotational);
+            snprintf(path, sizeof(path), "/sys/block/%s/queue/discard_max_bytes", disk);
+            read_sysfs_long(path, &discard_max);
+        }
+        if (!e->spec[0]) {
+            snprintf(e->spec, sizeof(e->spec), "%s", source);
+        }
+
+        int ssd = rotational == 0;
+        if (ssd) {
+            local.ssd = 1;
+            if (discard_max > 0) local.discard = 1;
+        }
+        pick_options(e, super_opts, ssd);
+        e->pass = strcmp(fstype, "btrfs") == 0 ? 0 : strcmp(target, "/") == 0 ? 1 : 2;
+    }
+    fclose(fp);
+
+    if (count == 0) {
+        log_message("Nothing is mounted under %s", root_path);
+        return -1;
+    }
+
+    // Assemble the file
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    if (!out) return -1;
+    fputs("# Static information about the filesystems.\n"
+          "# See fstab(5) for details.\n\n"
+          "# <file system> <dir> <type> <options> <dump> <pass>\n", out);
+    for (int i = 0; i < count; i++) {
+        FstabEntry *e = &entries[i];
+        char target[512];
+        escape(e->target, target, sizeof(target));
+        fprintf(out, "# %s%s%s\n%s\t%s\t%s\t%s\t0 %d\n\n", e->source,
+                e->label[0] ? " LABEL=" : "", e->label, e->spec, target, e->fstype,
+                e->options, e->pass);
+        local.entries++;
+    }
+    for (int i = 0; swapfiles && swapfiles[i]; i++) {
+        char target[512];
+        escape(swapfiles[i], target, sizeof(target));
+        fprintf(out, "%s\tnone\tswap\tdefaults\t0 0\n", target);
+        local.entries++;
+    }
+    if (fclose(out) != 0) {
+        log_message("fstab: out of memory");
+        free(text);
+        return -1;
+    }
+
+    int rc = write_fstab(root_path, text, len);
+    free(text);
+    if (rc == 0) {
+        log_message("fstab: %d entries%s", local.entries,
+                    local.ssd ? " (SSD options)" : "");
+    }
+    if (info) *info = local;
+    return rc;
+}
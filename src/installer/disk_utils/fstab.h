@@ -0,0 +1,28 @@
+#ifndef FSTAB_H
+#define FSTAB_H
+
+/*
+ * Built-in fstab generator (replaces genfstab/blkid).
+ * Walks /proc/self/mountinfo for block devices mounted at or below the
+ * target root, reads UUID/label straight from each filesystem superblock
+ * and the PARTUUID from the partition table, and picks mount options by
+ * device class: SSDs get noatime and a longer ext4 commit interval,
+ * spinning disks keep relatime. Discard is left to fstrim.timer.
+ */
+
+#define FSTAB_MAX_ENTRIES 16
+#define FSTAB_SSD_COMMIT 60        // ext4 commit interval on SSDs, seconds
+
+typedef struct {
+    int entries;          // lines written (filesystems + swap)
+    int ssd;              // at least one filesystem sits on an SSD
+    int discard;          // ... and that device supports discard: enable fstrim
+} FstabInfo;
+
+// Write <root>/etc/fstab for everything mounted under root, plus the
+// given swap files (target paths, NULL-terminated, may be NULL).
+// info may be NULL. Returns 0 on success.
+int fstab_generate(const char *root, const char *const swapfiles[],
+                   FstabInfo *info);
+
+#endif // fstab h
@@ -0,0 +1,395 @@
+/**
+ * @file gpt.c
+ * @brief in-process GPT / MBR partition table writer
+ *
+ * The whole table is assembled in memory: protective MBR, primary header
+ * and entries at the start of the disk, backup entries and header at the
+ * end. Each region goes out in a single pwrite, followed by one fsync and
+ * a BLKRRPART (or BLKPG when the disk is busy) so the kernel picks up the
+ * new partitions without partprobe/udevadm round trips.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/blkpg.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include "blockdev.h"
+#include "gpt.h"
+#include "../utils/log_message.h"
+
+#define GPT_ENTRIES 128
+#define GPT_ENTRY_SIZE 128
+#define GPT_HEADER_SIZE 92
+#define GPT_BLKPG_MAX 16   // stale partitions removed via BLKPG
+
+// Partition placement in logical sectors
+typedef struct {
+    uint64_t first;
+    uint64_t last;
+} PartRange;
+
+typedef struct {
+    int fd;
+    unsigned sector;        // logical sector size
+    uint64_t sectors;       // total logical sectors
+} Disk;
+
+unsigned int gpt_crc32(const void *data, size_t len) {
+    static uint32_t table[256];
+    static int ready;
+    const unsigned char *p = (const unsigned char *)data;
+
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        ready = 1;
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static void put_le16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static void put_le64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+// "C12A7328-F81F-11D2-..." -> on-disk layout (first three fields LE)
+static int parse_guid(const char *s, unsigned char out[16]) {
+    unsigned char raw[16];
+    int n = 0;
+
+    for (const char *p = s; *p && n < 16; p++) {
+        if (*p == '-') continue;
+        unsigned hi, lo;
+        if (sscanf(p, "%1x%1x", &hi, &lo) != 2) return -1;
+        raw[n++] = (unsigned char)(hi << 4 | lo);
+        p++;
+    }
+    if (n != 16) return -1;
+
+    const int order[16] = {3, 2, 1, 0, 5, 4, 7, 6,
+                           8, 9, 10, 11, 12, 13, 14, 15};
+    for (int i = 0; i < 16; i++) out[i] = raw[order[i]];
+    return 0;
+}
+
+// Random version 4 GUID
+static void random_guid(unsigned char out[16]) {
+    if (getrandom(out, 16, 0) != 16) {
+        for (int i = 0; i < 16; i++) out[i] = (unsigned char)rand();
+    }
+    out[7] = (out[7] & 0x0F) | 0x40;   // version, stored LE in field 3
+    out[8] = (out[8] & 0x3F) | 0x80;   // variant
+}
+
+static int disk_open(Disk *d, const char *dev_path) {
+    d->fd = open(dev_path, O_RDWR | O_EXCL | O_CLOEXEC);
+    if (d->fd < 0 && errno == EBUSY) {
+        log_message("%s is in use, writing partition table anyway", dev_path);
+        d->fd = open(dev_path, O_RDWR | O_CLOEXEC);
+    }
+    if (d->fd < 0) {
+        log_message("Cannot open %s: %s", dev_path, strerror(errno));
+        return -1;
+    }
+
+    int ss = 512;
+    unsigned long long bytes = 0;
+    if (ioctl(d->fd, BLKSSZGET, &ss) != 0 || ss < 512) ss = 512;
+    if (ioctl(d->fd, BLKGETSIZE64, &bytes) != 0) {
+        off_t end = lseek(d->fd, 0, SEEK_END);
+        bytes = end > 0 ? (unsigned long long)end : 0;
+    }
+    d->sector = (unsigned)ss;
+    d->sectors = bytes / d->sector;
+
+    if (d->sectors < 2048) {
+        log_message("%s is too small for a partition table", dev_path);
+        close(d->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Lay out parts between first and last usable LBA
+static int place_parts(const Disk *d, const PartSpec *parts, int count,
+                       uint64_t first_usable, uint64_t last_usable,
+                       PartRange *out) {
+    uint64_t align = (uint64_t)GPT_ALIGN_MB * 1024 * 1024 / d->sector;
+    uint64_t lba = first_usable;
+
+    for (int i = 0; i < count; i++) {
+        uint64_t start = (lba + align - 1) / align * align;
+        uint64_t len = parts[i].size_mb * 1024 * 1024 / d->sector;
+        uint64_t end;
+
+        if (parts[i].size_mb == 0) {
+            if (i != count - 1) {
+                log_message("Partition %d: only the last one may fill the disk", i + 1);
+                return -1;
+            }
+            end = last_usable;
+        } else {
+            end = start + len - 1;
+        }
+        if (start > last_usable || end > last_usable || end < start) {
+            log_message("Partition %d does not fit on the disk", i + 1);
+            return -1;
+        }
+        out[i].first = start;
+        out[i].last = end;
+        lba = end + 1;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t off) {
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Make the kernel see the new table
+static void reread_table(const Disk *d, const PartRange *ranges, int count) {
+    blockdev_invalidate();     // the partition list is about to change
+    if (ioctl(d->fd, BLKRRPART) == 0) {
+        return;
+    }
+    if (errno != EBUSY) {
+        log_message("BLKRRPART failed: %s", strerror(errno));
+        return;
+    }
+
+    // Busy disk: swap partitions one by one
+    for (int i = 1; i <= GPT_BLKPG_MAX; i++) {
+        struct blkpg_partition bp = {.pno = i};
+        struct blkpg_ioctl_arg arg = {.op = BLKPG_DEL_PARTITION,
+                                      .datalen = sizeof(bp), .data = &bp};
+        ioctl(d->fd, BLKPG, &arg);
+    }
+    for (int i = 0; i < count; i++) {
+        struct blkpg_partition bp = {
+            .start = (long long)(ranges[i].first * d->sector),
+            .length = (long long)((ranges[i].last - ranges[i].first + 1) * d->sector),
+            .pno = i + 1,
+        };
+        struct blkpg_ioctl_arg arg = {.op = BLKPG_ADD_PARTITION,
+                                      .datalen = sizeof(bp), .data = &bp};
+        if (ioctl(d->fd, BLKPG, &arg) != 0) {
+            log_message("BLKPG add partition %d failed: %s", i + 1, strerror(errno));
+        }
+    }
+}
+
+static void fill_header(unsigned char *h, uint64_t my_lba, uint64_t alt_lba,
+                        uint64_t first_usable, uint64_t last_usable,
+                        const unsigned char disk_guid[16], uint64_t entries_lba,
+                        uint32_t entries_crc) {
+    memcpy(h, "EFI PART", 8);
+    put_le32(h + 8, 0x00010000);
+    put_le32(h + 12, GPT_HEADER_SIZE);
+    put_le32(h + 16, 0);
+    put_le64(h + 24, my_lba);
+    put_le64(h + 32, alt_lba);
+    put_le64(h + 40, first_usable);
+    put_le64(h + 48, last_usable);
+    memcpy(h + 56, disk_guid, 16);
+    put_le64(h + 72, entries_lba);
+    put_le32(h + 80, GPT_ENTRIES);
+    put_le32(h + 84, GPT_ENTRY_SIZE);
+    put_le32(h + 88, entries_crc);
+    put_le32(h + 16, gpt_crc32(h, GPT_HEADER_SIZE));
+}
+
+static void fill_mbr_entry(unsigned char *e, int active, unsigned char type,
+                           uint64_t first, uint64_t count) {
+    e[0] = active ? 0x80 : 0x00;
+    // CHS fields unused: LBA addressing everywhere
+    e[1] = 0xFE; e[2] = 0xFF; e[3] = 0xFF;
+    e[4] = type;
+    e[5] = 0xFE; e[6] = 0xFF; e[7] = 0xFF;
+    put_le32(e + 8, first > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)first);
+    put_le32(e + 12, count > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)count);
+}
+
+int gpt_create(const char *dev_path, const PartSpec *parts, int count) {
+    Disk d;
+    PartRange ranges[GPT_MAX_PARTS];
+
+    if (count < 1 || count > GPT_MAX_PARTS) return -1;
+    if (disk_open(&d, dev_path) != 0) return -1;
+
+    uint64_t entry_sectors = (GPT_ENTRIES * GPT_ENTRY_SIZE) / d.sector;
+    uint64_t last_lba = d.sectors - 1;
+    uint64_t first_usable = 2 + entry_sectors;
+    uint64_t last_usable = last_lba - entry_sectors - 1;
+
+    if (place_parts(&d, parts, count, first_usable, last_usable, ranges) != 0) {
+        close(d.fd);
+        return -1;
+    }
+
+    // Head covers everything up to the first aligned partition start, so
+    // stale boot code and old table remnants are cleared in the same write
+    size_t head_len = (size_t)(ranges[0].first * d.sector);
+    size_t tail_len = (size_t)((entry_sectors + 1) * d.sector);
+    unsigned char *head = calloc(1, head_len);
+    unsigned char *tail = calloc(1, tail_len);
+    if (!head || !tail) {
+        free(head);
+        free(tail);
+        close(d.fd);
+        return -1;
+    }
+
+    unsigned char *entries = head + 2 * d.sector;
+    for (int i = 0; i < count; i++) {
+        unsigned char *e = entries + i * GPT_ENTRY_SIZE;
+        if (parse_guid(parts[i].type, e) != 0) {
+            log_message("Bad partition type GUID: %s", parts[i].type);
+            free(head);
+            free(tail);
+            close(d.fd);
+            return -1;
+        }
+        random_guid(e + 16);
+        put_le64(e + 32, ranges[i].first);
+        put_le64(e + 40, ranges[i].last);
+        put_le64(e + 48, parts[i].bootable ? 1ULL << 2 : 0);
+        for (int k = 0; parts[i].name && parts[i].name[k] && k < 36; k++) {
+            put_le16(e + 56 + 2 * k, (unsigned char)parts[i].name[k]);
+        }
+    }
+    uint32_t entries_crc = gpt_crc32(entries, GPT_ENTRIES * GPT_ENTRY_SIZE);
+
+    unsigned char disk_guid[16];
+    random_guid(disk_guid);
+
+    // Protective MBR
+    fill_mbr_entry(head + 446, 0, 0xEE, 1, d.sectors - 1);
+    head[446 + 1] = 0x00; head[446 + 2] = 0x02; head[446 + 3] = 0x00;
+    head[510] = 0x55;
+    head[511] = 0xAA;
+
+    fill_header(head + d.sector, 1, last_lba, first_usable, last_usable,
+                disk_guid, 2, entries_crc);
+
+    // Backup: entries first, header in the very last sector
+    memcpy(tail, entries, GPT_ENTRIES * GPT_ENTRY_SIZE);
+    fill_header(tail + entry_sectors * d.sector, last_lba, 1, first_usable,
+                last_usable, disk_guid, last_lba - entry_sectors, entries_crc);
+
+    int rc = 0;
+    if (write_all(d.fd, head, head_len, 0) != 0 ||
+        write_all(d.fd, tail, tail_len,
+                  (off_t)((last_lba - entry_sectors) * d.sector)) != 0 ||
+        fsync(d.fd) != 0) {
+        log_message("Writing partition table to %s failed: %s", dev_path,
+                    strerror(errno));
+        rc = -1;
+    }
+    free(head);
+    free(tail);
+
+    if (rc == 0) {
+        reread_table(&d, ranges, count);
+        log_message("GPT written to %s: %d partition(s), %u-byte sectors",
+                    dev_path, count, d.sector);
+    }
+    close(d.fd);
+    return rc;
+}
+
+int mbr_create(const char *dev_path, const PartSpec *parts, int count) {
+    Disk d;
+    PartRange ranges[4];
+
+    if (count < 1 || count > 4) return -1;
+    if (disk_open(&d, dev_path) != 0) return -1;
+
+    uint64_t last_usable = d.sectors - 1;
+    if (last_usable > 0xFFFFFFFFu) {
+        log_message("%s is larger than 2 TiB, MBR cannot address it", dev_path);
+        close(d.fd);
+        return -1;
+    }
+    if (place_parts(&d, parts, count, 1, last_usable, ranges) != 0) {
+        close(d.fd);
+        return -1;
+    }
+
+    size_t head_len = (size_t)(ranges[0].first * d.sector);
+    unsigned char *head = calloc(1, head_len);
+    if (!head) {
+        close(d.fd);
+        return -1;
+    }
+
+    uint32_t signature;
+    if (getrandom(&signature, sizeof(signature), 0) != sizeof(signature)) {
+        signature = (uint32_t)rand();
+    }
+    put_le32(head + 440, signature);
+    for (int i = 0; i < count; i++) {
+        fill_mbr_entry(head + 446 + 16 * i, parts[i].bootable, parts[i].mbr_type,
+                       ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    head[510] = 0x55;
+    head[511] = 0xAA;
+
+    // A leftover GPT would win over the MBR: clear its backup header too
+    unsigned char *blank = calloc(1, d.sector);
+    int rc = 0;
+    if (!blank || write_all(d.fd, head, head_len, 0) != 0 ||
+        write_all(d.fd, blank, d.sector,
+                  (off_t)((d.sectors - 1) * d.sector)) != 0 ||
+        fsync(d.fd) != 0) {
+        log_message("Writing partition table to %s failed: %s", dev_path,
+                    strerror(errno));
+        rc = -1;
+    }
+    free(blank);
+    free(head);
+
+    if (rc == 0) {
+        reread_table(&d, ranges, count);
+        log_message("MBR written to %s: %d partition(s)", dev_path, count);
+    }
+    close(d.fd);
+    return rc;
+}
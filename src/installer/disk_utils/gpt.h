@@ -0,0 +1,43 @@
+#ifndef GPT_H
+#define GPT_H
+
+#include <stddef.h>
+
+/*
+ * Native partition table writer.
+ * Builds the protective MBR, both GPT headers and the entry array in
+ * memory, writes them directly to the device and asks the kernel to
+ * re-read the table. Replaces sgdisk/parted/fdisk.
+ */
+
+#define GPT_MAX_PARTS 8
+#define GPT_ALIGN_MB 1
+
+// GPT type GUIDs (sgdisk codes in comments)
+#define GPT_TYPE_ESP "C12A7328-F81F-11D2-BA4B-00A0C93EC3B8"         // ef00
+#define GPT_TYPE_LINUX "0FC63DAF-8483-4772-8E79-3D69D8477DE4"       // 8300
+#define GPT_TYPE_ROOT_X86_64 "4F68BCE3-E8CD-4DB1-96E7-FBCAF984B709" // 8304
+
+// MBR partition types
+#define MBR_TYPE_LINUX 0x83
+#define MBR_TYPE_ESP 0xef
+
+typedef struct {
+    const char *name;          // GPT partition label (ASCII), may be NULL
+    const char *type;          // GPT type GUID string
+    unsigned char mbr_type;    // type byte for MBR tables
+    unsigned long long size_mb;  // 0 = rest of the disk (last entry only)
+    int bootable;              // MBR active flag / GPT legacy BIOS bootable
+} PartSpec;
+
+// Replace the partition table of dev_path with a fresh GPT holding parts
+// in order, each start aligned to GPT_ALIGN_MB. Returns 0 on success.
+int gpt_create(const char *dev_path, const PartSpec *parts, int count);
+
+// Same layout as a classic MBR table (primary partitions only, max 4)
+int mbr_create(const char *dev_path, const PartSpec *parts, int count);
+
+// CRC32 (IEEE 802.3) as used by GPT headers and entry arrays
+unsigned int gpt_crc32(const void *data, size_t len);
+
+#endif // gpt h
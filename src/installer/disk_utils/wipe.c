@@ -0,0 +1,489 @@
+/**
+ * @file wipe.c
+ * @brief whole-disk erase: NVMe admin commands, discard, threaded overwrite
+ *
+ * The device is opened with O_EXCL, which the kernel refuses while any
+ * partition is mounted or claimed by dm/md. The random pattern is a
+ * function of (seed, 4 KiB block number), so every block can be
+ * regenerated on its own for the sampled read-back.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/nvme_ioctl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wipe.h"
+#include "blockdev.h"
+#include "../utils/log_message.h"
+
+#define NVME_ADMIN_GET_LOG 0x02
+#define NVME_ADMIN_IDENTIFY 0x06
+#define NVME_ADMIN_FORMAT 0x80
+#define NVME_ADMIN_SANITIZE 0x84
+#define NVME_LOG_SANITIZE 0x81
+#define NVME_SES_USER_DATA (1u << 9)
+#define NVME_SANACT_BLOCK_ERASE 2
+#define NVME_SANITIZE_POLL_MS 1000
+
+typedef struct {
+    int fd;
+    unsigned long long size;
+    unsigned long long chunks;
+    int threads;
+    int random;
+    uint64_t seed;
+    unsigned long long done;     // bytes, updated atomically
+    int failed;
+    int running;
+} Overwrite;
+
+typedef struct {
+    Overwrite *ow;
+    int index;
+} OverwriteSlice;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// One 4 KiB block of xoshiro256** output seeded from (seed, block number)
+static void fill_block(uint64_t *out, uint64_t seed, uint64_t block) {
+    uint64_t sm = seed ^ (block * 0xD1B54A32D192ED03ULL);
+    uint64_t s0 = splitmix64(&sm), s1 = splitmix64(&sm);
+    uint64_t s2 = splitmix64(&sm), s3 = splitmix64(&sm);
+
+    for (size_t i = 0; i < WIPE_SAMPLE / sizeof(uint64_t); i++) {
+        out[i] = rotl(s1 * 5, 7) * 9;
+        uint64_t t = s1 << 17;
+        s2 ^= s0;
+        s3 ^= s1;
+        s1 ^= s2;
+        s0 ^= s3;
+        s2 ^= t;
+        s3 = rotl(s3, 45);
+    }
+}
+
+static int write_full(int fd, const void *buf, size_t len, off_t off) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void *overwrite_worker(void *arg) {
+    OverwriteSlice *slice = arg;
+    Overwrite *ow = slice->ow;
+    unsigned long long first = ow->chunks * slice->index / ow->threads;
+    unsigned long long last = ow->chunks * (slice->index + 1) / ow->threads;
+
+    void *buf;
+    if (posix_memalign(&buf, WIPE_ALIGN, WIPE_CHUNK) != 0) {
+        __atomic_store_n(&ow->failed, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+    memset(buf, 0, WIPE_CHUNK);
+
+    for (unsigned long long c = first; c < last; c++) {
+        if (__atomic_load_n(&ow->failed, __ATOMIC_RELAXED)) break;
+
+        unsigned long long off = c * WIPE_CHUNK;
+        size_t len = ow->size - off < WIPE_CHUNK ? (size_t)(ow->size - off) : WIPE_CHUNK;
+        if (ow->random) {
+            // Whole blocks; a short tail only writes its sectors
+            for (size_t b = 0; b < len; b += WIPE_SAMPLE) {
+                fill_block((uint64_t *)((char *)buf + b), ow->seed, (off + b) / WIPE_SAMPLE);
+            }
+        }
+        if (write_full(ow->fd, buf, len, (off_t)off) != 0) {
+            log_message("Wipe write at %llu failed: %s", off, strerror(errno));
+            __atomic_store_n(&ow->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        __atomic_fetch_add(&ow->done, len, __ATOMIC_RELAXED);
+    }
+    free(buf);
+out:
+    __atomic_fetch_sub(&ow->running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int overwrite(int fd, unsigned long long size, const WipeOptions *opt, int random,
+                     uint64_t seed) {
+    Overwrite ow = {
+        .fd = fd,
+        .size = size,
+        .chunks = (size + WIPE_CHUNK - 1) / WIPE_CHUNK,
+        .random = random,
+        .seed = seed,
+    };
+    ow.threads = opt->threads > 0 ? opt->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (ow.threads > WIPE_MAX_THREADS) ow.threads = WIPE_MAX_THREADS;
+    if (ow.threads < 1) ow.threads = 1;
+    if ((unsigned long long)ow.threads > ow.chunks) ow.threads = (int)ow.chunks;
+
+    pthread_t tids[WIPE_MAX_THREADS];
+    OverwriteSlice slices[WIPE_MAX_THREADS];
+    int started = 0;
+    ow.running = ow.threads;
+    for (int i = 0; i < ow.threads; i++) {
+        slices[i].ow = &ow;
+        slices[i].index = i;
+        if (pthread_create(&tids[i], NULL, overwrite_worker, &slices[i]) != 0) {
+            // Nobody will run this slice: stop the others and bail out
+            ow.failed = 1;
+            __atomic_fetch_sub(&ow.running, ow.threads - i, __ATOMIC_RELEASE);
+            break;
+        }
+        started++;
+    }
+
+    // Live throughput, measured over each report interval
+    double start = now_sec(), last_time = start;
+    unsigned long long last_done = 0;
+    while (__atomic_load_n(&ow.running, __ATOMIC_ACQUIRE) > 0) {
+        sleep_ms(100);
+        double now = now_sec();
+        if (opt->progress && (now - last_time) * 1000 >= WIPE_REPORT_MS) {
+            unsigned long long done = __atomic_load_n(&ow.done, __ATOMIC_RELAXED);
+            opt->progress(done, size, (done - last_done) / (now - last_time) / 1e6,
+                          opt->progress_arg);
+            last_done = done;
+            last_time = now;
+        }
+    }
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+
+    if (!ow.failed && fsync(fd) != 0) ow.failed = 1;
+    if (opt->progress && !ow.failed) {
+        double secs = now_sec() - start;
+        opt->progress(size, size, secs > 0 ? size / secs / 1e6 : 0, opt->progress_arg);
+    }
+    return ow.failed ? -1 : 0;
+}
+
+// Read back random 4 KiB blocks and compare with the expected pattern
+static int verify_samples(int fd, unsigned long long size, int samples, int random,
+                          uint64_t seed) {
+    if (size < WIPE_SAMPLE) return 0;
+
+    void *got, *want;
+    if (posix_memalign(&got, WIPE_ALIGN, WIPE_SAMPLE) != 0) return samples;
+    if (posix_memalign(&want, WIPE_ALIGN, WIPE_SAMPLE) != 0) {
+        free(got);
+        return samples;
+    }
+    memset(want, 0, WIPE_SAMPLE);
+
+    uint64_t pick;
+    if (getrandom(&pick, sizeof(pick), 0) != sizeof(pick)) pick = (uint64_t)time(NULL);
+
+    int failures = 0;
+    unsigned long long blocks = size / WIPE_SAMPLE;
+    for (int i = 0; i < samples; i++) {
+        // Always check the first and last block, the rest at random
+        unsigned long long block = i == 0 ? 0 : i == 1 ? blocks - 1
+                                                       : splitmix64(&pick) % blocks;
+        if (random) fill_block(want, seed, block);
+        if (pread(fd, got, WIPE_SAMPLE, (off_t)(block * WIPE_SAMPLE)) != WIPE_SAMPLE ||
+            memcmp(got, want, WIPE_SAMPLE) != 0) {
+            log_message("Wipe verify: block %llu does not match", block);
+            failures++;
+        }
+    }
+    free(got);
+    free(want);
+    return failures;
+}
+
+// Zero the first and last WIPE_EDGE_BYTES: partition tables, superblocks, RAID labels
+static int zero_edges(int fd, unsigned long long size) {
+    size_t len = size < WIPE_EDGE_BYTES ? (size_t)size : WIPE_EDGE_BYTES;
+    void *buf;
+    if (posix_memalign(&buf, WIPE_ALIGN, WIPE_EDGE_BYTES) != 0) return -1;
+    memset(buf, 0, WIPE_EDGE_BYTES);
+    int rc = write_full(fd, buf, len, 0);
+    if (rc == 0 && size > len) rc = write_full(fd, buf, len, (off_t)(size - len));
+    if (rc == 0) rc = fsync(fd);
+    free(buf);
+    return rc;
+}
+
+static int nvme_admin(int fd, struct nvme_admin_cmd *cmd) {
+    int rc = ioctl(fd, NVME_IOCTL_ADMIN_CMD, cmd);
+    if (rc > 0) {
+        log_message("NVMe admin opcode 0x%02x: status 0x%x", cmd->opcode, rc);
+        return -1;
+    }
+    return rc;
+}
+
+static int nvme_identify(int fd, unsigned nsid, unsigned cns, unsigned char *data) {
+    struct nvme_admin_cmd cmd = {
+        .opcode = NVME_ADMIN_IDENTIFY,
+        .nsid = nsid,
+        .addr = (uintptr_t)data,
+        .data_len = 4096,
+        .cdw10 = cns,
+    };
+    return nvme_admin(fd, &cmd);
+}
+
+// Format NVM with user data erase, keeping the current LBA format.
+// Refused when it would also format other namespaces.
+static int nvme_format(int fd) {
+    int nsid = ioctl(fd, NVME_IOCTL_ID);
+    if (nsid <= 0) return -1;
+
+    unsigned char *id = aligned_alloc(WIPE_ALIGN, 4096);
+    if (!id) return -1;
+    int rc = -1;
+    if (nvme_identify(fd, 0, 1, id) != 0) goto out;
+
+    unsigned oacs = id[256] | id[257] << 8;
+    unsigned nn = id[516] | id[517] << 8 | id[518] << 16 | (unsigned)id[519] << 24;
+    if (!(oacs & 0x2)) goto out;                       // Format NVM unsupported
+    if ((id[524] & 0x1) && nn > 1) {
+        log_message("NVMe format would erase all %u namespaces, skipping", nn);
+        goto out;
+    }
+
+    if (nvme_identify(fd, (unsigned)nsid, 0, id) != 0) goto out;
+    unsigned flbas = id[26], dps = id[29];
+    unsigned cdw10 = (flbas & 0xF) | (flbas & 0x10)            // LBAF, MSET
+                     | (dps & 0x7) << 5 | (dps & 0x8) << 5     // PI, PIL
+                     | ((flbas >> 5) & 0x3) << 12              // LBAF upper bits
+                     | NVME_SES_USER_DATA;
+
+    struct nvme_admin_cmd cmd = {
+        .opcode = NVME_ADMIN_FORMAT,
+        .nsid = (unsigned)nsid,
+        .cdw10 = cdw10,
+        .timeout_ms = WIPE_NVME_TIMEOUT_MS,
+    };
+    rc = nvme_admin(fd, &cmd);
+out:
+    free(id);
+    return rc;
+}
+
+// Sanitize (block erase) and poll the sanitize status log until done
+static int nvme_sanitize(int fd, const WipeOptions *opt, unsigned long long size) {
+    unsigned char *buf = aligned_alloc(WIPE_ALIGN, 4096);
+    if (!buf) return -1;
+    int rc = -1;
+    if (nvme_identify(fd, 0, 1, buf) != 0) goto out;
+    if (!(buf[328] & 0x2)) goto out;                   // no block erase support
+
+    struct nvme_admin_cmd cmd = {
+        .opcode = NVME_ADMIN_SANITIZE,
+        .cdw10 = NVME_SANACT_BLOCK_ERASE,
+        .timeout_ms = WIPE_NVME_TIMEOUT_MS,
+    };
+    if (nvme_admin(fd, &cmd) != 0) goto out;
+
+    for (;;) {
+        sleep_ms(NVME_SANITIZE_POLL_MS);
+        struct nvme_admin_cmd log = {
+            .opcode = NVME_ADMIN_GET_LOG,
+            .nsid = 0xFFFFFFFF,
+            .addr = (uintptr_t)buf,
+            .data_len = 512,
+            .cdw10 = NVME_LOG_SANITIZE | (512 / 4 - 1) << 16,
+        };
+        if (nvme_admin(fd, &log) != 0) break;
+        unsigned sprog = buf[0] | buf[1] << 8;
+        unsigned sstat = buf[2] & 0x7;
+        if (sstat == 1) {
+            rc = 0;
+            break;
+        }
+        if (sstat != 2) {
+            log_message("NVMe sanitize failed (status %u)", sstat);
+            break;
+        }
+        if (opt->progress) {
+            opt->progress(size / 65536 * sprog, size, 0, opt->progress_arg);
+        }
+    }
+out:
+    free(buf);
+    return rc;
+}
+
+static int discard(int fd, unsigned long long size, int secure) {
+    uint64_t range[2] = {0, size};
+    return ioctl(fd, secure ? BLKSECDISCARD : BLKDISCARD, range);
+}
+
+// Zeroed by the device (WRITE ZEROES / WRITE SAME) where it can offload it
+static int write_zeroes(int fd, unsigned long long size) {
+    uint64_t range[2] = {0, size};
+    return ioctl(fd, BLKZEROOUT, range);
+}
+
+const char *wipe_mode_name(WipeMode mode) {
+    switch (mode) {
+    case WIPE_AUTO: return "auto";
+    case WIPE_NVME_FORMAT: return "NVMe format";
+    case WIPE_NVME_SANITIZE: return "NVMe sanitize";
+    case WIPE_SECURE_DISCARD: return "secure discard";
+    case WIPE_WRITE_ZEROES: return "write zeroes";
+    case WIPE_DISCARD: return "discard";
+    case WIPE_ZERO: return "zero overwrite";
+    case WIPE_RANDOM: return "random overwrite";
+    }
+    return "unknown";
+}
+
+// Run one method; 0 on success, -1 when unsupported or failed
+static int wipe_with(WipeMode mode, int fd, unsigned long long size,
+                     const WipeOptions *opt, WipeResult *res) {
+    uint64_t seed = 0;
+    int rc;
+
+    switch (mode) {
+    case WIPE_NVME_FORMAT:
+        rc = nvme_format(fd);
+        break;
+    case WIPE_NVME_SANITIZE:
+        rc = nvme_sanitize(fd, opt, size);
+        break;
+    case WIPE_SECURE_DISCARD:
+    case WIPE_DISCARD:
+        rc = discard(fd, size, mode == WIPE_SECURE_DISCARD);
+        break;
+    case WIPE_WRITE_ZEROES:
+        rc = write_zeroes(fd, size);
+        break;
+    case WIPE_RANDOM:
+        if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) seed = (uint64_t)time(NULL);
+        // fall through
+    case WIPE_ZERO:
+        rc = overwrite(fd, size, opt, mode == WIPE_RANDOM, seed);
+        if (rc == 0 && opt->verify_samples > 0) {
+            res->verify_failures = verify_samples(fd, size, opt->verify_samples,
+                                                  mode == WIPE_RANDOM, seed);
+            if (res->verify_failures > 0) rc = -1;
+        }
+        res->used = mode;
+        return rc;
+    default:
+        return -1;
+    }
+
+    // Metadata erase: make sure no old signature is left at either end
+    if (rc == 0) rc = zero_edges(fd, size);
+    if (rc == 0) res->used = mode;
+    return rc;
+}
+
+int wipe_device(const char *dev_path, const WipeOptions *opt, WipeResult *res) {
+    WipeResult local;
+    if (!res) res = &local;
+    memset(res, 0, sizeof(*res));
+
+    BlockDev dev;
+    memset(&dev, 0, sizeof(dev));
+    if (blockdev_lookup(dev_path, &dev) == 0 && (dev.is_partition || dev.holder_count > 0)) {
+        log_message("Refusing to wipe %s: %s", dev_path,
+                    dev.is_partition ? "not a whole disk" : "in use by a dm/md device");
+        return -1;
+    }
+
+    // O_EXCL fails with EBUSY while anything on the disk is mounted
+    int fd = open(dev_path, O_RDWR | O_DIRECT | O_EXCL | O_CLOEXEC);
+    if (fd < 0) {
+        log_message("Cannot open %s for wiping: %s", dev_path, strerror(errno));
+        return -1;
+    }
+    unsigned long long size = 0;
+    if (ioctl(fd, BLKGETSIZE64, &size) != 0 || size == 0) {
+        log_message("Cannot get size of %s", dev_path);
+        close(fd);
+        return -1;
+    }
+
+    double start = now_sec();
+    int rc;
+    if (opt->mode == WIPE_AUTO) {
+        // Fastest first; every method that is not supported falls through
+        static const WipeMode order[] = {
+            WIPE_NVME_FORMAT, WIPE_SECURE_DISCARD, WIPE_WRITE_ZEROES, WIPE_DISCARD, WIPE_ZERO
+        };
+        rc = -1;
+        for (size_t i = 0; i < sizeof(order) / sizeof(order[0]) && rc != 0; i++) {
+            if (order[i] == WIPE_NVME_FORMAT && dev.transport != BLOCKDEV_TR_NVME) continue;
+            if (order[i] == WIPE_WRITE_ZEROES && !dev.write_zeroes) continue;
+            if (order[i] == WIPE_DISCARD && !dev.discard) continue;
+            rc = wipe_with(order[i], fd, size, opt, res);
+            if (rc == 0 && order[i] == WIPE_DISCARD) {
+                // Discard is only a hint: unless the blocks read back as
+                // zeros the old data may still be there, so overwrite
+                int samples = opt->verify_samples > WIPE_DISCARD_SAMPLES ? opt->verify_samples
+                                                                         : WIPE_DISCARD_SAMPLES;
+                if (verify_samples(fd, size, samples, 0, 0) > 0) {
+                    log_message("Wipe: discarded blocks on %s keep their data", dev_path);
+                    rc = -1;
+                }
+                continue;
+            }
+            if (rc != 0 && res->verify_failures == 0) {
+                log_message("Wipe: %s not available on %s", wipe_mode_name(order[i]), dev_path);
+            }
+        }
+    } else {
+        rc = wipe_with(opt->mode, fd, size, opt, res);
+    }
+    res->bytes = rc == 0 ? size : 0;
+    res->seconds = now_sec() - start;
+
+    // The partition table is gone; let the kernel drop its partitions
+    ioctl(fd, BLKRRPART);
+    blockdev_invalidate();
+    close(fd);
+
+    if (rc == 0) {
+        log_message("Wiped %s (%.1f GB) with %s in %.1f s", dev_path, size / 1e9,
+                    wipe_mode_name(res->used), res->seconds);
+    } else {
+        log_message("Wipe of %s failed%s", dev_path,
+                    res->verify_failures ? ": verification mismatch" : "");
+    }
+    return rc;
+}
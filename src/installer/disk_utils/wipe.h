@@ -0,0 +1,60 @@
+#ifndef WIPE_H
+#define WIPE_H
+
+/*
+ * Disk wipe engine.
+ * Erases a whole block device with the fastest method it supports:
+ * NVMe format/sanitize through the admin ioctl, BLKSECDISCARD,
+ * BLKZEROOUT, BLKDISCARD or a full overwrite. The overwrite splits the device into
+ * disjoint LBA ranges, one per thread, and writes large O_DIRECT
+ * buffers of zeros or a xoshiro256** pattern; a sampled read-back can
+ * verify the result. Metadata-only methods also zero both ends of the
+ * disk so no partition table or superblock signature survives.
+ */
+
+#define WIPE_CHUNK (4u << 20)        // write unit per thread
+#define WIPE_ALIGN 4096
+#define WIPE_MAX_THREADS 8
+#define WIPE_EDGE_BYTES (1u << 20)   // zeroed at each end after discard/format
+#define WIPE_REPORT_MS 1000          // progress callback interval
+#define WIPE_SAMPLE 4096             // read-back verify unit
+#define WIPE_NVME_TIMEOUT_MS 600000
+#define WIPE_DISCARD_SAMPLES 64      // auto mode: read-back after a plain discard
+
+typedef enum {
+    WIPE_AUTO = 0,          // NVMe format, then secure discard, write zeroes,
+                            // discard if it reads back as zeros, zeros
+    WIPE_NVME_FORMAT,       // Format NVM, user data erase
+    WIPE_NVME_SANITIZE,     // Sanitize, block erase (controller-wide)
+    WIPE_SECURE_DISCARD,    // BLKSECDISCARD
+    WIPE_WRITE_ZEROES,      // BLKZEROOUT
+    WIPE_DISCARD,           // BLKDISCARD
+    WIPE_ZERO,              // overwrite with zeros
+    WIPE_RANDOM,            // overwrite with a PRNG pattern
+} WipeMode;
+
+typedef void (*WipeProgress)(unsigned long long done, unsigned long long total,
+                             double mb_per_sec, void *arg);
+
+typedef struct {
+    WipeMode mode;
+    int threads;                 // overwrite threads, 0 - one per CPU
+    int verify_samples;          // overwrite read-back checks, 0 - none
+    WipeProgress progress;       // may be NULL
+    void *progress_arg;
+} WipeOptions;
+
+typedef struct {
+    WipeMode used;               // method that actually ran
+    unsigned long long bytes;    // bytes erased
+    double seconds;
+    int verify_failures;         // sampled blocks that did not match
+} WipeResult;
+
+// Erase dev_path (a whole, unmounted disk). res may be NULL.
+// Returns 0 on success, -1 on error or failed verification.
+int wipe_device(const char *dev_path, const WipeOptions *opt, WipeResult *res);
+
+const char *wipe_mode_name(WipeMode mode);
+
+#endif // wipe h
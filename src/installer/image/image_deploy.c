@@ -0,0 +1,468 @@
+/**
+ * @file image_deploy.c
+ * @brief stream a prebuilt root filesystem image onto the target
+ *
+ * The source (file or HTTP) is read on the calling thread and run through
+ * a zstd stream decoder straight into IMAGE_BLOCK sized, page aligned
+ * buffers. A writer thread drains full buffers to the sink, so reading,
+ * decompression and device writes overlap. Raw images go to the root
+ * partition with O_DIRECT; tarballs are piped into tar on the async
+ * executor.
+ */
+
+#define _GNU_SOURCE
+#include <curl/curl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include "image_deploy.h"
+#include "../utils/cmd_async.h"
+#include "../utils/log_message.h"
+
+#define IMAGE_READ_CHUNK (1u << 20)
+#define IMAGE_ALIGN 4096
+#define IMAGE_PROGRESS_STEP (256LL << 20)
+
+static const unsigned char zstd_magic[4] = {0x28, 0xB5, 0x2F, 0xFD};
+
+typedef enum {
+    SINK_DEVICE,
+    SINK_PIPE
+} SinkKind;
+
+typedef struct {
+    // buffers shared with the writer thread
+    unsigned char *buf[IMAGE_BUFFERS];
+    size_t len[IMAGE_BUFFERS];
+    int head;                 // block the decoder is filling
+    int tail;                 // next block for the writer
+    int queued;               // blocks handed over, not yet written
+    int done;
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    // decoder state
+    ZSTD_DStream *zs;
+    int mode;                 // 0 - undecided, 1 - zstd, 2 - plain
+    unsigned char magic[4];
+    size_t magic_len;
+    size_t fill;
+    size_t zret;              // last ZSTD_decompressStream result
+
+    // sink
+    SinkKind sink;
+    int fd;
+    int cmd_id;
+    long long offset;
+    long long limit;          // device size, 0 - unlimited
+    long long written;
+    long long next_report;
+    double start;
+} ImageStream;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+int image_find(ImageInfo *img) {
+    const char *src = getenv(IMAGE_ENV);
+    struct stat st;
+
+    memset(img, 0, sizeof(*img));
+    if (!src || !*src) {
+        if (stat(IMAGE_DEFAULT_PATH, &st) != 0) {
+            return -1;
+        }
+        src = IMAGE_DEFAULT_PATH;
+    } else if (strncmp(src, "http://", 7) != 0 && strncmp(src, "https://", 8) != 0 &&
+               stat(src, &st) != 0) {
+        log_message("Image %s not found", src);
+        return -1;
+    }
+    snprintf(img->source, sizeof(img->source), "%s", src);
+
+    // name.tar.zst / name.img.zst / name.img -> version "name"
+    const char *base = strrchr(src, '/');
+    snprintf(img->version, sizeof(img->version), "%s", base ? base + 1 : src);
+    const char *exts[] = {".zst", ".tar", ".img", ".raw", NULL};
+    for (int i = 0; exts[i]; i++) {
+        if (ends_with(img->version, exts[i])) {
+            img->version[strlen(img->version) - strlen(exts[i])] = '\0';
+        }
+    }
+    img->kind = (strstr(src, ".tar") != NULL) ? IMAGE_TAR : IMAGE_RAW;
+    return 0;
+}
+
+/* Writer thread */
+
+static int sink_write(ImageStream *s, unsigned char *buf, size_t len) {
+    if (s->sink == SINK_PIPE) {
+        size_t off = 0;
+        while (off < len) {
+            ssize_t n = write(s->fd, buf + off, len - off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                log_message("Image: tar stopped reading: %s", strerror(errno));
+                return -1;
+            }
+            off += (size_t)n;
+        }
+        // Keep tar's stderr pipe drained while we feed it
+        ProcResult res;
+        if (cmd_poll(s->cmd_id, 0, &res) == CMD_DONE) {
+            log_message("Image: tar exited early (%d): %s", res.exit_code, res.last_err);
+            proc_result_free(&res);
+            s->cmd_id = -1;
+            return -1;
+        }
+        return 0;
+    }
+
+    // O_DIRECT wants aligned lengths; the tail past the image is free space
+    size_t padded = (len + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+    if (s->limit && s->offset + (long long)len > s->limit) {
+        log_message("Image is larger than the target partition");
+        return -1;
+    }
+    if (s->limit && s->offset + (long long)padded > s->limit) {
+        // Last block ends unaligned at the device end: finish it through
+        // the page cache, the fsync in image_deploy_raw() flushes it
+        int flags = fcntl(s->fd, F_GETFL);
+        if (flags >= 0 && (flags & O_DIRECT) &&
+            fcntl(s->fd, F_SETFL, flags & ~O_DIRECT) != 0) {
+            log_message("Image: cannot leave O_DIRECT for the tail: %s", strerror(errno));
+            return -1;
+        }
+        padded = len;
+    }
+    memset(buf + len, 0, padded - len);
+
+    size_t off = 0;
+    while (off < padded) {
+        ssize_t n = pwrite(s->fd, buf + off, padded - off, s->offset + (off_t)off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_message("Image: write failed at %lld: %s", s->offset, strerror(errno));
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    s->offset += (long long)len;
+    return 0;
+}
+
+static void *image_writer(void *arg) {
+    ImageStream *s = (ImageStream *)arg;
+    sigset_t set;
+
+    // A dead tar must give us EPIPE, not kill the installer
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (s->queued == 0 && !s->done && !s->failed) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+        if (s->failed || s->queued == 0) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        int slot = s->tail;
+        pthread_mutex_unlock(&s->lock);
+
+        int rc = sink_write(s, s->buf[slot], s->len[slot]);
+
+        pthread_mutex_lock(&s->lock);
+        if (rc != 0) {
+            s->failed = 1;
+        } else {
+            s->written += (long long)s->len[slot];
+        }
+        s->tail = (s->tail + 1) % IMAGE_BUFFERS;
+        s->queued--;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+
+        if (s->written >= s->next_report) {
+            double secs = now_sec() - s->start;
+            log_message("Image: %lld MiB written (%.0f MiB/s)", s->written >> 20,
+                        secs > 0 ? (s->written >> 20) / secs : 0.0);
+            s->next_report += IMAGE_PROGRESS_STEP;
+        }
+    }
+    return NULL;
+}
+
+/* Decoder side */
+
+// Hand the current block to the writer; wait for a free one
+static int submit_block(ImageStream *s) {
+    pthread_mutex_lock(&s->lock);
+    s->len[s->head] = s->fill;
+    s->queued++;
+    s->head = (s->head + 1) % IMAGE_BUFFERS;
+    s->fill = 0;
+    pthread_cond_broadcast(&s->cond);
+    while (s->queued == IMAGE_BUFFERS && !s->failed) {
+        pthread_cond_wait(&s->cond, &s->lock);
+    }
+    int failed = s->failed;
+    pthread_mutex_unlock(&s->lock);
+    return failed ? -1 : 0;
+}
+
+static int emit_plain(ImageStream *s, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        size_t n = IMAGE_BLOCK - s->fill;
+        if (n > len) n = len;
+        memcpy(s->buf[s->head] + s->fill, data, n);
+        s->fill += n;
+        data += n;
+        len -= n;
+        if (s->fill == IMAGE_BLOCK && submit_block(s) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int emit_zstd(ImageStream *s, const unsigned char *data, size_t len) {
+    ZSTD_inBuffer in = {data, len, 0};
+
+    while (in.pos < in.size) {
+        ZSTD_outBuffer out = {s->buf[s->head], IMAGE_BLOCK, s->fill};
+        size_t r = ZSTD_decompressStream(s->zs, &out, &in);
+        if (ZSTD_isError(r)) {
+            log_message("Image: corrupt zstd stream: %s", ZSTD_getErrorName(r));
+            return -1;
+        }
+        s->zret = r;
+        s->fill = out.pos;
+        if (s->fill == IMAGE_BLOCK && submit_block(s) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int feed(ImageStream *s, const unsigned char *data, size_t len) {
+    if (s->mode == 0) {
+        // Sniff the zstd magic, which may arrive split across chunks
+        while (s->magic_len < sizeof(s->magic) && len > 0) {
+            s->magic[s->magic_len++] = *data++;
+            len--;
+        }
+        if (s->magic_len < sizeof(s->magic)) {
+            return 0;
+        }
+        if (memcmp(s->magic, zstd_magic, sizeof(zstd_magic)) == 0) {
+            s->zs = ZSTD_createDStream();
+            if (!s->zs) return -1;
+            ZSTD_initDStream(s->zs);
+            s->mode = 1;
+            if (emit_zstd(s, s->magic, sizeof(s->magic)) != 0) return -1;
+        } else {
+            s->mode = 2;
+            if (emit_plain(s, s->magic, sizeof(s->magic)) != 0) return -1;
+        }
+    }
+    return s->mode == 1 ? emit_zstd(s, data, len) : emit_plain(s, data, len);
+}
+
+static size_t curl_feed(char *ptr, size_t size, size_t nmemb, void *user) {
+    ImageStream *s = (ImageStream *)user;
+    size_t len = size * nmemb;
+    return feed(s, (const unsigned char *)ptr, len) == 0 ? len : 0;
+}
+
+static int read_source(ImageStream *s, const char *source) {
+    if (strncmp(source, "http://", 7) == 0 || strncmp(source, "https://", 8) == 0) {
+        CURL *curl = curl_easy_init();
+        if (!curl) return -1;
+        curl_easy_setopt(curl, CURLOPT_URL, source);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_feed);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, s);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 512L * 1024);
+        CURLcode rc = curl_easy_perform(curl);
+        curl_easy_cleanup(curl);
+        if (rc != CURLE_OK) {
+            log_message("Image: download failed: %s", curl_easy_strerror(rc));
+            return -1;
+        }
+        return 0;
+    }
+
+    int fd = open(source, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_message("Image: cannot open %s: %s", source, strerror(errno));
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    unsigned char *chunk = malloc(IMAGE_READ_CHUNK);
+    int rc = chunk ? 0 : -1;
+    while (rc == 0) {
+        ssize_t n = read(fd, chunk, IMAGE_READ_CHUNK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            log_message("Image: read failed: %s", strerror(errno));
+            rc = -1;
+        }
+        if (n <= 0) break;
+        rc = feed(s, chunk, (size_t)n);
+    }
+    free(chunk);
+    close(fd);
+    return rc;
+}
+
+// Run source -> decoder -> writer until the image is consumed
+static int stream_image(ImageStream *s, const char *source) {
+    pthread_t writer;
+    int rc = -1;
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    for (int i = 0; i < IMAGE_BUFFERS; i++) {
+        if (posix_memalign((void **)&s->buf[i], IMAGE_ALIGN, IMAGE_BLOCK) != 0) {
+            s->buf[i] = NULL;
+            goto out;
+        }
+    }
+    s->start = now_sec();
+    s->next_report = IMAGE_PROGRESS_STEP;
+
+    if (pthread_create(&writer, NULL, image_writer, s) != 0) {
+        goto out;
+    }
+
+    rc = read_source(s, source);
+    if (rc == 0 && s->mode == 1 && s->zret != 0) {
+        log_message("Image: zstd stream is truncated");
+        rc = -1;
+    }
+    if (rc == 0 && s->mode == 0) {
+        log_message("Image: source is empty");
+        rc = -1;
+    }
+    if (rc == 0 && s->fill > 0) {
+        rc = submit_block(s);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->done = 1;
+    if (rc != 0) s->failed = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(writer, NULL);
+
+    if (s->failed) rc = -1;
+    if (rc == 0) {
+        double secs = now_sec() - s->start;
+        log_message("Image: %lld MiB in %.1fs (%.0f MiB/s)", s->written >> 20,
+                    secs, secs > 0 ? (s->written >> 20) / secs : 0.0);
+    }
+
+out:
+    for (int i = 0; i < IMAGE_BUFFERS; i++) free(s->buf[i]);
+    if (s->zs) ZSTD_freeDStream(s->zs);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    return rc;
+}
+
+long long image_deploy_raw(const ImageInfo *img, const char *dev_path) {
+    ImageStream s;
+    memset(&s, 0, sizeof(s));
+    s.sink = SINK_DEVICE;
+    s.cmd_id = -1;
+
+    log_message("Deploying image %s onto %s", img->version, dev_path);
+    s.fd = open(dev_path, O_WRONLY | O_DIRECT | O_CLOEXEC);
+    if (s.fd < 0 && errno == EINVAL) {
+        s.fd = open(dev_path, O_WRONLY | O_CLOEXEC);
+    }
+    if (s.fd < 0) {
+        log_message("Cannot open %s: %s", dev_path, strerror(errno));
+        return -1;
+    }
+    unsigned long long size = 0;
+    if (ioctl(s.fd, BLKGETSIZE64, &size) == 0) {
+        s.limit = (long long)size;
+    }
+
+    int rc = stream_image(&s, img->source);
+    if (rc == 0 && fsync(s.fd) != 0) {
+        log_message("Image: fsync failed: %s", strerror(errno));
+        rc = -1;
+    }
+    close(s.fd);
+    return rc == 0 ? s.written : -1;
+}
+
+int image_deploy_tar(const ImageInfo *img, const char *root_mount) {
+    ImageStream s;
+    int fds[2];
+
+    memset(&s, 0, sizeof(s));
+    s.sink = SINK_PIPE;
+
+    log_message("Unpacking image %s into %s", img->version, root_mount);
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+
+    const char *tar_argv[] = {"tar", "-x", "-p", "--numeric-owner", "--xattrs",
+                              "--acls", "-C", root_mount, "-f", "-", NULL};
+    CmdOptions opts = {
+        .proc = {PROC_LOG_STDERR, IMAGE_TAR_TIMEOUT, fds[0], NULL},
+        .label = "tar",
+    };
+    s.cmd_id = cmd_submit(tar_argv, &opts);
+    close(fds[0]);
+    if (s.cmd_id < 0) {
+        close(fds[1]);
+        return -1;
+    }
+    s.fd = fds[1];
+
+    int rc = stream_image(&s, img->source);
+    close(s.fd);    // EOF for tar
+
+    if (s.cmd_id >= 0) {
+        ProcResult res;
+        if (cmd_wait(s.cmd_id, &res) != 0) {
+            log_message("Image: tar failed (%d): %s", res.exit_code, res.last_err);
+            rc = -1;
+        }
+        proc_result_free(&res);
+    } else {
+        rc = -1;
+    }
+    return rc;
+}
@@ -0,0 +1,41 @@
+#ifndef IMAGE_DEPLOY_H
+#define IMAGE_DEPLOY_H
+
+/*
+ * Image mode: deploy a prebuilt root filesystem instead of pacstrap.
+ * Supported images (optionally zstd compressed, local path or http URL):
+ *   *.img[.zst]  raw ext4 image, streamed onto the root partition
+ *   *.tar[.zst]  root tree tarball, unpacked into the mounted root
+ * Decompression and writing run on separate threads with large aligned
+ * buffers; per-host settings are applied by the regular stages after.
+ */
+
+#define IMAGE_ENV "LAINUX_IMAGE"
+#define IMAGE_DEFAULT_PATH "/run/archiso/bootmnt/lainux/rootfs.img.zst"
+#define IMAGE_BLOCK (4u << 20)   // write unit, multiple of any sector size
+#define IMAGE_BUFFERS 4          // blocks in flight between decode and write
+#define IMAGE_TAR_TIMEOUT 3600
+
+typedef enum {
+    IMAGE_RAW = 0,
+    IMAGE_TAR
+} ImageKind;
+
+typedef struct {
+    char source[512];            // path or http(s) URL
+    char version[128];           // file name without extensions
+    ImageKind kind;
+} ImageInfo;
+
+// Look for an image ($LAINUX_IMAGE, then IMAGE_DEFAULT_PATH).
+// Returns 0 and fills img when one is available.
+int image_find(ImageInfo *img);
+
+// Stream a raw filesystem image onto dev_path. Returns bytes written,
+// -1 on error.
+long long image_deploy_raw(const ImageInfo *img, const char *dev_path);
+
+// Unpack a tarball image into root_mount. Returns 0 on success.
+int image_deploy_tar(const ImageInfo *img, const char *root_mount);
+
+#endif // image deploy h
@@ -9,6 +9,7 @@
 #define FALLBACK_CORE_URL "https://mirror.lainux.org/core/lainux-core-0.1-1-x86_64.pkg.tar.zst"
 #define ARCH_ISO_URL "https://github.com/wienton/Lainux/releases/download/lainuxiso/lainuxiso-2025.12.25-x86_64.iso" // links for arch iso download
 #define MAX_DISKS 32 // max count disks
+#define FLEET_MAX_DISKS 8 // disks installed at once in fleet mode
 #define MAX_PATH 512 // max path count
 #define LOG_BUFFER_SIZE 8192
 #define INSTALL_TIMEOUT 3600
@@ -59,18 +60,24 @@ long get_available_space(const char *path);
 int check_network();
 int check_dependencies();
 void log_message(const char *format, ...);
+void log_pause(void);
+void log_resume(void);
 int run_command(const char *cmd, int show_output);
 int run_command_with_fallback(const char *cmd, const char *fallback);
 void get_target_disk(char *target, size_t size);
+int get_fleet_disks(char targets[][32], int max);
 void show_disk_info();
 int confirm_action(const char *question, const char *required_input);
 void create_partitions(const char *disk);
 void perform_installation(const char *disk);
+void perform_fleet_installation(const char *const disks[], int count);
 void show_summary(const char *disk);
 void install_on_virtual_machine();
 int check_qemu_dependencies();
+int check_qemu_tools();
 void create_virtual_disk();
 void setup_qemu_vm(const char *iso_path);
+void run_vm_test_loop();
 void download_arch_iso();
 void select_iso_file(char *iso_path, size_t size);
 int find_iso_files(char files[][MAX_PATH], int max_files);
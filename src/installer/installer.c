@@ -24,12 +24,16 @@ Installation Engine
 */
 
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 // ui, general function for UI
@@ -38,19 +42,84 @@ Installation Engine
 #include "utils/log_message.h"
 // start command, system utils
 #include "utils/run_command.h"
+#include "utils/cmd_async.h"
+#include "utils/chroot_session.h"
+// native partition table writer
+#include "disk_utils/devwait.h"
+#include "disk_utils/fat32.h"
+#include "disk_utils/fstab.h"
+#include "disk_utils/gpt.h"
+// parallel package downloads
+#include "network_connection/fetch.h"
+#include "network_connection/pkg_prefetch.h"
+// prebuilt root filesystem images
+#include "image/image_deploy.h"
 // system check hardware && requirements
 #include "system/system_check.h"
+#include "system/target_config.h"
 // general installer function prototype and data struct
 #include "include/installer.h"
 // ncurses lib for good working with Ncurses UI
 #include "../../libc/ncurses/ncurses_util.h"
+// stage graph scheduler and checkpoint journal
+#include "pipeline/journal.h"
+#include "pipeline/pipeline.h"
 
 /* Constants */
 #define MIN_ROOT_SIZE_GB 15
 #define MIN_EFI_SIZE_MB 512
 #define BOOTLOADER_ID "lainux"
 #define MAX_RETRIES 5
-#define DEVICE_WAIT_TIME 2
+#define PARTITION_WAIT_MS 10000
+#define MKFS_TIMEOUT 600
+#define MKFS_BACKOFF_MS 250
+#define MKFS_BACKOFF_MAX_MS 4000
+#define EXT4_BLOCK_SIZE 4096
+#define BOOTLOADER_TIMEOUT 600
+#define IMAGE_FSCK_TIMEOUT 600
+#define IMAGE_PROBE_DIR "/run/lainux-image-root"
+
+/* Pipeline resources (stage inputs/outputs) */
+#define RES_DISK (1u << 0)        /* target disk selected and checked */
+#define RES_PARTITIONS (1u << 1)  /* partition table written, nodes present */
+#define RES_ESP_FS (1u << 2)      /* FAT32 on the EFI partition */
+#define RES_ROOT_FS (1u << 3)     /* ext4 on the root partition */
+#define RES_ROOT_MOUNT (1u << 4)  /* root mounted at root_mount */
+#define RES_BOOT_MOUNT (1u << 5)  /* ESP mounted at root_mount/boot */
+#define RES_BASE (1u << 6)        /* pacstrap finished */
+#define RES_FSTAB (1u << 7)
+#define RES_TIMEZONE (1u << 8)
+#define RES_LOCALE (1u << 9)
+#define RES_HOSTNAME (1u << 10)
+#define RES_USERS (1u << 11)
+#define RES_SUDOERS (1u << 12)
+#define RES_BOOTLOADER (1u << 13)
+#define RES_SERVICES (1u << 14)
+#define RES_PKG_CACHE (1u << 15)  /* package archives prefetched */
+#define RES_IMAGE (1u << 16)      /* tarball image unpacked into the root */
+
+/* Fleet mode: one pipeline per target disk (FLEET_MAX_DISKS in installer.h) */
+#define FLEET_MOUNT_FMT "/mnt/target-%d"
+#define FLEET_CACHE_ROOT "/var/cache/lainux/fleet"
+#define FLEET_PKG_CACHE FLEET_CACHE_ROOT "/var/cache/pacman/pkg"
+#define FLEET_PKG_CACHE_RO "/run/lainux-fleet-pkg"  /* read-only view of it */
+#define FLEET_REFRESH_MS 250
+
+struct FleetSlot;
+
+/* Per-installation state shared by the pipeline stages */
+typedef struct {
+  const char *disk;
+  const char *root_mount;
+  char dev_path[32];
+  char efi_part[32];
+  char root_part[32];
+  int boot_mode;
+  const ImageInfo *image;  /* NULL - regular pacstrap install */
+  const char *pkg_cache;   /* shared package cache, NULL - target's own */
+  int portable;            /* disk leaves this machine: no NVRAM entries */
+  struct FleetSlot *slot;  /* fleet progress pane, NULL - status window */
+} InstallCtx;
 
 /* Installation state */
 volatile int install_running = 0;
@@ -134,25 +203,9 @@ static void get_partition_names(const char *dev_path, char *efi_part,
   }
 }
 
-/* Safe file existence check with timeout */
-static int safe_file_exists(const char *path, int max_wait) {
-  struct stat st;
-  int attempts = 0;
-
-  while (attempts < max_wait) {
-    if (stat(path, &st) == 0) {
-      return 1;
-    }
-    sleep(500000); /* 500ms */
-    attempts++;
-  }
-  return 0;
-}
-
 /* Secure partition creation */
 static int create_secure_partitions(const char *disk, int boot_mode) {
   char dev_path[32];
-  char cmd[256];
 
   if (build_disk_path(dev_path, sizeof(dev_path), disk) != 0) {
     return -1;
@@ -160,98 +213,22 @@ static int create_secure_partitions(const char *disk, int boot_mode) {
 
   log_message("Creating partitions on %s", dev_path);
 
-  /* Clear partition table */
-  snprintf(cmd, sizeof(cmd), "sgdisk -Z %s", dev_path);
-  if (run_command(cmd, 1) != 0) {
-    snprintf(cmd, sizeof(cmd), "dd if=/dev/zero of=%s bs=512 count=1",
-             dev_path);
-    run_command(cmd, 1);
-  }
-
-  /* Wait for device reset */
-  sleep(1);
-  run_command("udevadm settle 2>/dev/null", 0);
-
+  /* Written in-process; the kernel re-reads the table before we return */
   if (boot_mode) {
     /* UEFI: GPT with ESP */
-    snprintf(cmd, sizeof(cmd), "sgdisk -n 1::+%dM -t 1:ef00 -c 1:lainux-efi %s",
-             MIN_EFI_SIZE_MB, dev_path);
-    if (run_command(cmd, 1) != 0)
-      return -1;
-
-    snprintf(cmd, sizeof(cmd), "sgdisk -n 2:: -t 2:8300 -c 2:lainux-root %s",
-             dev_path);
-    if (run_command(cmd, 1) != 0)
-      return -1;
-  } else {
-    /* BIOS: MBR with boot flag */
-    snprintf(cmd, sizeof(cmd),
-             "fdisk %s << EOF\no\nn\np\n1\n\n+%dM\na\n1\nn\np\n2\n\n\nw\nEOF",
-             dev_path, MIN_EFI_SIZE_MB);
-    if (run_command(cmd, 1) != 0)
-      return -1;
-  }
-
-  /* Force kernel to re-read partition table */
-  snprintf(cmd, sizeof(cmd), "partprobe %s 2>/dev/null", dev_path);
-  run_command(cmd, 0);
-
-  run_command("udevadm settle 2>/dev/null", 0);
-  sleep(DEVICE_WAIT_TIME);
-
-  return 0;
-}
-
-/* Safe formatting with fallback */
-static int format_partitions_safe(const char *efi_part, const char *root_part) {
-  char cmd[512];
-  int retry;
-
-  /* Format EFI partition */
-  log_message("Formatting %s as FAT32", efi_part);
-  for (retry = 0; retry < MAX_RETRIES; retry++) {
-    snprintf(cmd, sizeof(cmd), "mkfs.fat -F32 -n LAINUX_EFI %s", efi_part);
-    if (run_command(cmd, 0) == 0)
-      break;
-
-    snprintf(cmd, sizeof(cmd), "mkfs.vfat -F32 %s", efi_part);
-    if (run_command(cmd, 0) == 0)
-      break;
-
-    if (retry < MAX_RETRIES - 1) {
-      log_message("Retrying EFI format...");
-      sleep(1);
-    }
-  }
-
-  if (retry == MAX_RETRIES) {
-    log_message("Failed to format EFI partition");
-    return -1;
-  }
-
-  /* Format root partition */
-  log_message("Formatting %s as ext4", root_part);
-  for (retry = 0; retry < MAX_RETRIES; retry++) {
-    snprintf(cmd, sizeof(cmd), "mkfs.ext4 -F -L lainux_root %s", root_part);
-    if (run_command(cmd, 0) == 0)
-      break;
-
-    snprintf(cmd, sizeof(cmd), "mkfs.ext4 %s", root_part);
-    if (run_command(cmd, 0) == 0)
-      break;
-
-    if (retry < MAX_RETRIES - 1) {
-      log_message("Retrying root format...");
-      sleep(1);
-    }
-  }
-
-  if (retry == MAX_RETRIES) {
-    log_message("Failed to format root partition");
-    return -1;
+    const PartSpec gpt_parts[] = {
+        {"lainux-efi", GPT_TYPE_ESP, MBR_TYPE_ESP, MIN_EFI_SIZE_MB, 0},
+        {"lainux-root", GPT_TYPE_LINUX, MBR_TYPE_LINUX, 0, 0},
+    };
+    return gpt_create(dev_path, gpt_parts, 2);
   }
 
-  return 0;
+  /* BIOS: MBR with boot flag */
+  const PartSpec mbr_parts[] = {
+      {NULL, GPT_TYPE_LINUX, MBR_TYPE_LINUX, MIN_EFI_SIZE_MB, 1},
+      {NULL, GPT_TYPE_LINUX, MBR_TYPE_LINUX, 0, 0},
+  };
+  return mbr_create(dev_path, mbr_parts, 2);
 }
 
 /* Safe mount with verification */
@@ -280,9 +257,10 @@ static int safe_mount(const char *source, const char *target,
       }
     }
 
-    if (attempts < MAX_RETRIES - 1) {
-      sleep(500000);
-      attempts++;
+    attempts++;
+    if (attempts < MAX_RETRIES) {
+      struct timespec ts = {0, 500000000L};
+      nanosleep(&ts, NULL);
     }
   }
 
@@ -290,127 +268,715 @@ static int safe_mount(const char *source, const char *target,
   return -1;
 }
 
-/* Universal bootloader installation */
-static int install_universal_bootloader(const char *disk, int boot_mode,
-                                        const char *root_mount) {
-  char dev_path[32];
-  char cmd[512];
+/* Live status for long-running jobs */
+typedef struct {
+  char last_line[128];
+} LiveStatus;
 
-  if (build_disk_path(dev_path, sizeof(dev_path), disk) != 0) {
+static void live_status_line(const char *line, int is_err, void *user) {
+  LiveStatus *st = (LiveStatus *)user;
+  if (!is_err) {
+    snprintf(st->last_line, sizeof(st->last_line), "%s", line);
+  }
+}
+
+static void fleet_slot_detail(struct FleetSlot *slot, const char *msg);
+
+/* Run a job on the async executor, keep the status line ticking */
+static int run_live(const InstallCtx *ctx, const char *const argv[],
+                    const char *label, int timeout_sec) {
+  LiveStatus st = {""};
+  CmdOptions opts = {
+      .proc = {PROC_LOG_STDOUT | PROC_LOG_STDERR, timeout_sec, -1, NULL},
+      .label = label,
+      .on_line = live_status_line,
+      .user = &st,
+  };
+  ProcResult res = {0};
+  char msg[192];
+  int rc;
+
+  log_message("Executing: %s", argv[0]);
+  int id = cmd_submit(argv, &opts);
+  if (id < 0) {
     return -1;
   }
 
+  while ((rc = cmd_poll(id, 250, &res)) == CMD_RUNNING) {
+    snprintf(msg, sizeof(msg), "%s [%ds] %s", label, (int)cmd_elapsed(id),
+             st.last_line);
+    if (ctx && ctx->slot) {
+      fleet_slot_detail(ctx->slot, msg);
+      continue;
+    }
+    display_status(msg);
+  }
+  if (rc != CMD_DONE) {
+    log_message("%s: lost track of the job", label);
+    return -1;
+  }
+
+  log_message("%s finished in %.1fs (exit %d, peak RSS %ld KB)", label,
+              res.elapsed_sec, res.exit_code, res.peak_rss_kb);
+  proc_result_free(&res);
+  return res.exit_code;
+}
+
+/*
+ * Filesystem creation.
+ * format-efi and format-root are separate pipeline stages, so both mkfs
+ * jobs run on the async executor at the same time; each one retries on
+ * its own with exponential backoff.
+ */
+
+/* Read an unsigned queue attribute of the disk holding a partition */
+static unsigned long read_queue_attr(const char *part, const char *attr) {
+  char path[MAX_PATH], buf[32];
+  const char *name = strrchr(part, '/');
+  unsigned long value = 0;
+
+  name = name ? name + 1 : part;
+  /* partitions have no queue/ of their own, it lives on the parent */
+  snprintf(path, sizeof(path), "/sys/class/block/%s/../queue/%s", name, attr);
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    snprintf(path, sizeof(path), "/sys/class/block/%s/queue/%s", name, attr);
+    fp = fopen(path, "r");
+  }
+  if (fp) {
+    if (fgets(buf, sizeof(buf), fp))
+      value = strtoul(buf, NULL, 10);
+    fclose(fp);
+  }
+  return value;
+}
+
+/* Install-optimized ext4 extended options for root_part */
+static void ext4_profile(const char *root_part, char *opts, size_t size) {
+  unsigned long discard = read_queue_attr(root_part, "discard_granularity");
+  unsigned long min_io = read_queue_attr(root_part, "minimum_io_size");
+  unsigned long opt_io = read_queue_attr(root_part, "optimal_io_size");
+  int len;
+
+  /* inode tables and journal are zeroed later by the kernel */
+  len = snprintf(opts, size, "lazy_itable_init=1,lazy_journal_init=1,%s",
+                 discard ? "discard" : "nodiscard");
+
+  /* RAID / striped devices advertise their geometry */
+  if (opt_io >= 2 * EXT4_BLOCK_SIZE && opt_io % EXT4_BLOCK_SIZE == 0 &&
+      len > 0 && (size_t)len < size) {
+    unsigned long stride =
+        min_io > EXT4_BLOCK_SIZE ? min_io / EXT4_BLOCK_SIZE : 1;
+    snprintf(opts + len, size - (size_t)len, ",stride=%lu,stripe_width=%lu",
+             stride, opt_io / EXT4_BLOCK_SIZE);
+  }
+}
+
+static void mkfs_backoff(int attempt) {
+  long ms = (long)MKFS_BACKOFF_MS << attempt;
+  if (ms > MKFS_BACKOFF_MAX_MS)
+    ms = MKFS_BACKOFF_MAX_MS;
+  struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+/* Try mkfs variants in order until one succeeds, backing off between rounds */
+static int mkfs_with_retry(const InstallCtx *ctx,
+                           const char *const *const variants[],
+                           const char *label) {
+  for (int attempt = 0; attempt < MAX_RETRIES; attempt++) {
+    for (int v = 0; variants[v]; v++) {
+      if (run_live(ctx, variants[v], label, MKFS_TIMEOUT) == 0)
+        return 0;
+    }
+    if (attempt < MAX_RETRIES - 1) {
+      log_message("%s failed, retrying (attempt %d)", label, attempt + 2);
+      mkfs_backoff(attempt);
+    }
+  }
+  log_message("%s failed after %d attempts", label, MAX_RETRIES);
+  return -1;
+}
+
+/* Format EFI partition as FAT32 with fallback */
+static int format_efi_partition(const InstallCtx *ctx) {
+  const char *efi_part = ctx->efi_part;
+  const char *fat_argv[] = {"mkfs.fat", "-F32", "-n", "LAINUX_EFI", efi_part,
+                            NULL};
+  const char *vfat_argv[] = {"mkfs.vfat", "-F32", efi_part, NULL};
+  const char *const *const variants[] = {fat_argv, vfat_argv, NULL};
+
+  log_message("Formatting %s as FAT32", efi_part);
+  if (fat32_format(efi_part, "LAINUX_EFI") == 0)
+    return 0;
+
+  /* dosfstools only as a fallback, it is no longer required */
+  log_message("Built-in FAT32 formatter failed, trying mkfs.fat");
+  return mkfs_with_retry(ctx, variants, "mkfs.fat");
+}
+
+/* Format root partition as ext4 with fallback */
+static int format_root_partition(const InstallCtx *ctx) {
+  const char *root_part = ctx->root_part;
+  char ext_opts[160];
+
+  ext4_profile(root_part, ext_opts, sizeof(ext_opts));
+  log_message("Formatting %s as ext4 (%s)", root_part, ext_opts);
+
+  const char *ext4_argv[] = {"mkfs.ext4", "-F", "-L", "lainux_root", "-E",
+                             ext_opts, root_part, NULL};
+  const char *plain_argv[] = {"mkfs.ext4", "-F", root_part, NULL};
+  const char *const *const variants[] = {ext4_argv, plain_argv, NULL};
+  return mkfs_with_retry(ctx, variants, "mkfs.ext4");
+}
+
+/* Universal bootloader installation */
+static int install_universal_bootloader(const InstallCtx *ctx) {
+  const char *dev_path = ctx->dev_path;
+  const char *root_mount = ctx->root_mount;
+  int boot_mode = ctx->boot_mode;
+  char arg1[MAX_PATH], arg2[MAX_PATH];
+  const char *argv[10];
+  int argc = 0;
+
   log_message("Installing bootloader for %s mode", boot_mode ? "UEFI" : "BIOS");
 
   if (boot_mode) {
     /* UEFI bootloader */
     if (file_exists("/usr/bin/grub-install")) {
-      snprintf(cmd, sizeof(cmd),
-               "grub-install --target=x86_64-efi --efi-directory=%s/boot "
-               "--bootloader-id=%s --recheck %s",
-               root_mount, BOOTLOADER_ID, dev_path);
+      snprintf(arg1, sizeof(arg1), "--efi-directory=%s/boot", root_mount);
+      argv[argc++] = "grub-install";
+      argv[argc++] = "--target=x86_64-efi";
+      argv[argc++] = arg1;
+      argv[argc++] = "--bootloader-id=" BOOTLOADER_ID;
+      argv[argc++] = "--recheck";
+      if (ctx->portable) {
+        /* fallback path EFI/BOOT/BOOTX64.EFI, this NVRAM is not its home */
+        argv[argc++] = "--removable";
+        argv[argc++] = "--no-nvram";
+      }
+      argv[argc++] = dev_path;
     } else if (file_exists("/usr/bin/systemd-bootctl")) {
-      snprintf(cmd, sizeof(cmd),
-               "bootctl install --esp-path=%s/boot --boot-path=%s/boot",
-               root_mount, root_mount);
+      snprintf(arg1, sizeof(arg1), "--esp-path=%s/boot", root_mount);
+      snprintf(arg2, sizeof(arg2), "--boot-path=%s/boot", root_mount);
+      argv[argc++] = "bootctl";
+      argv[argc++] = "install";
+      argv[argc++] = arg1;
+      argv[argc++] = arg2;
+      if (ctx->portable)
+        argv[argc++] = "--no-variables";
     } else {
       log_message("No UEFI bootloader found");
       return -1;
     }
   } else {
     /* BIOS bootloader */
-    snprintf(
-        cmd, sizeof(cmd),
-        "grub-install --target=i386-pc --recheck --boot-directory=%s/boot %s",
-        root_mount, dev_path);
+    snprintf(arg1, sizeof(arg1), "--boot-directory=%s/boot", root_mount);
+    argv[argc++] = "grub-install";
+    argv[argc++] = "--target=i386-pc";
+    argv[argc++] = "--recheck";
+    argv[argc++] = arg1;
+    argv[argc++] = dev_path;
   }
+  argv[argc] = NULL;
 
-  if (run_command(cmd, 1) != 0) {
+  if (run_live(ctx, argv, "Bootloader", BOOTLOADER_TIMEOUT) != 0) {
     log_message("Bootloader installation failed");
     return -1;
   }
 
   /* Generate bootloader config */
   if (file_exists("/usr/bin/grub-mkconfig")) {
-    snprintf(cmd, sizeof(cmd), "grub-mkconfig -o %s/boot/grub/grub.cfg",
-             root_mount);
-    run_command(cmd, 1);
+    snprintf(arg1, sizeof(arg1), "%s/boot/grub/grub.cfg", root_mount);
+    const char *mkconfig_argv[] = {"grub-mkconfig", "-o", arg1, NULL};
+    run_argv(mkconfig_argv, 1, BOOTLOADER_TIMEOUT);
   }
 
   return 0;
 }
 
-/* Secure system configuration */
-static int configure_system_secure(const char *root_mount) {
-  char cmd[512];
-  FILE *fp;
+/*
+ * Pipeline stages.
+ * Inputs/outputs below define the dependency graph; everything that
+ * does not share a resource runs in parallel.
+ */
 
-  /* Basic system configuration */
-  snprintf(cmd, sizeof(cmd),
-           "arch-chroot %s ln -sf /usr/share/zoneinfo/UTC /etc/localtime",
-           root_mount);
-  run_command(cmd, 0);
+static int stage_partition(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
 
-  snprintf(cmd, sizeof(cmd), "arch-chroot %s hwclock --systohc", root_mount);
-  run_command(cmd, 0);
+  const char *const parts[] = {ctx->efi_part, ctx->root_part, NULL};
+  DevWait wait;
 
-  /* Locale */
-  fp = fopen("/mnt/etc/locale.gen", "w");
-  if (fp) {
-    fprintf(fp, "en_US.UTF-8 UTF-8\n");
-    fprintf(fp, "en_US ISO-8859-1\n");
-    fclose(fp);
+  /* Subscribe first so the partition uevents cannot be missed */
+  devwait_open(&wait);
+  if (create_secure_partitions(ctx->disk, ctx->boot_mode) != 0) {
+    devwait_close(&wait);
+    return -1;
   }
 
-  snprintf(cmd, sizeof(cmd), "arch-chroot %s locale-gen", root_mount);
-  run_command(cmd, 0);
+  /* Wait for partitions */
+  int rc = devwait_for(&wait, parts, PARTITION_WAIT_MS);
+  devwait_close(&wait);
+  if (rc != 0) {
+    log_message("Partitions not detected");
+    return -1;
+  }
+  return 0;
+}
 
-  fp = fopen("/mnt/etc/locale.conf", "w");
-  if (fp) {
-    fprintf(fp, "LANG=en_US.UTF-8\n");
-    fclose(fp);
+static int stage_format_efi(void *arg) {
+  return format_efi_partition((InstallCtx *)arg);
+}
+
+static int stage_format_root(void *arg) {
+  return format_root_partition((InstallCtx *)arg);
+}
+
+static int stage_mount_root(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+
+  /* Clean previous mounts */
+  const char *umount_argv[] = {"umount", "-R", ctx->root_mount, NULL};
+  run_argv(umount_argv, 0, 0);
+  mkdir(ctx->root_mount, 0755);
+
+  if (safe_mount(ctx->root_part, ctx->root_mount, "ext4") != 0) {
+    log_message("Failed to mount root");
+    return -1;
   }
+  return 0;
+}
 
-  /* Hostname */
-  fp = fopen("/mnt/etc/hostname", "w");
-  if (fp) {
-    fprintf(fp, "lainux\n");
-    fclose(fp);
+static int stage_mount_boot(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  char boot[MAX_PATH];
+
+  snprintf(boot, sizeof(boot), "%s/boot", ctx->root_mount);
+  mkdir(boot, 0755);
+  if (safe_mount(ctx->efi_part, boot, "vfat") != 0) {
+    log_message("Failed to mount boot");
+    return -1;
+  }
+  return 0;
+}
+
+/* Packages pacstrap installs into the target */
+static const char *const base_packages[] = {"base", "linux", "linux-firmware",
+                                            NULL};
+
+static int stage_prefetch(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+
+  /* pacstrap uses <root>/var/cache/pacman/pkg, warm it in parallel */
+  return pkg_prefetch(ctx->root_mount, base_packages) < 0 ? -1 : 0;
+}
+
+static int stage_base_system(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  char cache[MAX_PATH];
+
+  snprintf(cache, sizeof(cache), "%s/var/cache/pacman/pkg", ctx->root_mount);
+  const char *mkdir_argv[] = {"mkdir", "-p", cache, NULL};
+  run_argv(mkdir_argv, 0, 0);
+
+  const char *pacstrap_argv[10] = {"pacstrap", "-K", ctx->root_mount};
+  int argc = 3;
+  for (int i = 0; base_packages[i] && argc < 7; i++)
+    pacstrap_argv[argc++] = base_packages[i];
+  if (ctx->pkg_cache) {
+    /* passed on to pacman, searched before the target's own cache */
+    pacstrap_argv[argc++] = "--cachedir";
+    pacstrap_argv[argc++] = ctx->pkg_cache;
   }
+  pacstrap_argv[argc] = NULL;
 
-  /* Hosts */
-  fp = fopen("/mnt/etc/hosts", "a");
-  if (fp) {
-    fprintf(fp, "127.0.1.1 lainux.localdomain lainux\n");
-    fclose(fp);
+  if (run_live(ctx, pacstrap_argv, "pacstrap", INSTALL_TIMEOUT) != 0) {
+    log_message("Base installation failed");
+    return -1;
   }
+  return 0;
+}
 
-  /* Users */
-  snprintf(cmd, sizeof(cmd), "echo 'root:lainux' | arch-chroot %s chpasswd",
-           root_mount);
-  run_command(cmd, 0);
+/* Image mode: raw images replace mkfs, tarballs replace pacstrap */
+static int stage_deploy_image(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
 
-  snprintf(cmd, sizeof(cmd),
-           "arch-chroot %s useradd -m -G wheel -s /bin/bash lainux",
-           root_mount);
-  run_command(cmd, 0);
+  if (ctx->image->kind == IMAGE_TAR)
+    return image_deploy_tar(ctx->image, ctx->root_mount);
 
-  snprintf(cmd, sizeof(cmd), "echo 'lainux:lainux' | arch-chroot %s chpasswd",
-           root_mount);
-  run_command(cmd, 0);
+  if (image_deploy_raw(ctx->image, ctx->root_part) < 0)
+    return -1;
 
-  /* Sudo */
-  fp = fopen("/mnt/etc/sudoers.d/wheel", "w");
-  if (fp) {
-    fprintf(fp, "%%wheel ALL=(ALL) ALL\n");
-    fclose(fp);
-    snprintf(cmd, sizeof(cmd), "chmod 440 %s/etc/sudoers.d/wheel", root_mount);
-    run_command(cmd, 0);
+  /* Every host gets its own UUID, then grow to the partition */
+  const char *fsck_argv[] = {"e2fsck", "-f", "-y", ctx->root_part, NULL};
+  int rc = run_argv(fsck_argv, 0, IMAGE_FSCK_TIMEOUT);
+  if (rc < 0 || rc >= 4) {
+    log_message("Image filesystem check failed (%d)", rc);
+    return -1;
+  }
+  const char *uuid_argv[] = {"tune2fs", "-U", "random", ctx->root_part, NULL};
+  const char *resize_argv[] = {"resize2fs", "-f", ctx->root_part, NULL};
+  if (run_argv(uuid_argv, 0, IMAGE_FSCK_TIMEOUT) != 0 ||
+      run_live(ctx, resize_argv, "resize2fs", IMAGE_FSCK_TIMEOUT) != 0) {
+    log_message("Failed to adapt the image filesystem to %s", ctx->root_part);
+    return -1;
+  }
+  return 0;
+}
+
+static int copy_file(const char *src, const char *dst) {
+  char buf[65536];
+  int in = open(src, O_RDONLY | O_CLOEXEC);
+  if (in < 0)
+    return -1;
+  int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    close(in);
+    return -1;
+  }
+
+  ssize_t n;
+  int rc = 0;
+  while ((n = read(in, buf, sizeof(buf))) > 0) {
+    if (write(out, buf, (size_t)n) != n) {
+      rc = -1;
+      break;
+    }
+  }
+  if (n < 0 || fsync(out) != 0)
+    rc = -1;
+  close(in);
+  close(out);
+  return rc;
+}
+
+/* The image ships kernel and initramfs in its own /boot, which the ESP
+ * now covers: look under the mount through a plain bind and copy them */
+static int stage_image_boot(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  char probe[64], src_dir[MAX_PATH], src[MAX_PATH], dst[MAX_PATH];
+  int copied = 0, rc = 0;
+
+  /* per disk: fleet installs run this stage side by side */
+  snprintf(probe, sizeof(probe), "%s-%s", IMAGE_PROBE_DIR, ctx->disk);
+  mkdir(probe, 0700);
+  if (mount(ctx->root_mount, probe, NULL, MS_BIND, NULL) != 0) {
+    log_message("Cannot bind %s: %s", ctx->root_mount, strerror(errno));
+    rmdir(probe);
+    return -1;
+  }
+
+  snprintf(src_dir, sizeof(src_dir), "%s/boot", probe);
+  DIR *dir = opendir(src_dir);
+  if (dir) {
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+      struct stat st;
+      if ((size_t)snprintf(src, sizeof(src), "%s/%s", src_dir, de->d_name) >= sizeof(src) ||
+          stat(src, &st) != 0 || !S_ISREG(st.st_mode))
+        continue;
+      if ((size_t)snprintf(dst, sizeof(dst), "%s/boot/%s", ctx->root_mount, de->d_name) >=
+              sizeof(dst) ||
+          copy_file(src, dst) != 0) {
+        log_message("Failed to copy %s to the ESP", de->d_name);
+        rc = -1;
+        break;
+      }
+      copied++;
+    }
+    closedir(dir);
+  }
+  umount2(probe, MNT_DETACH);
+  rmdir(probe);
+
+  if (rc == 0 && copied == 0) {
+    log_message("Image has no kernel in /boot");
+    return -1;
+  }
+  log_message("Copied %d boot file(s) from the image", copied);
+  return rc;
+}
+
+static int stage_fstab(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  FstabInfo info;
+  char unit[MAX_PATH], wants[MAX_PATH];
+
+  /* rewritten as a whole, so a re-run on resume is harmless */
+  if (fstab_generate(ctx->root_mount, NULL, &info) != 0)
+    return -1;
+
+  /* SSD with discard: weekly fstrim instead of the discard mount option */
+  snprintf(unit, sizeof(unit), "%s/usr/lib/systemd/system/fstrim.timer",
+           ctx->root_mount);
+  if (info.discard && file_exists(unit)) {
+    snprintf(wants, sizeof(wants), "%s/etc/systemd/system/timers.target.wants",
+             ctx->root_mount);
+    mkdir(wants, 0755);
+    strncat(wants, "/fstrim.timer", sizeof(wants) - strlen(wants) - 1);
+    unlink(wants);
+    if (symlink("/usr/lib/systemd/system/fstrim.timer", wants) == 0)
+      log_message("Enabled fstrim.timer for SSD storage");
+  }
+  return 0;
+}
+
+static int stage_bootloader(void *arg) {
+  return install_universal_bootloader((InstallCtx *)arg);
+}
+
+/* Hostname, timezone, locale files, accounts and sudo policy, written
+ * directly from one TargetConfig */
+static int stage_system_config(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  TargetConfig cfg;
+
+  target_config_defaults(&cfg);
+  target_config_add_locale(&cfg, "en_US");
+  snprintf(cfg.root_password, sizeof(cfg.root_password), "lainux");
+  target_config_add_user(&cfg, "lainux", "lainux", "wheel", "/bin/bash");
+
+  int rc = target_config_apply(&cfg, ctx->root_mount, TC_ALL);
+  target_config_clear(&cfg);
+  return rc;
+}
+
+/* What still needs the target's own binaries: one chroot session
+ * instead of an arch-chroot (and its mount setup) per command */
+static int stage_configure(void *arg) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  ChrootSession session;
+
+  chroot_begin(&session, ctx->root_mount);
+
+  const char *clock_argv[] = {"hwclock", "--systohc", NULL};
+  chroot_add_run(&session, clock_argv, NULL, CHROOT_OPTIONAL);
+  const char *locale_argv[] = {"locale-gen", NULL};
+  chroot_add_run(&session, locale_argv, NULL, CHROOT_OPTIONAL);
+
+  const char *services_argv[] = {"systemctl", "enable", "systemd-networkd",
+                                 "systemd-resolved", NULL};
+  chroot_add_run(&session, services_argv, NULL, 0);
+
+  return chroot_commit(&session);
+}
+
+/*
+ * Stage fingerprints for the checkpoint journal.
+ * Each one hashes what the stage leaves behind, so a resumed install
+ * only skips a stage whose result is still on disk.
+ */
+
+/* Hash target-relative paths in order; all must exist */
+static int fp_target_files(const InstallCtx *ctx, const char *const rel[],
+                           unsigned long long *fp) {
+  char path[MAX_PATH];
+  unsigned long long h = JOURNAL_FP_SEED;
+
+  for (int i = 0; rel[i]; i++) {
+    snprintf(path, sizeof(path), "%s%s", ctx->root_mount, rel[i]);
+    if (journal_hash_file(path, &h) != 0)
+      return -1;
   }
+  *fp = h;
+  return 0;
+}
+
+static int fp_partition_table(void *arg, unsigned long long *fp) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  unsigned long long h = JOURNAL_FP_SEED;
+
+  /* MBR partition table (not boot code, grub rewrites that) */
+  if (journal_hash_region(ctx->dev_path, 446, 66, &h) != 0)
+    return -1;
+  /* GPT header and entries, LBA 1..33 */
+  if (ctx->boot_mode && journal_hash_region(ctx->dev_path, 512, 33 * 512, &h) != 0)
+    return -1;
+  *fp = h;
+  return 0;
+}
+
+static int fp_format_efi(void *arg, unsigned long long *fp) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  unsigned long long h = JOURNAL_FP_SEED;
+
+  /* FAT32 boot sector: BPB, volume id and label */
+  if (journal_hash_region(ctx->efi_part, 0, 90, &h) != 0)
+    return -1;
+  *fp = h;
+  return 0;
+}
+
+static int fp_format_root(void *arg, unsigned long long *fp) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  unsigned char sb[0x78];
+  int fd = open(ctx->root_part, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return -1;
+  ssize_t n = pread(fd, sb, sizeof(sb), 1024);
+  close(fd);
+
+  /* ext4 superblock: magic 0xEF53 at 0x38, UUID at 0x68 */
+  if (n != (ssize_t)sizeof(sb) || sb[0x38] != 0x53 || sb[0x39] != 0xEF)
+    return -1;
+  *fp = journal_hash(sb + 0x68, 16, JOURNAL_FP_SEED);
+  return 0;
+}
+
+static int fp_base_system(void *arg, unsigned long long *fp) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  char path[MAX_PATH];
+  unsigned long long h = JOURNAL_FP_SEED;
+
+  snprintf(path, sizeof(path), "%s/var/lib/pacman/local", ctx->root_mount);
+  if (journal_hash_dir(path, &h) != 0)
+    return -1;
+  snprintf(path, sizeof(path), "%s/boot/vmlinuz-linux", ctx->root_mount);
+  if (journal_hash_region(path, 0, 4096, &h) != 0)
+    return -1;
+  *fp = h;
+  return 0;
+}
+
+static int fp_fstab(void *arg, unsigned long long *fp) {
+  const char *const files[] = {"/etc/fstab", NULL};
+  return fp_target_files((InstallCtx *)arg, files, fp);
+}
+
+static int fp_bootloader(void *arg, unsigned long long *fp) {
+  const char *const files[] = {"/boot/grub/grub.cfg", NULL};
+  return fp_target_files((InstallCtx *)arg, files, fp);
+}
+
+static int fp_services(void *arg, unsigned long long *fp) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  char path[MAX_PATH];
+  unsigned long long h = JOURNAL_FP_SEED;
+
+  snprintf(path, sizeof(path),
+           "%s/etc/systemd/system/multi-user.target.wants/"
+           "systemd-networkd.service",
+           ctx->root_mount);
+  if (journal_hash_link(path, &h) != 0)
+    return -1;
+  *fp = h;
+  return 0;
+}
+
+static int fp_system_config(void *arg, unsigned long long *fp) {
+  InstallCtx *ctx = (InstallCtx *)arg;
+  const char *const files[] = {"/etc/hostname",    "/etc/hosts",
+                               "/etc/locale.gen",  "/etc/locale.conf",
+                               "/etc/passwd",      "/etc/shadow",
+                               "/etc/group",       "/etc/sudoers.d/wheel",
+                               NULL};
+  char path[MAX_PATH];
+  unsigned long long h;
+
+  if (fp_target_files(ctx, files, &h) != 0)
+    return -1;
+  snprintf(path, sizeof(path), "%s/etc/localtime", ctx->root_mount);
+  if (journal_hash_link(path, &h) != 0)
+    return -1;
+  *fp = h;
+  return 0;
+}
 
+/* configure: generated locales and enabled services */
+static int fp_configure(void *arg, unsigned long long *fp) {
+  const char *const files[] = {"/usr/lib/locale/locale-archive", NULL};
+  unsigned long long h, services;
+
+  if (fp_target_files((InstallCtx *)arg, files, &h) != 0 ||
+      fp_services(arg, &services) != 0)
+    return -1;
+  *fp = journal_hash(&services, sizeof(services), h);
   return 0;
 }
 
+/* Installation graph */
+static const PipelineStage install_stages[] = {
+    {"partition", stage_partition, RES_DISK, RES_PARTITIONS, 0,
+     fp_partition_table},
+    {"format-efi", stage_format_efi, RES_PARTITIONS, RES_ESP_FS, 0,
+     fp_format_efi},
+    {"format-root", stage_format_root, RES_PARTITIONS, RES_ROOT_FS, 0,
+     fp_format_root},
+    {"mount-root", stage_mount_root, RES_ROOT_FS, RES_ROOT_MOUNT, 0, NULL},
+    {"mount-boot", stage_mount_boot, RES_ESP_FS | RES_ROOT_MOUNT,
+     RES_BOOT_MOUNT, 0, NULL},
+    {"prefetch", stage_prefetch, RES_ROOT_MOUNT, RES_PKG_CACHE, 1, NULL},
+    {"base-system", stage_base_system,
+     RES_ROOT_MOUNT | RES_BOOT_MOUNT | RES_PKG_CACHE, RES_BASE, 0,
+     fp_base_system},
+    {"fstab", stage_fstab, RES_BASE, RES_FSTAB, 0, fp_fstab},
+    {"system-config", stage_system_config, RES_BASE,
+     RES_TIMEZONE | RES_LOCALE | RES_HOSTNAME | RES_USERS | RES_SUDOERS, 1,
+     fp_system_config},
+    {"configure", stage_configure, RES_BASE | RES_LOCALE, RES_SERVICES, 1,
+     fp_configure},
+    {"bootloader", stage_bootloader, RES_BASE | RES_BOOT_MOUNT,
+     RES_BOOTLOADER, 1, fp_bootloader},
+};
+
+#define INSTALL_STAGE_COUNT                                                    \
+  ((int)(sizeof(install_stages) / sizeof(install_stages[0])))
+
+/* Image mode graph: install_stages without pacstrap. A raw image is the
+ * root filesystem itself; a tarball is unpacked before the ESP goes over
+ * /boot. Everything per-host (fstab, users, bootloader...) still runs. */
+static int build_image_stages(const ImageInfo *image, PipelineStage *out) {
+  int raw = image->kind == IMAGE_RAW;
+  int n = 0;
+
+  for (int i = 0; i < INSTALL_STAGE_COUNT; i++) {
+    const PipelineStage *st = &install_stages[i];
+    if (strcmp(st->name, "prefetch") == 0 ||
+        strcmp(st->name, "base-system") == 0)
+      continue;
+    if (raw && strcmp(st->name, "format-root") == 0) {
+      out[n++] = (PipelineStage){"deploy-image", stage_deploy_image,
+                                 RES_PARTITIONS, RES_ROOT_FS, 0,
+                                 fp_format_root};
+      continue;
+    }
+    out[n] = *st;
+    if (!raw && strcmp(st->name, "mount-boot") == 0)
+      out[n].inputs |= RES_IMAGE;
+    n++;
+  }
+
+  if (!raw)
+    out[n++] = (PipelineStage){"deploy-image", stage_deploy_image,
+                               RES_ROOT_MOUNT, RES_IMAGE, 0, fp_base_system};
+  out[n++] = (PipelineStage){"image-boot", stage_image_boot,
+                             RES_ROOT_MOUNT | RES_BOOT_MOUNT, RES_BASE, 0,
+                             fp_base_system};
+  return n;
+}
+
+/* Worker pool size: enough for the widest level of the graph */
+static int pipeline_workers(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 2)
+    return 2;
+  return cpus > PIPELINE_MAX_WORKERS ? PIPELINE_MAX_WORKERS : (int)cpus;
+}
+
+/* Disk identity for the journal: size in bytes */
+static unsigned long long disk_identity(const char *dev_path) {
+  unsigned long long bytes = 0;
+  int fd = open(dev_path, O_RDONLY | O_CLOEXEC);
+
+  if (fd >= 0) {
+    if (ioctl(fd, BLKGETSIZE64, &bytes) != 0)
+      bytes = 0;
+    close(fd);
+  }
+  return bytes;
+}
+
 /* Main installation procedure */
 void perform_installation(const char *disk) {
   if (atomic_test_and_set(&install_running)) {
@@ -418,23 +984,25 @@ void perform_installation(const char *disk) {
     return;
   }
 
-  char dev_path[32];
-  char efi_part[32], root_part[32];
-  int boot_mode;
+  InstallCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.disk = disk;
+  ctx.root_mount = "/mnt";
 
   /* Detect boot mode */
-  boot_mode = detect_boot_mode();
-  log_message("Detected %s boot mode", boot_mode ? "UEFI" : "BIOS");
+  ctx.boot_mode = detect_boot_mode();
+  log_message("Detected %s boot mode", ctx.boot_mode ? "UEFI" : "BIOS");
 
   /* Build device path */
-  if (build_disk_path(dev_path, sizeof(dev_path), disk) != 0) {
+  if (build_disk_path(ctx.dev_path, sizeof(ctx.dev_path), disk) != 0) {
     log_message("Invalid disk name");
     install_running = 0;
     return;
   }
 
   /* Get partition names */
-  get_partition_names(dev_path, efi_part, root_part, sizeof(efi_part));
+  get_partition_names(ctx.dev_path, ctx.efi_part, ctx.root_part,
+                      sizeof(ctx.efi_part));
 
   /* Pre-installation checks */
   if (!check_dependencies()) {
@@ -461,108 +1029,64 @@ void perform_installation(const char *disk) {
     return;
   }
 
-  /* Partitioning */
-  log_message("Creating partitions...");
-  if (create_secure_partitions(disk, boot_mode) != 0) {
-    log_message("Partitioning failed");
-    install_running = 0;
-    return;
+  /* Checkpoint journal: resume an interrupted install on the same disk */
+  InstallJournal journal;
+  int recorded = journal_open(&journal, disk, disk_identity(ctx.dev_path),
+                              ctx.root_mount);
+  if (recorded == 0) {
+    recorded = journal_recover(&journal, ctx.root_part);
   }
-
-  /* Wait for partitions */
-  if (!safe_file_exists(efi_part, 10) || !safe_file_exists(root_part, 10)) {
-    log_message("Partitions not detected");
-    install_running = 0;
-    return;
-  }
-
-  /* Formatting */
-  log_message("Formatting partitions...");
-  if (format_partitions_safe(efi_part, root_part) != 0) {
-    install_running = 0;
-    return;
-  }
-
-  /* Mounting */
-  log_message("Mounting filesystems...");
-
-  /* Clean previous mounts */
-  run_command("umount -R /mnt 2>/dev/null || true", 0);
-  run_command("rmdir /mnt 2>/dev/null || true", 0);
-  run_command("mkdir -p /mnt", 0);
-
-  /* Mount root */
-  if (safe_mount(root_part, "/mnt", "ext4") != 0) {
-    log_message("Failed to mount root");
-    install_running = 0;
-    return;
+  if (recorded > 0) {
+    log_message("Found journal with %d completed stage(s) for %s", recorded,
+                ctx.dev_path);
+    if (!confirm_action("Resume the interrupted installation?", "RESUME")) {
+      journal_discard(&journal);
+    }
   }
-
-  /* Create and mount boot */
-  run_command("mkdir -p /mnt/boot", 0);
-  if (safe_mount(efi_part, "/mnt/boot", "vfat") != 0) {
-    log_message("Failed to mount boot");
-    install_running = 0;
-    return;
+  PipelineHooks hooks = {journal_lookup, journal_record, &journal, NULL, NULL};
+
+  /* Prebuilt image available: stream it instead of running pacstrap */
+  static ImageInfo image;
+  PipelineStage image_stages[PIPELINE_MAX_STAGES];
+  const PipelineStage *stages = install_stages;
+  int stage_count = INSTALL_STAGE_COUNT;
+
+  if (image_find(&image) == 0) {
+    char question[256];
+    snprintf(question, sizeof(question),
+             "Deploy prebuilt image %.128s instead of pacstrap?",
+             image.version);
+    if (confirm_action(question, "IMAGE")) {
+      ctx.image = &image;
+      stage_count = build_image_stages(&image, image_stages);
+      stages = image_stages;
+    }
   }
 
-  /* Base system installation */
-  log_message("Installing base system...");
-  run_command("mkdir -p /mnt/var/cache/pacman/pkg", 0);
-
-  char cmd[512];
-  snprintf(cmd, sizeof(cmd), "pacstrap -K /mnt base linux linux-firmware");
-  if (run_command(cmd, 1) != 0) {
-    log_message("Base installation failed");
+  /* Run the installation graph */
+  PipelineReport report;
+  if (pipeline_run(stages, stage_count, RES_DISK, &ctx, pipeline_workers(),
+                   &hooks, &report) != 0) {
+    if (report.failed_stage >= 0) {
+      log_message("Installation failed at stage '%s', journal kept for resume",
+                  stages[report.failed_stage].name);
+    }
+    journal_close(&journal);
+    run_argv((const char *[]){"umount", "-R", ctx.root_mount, NULL}, 0, 0);
+    secure_zero(&ctx, sizeof(ctx));
     install_running = 0;
     return;
   }
 
-  /* Generate fstab */
-  log_message("Generating fstab...");
-  run_command("genfstab -U /mnt >> /mnt/etc/fstab", 1);
-
-  /* System configuration */
-  log_message("Configuring system...");
-  configure_system_secure("/mnt");
-
-  /* Install bootloader */
-  log_message("Installing bootloader...");
-  if (install_universal_bootloader(disk, boot_mode, "/mnt") != 0) {
-    log_message("Bootloader installation failed");
-  }
-
-  /* Services */
-  log_message("Enabling services...");
-  snprintf(
-      cmd, sizeof(cmd),
-      "arch-chroot /mnt systemctl enable systemd-networkd systemd-resolved");
-  run_command(cmd, 0);
-
-  /* Cleanup */
-  log_message("Cleaning up...");
-  run_command("sync", 0);
-  run_command("umount -R /mnt", 0);
-
-  log_message("Installation complete!");
-
-  /* Secure cleanup */
-  secure_zero(dev_path, sizeof(dev_path));
-  secure_zero(efi_part, sizeof(efi_part));
-  secure_zero(root_part, sizeof(root_part));
-
-  /* Services */
-  log_message("Try enabling services...");
-  snprintf(
-      cmd, sizeof(cmd),
-      "arch-chroot /mnt systemctl enable systemd-networkd systemd-resolved");
-  run_command(cmd, 0);
+  /* Finished: a later install on this disk must start from scratch */
+  journal_discard(&journal);
+  journal_close(&journal);
 
   log_message("Preparing kexec transition...");
 
   char cmdline[512];
   snprintf(cmdline, sizeof(cmdline), "root=%s rw init=/usr/lib/systemd/systemd",
-           root_part);
+           ctx.root_part);
   /* configuration for kexec func using struct */
   KexecConfig k_cfg = {
       .kernel_path = "/mnt/boot/vmlinuz-linux",
@@ -572,7 +1096,7 @@ void perform_installation(const char *disk) {
 
   /* Cleanup */
   log_message("Cleaning up...");
-  run_command("sync", 0);
+  sync();
 
   /* look final  */
   show_summary(disk);
@@ -584,13 +1108,368 @@ void perform_installation(const char *disk) {
     log_message(" Kexec failed, proceeding with standard cleanup. :( ");
   }
 
-  run_command("umount -R /mnt", 0);
+  run_argv((const char *[]){"umount", "-R", ctx.root_mount, NULL}, 0, 0);
   log_message("Woow! Installation complete! :D ");
 
   /* Secure cleanup */
-  secure_zero(dev_path, sizeof(dev_path));
-  secure_zero(efi_part, sizeof(efi_part));
-  secure_zero(root_part, sizeof(root_part));
+  secure_zero(&ctx, sizeof(ctx));
+
+  install_running = 0;
+}
+
+/*
+ * Fleet mode.
+ * Every target disk gets its own context, mount root, journal and
+ * pipeline run; all of them start at once. Packages are prefetched once
+ * into a shared cache (and a remote image downloaded once), so the
+ * targets only compete for the local source and their own disks.
+ */
+
+typedef struct FleetSlot {
+  InstallCtx ctx;
+  char disk[32];
+  char root_mount[64];
+  const PipelineStage *stages;
+  int stage_count;
+  unsigned initial;
+  pthread_t thread;
+  int has_thread;
+  int rc;
+  InstallJournal journal;
+  /* progress, guarded by fleet_lock */
+  int finished;
+  int done_stages;
+  char stage[32];
+  char detail[192]; /* a run_live() status line, clipped when drawn */
+  double started;
+  double elapsed;
+} FleetSlot;
+
+static pthread_mutex_t fleet_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double fleet_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fleet_slot_detail(struct FleetSlot *slot, const char *msg) {
+  pthread_mutex_lock(&fleet_lock);
+  snprintf(slot->detail, sizeof(slot->detail), "%s", msg);
+  pthread_mutex_unlock(&fleet_lock);
+}
+
+static void fleet_on_state(int stage, StageState state, void *user) {
+  FleetSlot *slot = (FleetSlot *)user;
+
+  pthread_mutex_lock(&fleet_lock);
+  if (state == STAGE_RUNNING) {
+    snprintf(slot->stage, sizeof(slot->stage), "%s", slot->stages[stage].name);
+    slot->detail[0] = '\0';
+  } else if (state != STAGE_FAILED) {
+    slot->done_stages++;
+  }
+  pthread_mutex_unlock(&fleet_lock);
+}
+
+static void *fleet_worker(void *arg) {
+  FleetSlot *slot = (FleetSlot *)arg;
+  InstallCtx *ctx = &slot->ctx;
+
+  /* journal opened (and resume confirmed) before the workers started */
+  InstallJournal *journal = &slot->journal;
+  PipelineHooks hooks = {journal_lookup, journal_record, journal,
+                         fleet_on_state, slot};
+  PipelineReport report;
+  mkdir(ctx->root_mount, 0755);
+  int rc = pipeline_run(slot->stages, slot->stage_count, slot->initial, ctx,
+                        pipeline_workers(), &hooks, &report);
+  if (rc == 0) {
+    journal_discard(journal);
+  } else if (report.failed_stage >= 0) {
+    log_message("%s: failed at stage '%s', journal kept for resume", slot->disk,
+                slot->stages[report.failed_stage].name);
+  }
+  journal_close(journal);
+
+  run_argv((const char *[]){"umount", "-R", ctx->root_mount, NULL}, 0, 0);
+  rmdir(ctx->root_mount);
+  sync();
+
+  pthread_mutex_lock(&fleet_lock);
+  slot->rc = rc;
+  slot->finished = 1;
+  slot->elapsed = fleet_now() - slot->started;
+  pthread_mutex_unlock(&fleet_lock);
+  return NULL;
+}
+
+/* One row per target: bar, current stage and its live output */
+static void fleet_draw(FleetSlot *slots, int count, double start) {
+  int max_y, max_x;
+  getmaxyx(stdscr, max_y, max_x);
+  (void)max_y;
+
+  pthread_mutex_lock(&log_mutex);
+  pthread_mutex_lock(&fleet_lock);
+  erase();
+  attron(A_BOLD | COLOR_PAIR(1));
+  mvprintw(1, 2, "FLEET INSTALL: %d target(s), %.0fs", count,
+           fleet_now() - start);
+  attroff(A_BOLD | COLOR_PAIR(1));
+
+  for (int i = 0; i < count; i++) {
+    FleetSlot *s = &slots[i];
+    int y = 3 + i * 3;
+    float progress =
+        s->stage_count ? (float)s->done_stages / (float)s->stage_count : 0;
+
+    mvprintw(y, 2, "/dev/%-10s", s->disk);
+    draw_progress_bar(y, 18, 30, progress > 1 ? 1 : progress);
+    if (!s->finished) {
+      mvprintw(y, 56, "%-20s", s->stage);
+      mvprintw(y + 1, 6, "%.*s", max_x > 8 ? max_x - 8 : 0, s->detail);
+    } else {
+      attron(COLOR_PAIR(s->rc == 0 ? 2 : 3));
+      mvprintw(y, 56, "%s in %.0fs", s->rc == 0 ? "done" : "FAILED",
+               s->elapsed);
+      attroff(COLOR_PAIR(s->rc == 0 ? 2 : 3));
+    }
+  }
+  refresh();
+  pthread_mutex_unlock(&fleet_lock);
+  pthread_mutex_unlock(&log_mutex);
+}
+
+static void fleet_fetch_progress(unsigned long long done,
+                                 unsigned long long total, double mb_per_sec,
+                                 void *arg) {
+  (void)arg;
+  char msg[128];
+  if (total > 0)
+    snprintf(msg, sizeof(msg), "Downloading image: %llu/%llu MB (%.1f MB/s)",
+             done >> 20, total >> 20, mb_per_sec);
+  else
+    snprintf(msg, sizeof(msg), "Downloading image: %llu MB (%.1f MB/s)",
+             done >> 20, mb_per_sec);
+  display_status(msg);
+}
+
+/* Remote images are fetched once into the shared cache */
+static int fleet_cache_image(ImageInfo *image) {
+  if (strncmp(image->source, "http://", 7) != 0 &&
+      strncmp(image->source, "https://", 8) != 0)
+    return 0;
+
+  const char *name = strrchr(image->source, '/');
+  char local[MAX_PATH];
+  snprintf(local, sizeof(local), "%s/%s", FLEET_CACHE_ROOT,
+           name && name[1] ? name + 1 : "image");
+  if (!file_exists(local)) {
+    log_message("Fleet: downloading %s once for all targets", image->source);
+    const char *mkdir_argv[] = {"mkdir", "-p", FLEET_CACHE_ROOT, NULL};
+    run_argv(mkdir_argv, 0, 0);
+    /* Hashed on the fly; only a complete download lands under local */
+    FetchOptions opts = {NULL, fleet_fetch_progress, NULL, 0};
+    if (fetch_file(image->source, local, &opts, NULL) != 0)
+      return -1;
+  }
+  snprintf(image->source, sizeof(image->source), "%s", local);
+  return 0;
+}
+
+/* pacman downloads into the first writable cachedir. A read-only view of
+ * the shared cache keeps whatever the prefetch missed in each target's own
+ * cache, instead of every pacstrap writing the same .part files */
+static int fleet_share_cache(void) {
+  umount2(FLEET_PKG_CACHE_RO, MNT_DETACH); /* left over by a crashed run */
+  mkdir(FLEET_PKG_CACHE_RO, 0755);
+  if (mount(FLEET_PKG_CACHE, FLEET_PKG_CACHE_RO, NULL, MS_BIND, NULL) != 0)
+    goto fail;
+  if (mount(NULL, FLEET_PKG_CACHE_RO, NULL, MS_BIND | MS_REMOUNT | MS_RDONLY,
+            NULL) != 0) {
+    umount2(FLEET_PKG_CACHE_RO, MNT_DETACH);
+    goto fail;
+  }
+  return 0;
+fail:
+  log_message("Fleet: cannot share the package cache (%s), every target "
+              "downloads its own packages",
+              strerror(errno));
+  rmdir(FLEET_PKG_CACHE_RO);
+  return -1;
+}
+
+/* Install onto several disks at once */
+void perform_fleet_installation(const char *const disks[], int count) {
+  if (count < 1 || count > FLEET_MAX_DISKS) {
+    log_message("Fleet mode takes 1 to %d disks", FLEET_MAX_DISKS);
+    return;
+  }
+  if (atomic_test_and_set(&install_running)) {
+    log_message("Installation already running");
+    return;
+  }
+
+  int boot_mode = detect_boot_mode();
+  if (!check_dependencies()) {
+    log_message("Dependency check failed");
+    install_running = 0;
+    return;
+  }
+  if (!check_network()) {
+    log_message("Network check failed");
+    if (!confirm_action("Continue without network?", "CONTINUE")) {
+      install_running = 0;
+      return;
+    }
+  }
+
+  const char *mkdir_argv[] = {"mkdir", "-p", FLEET_PKG_CACHE, NULL};
+  run_argv(mkdir_argv, 0, 0);
+
+  /* One stage table for every target */
+  static ImageInfo image;
+  static PipelineStage fleet_stages[PIPELINE_MAX_STAGES];
+  int stage_count = 0;
+  const ImageInfo *use_image = NULL;
+  const char *pkg_cache = NULL;
+
+  if (image_find(&image) == 0) {
+    char question[256];
+    snprintf(question, sizeof(question),
+             "Deploy prebuilt image %.128s to all %d disks?", image.version,
+             count);
+    if (confirm_action(question, "IMAGE")) {
+      if (fleet_cache_image(&image) != 0) {
+        log_message("Fleet: image download failed");
+        install_running = 0;
+        return;
+      }
+      use_image = &image;
+      stage_count = build_image_stages(&image, fleet_stages);
+    }
+  }
+  if (!use_image) {
+    /* Shared cache instead of a prefetch per target */
+    display_status("Prefetching packages for all targets...");
+    if (pkg_prefetch(FLEET_CACHE_ROOT, base_packages) < 0)
+      log_message("Fleet: prefetch failed, pacstrap will download per target");
+    if (fleet_share_cache() == 0)
+      pkg_cache = FLEET_PKG_CACHE_RO;
+    for (int i = 0; i < INSTALL_STAGE_COUNT; i++) {
+      if (strcmp(install_stages[i].name, "prefetch") != 0)
+        fleet_stages[stage_count++] = install_stages[i];
+    }
+  }
+
+  static FleetSlot slots[FLEET_MAX_DISKS];
+  memset(slots, 0, sizeof(slots));
+  double start = fleet_now();
+  int started = 0, resumable = 0;
+
+  for (int i = 0; i < count; i++) {
+    FleetSlot *s = &slots[i];
+    InstallCtx *ctx = &s->ctx;
+
+    snprintf(s->disk, sizeof(s->disk), "%s", disks[i]);
+    snprintf(s->root_mount, sizeof(s->root_mount), FLEET_MOUNT_FMT, i);
+    s->stages = fleet_stages;
+    s->stage_count = stage_count;
+    s->initial = RES_DISK | RES_PKG_CACHE;
+    s->started = start;
+    snprintf(s->stage, sizeof(s->stage), "waiting");
+
+    ctx->disk = s->disk;
+    ctx->root_mount = s->root_mount;
+    ctx->boot_mode = boot_mode;
+    ctx->image = use_image;
+    ctx->pkg_cache = pkg_cache;
+    ctx->portable = 1;
+    ctx->slot = s;
+    if (build_disk_path(ctx->dev_path, sizeof(ctx->dev_path), s->disk) != 0) {
+      s->rc = -1;
+      s->finished = 1;
+      continue;
+    }
+    get_partition_names(ctx->dev_path, ctx->efi_part, ctx->root_part,
+                        sizeof(ctx->efi_part));
+
+    /* Every skipped stage is still verified against its fingerprint */
+    int recorded = journal_open(&s->journal, s->disk,
+                                disk_identity(ctx->dev_path), ctx->root_mount);
+    if (recorded == 0)
+      recorded = journal_recover(&s->journal, ctx->root_part);
+    if (recorded > 0) {
+      log_message("Found journal with %d completed stage(s) for %s", recorded,
+                  ctx->dev_path);
+      resumable++;
+    }
+  }
+
+  /* Same question as a single install, asked once for the whole fleet */
+  if (resumable > 0) {
+    char question[96];
+    snprintf(question, sizeof(question),
+             "Resume %d interrupted installation(s)?", resumable);
+    if (!confirm_action(question, "RESUME")) {
+      for (int i = 0; i < count; i++) {
+        if (!slots[i].finished)
+          journal_discard(&slots[i].journal);
+      }
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    FleetSlot *s = &slots[i];
+    if (s->finished)
+      continue;
+    if (pthread_create(&s->thread, NULL, fleet_worker, s) != 0) {
+      log_message("Fleet: cannot start worker for %s", s->disk);
+      journal_close(&s->journal);
+      s->rc = -1;
+      s->finished = 1;
+      continue;
+    }
+    s->has_thread = 1;
+    started++;
+  }
+
+  /* Redraw the panes until every target is finished */
+  for (;;) {
+    fleet_draw(slots, count, start);
+    int pending = 0;
+    pthread_mutex_lock(&fleet_lock);
+    for (int i = 0; i < count; i++)
+      pending += !slots[i].finished;
+    pthread_mutex_unlock(&fleet_lock);
+    if (!pending)
+      break;
+    struct timespec ts = {0, FLEET_REFRESH_MS * 1000000L};
+    nanosleep(&ts, NULL);
+  }
+  for (int i = 0; i < count; i++) {
+    if (slots[i].has_thread)
+      pthread_join(slots[i].thread, NULL);
+  }
+  if (pkg_cache) {
+    umount2(FLEET_PKG_CACHE_RO, MNT_DETACH);
+    rmdir(FLEET_PKG_CACHE_RO);
+  }
+
+  int ok = 0;
+  for (int i = 0; i < count; i++)
+    ok += slots[i].rc == 0;
+  log_message("Fleet: %d/%d disk(s) installed in %.0fs (%d started)", ok, count,
+              fleet_now() - start, started);
+
+  log_pause();
+  mvprintw(4 + count * 3, 2, "%d of %d disk(s) installed. Press any key...",
+           ok, count);
+  refresh();
+  getch();
+  log_resume();
 
+  secure_zero(slots, sizeof(slots));
   install_running = 0;
 }
@@ -55,6 +55,8 @@ int main() {
   getmaxyx(stdscr, max_y, max_x);
 
   while (1) {
+    // the menu owns the terminal until a key is read
+    log_pause();
     clear();
     getmaxyx(stdscr, max_y, max_x);
 
@@ -174,9 +176,9 @@ int main() {
     // Navigation hint
     const char *nav_text;
     if (current_lang == LANG_RU) {
-      nav_text = "Упр.: ↑ ↓ • Выбор: Enter • Язык: j • Выход: Esc";
+      nav_text = "Упр.: ↑ ↓ • Выбор: Enter • Флот: f • Тесты VM: t • Язык: j • Выход: Esc";
     } else {
-      nav_text = "Navigate: ↑ ↓ • Select: Enter • Lang: j • Exit: Esc";
+      nav_text = "Navigate: ↑ ↓ • Select: Enter • Fleet: f • VM tests: t • Lang: j • Exit: Esc";
     }
     int nav_x = (max_x - (int)strlen(nav_text)) / 2;
     if (nav_x < 0)
@@ -194,6 +196,7 @@ int main() {
 
     // Input handling
     int input = getch();
+    log_resume();
     switch (input) {
     case KEY_UP:
       menu_selection = (menu_selection > 0) ? menu_selection - 1 : 7;
@@ -225,9 +228,11 @@ int main() {
         show_disk_info();
         break;
       case 6: // Settings
+        log_pause();
         clear();
         print_settings();
         getch(); // Wait for key
+        log_resume();
         break;
       case 7: // Exit
         if (confirm_action(get_text("EXIT_CONFIRM_PROMPT"), "EXIT")) {
@@ -245,6 +250,24 @@ int main() {
         return 0;
       }
       break;
+    case 'f':
+    case 'F': {
+      // Fleet mode: install onto several disks at once
+      char fleet_disks[FLEET_MAX_DISKS][32];
+      int n = get_fleet_disks(fleet_disks, FLEET_MAX_DISKS);
+      if (n > 0) {
+        const char *targets[FLEET_MAX_DISKS];
+        for (int i = 0; i < n; i++)
+          targets[i] = fleet_disks[i];
+        perform_fleet_installation(targets, n);
+      }
+      break;
+    }
+    case 't':
+    case 'T':
+      // Installer regression matrix on VM snapshot clones
+      run_vm_test_loop();
+      break;
     case 'j':
     case 'J':
       // Switch to Russian language immediately
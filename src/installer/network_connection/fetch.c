@@ -0,0 +1,719 @@
+/**
+ * @file fetch.c
+ * @brief libcurl downloads hashed in the write callback
+ *
+ * Every block curl delivers is digested first and copied into the
+ * aligned gather buffer second, both while the bytes are still in L1/L2.
+ * Only full FETCH_BUFFER blocks are written until the very end, so file
+ * offsets stay aligned for O_DIRECT; the short tail goes out after
+ * O_DIRECT has been dropped.
+ */
+
+#define _GNU_SOURCE
+#include <curl/curl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fetch.h"
+#include "../utils/log_message.h"
+
+typedef struct {
+    int fd;
+    int direct;                        // fd still has O_DIRECT
+    unsigned char *buf;
+    size_t fill;
+    int failed;                        // write error, errno in err
+    int err;
+    EVP_MD_CTX *md;
+    unsigned long long bytes;
+    double start;
+    double last_report;
+    const FetchOptions *opt;
+} FetchSink;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_all(FetchSink *s, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(s->fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EINVAL && s->direct) {
+            // The filesystem accepted O_DIRECT at open but not for writes
+            fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) & ~O_DIRECT);
+            s->direct = 0;
+            continue;
+        }
+        if (n <= 0) {
+            s->err = n < 0 ? errno : EIO;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static size_t sink_write(char *ptr, size_t size, size_t nmemb, void *user) {
+    FetchSink *s = (FetchSink *)user;
+    size_t len = size * nmemb;
+
+    if (EVP_DigestUpdate(s->md, ptr, len) != 1) {
+        s->failed = 1;
+        return 0;
+    }
+    s->bytes += len;
+
+    const unsigned char *src = (const unsigned char *)ptr;
+    size_t left = len;
+    while (left > 0) {
+        size_t n = FETCH_BUFFER - s->fill < left ? FETCH_BUFFER - s->fill : left;
+        memcpy(s->buf + s->fill, src, n);
+        s->fill += n;
+        src += n;
+        left -= n;
+        if (s->fill == FETCH_BUFFER) {
+            if (write_all(s, s->buf, s->fill) != 0) {
+                s->failed = 1;
+                return 0;          // makes curl abort with CURLE_WRITE_ERROR
+            }
+            s->fill = 0;
+        }
+    }
+    return len;
+}
+
+static int sink_progress(void *user, curl_off_t dltotal, curl_off_t dlnow,
+                         curl_off_t ultotal, curl_off_t ulnow) {
+    (void)ultotal;
+    (void)ulnow;
+    FetchSink *s = (FetchSink *)user;
+    double t = now_sec();
+    if ((t - s->last_report) * 1000 < FETCH_REPORT_MS) return 0;
+    s->last_report = t;
+    double secs = t - s->start;
+    s->opt->progress((unsigned long long)dlnow, (unsigned long long)dltotal,
+                     secs > 0 ? dlnow / secs / 1e6 : 0, s->opt->progress_arg);
+    return 0;
+}
+
+// Create (or truncate) the .part file; O_DIRECT when the filesystem has it
+static int sink_open(FetchSink *s, const char *part) {
+    s->direct = 1;
+    s->fd = open(part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    if (s->fd < 0 && errno == EINVAL) {
+        s->direct = 0;
+        s->fd = open(part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (s->fd < 0) return -1;
+    if (!s->direct) posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    s->fill = 0;
+    s->failed = 0;
+    s->bytes = 0;
+    return EVP_DigestInit_ex(s->md, EVP_sha256(), NULL) == 1 ? 0 : -1;
+}
+
+// Write the tail, flush to disk and close. Returns 0 on success
+static int sink_close(FetchSink *s) {
+    int rc = 0;
+    if (s->fill > 0) {
+        if (s->direct) {
+            fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) & ~O_DIRECT);
+            s->direct = 0;
+        }
+        rc = write_all(s, s->buf, s->fill);
+        s->fill = 0;
+    }
+    if (rc == 0 && fdatasync(s->fd) != 0) {
+        s->err = errno;
+        rc = -1;
+    }
+    close(s->fd);
+    s->fd = -1;
+    return rc;
+}
+
+static CURLcode transfer(FetchSink *s, const char *url) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return CURLE_FAILED_INIT;
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, sink_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, s);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 512L * 1024);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)FETCH_CONNECT_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)FETCH_STALL_SECONDS);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "lainux-installer");
+    if (s->opt && s->opt->progress) {
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, sink_progress);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, s);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    }
+    CURLcode rc = curl_easy_perform(curl);
+    curl_easy_cleanup(curl);
+    return rc;
+}
+
+// Errors worth another attempt from scratch
+static int transient(CURLcode rc) {
+    return rc == CURLE_COULDNT_CONNECT || rc == CURLE_COULDNT_RESOLVE_HOST ||
+           rc == CURLE_OPERATION_TIMEDOUT || rc == CURLE_RECV_ERROR ||
+           rc == CURLE_SEND_ERROR || rc == CURLE_PARTIAL_FILE ||
+           rc == CURLE_GOT_NOTHING || rc == CURLE_HTTP2_STREAM;
+}
+
+// One plain GET through the gather buffer; retries restart from byte 0
+static int fetch_stream(const char *url, const char *part, const FetchOptions *opt,
+                        EVP_MD_CTX *md, unsigned long long *bytes) {
+    FetchSink s;
+    void *buf = NULL;
+
+    memset(&s, 0, sizeof(s));
+    s.fd = -1;
+    s.opt = opt;
+    s.md = md;
+    if (posix_memalign(&buf, FETCH_ALIGN, FETCH_BUFFER) != 0) return -1;
+    s.buf = buf;
+
+    int rc = -1;
+    for (int attempt = 1; attempt <= FETCH_RETRIES; attempt++) {
+        if (sink_open(&s, part) != 0) {
+            log_message("Fetch: cannot create %s: %s", part, strerror(errno));
+            break;
+        }
+        s.start = s.last_report = now_sec();
+        CURLcode cr = transfer(&s, url);
+        int closed = sink_close(&s);
+
+        if (cr == CURLE_OK && !s.failed && closed == 0) {
+            rc = 0;
+            break;
+        }
+        if (s.failed || closed != 0) {
+            log_message("Fetch: writing %s failed: %s", part, strerror(s.err));
+            break;
+        }
+        if (!transient(cr) || attempt == FETCH_RETRIES) {
+            log_message("Fetch: %s: %s", url, curl_easy_strerror(cr));
+            break;
+        }
+        log_message("Fetch: %s: %s, retrying (%d/%d)", url, curl_easy_strerror(cr),
+                    attempt + 1, FETCH_RETRIES);
+    }
+    free(buf);
+    *bytes = s.bytes;
+    if (rc != 0) unlink(part);
+    return rc;
+}
+
+/* Segmented download */
+
+typedef struct SegFetch SegFetch;
+
+typedef struct {
+    unsigned long long start, end;     // byte range [start, end)
+    unsigned long long done;           // bytes in place from start
+    unsigned long long done_before;    // done when the request started
+    int tries;
+    int checked;                       // 206 seen for the current request
+    CURL *easy;
+    struct curl_slist *headers;
+    SegFetch *owner;
+} Segment;
+
+struct SegFetch {
+    const char *url;
+    const FetchOptions *opt;
+    int fd;
+    unsigned long long size;
+    char validator[160];               // ETag or Last-Modified, "" if none
+    Segment seg[FETCH_MAX_SEGMENTS];
+    int count;
+    int hash_seg;                      // segment holding the hash frontier
+    unsigned long long hashed;         // digest covers [0, hashed)
+    unsigned long long received;       // bytes fetched by this run
+    EVP_MD_CTX *md;
+    unsigned char *buf;                // read-back buffer for the digest
+    int no_ranges;                     // server answered a range with 200
+    int failed;                        // local write/read error, errno in err
+    int err;
+};
+
+typedef struct {
+    int ranges;
+    char etag[160];
+    char modified[160];
+} ProbeInfo;
+
+// Header value without the name, leading blanks and the trailing CRLF
+static void header_value(const char *line, size_t len, size_t skip, char *out,
+                         size_t size) {
+    size_t i = skip, n = 0;
+    while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;
+    while (i < len && line[i] != '\r' && line[i] != '\n' && n + 1 < size) {
+        out[n++] = line[i++];
+    }
+    out[n] = '\0';
+}
+
+static size_t probe_header(char *line, size_t size, size_t nmemb, void *user) {
+    ProbeInfo *p = (ProbeInfo *)user;
+    size_t len = size * nmemb;
+    char value[160];
+
+    // A redirect starts a new response; only the last one counts
+    if (len >= 5 && strncmp(line, "HTTP/", 5) == 0) {
+        memset(p, 0, sizeof(*p));
+    } else if (len > 14 && strncasecmp(line, "accept-ranges:", 14) == 0) {
+        header_value(line, len, 14, value, sizeof(value));
+        p->ranges = strcasecmp(value, "bytes") == 0;
+    } else if (len > 5 && strncasecmp(line, "etag:", 5) == 0) {
+        header_value(line, len, 5, p->etag, sizeof(p->etag));
+    } else if (len > 14 && strncasecmp(line, "last-modified:", 14) == 0) {
+        header_value(line, len, 14, p->modified, sizeof(p->modified));
+    }
+    return len;
+}
+
+// HEAD the url: size, range support and a validator for If-Range.
+// Returns the size, -1 when unknown or ranges are not offered.
+static long long probe(const char *url, char *validator, size_t size) {
+    ProbeInfo info;
+    curl_off_t length = -1;
+
+    memset(&info, 0, sizeof(info));
+    CURL *curl = curl_easy_init();
+    if (!curl) return -1;
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, probe_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &info);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)FETCH_CONNECT_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)FETCH_STALL_SECONDS);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "lainux-installer");
+    CURLcode rc = curl_easy_perform(curl);
+    if (rc == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+    }
+    curl_easy_cleanup(curl);
+
+    if (rc != CURLE_OK || !info.ranges || length <= 0) return -1;
+    snprintf(validator, size, "%s", info.etag[0] ? info.etag : info.modified);
+    return (long long)length;
+}
+
+static size_t seg_write(char *ptr, size_t size, size_t nmemb, void *user) {
+    Segment *sg = (Segment *)user;
+    SegFetch *f = sg->owner;
+    size_t len = size * nmemb;
+
+    if (!sg->checked) {
+        // 200 means the Range (or If-Range) was ignored: the body is the
+        // whole file, not our slice
+        long code = 0;
+        curl_easy_getinfo(sg->easy, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 206) {
+            f->no_ranges = 1;
+            return 0;
+        }
+        sg->checked = 1;
+    }
+
+    unsigned long long off = sg->start + sg->done;
+    if (len > sg->end - off) {
+        f->failed = 1;
+        f->err = EPROTO;
+        return 0;
+    }
+    if (off == f->hashed) {
+        // At the frontier: hash while the bytes are hot
+        if (EVP_DigestUpdate(f->md, ptr, len) != 1) {
+            f->failed = 1;
+            f->err = EIO;
+            return 0;
+        }
+        f->hashed += len;
+    }
+
+    const char *src = ptr;
+    size_t left = len;
+    while (left > 0) {
+        ssize_t n = pwrite(f->fd, src, left, (off_t)off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            f->failed = 1;
+            f->err = n < 0 ? errno : EIO;
+            return 0;
+        }
+        src += n;
+        off += (unsigned long long)n;
+        left -= (size_t)n;
+    }
+    sg->done += len;
+    f->received += len;
+    return len;
+}
+
+static int seg_start(SegFetch *f, CURLM *multi, Segment *sg) {
+    char range[64], if_range[192];
+
+    CURL *easy = curl_easy_init();
+    if (!easy) return -1;
+    snprintf(range, sizeof(range), "%llu-%llu", sg->start + sg->done, sg->end - 1);
+    sg->easy = easy;
+    sg->checked = 0;
+    sg->done_before = sg->done;
+    sg->headers = NULL;
+    if (f->validator[0]) {
+        // The server falls back to 200 if the file changed under us
+        snprintf(if_range, sizeof(if_range), "If-Range: %s", f->validator);
+        sg->headers = curl_slist_append(NULL, if_range);
+    }
+
+    curl_easy_setopt(easy, CURLOPT_URL, f->url);
+    curl_easy_setopt(easy, CURLOPT_RANGE, range);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, sg->headers);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, seg_write);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, sg);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, sg);
+    curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(easy, CURLOPT_FAILONERROR, 1L);
+    // One TCP connection per range; HTTP/2 would squeeze them into one
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_1_1);
+    curl_easy_setopt(easy, CURLOPT_BUFFERSIZE, 512L * 1024);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, (long)FETCH_CONNECT_TIMEOUT);
+    curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+    curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, (long)FETCH_STALL_SECONDS);
+    curl_easy_setopt(easy, CURLOPT_USERAGENT, "lainux-installer");
+    if (curl_multi_add_handle(multi, easy) != CURLM_OK) {
+        curl_easy_cleanup(easy);
+        curl_slist_free_all(sg->headers);
+        sg->easy = NULL;
+        sg->headers = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void seg_stop(CURLM *multi, Segment *sg) {
+    curl_multi_remove_handle(multi, sg->easy);
+    curl_easy_cleanup(sg->easy);
+    curl_slist_free_all(sg->headers);
+    sg->easy = NULL;
+    sg->headers = NULL;
+}
+
+// Move the digest over everything contiguous from the frontier on
+static int catch_up(SegFetch *f) {
+    while (f->hash_seg < f->count) {
+        Segment *sg = &f->seg[f->hash_seg];
+        unsigned long long written = sg->start + sg->done;
+        if (f->hashed < written) {
+            size_t n = written - f->hashed < FETCH_BUFFER ? written - f->hashed
+                                                          : FETCH_BUFFER;
+            ssize_t r = pread(f->fd, f->buf, n, (off_t)f->hashed);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0 || EVP_DigestUpdate(f->md, f->buf, (size_t)r) != 1) {
+                f->err = r < 0 ? errno : EIO;
+                return -1;
+            }
+            f->hashed += (unsigned long long)r;
+            continue;
+        }
+        if (written < sg->end) break;
+        f->hash_seg++;
+    }
+    return 0;
+}
+
+// State file: header lines, then "start end done" per segment. The data
+// is flushed first so a crash never records bytes that are not on disk.
+static int save_state(SegFetch *f, const char *state) {
+    char tmp[4200];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", state);
+    if (fdatasync(f->fd) != 0) return -1;
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return -1;
+    fprintf(fp, "lainux-fetch 1\nurl %s\nsize %llu\nvalidator %s\nsegments %d\n",
+            f->url, f->size, f->validator[0] ? f->validator : "-", f->count);
+    for (int i = 0; i < f->count; i++) {
+        fprintf(fp, "%llu %llu %llu\n", f->seg[i].start, f->seg[i].end, f->seg[i].done);
+    }
+    int rc = fflush(fp) == 0 && fsync(fileno(fp)) == 0 ? 0 : -1;
+    fclose(fp);
+    if (rc == 0) rc = rename(tmp, state);
+    if (rc != 0) unlink(tmp);
+    return rc;
+}
+
+// Accept a state file only for the same url, size and server validator
+static int load_state(SegFetch *f, const char *state) {
+    char line[4200], value[4200];
+    FILE *fp = fopen(state, "r");
+    if (!fp) return -1;
+
+    int ok = fgets(line, sizeof(line), fp) && strcmp(line, "lainux-fetch 1\n") == 0;
+    ok = ok && fgets(line, sizeof(line), fp) && sscanf(line, "url %4199s", value) == 1 &&
+         strcmp(value, f->url) == 0;
+    unsigned long long size = 0;
+    ok = ok && fgets(line, sizeof(line), fp) && sscanf(line, "size %llu", &size) == 1 &&
+         size == f->size;
+    ok = ok && fgets(line, sizeof(line), fp) &&
+         sscanf(line, "validator %4199[^\n]", value) == 1 &&
+         strcmp(value, f->validator[0] ? f->validator : "-") == 0;
+    int count = 0;
+    ok = ok && fgets(line, sizeof(line), fp) && sscanf(line, "segments %d", &count) == 1 &&
+         count > 0 && count <= FETCH_MAX_SEGMENTS;
+
+    unsigned long long expect = 0;
+    for (int i = 0; ok && i < count; i++) {
+        Segment *sg = &f->seg[i];
+        ok = fgets(line, sizeof(line), fp) &&
+             sscanf(line, "%llu %llu %llu", &sg->start, &sg->end, &sg->done) == 3 &&
+             sg->start == expect && sg->end > sg->start && sg->done <= sg->end - sg->start;
+        expect = sg->end;
+    }
+    fclose(fp);
+    if (!ok || expect != f->size) return -1;
+    f->count = count;
+    return 0;
+}
+
+static void plan_segments(SegFetch *f) {
+    unsigned long long seg_size = FETCH_SEGMENT;
+    while ((f->size + seg_size - 1) / seg_size > FETCH_MAX_SEGMENTS) seg_size *= 2;
+
+    f->count = 0;
+    for (unsigned long long off = 0; off < f->size; off += seg_size) {
+        Segment *sg = &f->seg[f->count++];
+        sg->start = off;
+        sg->end = f->size - off < seg_size ? f->size : off + seg_size;
+        sg->done = 0;
+    }
+}
+
+static void seg_progress(SegFetch *f, double start) {
+    unsigned long long done = 0;
+    for (int i = 0; i < f->count; i++) done += f->seg[i].done;
+    double secs = now_sec() - start;
+    f->opt->progress(done, f->size, secs > 0 ? f->received / secs / 1e6 : 0,
+                     f->opt->progress_arg);
+}
+
+// Returns 0 when complete, -1 on failure (.part and .state kept for a
+// resume), 1 when the server does not do ranges and a plain GET is needed
+static int fetch_segmented(const char *url, const char *part, const char *state,
+                           int connections, const FetchOptions *opt, EVP_MD_CTX *md,
+                           unsigned long long *bytes) {
+    char validator[160];
+    long long size = probe(url, validator, sizeof(validator));
+    if (size < (long long)FETCH_SEGMENT) return 1;
+
+    SegFetch *f = calloc(1, sizeof(*f));
+    void *buf = NULL;
+    if (!f || posix_memalign(&buf, FETCH_ALIGN, FETCH_BUFFER) != 0) {
+        free(f);
+        return -1;
+    }
+    f->url = url;
+    f->opt = opt;
+    f->md = md;
+    f->buf = buf;
+    f->size = (unsigned long long)size;
+    snprintf(f->validator, sizeof(f->validator), "%s", validator);
+    for (int i = 0; i < FETCH_MAX_SEGMENTS; i++) f->seg[i].owner = f;
+
+    struct stat st;
+    int resume = load_state(f, state) == 0 && stat(part, &st) == 0 &&
+                 (unsigned long long)st.st_size == f->size;
+    f->fd = open(part, O_RDWR | O_CREAT | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+    if (f->fd < 0) {
+        log_message("Fetch: cannot create %s: %s", part, strerror(errno));
+        free(buf);
+        free(f);
+        return -1;
+    }
+    if (resume) {
+        unsigned long long have = 0;
+        for (int i = 0; i < f->count; i++) have += f->seg[i].done;
+        log_message("Fetch: resuming %s at %llu/%llu MB", part, have >> 20, f->size >> 20);
+    } else {
+        plan_segments(f);
+        // One extent up front instead of per-range growth
+        if (posix_fallocate(f->fd, 0, (off_t)f->size) != 0) ftruncate(f->fd, (off_t)f->size);
+    }
+
+    CURLM *multi = curl_multi_init();
+    int rc = multi ? 0 : -1;
+    if (multi) {
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_NOTHING);
+    }
+    log_message("Fetch: %s in %d ranges over %d connections", url, f->count, connections);
+
+    double start = now_sec(), last_report = start, last_state = start;
+    int next = 0, active = 0;
+    if (rc == 0 && catch_up(f) != 0) rc = -1;    // digest of a resumed prefix
+
+    while (rc == 0) {
+        while (active < connections && next < f->count) {
+            Segment *sg = &f->seg[next++];
+            if (sg->start + sg->done >= sg->end) continue;
+            if (seg_start(f, multi, sg) != 0) {
+                rc = -1;
+                break;
+            }
+            active++;
+        }
+        if (rc != 0 || active == 0) break;
+
+        int running;
+        curl_multi_perform(multi, &running);
+        curl_multi_poll(multi, NULL, 0, 1000, NULL);
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            CURLcode result = msg->data.result;
+            Segment *sg;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&sg);
+            seg_stop(multi, sg);
+            active--;
+
+            if (f->no_ranges || f->failed) {
+                rc = f->no_ranges ? 1 : -1;
+                continue;
+            }
+            if (sg->start + sg->done == sg->end) continue;
+
+            // Cut short: request the rest of this range again
+            if (sg->done > sg->done_before) sg->tries = 0;
+            if ((result == CURLE_OK || transient(result)) && ++sg->tries < FETCH_RETRIES &&
+                seg_start(f, multi, sg) == 0) {
+                active++;
+                continue;
+            }
+            log_message("Fetch: range %llu-%llu of %s: %s", sg->start, sg->end - 1, url,
+                        result == CURLE_OK ? "short read" : curl_easy_strerror(result));
+            rc = -1;
+        }
+        if (rc == 0 && catch_up(f) != 0) rc = -1;
+
+        double t = now_sec();
+        if (opt && opt->progress && (t - last_report) * 1000 >= FETCH_REPORT_MS) {
+            last_report = t;
+            seg_progress(f, start);
+        }
+        if ((t - last_state) * 1000 >= FETCH_STATE_MS) {
+            last_state = t;
+            save_state(f, state);
+        }
+    }
+
+    for (int i = 0; i < f->count; i++) {
+        if (f->seg[i].easy) seg_stop(multi, &f->seg[i]);
+    }
+    if (multi) curl_multi_cleanup(multi);
+
+    if (f->failed) log_message("Fetch: writing %s failed: %s", part, strerror(f->err));
+    if (rc == 0 && f->hashed != f->size) rc = -1;
+    if (rc == 0 && fdatasync(f->fd) != 0) rc = -1;
+    if (rc == -1) save_state(f, state);
+    if (rc == 0 && opt && opt->progress) seg_progress(f, start);
+    close(f->fd);
+    if (rc == 1) {
+        log_message("Fetch: %s ignores ranges, using a single stream", url);
+        unlink(part);
+    }
+    if (rc != -1) unlink(state);
+
+    *bytes = f->received;
+    free(buf);
+    free(f);
+    return rc;
+}
+
+int fetch_file(const char *url, const char *path, const FetchOptions *opt,
+               FetchResult *res) {
+    FetchResult local;
+    char part[4096], state[4200];
+    unsigned long long bytes = 0;
+
+    if (!res) res = &local;
+    memset(res, 0, sizeof(*res));
+    snprintf(part, sizeof(part), "%s%s", path, FETCH_PART_SUFFIX);
+    snprintf(state, sizeof(state), "%s%s", part, FETCH_STATE_SUFFIX);
+
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(md);
+        return -1;
+    }
+
+    double start = now_sec();
+    int connections = opt && opt->connections > 0 ? opt->connections : FETCH_CONNECTIONS;
+    int rc = 1;
+    if (connections > 1) {
+        rc = fetch_segmented(url, part, state, connections, opt, md, &bytes);
+    }
+    if (rc == 1) {
+        unlink(state);
+        rc = EVP_DigestInit_ex(md, EVP_sha256(), NULL) == 1
+                 ? fetch_stream(url, part, opt, md, &bytes)
+                 : -1;
+    }
+
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    struct stat st;
+    if (rc == 0 && EVP_DigestFinal_ex(md, hash, &len) != 1) rc = -1;
+    EVP_MD_CTX_free(md);
+
+    if (rc == 0) {
+        for (unsigned int i = 0; i < len && i < 32; i++) {
+            snprintf(res->sha256 + i * 2, 3, "%02x", hash[i]);
+        }
+        res->bytes = stat(part, &st) == 0 ? (unsigned long long)st.st_size : bytes;
+        res->seconds = now_sec() - start;
+        res->mb_per_sec = res->seconds > 0 ? bytes / res->seconds / 1e6 : 0;
+        log_message("Fetch: %s: %llu bytes, %.1f MB/s, sha256 %s", path, res->bytes,
+                    res->mb_per_sec, res->sha256);
+
+        if (opt && opt->expected_sha256 &&
+            strcasecmp(res->sha256, opt->expected_sha256) != 0) {
+            log_message("Fetch: %s: checksum mismatch, expected %s", path,
+                        opt->expected_sha256);
+            unlink(part);
+            rc = -1;
+        }
+    }
+    if (rc == 0 && rename(part, path) != 0) {
+        log_message("Fetch: cannot rename %s: %s", part, strerror(errno));
+        unlink(part);
+        rc = -1;
+    }
+    return rc;
+}
+
+// Declared in installer.h / network.h; plain download, digest only logged
+int download_file(const char *url, const char *output) {
+    return fetch_file(url, output, NULL, NULL);
+}
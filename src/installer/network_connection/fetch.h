@@ -0,0 +1,60 @@
+#ifndef FETCH_H
+#define FETCH_H
+
+/*
+ * In-process downloads with hash-while-downloading.
+ * libcurl hands each received block to the write callback, which feeds
+ * it to SHA-256 (OpenSSL EVP) while it is still hot in cache and gathers
+ * it into a large page aligned buffer. Full buffers go to <path>.part
+ * with one write() each, O_DIRECT where the filesystem allows it. The
+ * digest is final the moment the transfer ends, so a multi-GB artifact
+ * is never read back just to checksum it.
+ *
+ * Large files from servers that honour byte ranges are split into
+ * segments fetched over several connections and placed with pwrite().
+ * Progress per segment is kept in <path>.part.state, so an interrupted
+ * download (crash, reboot, dead mirror) resumes where it stopped. The
+ * digest then follows the contiguous prefix: bytes arriving at the hash
+ * frontier are hashed live, later ranges are read back from the page
+ * cache once everything before them is in.
+ */
+
+#define FETCH_BUFFER (4u << 20)        // bytes gathered per write()
+#define FETCH_ALIGN 4096
+#define FETCH_RETRIES 3                // attempts on transient errors
+#define FETCH_CONNECT_TIMEOUT 15
+#define FETCH_STALL_SECONDS 30         // below 1 KB/s this long = retry
+#define FETCH_REPORT_MS 500            // progress callback interval
+#define FETCH_PART_SUFFIX ".part"
+#define FETCH_STATE_SUFFIX ".state"    // appended to the .part name
+#define FETCH_CONNECTIONS 4            // parallel ranges by default
+#define FETCH_SEGMENT (64u << 20)      // range size, also the split threshold
+#define FETCH_MAX_SEGMENTS 256         // larger files get larger segments
+#define FETCH_STATE_MS 1000            // state file refresh interval
+
+typedef void (*FetchProgress)(unsigned long long done, unsigned long long total,
+                              double mb_per_sec, void *arg);
+
+typedef struct {
+    const char *expected_sha256;       // NULL - only compute the digest
+    FetchProgress progress;            // may be NULL; total is 0 if unknown
+    void *progress_arg;
+    int connections;                   // 0 - FETCH_CONNECTIONS, 1 - one stream
+} FetchOptions;
+
+typedef struct {
+    char sha256[65];                   // lowercase hex
+    unsigned long long bytes;
+    double seconds;
+    double mb_per_sec;
+} FetchResult;
+
+// Download url to path. The file appears under path only when the
+// transfer completed and, with expected_sha256 set, the digest matched.
+// A segmented download that fails leaves .part and .state behind and the
+// next call with the same url and path resumes it. opt and res may be
+// NULL. Returns 0 on success, -1 on error.
+int fetch_file(const char *url, const char *path, const FetchOptions *opt,
+               FetchResult *res);
+
+#endif // fetch h
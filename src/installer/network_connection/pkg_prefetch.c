@@ -0,0 +1,362 @@
+/**
+ * @file pkg_prefetch.c
+ * @brief download pacstrap's package set in parallel with libcurl multi
+ *
+ * pacman resolves the package list (-Sp) against databases synced into
+ * the target root; the archives are then fetched over one curl multi
+ * handle. Transfers are spread over the best PREFETCH_SPREAD mirrors of
+ * the (ranked) mirrorlist, HTTP/2 streams are multiplexed over a small
+ * per-mirror connection pool, and a failed transfer moves on to the next
+ * mirror in rank order.
+ */
+
+#define _GNU_SOURCE
+#include <curl/curl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pkg_prefetch.h"
+#include "../utils/log_message.h"
+#include "../utils/process.h"
+
+#define PREFETCH_SYNC_TIMEOUT 300
+#define PREFETCH_CONNECT_TIMEOUT 10
+#define PREFETCH_STALL_SECONDS 20      // below 1 KB/s this long = failover
+
+typedef struct {
+    char url[256];                     // Server template ($repo, $arch)
+    int strikes;
+} Mirror;
+
+typedef struct {
+    char repo[32];
+    char file[256];
+    long long size;
+    int mirror;                        // mirror of the current attempt
+    int tried;                         // mirrors tried so far
+    FILE *out;
+    char part[800];
+} PkgJob;
+
+typedef struct {
+    Mirror mirrors[PREFETCH_MAX_MIRRORS];
+    int mirror_count;
+    char arch[32];
+    char cache[512];
+    CURLM *multi;
+} Prefetch;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void mkdir_p(const char *path) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(tmp, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(tmp, 0755);
+}
+
+// Uncommented "Server = ..." lines in file order (rankmirrors order)
+static int load_mirrors(Prefetch *pf) {
+    FILE *fp = fopen(PREFETCH_MIRRORLIST, "r");
+    char line[512];
+
+    if (!fp) {
+        return 0;
+    }
+    while (pf->mirror_count < PREFETCH_MAX_MIRRORS && fgets(line, sizeof(line), fp)) {
+        char url[256];
+        if (sscanf(line, " Server = %255s", url) == 1) {
+            snprintf(pf->mirrors[pf->mirror_count++].url, sizeof(url), "%s", url);
+        }
+    }
+    fclose(fp);
+    return pf->mirror_count;
+}
+
+// Expand $repo/$arch of a mirror template and append the file name
+static void build_url(const Prefetch *pf, const PkgJob *job, char *out,
+                      size_t size) {
+    const char *src = pf->mirrors[job->mirror].url;
+    size_t n = 0;
+
+    while (*src && n + 1 < size) {
+        if (strncmp(src, "$repo", 5) == 0) {
+            n += snprintf(out + n, size - n, "%s", job->repo);
+            src += 5;
+        } else if (strncmp(src, "$arch", 5) == 0) {
+            n += snprintf(out + n, size - n, "%s", pf->arch);
+            src += 5;
+        } else {
+            out[n++] = *src++;
+        }
+        if (n >= size) n = size - 1;
+    }
+    out[n] = '\0';
+    snprintf(out + n, size - n, "/%s", job->file);
+}
+
+// Sync databases into the target and list "repo file size" per package
+static int resolve_packages(const char *root_mount,
+                            const char *const packages[], PkgJob **jobs_out) {
+    char root_arg[300], db_arg[320];
+    const char *argv[64];
+    int argc = 0;
+    ProcResult res;
+
+    snprintf(root_arg, sizeof(root_arg), "--root=%s", root_mount);
+    snprintf(db_arg, sizeof(db_arg), "--dbpath=%s/var/lib/pacman", root_mount);
+
+    const char *sync_argv[] = {"pacman", root_arg, db_arg, "-Sy", NULL};
+    ProcOptions sync_opts = {PROC_LOG_STDERR, PREFETCH_SYNC_TIMEOUT, -1, NULL};
+    if (proc_run(sync_argv, &sync_opts, NULL) != 0) {
+        log_message("Prefetch: database sync failed");
+        return -1;
+    }
+
+    argv[argc++] = "pacman";
+    argv[argc++] = root_arg;
+    argv[argc++] = db_arg;
+    argv[argc++] = "-Sp";
+    argv[argc++] = "--print-format";
+    argv[argc++] = "%r %f %s";
+    for (int i = 0; packages[i] && argc < 63; i++) {
+        argv[argc++] = packages[i];
+    }
+    argv[argc] = NULL;
+
+    ProcOptions opts = {PROC_CAPTURE, PREFETCH_SYNC_TIMEOUT, -1, NULL};
+    if (proc_run(argv, &opts, &res) != 0 || !res.out) {
+        log_message("Prefetch: cannot resolve packages: %s", res.last_err);
+        proc_result_free(&res);
+        return -1;
+    }
+
+    int count = 0, cap = 0;
+    PkgJob *jobs = NULL;
+    char *save = NULL;
+    for (char *line = strtok_r(res.out, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+        PkgJob job;
+        memset(&job, 0, sizeof(job));
+        if (sscanf(line, "%31s %255s %lld", job.repo, job.file, &job.size) != 3) {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 256;
+            PkgJob *p = realloc(jobs, (size_t)cap * sizeof(*jobs));
+            if (!p) break;
+            jobs = p;
+        }
+        jobs[count++] = job;
+    }
+    proc_result_free(&res);
+
+    *jobs_out = jobs;
+    return count;
+}
+
+// Next usable mirror for a job in rank order, -1 when all are exhausted
+static int pick_mirror(Prefetch *pf, PkgJob *job) {
+    while (job->tried < pf->mirror_count) {
+        int m = (job->mirror + (job->tried ? 1 : 0)) % pf->mirror_count;
+        job->mirror = m;
+        job->tried++;
+        if (pf->mirrors[m].strikes < PREFETCH_MIRROR_STRIKES) {
+            return m;
+        }
+    }
+    return -1;
+}
+
+static int start_job(Prefetch *pf, PkgJob *job) {
+    char url[768];
+
+    if (pick_mirror(pf, job) < 0) {
+        return -1;
+    }
+
+    snprintf(job->part, sizeof(job->part), "%s/%s.part", pf->cache, job->file);
+    job->out = fopen(job->part, "wb");
+    if (!job->out) {
+        log_message("Prefetch: cannot create %s: %s", job->part, strerror(errno));
+        return -1;
+    }
+    build_url(pf, job, url, sizeof(url));
+
+    CURL *easy = curl_easy_init();
+    if (!easy) {
+        fclose(job->out);
+        unlink(job->part);
+        return -1;
+    }
+    curl_easy_setopt(easy, CURLOPT_URL, url);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, job->out);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, job);
+    curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(easy, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    // Prefer a new stream on an existing HTTP/2 connection
+    curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, (long)PREFETCH_CONNECT_TIMEOUT);
+    curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+    curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, (long)PREFETCH_STALL_SECONDS);
+    curl_easy_setopt(easy, CURLOPT_USERAGENT, "lainux-installer");
+    curl_multi_add_handle(pf->multi, easy);
+    return 0;
+}
+
+// Returns 1 when the package is in the cache, 0 to retry, -1 to give up
+static int finish_job(Prefetch *pf, CURL *easy, CURLcode result, PkgJob *job) {
+    char final[800];
+    struct stat st;
+
+    fclose(job->out);
+    job->out = NULL;
+    curl_multi_remove_handle(pf->multi, easy);
+    curl_easy_cleanup(easy);
+
+    if (result == CURLE_OK && stat(job->part, &st) == 0 && st.st_size == job->size) {
+        snprintf(final, sizeof(final), "%s/%s", pf->cache, job->file);
+        if (rename(job->part, final) == 0) {
+            return 1;
+        }
+    }
+    unlink(job->part);
+
+    Mirror *m = &pf->mirrors[job->mirror];
+    m->strikes++;
+    log_message("Prefetch: %s from %s failed (%s)", job->file, m->url,
+                result == CURLE_OK ? "size mismatch" : curl_easy_strerror(result));
+    if (m->strikes == PREFETCH_MIRROR_STRIKES) {
+        log_message("Prefetch: dropping mirror %s", m->url);
+    }
+    return job->tried < pf->mirror_count ? 0 : -1;
+}
+
+static int cached(const Prefetch *pf, const PkgJob *job) {
+    char path[800];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", pf->cache, job->file);
+    return stat(path, &st) == 0 && st.st_size == job->size;
+}
+
+int pkg_prefetch(const char *root_mount, const char *const packages[]) {
+    Prefetch pf;
+    PkgJob *jobs = NULL;
+    struct utsname uts;
+
+    memset(&pf, 0, sizeof(pf));
+    snprintf(pf.arch, sizeof(pf.arch), "%.31s",
+             uname(&uts) == 0 ? uts.machine : "x86_64");
+    snprintf(pf.cache, sizeof(pf.cache), "%s/var/cache/pacman/pkg", root_mount);
+
+    char dbpath[512];
+    snprintf(dbpath, sizeof(dbpath), "%s/var/lib/pacman", root_mount);
+    mkdir_p(dbpath);
+    mkdir_p(pf.cache);
+
+    if (load_mirrors(&pf) == 0) {
+        log_message("Prefetch: no mirrors in %s", PREFETCH_MIRRORLIST);
+        return -1;
+    }
+
+    int count = resolve_packages(root_mount, packages, &jobs);
+    if (count <= 0) {
+        free(jobs);
+        return -1;
+    }
+
+    pf.multi = curl_multi_init();
+    if (!pf.multi) {
+        free(jobs);
+        return -1;
+    }
+    curl_multi_setopt(pf.multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(pf.multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      (long)PREFETCH_HOST_CONNS);
+
+    int spread = pf.mirror_count < PREFETCH_SPREAD ? pf.mirror_count : PREFETCH_SPREAD;
+    long long total_bytes = 0;
+    int done = 0, failed = 0, next = 0, active = 0;
+    double t0 = now_sec();
+
+    log_message("Prefetch: %d packages from %d mirror(s)", count, pf.mirror_count);
+
+    while (next < count || active > 0) {
+        // Keep the pipe full; round-robin the initial mirror over the top ones
+        while (active < PREFETCH_PARALLEL && next < count) {
+            PkgJob *job = &jobs[next];
+            job->mirror = next % spread;
+            next++;
+            if (cached(&pf, job)) {
+                done++;
+                continue;
+            }
+            if (start_job(&pf, job) == 0) {
+                active++;
+            } else {
+                failed++;
+            }
+        }
+
+        if (active == 0) {
+            continue;
+        }
+
+        int running;
+        curl_multi_perform(pf.multi, &running);
+        curl_multi_poll(pf.multi, NULL, 0, 1000, NULL);
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(pf.multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+
+            CURL *easy = msg->easy_handle;
+            CURLcode result = msg->data.result;
+            PkgJob *job;
+            curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&job);
+
+            int rc = finish_job(&pf, easy, result, job);
+            if (rc == 0 && start_job(&pf, job) == 0) {
+                continue;       // still active, now on the next mirror
+            }
+            active--;
+            if (rc == 1) {
+                done++;
+                total_bytes += job->size;
+                if (done % 50 == 0) {
+                    log_message("Prefetch: %d/%d packages", done, count);
+                }
+            } else {
+                failed++;
+            }
+        }
+    }
+
+    curl_multi_cleanup(pf.multi);
+    free(jobs);
+
+    double secs = now_sec() - t0;
+    log_message("Prefetch: %d/%d cached, %.1f MB in %.1fs (%.1f MB/s)%s", done,
+                count, total_bytes / 1048576.0, secs,
+                secs > 0 ? total_bytes / 1048576.0 / secs : 0.0,
+                failed ? ", pacstrap fetches the rest" : "");
+    return done;
+}
@@ -0,0 +1,25 @@
+#ifndef PKG_PREFETCH_H
+#define PKG_PREFETCH_H
+
+/*
+ * Parallel package prefetch for pacstrap.
+ * Resolves the full package set (dependencies included) against freshly
+ * synced databases in the target root, then downloads every archive into
+ * <root>/var/cache/pacman/pkg with libcurl multi. pacstrap afterwards
+ * finds a warm cache and only verifies and unpacks.
+ */
+
+#define PREFETCH_MIRRORLIST "/etc/pacman.d/mirrorlist"
+#define PREFETCH_MAX_MIRRORS 8
+#define PREFETCH_SPREAD 3          // top mirrors sharing the initial load
+#define PREFETCH_PARALLEL 24       // transfers in flight
+#define PREFETCH_HOST_CONNS 4      // connections per mirror
+#define PREFETCH_MIRROR_STRIKES 3  // failures before a mirror is skipped
+
+// Download the archives for packages (NULL-terminated) and all of their
+// dependencies. Returns the number of packages now in the cache, -1 when
+// nothing could be resolved. Partial results are fine: pacstrap fetches
+// whatever is missing itself.
+int pkg_prefetch(const char *root_mount, const char *const packages[]);
+
+#endif // pkg prefetch h
@@ -0,0 +1,328 @@
+/**
+ * @file journal.c
+ * @brief persistent stage journal for resuming interrupted installations
+ *
+ * After a stage succeeds the pipeline asks it for a fingerprint of what
+ * it left on disk (GPT bytes, filesystem UUID, pacman db listing, file
+ * contents...) and records it here. A restarted install recomputes the
+ * fingerprint and skips the stage only when both match, so a stage is
+ * never skipped on the word of the journal alone.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "../utils/log_message.h"
+
+#define JOURNAL_MAGIC "# lainux install journal v1"
+
+unsigned long long journal_hash(const void *data, size_t len,
+                                unsigned long long seed) {
+    const unsigned char *p = (const unsigned char *)data;
+    unsigned long long h = seed;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int journal_hash_region(const char *path, long long offset, size_t len,
+                        unsigned long long *fp) {
+    unsigned char buf[4096];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    unsigned long long h = *fp;
+    while (len > 0) {
+        size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+        ssize_t n = pread(fd, buf, chunk, offset);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        h = journal_hash(buf, (size_t)n, h);
+        offset += n;
+        len -= (size_t)n;
+    }
+    close(fd);
+
+    *fp = h;
+    return 0;
+}
+
+int journal_hash_file(const char *path, unsigned long long *fp) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+    if (st.st_size == 0) {
+        *fp = journal_hash(path, strlen(path), *fp);
+        return 0;
+    }
+    return journal_hash_region(path, 0, (size_t)st.st_size, fp);
+}
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int journal_hash_dir(const char *path, unsigned long long *fp) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    char **names = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 256;
+            char **p = realloc(names, cap * sizeof(*names));
+            if (!p) break;
+            names = p;
+        }
+        names[count++] = strdup(ent->d_name);
+    }
+    closedir(dir);
+
+    if (count == 0) {
+        free(names);
+        return -1;
+    }
+
+    // readdir order is not stable across mounts
+    qsort(names, count, sizeof(*names), cmp_names);
+    unsigned long long h = *fp;
+    for (size_t i = 0; i < count; i++) {
+        if (names[i]) {
+            h = journal_hash(names[i], strlen(names[i]) + 1, h);
+        }
+        free(names[i]);
+    }
+    free(names);
+
+    *fp = h;
+    return 0;
+}
+
+int journal_hash_link(const char *path, unsigned long long *fp) {
+    char target[512];
+    ssize_t n = readlink(path, target, sizeof(target));
+    if (n <= 0) {
+        return -1;
+    }
+    *fp = journal_hash(target, (size_t)n, *fp);
+    return 0;
+}
+
+// Parse one journal file; returns entries loaded or -1
+static int load_file(InstallJournal *j, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[256];
+    int valid = 0;
+    j->count = 0;
+
+    if (!fgets(line, sizeof(line), fp) ||
+        strncmp(line, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char name[64], stage[sizeof(j->entries[0].stage)];
+        unsigned long long v;
+        long long when;
+
+        if (sscanf(line, "disk %63s %llu", name, &v) == 2) {
+            valid = strcmp(name, j->disk) == 0 && v == j->disk_id;
+        } else if (valid && j->count < PIPELINE_MAX_STAGES &&
+                   sscanf(line, "stage %31s %llx %lld", stage, &v, &when) == 3) {
+            JournalEntry *e = &j->entries[j->count++];
+            memcpy(e->stage, stage, sizeof(e->stage));
+            e->fp = v;
+            e->when = when;
+        }
+    }
+    fclose(fp);
+
+    return valid ? j->count : -1;
+}
+
+static int write_atomic(const InstallJournal *j, const char *path) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp, "%s\n", JOURNAL_MAGIC);
+    fprintf(fp, "disk %s %llu\n", j->disk, j->disk_id);
+    for (int i = 0; i < j->count; i++) {
+        fprintf(fp, "stage %s %016llx %lld\n", j->entries[i].stage,
+                j->entries[i].fp, j->entries[i].when);
+    }
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+
+    return rename(tmp, path);
+}
+
+// Target root counts as mounted when it sits on a different device
+static int target_mounted(const char *root) {
+    struct stat st_root, st_parent;
+    char parent[300];
+
+    snprintf(parent, sizeof(parent), "%s/..", root);
+    if (stat(root, &st_root) != 0 || stat(parent, &st_parent) != 0) {
+        return 0;
+    }
+    return st_root.st_dev != st_parent.st_dev;
+}
+
+static void journal_save(InstallJournal *j) {
+    if (write_atomic(j, j->path) != 0) {
+        log_message("Journal: cannot write %s: %s", j->path, strerror(errno));
+    }
+
+    // The mirror directories only appear once there is a stage to record
+    if (j->count > 0 && j->root_mount[0] && target_mounted(j->root_mount)) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/var", j->root_mount);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/var/lib", j->root_mount);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/var/lib/lainux", j->root_mount);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s%s", j->root_mount, JOURNAL_MIRROR);
+        write_atomic(j, path);
+    }
+}
+
+int journal_open(InstallJournal *j, const char *disk, unsigned long long disk_id,
+                 const char *root_mount) {
+    memset(j, 0, sizeof(*j));
+    pthread_mutex_init(&j->lock, NULL);
+    snprintf(j->disk, sizeof(j->disk), "%s", disk);
+    snprintf(j->root_mount, sizeof(j->root_mount), "%s", root_mount);
+    j->disk_id = disk_id;
+    snprintf(j->path, sizeof(j->path), JOURNAL_PATH_FMT, j->disk);
+
+    int n = load_file(j, j->path);
+    if (n < 0) {
+        j->count = 0;
+        return 0;
+    }
+    return n;
+}
+
+int journal_recover(InstallJournal *j, const char *root_part) {
+    char path[512], probe[96];
+    int n = -1;
+
+    // The disk is not confirmed for writing yet: a plain read-only mount
+    // would still replay the filesystem journal, noload/norecovery do not
+    snprintf(probe, sizeof(probe), JOURNAL_PROBE_FMT, j->disk);
+    mkdir(probe, 0700);
+    if (mount(root_part, probe, "ext4", MS_RDONLY, "noload") != 0 &&
+        mount(root_part, probe, "xfs", MS_RDONLY, "norecovery") != 0) {
+        rmdir(probe);
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s%s", probe, JOURNAL_MIRROR);
+    n = load_file(j, path);
+
+    umount2(probe, MNT_DETACH);
+    rmdir(probe);
+
+    if (n < 0) {
+        j->count = 0;
+        return 0;
+    }
+
+    log_message("Journal: recovered %d stage(s) from %s", n, root_part);
+    write_atomic(j, j->path);
+    return n;
+}
+
+void journal_discard(InstallJournal *j) {
+    pthread_mutex_lock(&j->lock);
+    j->count = 0;
+    unlink(j->path);
+    if (j->root_mount[0] && target_mounted(j->root_mount)) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s%s", j->root_mount, JOURNAL_MIRROR);
+        unlink(path);
+        // Leave no empty lainux directory behind on the installed system
+        snprintf(path, sizeof(path), "%s/var/lib/lainux", j->root_mount);
+        rmdir(path);
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+void journal_close(InstallJournal *j) {
+    pthread_mutex_destroy(&j->lock);
+}
+
+int journal_lookup(const char *stage, unsigned long long *fp, void *user) {
+    InstallJournal *j = (InstallJournal *)user;
+    int rc = -1;
+
+    pthread_mutex_lock(&j->lock);
+    for (int i = 0; i < j->count; i++) {
+        if (strcmp(j->entries[i].stage, stage) == 0) {
+            *fp = j->entries[i].fp;
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&j->lock);
+    return rc;
+}
+
+void journal_record(const char *stage, unsigned long long fp, void *user) {
+    InstallJournal *j = (InstallJournal *)user;
+
+    pthread_mutex_lock(&j->lock);
+    JournalEntry *e = NULL;
+    for (int i = 0; i < j->count; i++) {
+        if (strcmp(j->entries[i].stage, stage) == 0) {
+            e = &j->entries[i];
+            break;
+        }
+    }
+    if (!e && j->count < PIPELINE_MAX_STAGES) {
+        e = &j->entries[j->count++];
+    }
+    if (e) {
+        snprintf(e->stage, sizeof(e->stage), "%s", stage);
+        e->fp = fp;
+        e->when = (long long)time(NULL);
+        journal_save(j);
+    }
+    pthread_mutex_unlock(&j->lock);
+}
@@ -0,0 +1,65 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+
+#include "pipeline.h"
+
+/*
+ * Installation stage journal (checkpoint/resume).
+ * One line per completed stage with a content fingerprint of its result.
+ * The primary copy lives in /tmp, a mirror is kept on the target root so
+ * the journal survives a power loss of the live system. Both names are
+ * per disk, so several installs can run side by side.
+ */
+
+#define JOURNAL_PATH_FMT "/tmp/lainux-install-%s.journal"
+#define JOURNAL_MIRROR "/var/lib/lainux/install.journal"
+#define JOURNAL_PROBE_FMT "/tmp/lainux-journal-probe-%s"
+
+typedef struct {
+    char stage[32];
+    unsigned long long fp;
+    long long when;
+} JournalEntry;
+
+typedef struct {
+    char disk[32];                // target disk the journal belongs to
+    unsigned long long disk_id;   // disk size/identity, guards against swaps
+    char root_mount[256];         // mirror location (target root)
+    char path[96];                // primary copy, JOURNAL_PATH_FMT
+    JournalEntry entries[PIPELINE_MAX_STAGES];
+    int count;
+    pthread_mutex_t lock;
+} InstallJournal;
+
+// Load the journal for disk (from /tmp). Entries recorded for a
+// different disk are dropped. Returns number of entries loaded.
+int journal_open(InstallJournal *j, const char *disk, unsigned long long disk_id,
+                 const char *root_mount);
+
+// /tmp copy lost: read the mirror from the root partition (mounted
+// read-only for a moment). Returns number of entries loaded.
+int journal_recover(InstallJournal *j, const char *root_part);
+
+// Forget all entries and remove both copies
+void journal_discard(InstallJournal *j);
+void journal_close(InstallJournal *j);
+
+// PipelineHooks callbacks, user = InstallJournal *
+int journal_lookup(const char *stage, unsigned long long *fp, void *user);
+void journal_record(const char *stage, unsigned long long fp, void *user);
+
+// Fingerprint helpers (FNV-1a 64), chainable through seed
+#define JOURNAL_FP_SEED 0xcbf29ce484222325ULL
+unsigned long long journal_hash(const void *data, size_t len,
+                                unsigned long long seed);
+// Hash len bytes at offset of a file or block device, 0 on success
+int journal_hash_region(const char *path, long long offset, size_t len,
+                        unsigned long long *fp);
+int journal_hash_file(const char *path, unsigned long long *fp);
+// Hash sorted entry names of a directory
+int journal_hash_dir(const char *path, unsigned long long *fp);
+int journal_hash_link(const char *path, unsigned long long *fp);
+
+#endif // journal h
@@ -0,0 +1,312 @@
+/**
+ * @file pipeline.c
+ * @brief dependency-graph scheduler for the installation pipeline
+ *
+ * Stage B depends on stage A when B consumes something A produces.
+ * Workers pick any pending stage whose inputs are all available, so e.g.
+ * the ESP and root filesystems are formatted at the same time and the
+ * /etc writers run while the bootloader is installed.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "../utils/log_message.h"
+
+typedef struct {
+    const PipelineStage *stages;
+    int count;
+    void *ctx;
+    unsigned available;   // resources produced so far
+    unsigned fresh;       // resources rebuilt in this run
+    const PipelineHooks *hooks;
+    int running;
+    int abort;
+    double start[PIPELINE_MAX_STAGES];
+    double finish[PIPELINE_MAX_STAGES];
+    PipelineReport *report;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} PipelineRun;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Stages that must finish before stage i may start
+static int depends_on(const PipelineStage *stages, int i, int j) {
+    return i != j && (stages[i].inputs & stages[j].outputs) != 0;
+}
+
+int pipeline_validate(const PipelineStage *stages, int count, unsigned initial) {
+    if (count > PIPELINE_MAX_STAGES) {
+        log_message("Pipeline: too many stages (%d)", count);
+        return -1;
+    }
+
+    unsigned producible = initial;
+    for (int i = 0; i < count; i++) {
+        producible |= stages[i].outputs;
+    }
+    for (int i = 0; i < count; i++) {
+        unsigned missing = stages[i].inputs & ~producible;
+        if (missing) {
+            log_message("Pipeline: stage '%s' needs resources 0x%x nobody produces",
+                        stages[i].name, missing);
+            return -1;
+        }
+    }
+
+    // Kahn's algorithm over the derived edges
+    int done[PIPELINE_MAX_STAGES] = {0};
+    int finished = 0;
+    while (finished < count) {
+        int progressed = 0;
+        for (int i = 0; i < count; i++) {
+            if (done[i]) continue;
+            int ready = 1;
+            for (int j = 0; j < count && ready; j++) {
+                if (!done[j] && depends_on(stages, i, j)) ready = 0;
+            }
+            if (ready) {
+                done[i] = 1;
+                finished++;
+                progressed = 1;
+            }
+        }
+        if (!progressed) {
+            log_message("Pipeline: dependency cycle detected");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void set_state(PipelineRun *run, int i, StageState state) {
+    run->report->state[i] = state;
+    if (run->hooks && run->hooks->on_state) {
+        run->hooks->on_state(i, state, run->hooks->state_user);
+    }
+}
+
+static int stage_ready(PipelineRun *run, int i) {
+    const PipelineStage *st = &run->stages[i];
+    if (run->report->state[i] != STAGE_PENDING) {
+        return 0;
+    }
+    if ((st->inputs & run->available) != st->inputs) {
+        return 0;
+    }
+    // An input may have several producers; wait for all of them
+    for (int j = 0; j < run->count; j++) {
+        StageState s = run->report->state[j];
+        if (depends_on(run->stages, i, j) && s != STAGE_DONE &&
+            s != STAGE_SKIPPED && s != STAGE_RESUMED) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Called without the lock: does the journal vouch for this stage?
+static int stage_verified(PipelineRun *run, int i, unsigned fresh) {
+    const PipelineStage *st = &run->stages[i];
+    unsigned long long recorded, current;
+
+    if (!run->hooks || !run->hooks->lookup || !st->fingerprint) {
+        return 0;
+    }
+    if (st->inputs & fresh) {
+        return 0;
+    }
+    if (run->hooks->lookup(st->name, &recorded, run->hooks->user) != 0) {
+        return 0;
+    }
+    if (st->fingerprint(run->ctx, &current) != 0) {
+        return 0;
+    }
+    return recorded == current;
+}
+
+static void *pipeline_worker(void *arg) {
+    PipelineRun *run = (PipelineRun *)arg;
+
+    pthread_mutex_lock(&run->lock);
+    for (;;) {
+        int pick = -1;
+        if (!run->abort) {
+            for (int i = 0; i < run->count; i++) {
+                if (stage_ready(run, i)) {
+                    pick = i;
+                    break;
+                }
+            }
+        }
+
+        if (pick < 0) {
+            if (run->running == 0) {
+                // Nothing runs and nothing can start: finished or aborted
+                break;
+            }
+            pthread_cond_wait(&run->cond, &run->lock);
+            continue;
+        }
+
+        const PipelineStage *st = &run->stages[pick];
+        set_state(run, pick, STAGE_RUNNING);
+        run->running++;
+        run->start[pick] = now_sec();
+        unsigned fresh = run->fresh;
+        pthread_mutex_unlock(&run->lock);
+
+        if (stage_verified(run, pick, fresh)) {
+            pthread_mutex_lock(&run->lock);
+            run->finish[pick] = now_sec();
+            run->running--;
+            set_state(run, pick, STAGE_RESUMED);
+            run->available |= st->outputs;
+            log_message("[stage] %s verified from journal, skipped", st->name);
+            pthread_cond_broadcast(&run->cond);
+            continue;
+        }
+
+        log_message("[stage] %s started", st->name);
+        int rc = st->run(run->ctx);
+
+        if (rc == 0 && st->fingerprint && run->hooks && run->hooks->record) {
+            unsigned long long fp;
+            if (st->fingerprint(run->ctx, &fp) == 0) {
+                run->hooks->record(st->name, fp, run->hooks->user);
+            }
+        }
+
+        pthread_mutex_lock(&run->lock);
+        run->finish[pick] = now_sec();
+        run->report->elapsed[pick] = run->finish[pick] - run->start[pick];
+        run->running--;
+
+        // Everything downstream of a rebuilt stage must be rebuilt too
+        if (st->fingerprint || (st->inputs & run->fresh)) {
+            run->fresh |= st->outputs;
+        }
+
+        if (rc == 0 || st->optional) {
+            set_state(run, pick, rc == 0 ? STAGE_DONE : STAGE_SKIPPED);
+            run->available |= st->outputs;
+            if (rc == 0) {
+                log_message("[stage] %s done in %.1fs", st->name,
+                            run->report->elapsed[pick]);
+            } else {
+                log_message("[stage] %s failed (optional), continuing", st->name);
+            }
+        } else {
+            set_state(run, pick, STAGE_FAILED);
+            if (run->report->failed_stage < 0) {
+                run->report->failed_stage = pick;
+            }
+            run->abort = 1;
+            log_message("[stage] %s FAILED after %.1fs", st->name,
+                        run->report->elapsed[pick]);
+        }
+        pthread_cond_broadcast(&run->cond);
+    }
+    pthread_cond_broadcast(&run->cond);
+    pthread_mutex_unlock(&run->lock);
+
+    return NULL;
+}
+
+// Longest chain of dependent stage run times
+static double critical_path(PipelineRun *run) {
+    double best[PIPELINE_MAX_STAGES] = {0};
+    double longest = 0;
+
+    // Stages finish in dependency order, so relax in finish-time order
+    int order[PIPELINE_MAX_STAGES];
+    for (int i = 0; i < run->count; i++) order[i] = i;
+    for (int i = 1; i < run->count; i++) {
+        int k = order[i], j = i - 1;
+        while (j >= 0 && run->finish[order[j]] > run->finish[k]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = k;
+    }
+
+    for (int n = 0; n < run->count; n++) {
+        int i = order[n];
+        double base = 0;
+        for (int j = 0; j < run->count; j++) {
+            if (depends_on(run->stages, i, j) && best[j] > base) base = best[j];
+        }
+        best[i] = base + run->report->elapsed[i];
+        if (best[i] > longest) longest = best[i];
+    }
+
+    return longest;
+}
+
+int pipeline_run(const PipelineStage *stages, int count, unsigned initial,
+                 void *ctx, int workers, const PipelineHooks *hooks,
+                 PipelineReport *report) {
+    PipelineReport local;
+    PipelineRun run;
+
+    if (pipeline_validate(stages, count, initial) != 0) {
+        return -1;
+    }
+
+    if (!report) report = &local;
+    memset(report, 0, sizeof(*report));
+    report->failed_stage = -1;
+
+    memset(&run, 0, sizeof(run));
+    run.stages = stages;
+    run.count = count;
+    run.ctx = ctx;
+    run.available = initial;
+    run.hooks = hooks;
+    run.report = report;
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.cond, NULL);
+
+    if (workers < 1) workers = 1;
+    if (workers > PIPELINE_MAX_WORKERS) workers = PIPELINE_MAX_WORKERS;
+
+    double t0 = now_sec();
+    pthread_t threads[PIPELINE_MAX_WORKERS];
+    int started = 0;
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, pipeline_worker, &run) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        pipeline_worker(&run);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report->wall_sec = now_sec() - t0;
+    report->critical_sec = critical_path(&run);
+
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.cond);
+
+    int rc = 0;
+    for (int i = 0; i < count; i++) {
+        if (report->state[i] == STAGE_FAILED || report->state[i] == STAGE_PENDING) {
+            rc = -1;
+        }
+    }
+
+    log_message("Pipeline finished in %.1fs (critical path %.1fs)%s",
+                report->wall_sec, report->critical_sec, rc ? " with errors" : "");
+    return rc;
+}
@@ -0,0 +1,68 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/*
+ * Installation pipeline: a dependency graph of named stages.
+ * Every stage declares the resources it consumes (inputs) and produces
+ * (outputs) as bit masks; edges are derived from those masks, and a small
+ * worker pool runs every stage as soon as all of its inputs exist.
+ */
+
+#define PIPELINE_MAX_STAGES 32
+#define PIPELINE_MAX_WORKERS 8
+
+typedef int (*StageFn)(void *ctx);
+// Content fingerprint of what a stage leaves behind, 0 on success
+typedef int (*StageFingerprintFn)(void *ctx, unsigned long long *fp);
+
+typedef struct {
+    const char *name;
+    StageFn run;          // returns 0 on success
+    unsigned inputs;      // resources that must exist before the stage runs
+    unsigned outputs;     // resources the stage creates
+    int optional;         // failure is logged, outputs still count as done
+    StageFingerprintFn fingerprint;  // NULL - stage always runs
+} PipelineStage;
+
+typedef enum {
+    STAGE_PENDING = 0,
+    STAGE_RUNNING,
+    STAGE_DONE,
+    STAGE_FAILED,
+    STAGE_SKIPPED,        // optional stage failed
+    STAGE_RESUMED         // verified from the journal, not run
+} StageState;
+
+// Checkpoint hooks (see journal.h). A stage with a fingerprint is
+// skipped when lookup() returns a recorded value equal to the current
+// fingerprint and none of its inputs were rebuilt in this run.
+typedef struct {
+    int (*lookup)(const char *stage, unsigned long long *fp, void *user);
+    void (*record)(const char *stage, unsigned long long fp, void *user);
+    void *user;
+    // Optional progress feed: every state change of stage index `stage`,
+    // called from the worker thread with the scheduler lock held
+    void (*on_state)(int stage, StageState state, void *user);
+    void *state_user;
+} PipelineHooks;
+
+typedef struct {
+    StageState state[PIPELINE_MAX_STAGES];
+    double elapsed[PIPELINE_MAX_STAGES];  // per-stage run time (s)
+    double wall_sec;                      // total pipeline wall-clock time
+    double critical_sec;                  // longest dependency chain (s)
+    int failed_stage;                     // index of first fatal failure, -1
+} PipelineReport;
+
+// Check that every input is produced by some stage and the graph has no
+// cycles. Returns 0 if valid.
+int pipeline_validate(const PipelineStage *stages, int count, unsigned initial);
+
+// Run the graph with up to `workers` stages in parallel. `initial` holds
+// resources available before any stage runs. Returns 0 when every
+// mandatory stage succeeded. hooks and report may be NULL.
+int pipeline_run(const PipelineStage *stages, int count, unsigned initial,
+                 void *ctx, int workers, const PipelineHooks *hooks,
+                 PipelineReport *report);
+
+#endif // pipeline h
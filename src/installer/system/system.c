@@ -1,6 +1,13 @@
 #include <stdio.h>
 #include <string.h>
 #include "system.h"
+#include "../disk_utils/blockdev.h"
+#include "../disk_utils/fat32.h"
+#include "../disk_utils/fstab.h"
+#include "../disk_utils/gpt.h"
+#include "../utils/chroot_session.h"
+#include "../utils/process.h"
+#include "target_config.h"
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -10,108 +17,15 @@
  * Returns number of disks found
  */
 int get_disk_list(DiskInfo disks[MAX_DISKS]) {
-    FILE *fp = fopen("/proc/partitions", "r");
-    if (fp == NULL) {
-        printf("Cannot open /proc/partitions\n");
-        return 0;
-    }
-
-    char line[256];
-    int count = 0;
-
-    // Skip header lines
-    fgets(line, sizeof(line), fp);
-    fgets(line, sizeof(line), fp);
-
-    while (fgets(line, sizeof(line), fp) && count < MAX_DISKS) {
-        unsigned int major, minor;
-        long long blocks;
-        char name[32];
-
-        if (sscanf(line, "%u %u %lld %31s", &major, &minor, &blocks, name) == 4) {
-            // Skip virtual devices
-            if (strncmp(name, "loop", 4) == 0 ||
-                strncmp(name, "ram", 3) == 0 ||
-                strncmp(name, "dm-", 3) == 0 ||
-                strncmp(name, "zram", 4) == 0) {
-                continue;
-            }
-
-            // Extract base disk name (remove partition numbers)
-            char base_name[32];
-            strcpy(base_name, name);
-
-            int len = strlen(base_name);
-            while (len > 0 && base_name[len-1] >= '0' && base_name[len-1] <= '9') {
-                len--;
-            }
-            base_name[len] = '\0';
-
-            if (len == 0) continue;
-
-            // Check if disk already added
-            int already_added = 0;
-            for (int i = 0; i < count; i++) {
-                if (strcmp(disks[i].name, base_name) == 0) {
-                    already_added = 1;
-                    break;
-                }
-            }
-
-            if (already_added) continue;
-
-            // Add disk to list
-            strncpy(disks[count].name, base_name, 19);
-            disks[count].name[19] = '\0';
-
-            // Convert blocks to GB
-            double gb = (double)blocks / 1024.0 / 1024.0;
-            if (gb < 0.1) continue;
-
-            snprintf(disks[count].size, 19, "%.1f GB", gb);
-
-            // Try to get disk model from sysfs
-            char model_path[128];
-            snprintf(model_path, sizeof(model_path), "/sys/block/%s/device/model", base_name);
-            FILE *model_fp = fopen(model_path, "r");
-            if (model_fp) {
-                if (fgets(disks[count].model, 49, model_fp)) {
-                    disks[count].model[strcspn(disks[count].model, "\n")] = 0;
-                } else {
-                    strcpy(disks[count].model, "Unknown");
-                }
-                fclose(model_fp);
-            } else {
-                strcpy(disks[count].model, "Unknown");
-            }
-
-            count++;
-        }
-    }
-
-    fclose(fp);
-
-    // Fallback method using lsblk if /proc/partitions fails
-    if (count == 0) {
-        fp = popen("lsblk -d -o NAME,SIZE,MODEL -n | grep -v '^loop' | grep -v '^sr'", "r");
-        if (fp) {
-            while (fgets(line, sizeof(line), fp) && count < MAX_DISKS) {
-                char name[32], size[32], model[128];
-                if (sscanf(line, "%s %s %[^\n]", name, size, model) >= 2) {
-                    strncpy(disks[count].name, name, 19);
-                    disks[count].name[19] = '\0';
-
-                    strncpy(disks[count].size, size, 19);
-                    disks[count].size[19] = '\0';
-
-                    strncpy(disks[count].model, model, 49);
-                    disks[count].model[49] = '\0';
-
-                    count++;
-                }
-            }
-            pclose(fp);
-        }
+    BlockDev devs[MAX_DISKS];
+    int count = blockdev_disks(devs, MAX_DISKS);
+
+    for (int i = 0; i < count; i++) {
+        snprintf(disks[i].name, sizeof(disks[i].name), "%s", devs[i].name);
+        snprintf(disks[i].size, sizeof(disks[i].size), "%.1f GB",
+                 (double)devs[i].size / (1024.0 * 1024.0 * 1024.0));
+        snprintf(disks[i].model, sizeof(disks[i].model), "%s",
+                 devs[i].model[0] ? devs[i].model : "Unknown");
     }
 
     return count;
@@ -150,31 +64,21 @@ int prepare_disk(const char *disk_name) {
     snprintf(path, sizeof(path), "/dev/%s", disk_name);
 
 
-    // Verify disk exists
-    if (access(path, F_OK) != 0) {
+    // Verify disk exists and is a whole disk (not a partition)
+    BlockDev dev;
+    if (blockdev_lookup(disk_name, &dev) != 0 || access(path, F_OK) != 0) {
         printf("Disk not found: %s\n", path);
-        system("lsblk -d -o NAME,SIZE,MODEL,TYPE | grep -v 'loop\\|rom\\|part'");
+        DiskInfo disks[MAX_DISKS];
+        int count = get_disk_list(disks);
+        for (int i = 0; i < count; i++) {
+            printf("  %-12s %-12s %s\n", disks[i].name, disks[i].size, disks[i].model);
+        }
         return 1;
     }
 
-    // Check if it's a whole disk (not a partition)
-    FILE *fp = popen("lsblk -d -o NAME -n", "r");
-    if (fp) {
-        char found = 0;
-        char line[32];
-        while (fgets(line, sizeof(line), fp)) {
-            line[strcspn(line, "\n")] = 0;
-            if (strcmp(line, disk_name) == 0) {
-                found = 1;
-                break;
-            }
-        }
-        pclose(fp);
-
-        if (!found) {
-            printf("%s is not a whole disk (might be a partition)\n", disk_name);
-            return 1;
-        }
+    if (dev.is_partition) {
+        printf("%s is not a whole disk (partition %d of %s)\n", disk_name, dev.partno, dev.parent);
+        return 1;
     }
 
     // Final warning before destruction
@@ -194,77 +98,33 @@ int prepare_disk(const char *disk_name) {
     printf("\nUnmounting any partitions...\n");
     snprintf(cmd, sizeof(cmd), "umount /dev/%s* 2>/dev/null || true", disk_name);
     system(cmd);
-    sleep(2);
 
-    // Clear old partition table
-    printf("Cleaning old partition table...\n");
-    snprintf(cmd, sizeof(cmd), "wipefs -a %s 2>/dev/null || true", path);
-    system(cmd);
-    sleep(1);
-
-    // Create GPT partition table
+    // Write a fresh GPT: ESP (512MB) + root (rest of disk). The old table
+    // is replaced as a whole and the kernel re-reads it right away.
     printf("Creating GPT partition table...\n");
-    snprintf(cmd, sizeof(cmd), "parted -s %s mklabel gpt", path);
-
-    if (system(cmd) != 0) {
+    const PartSpec parts[] = {
+        {"ESP", GPT_TYPE_ESP, MBR_TYPE_ESP, 512, 0},
+        {"root", GPT_TYPE_ROOT_X86_64, MBR_TYPE_LINUX, 0, 0},
+    };
+    if (gpt_create(path, parts, 2) != 0) {
         printf("Failed to create GPT table\n");
-        printf("Trying alternative method with sgdisk...\n");
-
-        snprintf(cmd, sizeof(cmd), "sgdisk -Z %s", path);
-        system(cmd);
-
-        snprintf(cmd, sizeof(cmd), "sgdisk -o %s", path);
-        if (system(cmd) != 0) {
-            printf("All methods failed\n");
-            return 1;
-        }
-    }
-
-    sleep(1);
-
-    // Create EFI partition (512MB)
-    printf("Creating EFI partition (512MB)...\n");
-    snprintf(cmd, sizeof(cmd), "parted -s %s mkpart ESP fat32 1MiB 513MiB", path);
-
-    if (system(cmd) != 0) {
-        printf("Failed to create EFI partition\n");
-        printf("Trying with sgdisk...\n");
-
-        snprintf(cmd, sizeof(cmd), "sgdisk -n 1:1MiB:513MiB -t 1:ef00 %s", path);
-        if (system(cmd) != 0) {
-            printf("All methods failed for EFI\n");
-            return 1;
-        }
-    }
-
-    // Set ESP flag for EFI partition
-    printf("Setting ESP flag...\n");
-    snprintf(cmd, sizeof(cmd), "parted -s %s set 1 esp on", path);
-    system(cmd);
-
-    // Create root partition (remaining space)
-    printf("Creating root partition (rest of disk)...\n");
-    snprintf(cmd, sizeof(cmd), "parted -s %s mkpart root ext4 513MiB 100%%", path);
-
-    if (system(cmd) != 0) {
-        printf("Failed to create root partition\n");
-        printf("Trying with sgdisk...\n");
-
-        snprintf(cmd, sizeof(cmd), "sgdisk -n 2:513MiB:0 -t 2:8304 %s", path);
-        if (system(cmd) != 0) {
-            printf("All methods failed for root\n");
-            return 1;
-        }
+        return 1;
     }
 
-    // Update kernel partition table
-    system("partprobe 2>/dev/null || true");
-    sleep(2);
-
     // Verify created partitions
     printf("\nVerifying partitions...\n");
-    snprintf(cmd, sizeof(cmd), "lsblk -f %s", path);
-    system(cmd);
+    blockdev_invalidate();
+    if (blockdev_lookup(disk_name, &dev) != 0 || dev.part_count != 2) {
+        printf("Kernel does not see the new partitions on %s\n", path);
+        return 1;
+    }
+    for (int i = 0; i < dev.part_count; i++) {
+        BlockDev part;
+        char size[16];
+        if (blockdev_lookup(dev.partitions[i], &part) != 0) continue;
+        blockdev_format_size(part.size, size, sizeof(size));
+        printf("  %-12s %8s\n", part.name, size);
+    }
 
     printf("\nDisk preparation completed successfully!\n");
     return 0;
@@ -289,9 +149,8 @@ int format_and_mount(const char *disk_name) {
         snprintf(part_root, 64, "/dev/%s2", disk_name);
     }
 
-    // Format EFI partition as FAT32
-    snprintf(cmd, 512, "mkfs.fat -F32 %s", part_efi);
-    if(run_system_command(cmd) != 0) return 1;
+    // Format EFI partition as FAT32 (built-in, no dosfstools needed)
+    if(fat32_format(part_efi, "LAINUX_EFI") != 0) return 1;
 
     // Format root partition as ext4
     snprintf(cmd, 512, "mkfs.ext4 -F %s", part_root);
@@ -327,34 +186,36 @@ int install_base() {
 int install_grub(const char *disk_name) {
     printf("\nInstalling GRUB Bootloader\n");
 
-    char cmd[512];
     char disk_path[64];
     snprintf(disk_path, sizeof(disk_path), "/dev/%s", disk_name);
 
+    // grub-install and grub-mkconfig share one chroot session
+    ChrootSession session;
+    chroot_begin(&session, "/mnt");
+
     // Detect boot mode (UEFI or BIOS)
     if (access("/sys/firmware/efi", F_OK) == 0) {
         printf("UEFI mode detected\n");
         // UEFI installation
-        snprintf(cmd, sizeof(cmd),
-                 "arch-chroot /mnt grub-install --target=x86_64-efi "
-                 "--efi-directory=/boot/efi --bootloader-id=LAINUX --recheck %s",
-                 disk_path);
+        const char *efi_argv[] = {"grub-install", "--target=x86_64-efi",
+                                  "--efi-directory=/boot/efi",
+                                  "--bootloader-id=LAINUX", "--recheck",
+                                  disk_path, NULL};
+        chroot_add_run(&session, efi_argv, NULL, 0);
     } else {
         printf("BIOS mode detected\n");
         // BIOS installation
-        snprintf(cmd, sizeof(cmd),
-                 "arch-chroot /mnt grub-install --target=i386-pc --recheck %s",
-                 disk_path);
-    }
-
-    if (run_system_command(cmd) != 0) {
-        printf("Failed to install GRUB\n");
-        return 1;
+        const char *bios_argv[] = {"grub-install", "--target=i386-pc",
+                                   "--recheck", disk_path, NULL};
+        chroot_add_run(&session, bios_argv, NULL, 0);
     }
 
     // Generate GRUB configuration
-    if (run_system_command("arch-chroot /mnt grub-mkconfig -o /boot/grub/grub.cfg") != 0) {
-        printf("Failed to create GRUB config\n");
+    const char *mkconfig_argv[] = {"grub-mkconfig", "-o", "/boot/grub/grub.cfg", NULL};
+    chroot_add_run(&session, mkconfig_argv, NULL, 0);
+
+    if (chroot_commit(&session) != 0) {
+        printf("Failed to install GRUB\n");
         return 1;
     }
 
@@ -369,15 +230,14 @@ int install_grub(const char *disk_name) {
 int set_hostname(const char *hostname) {
     printf("\nSetting Hostname: %s\n", hostname);
 
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "echo '%s' > /mnt/etc/hostname", hostname);
-    run_system_command(cmd);
-
-    // Add entry to hosts file
-    snprintf(cmd, sizeof(cmd),
-             "echo '127.0.1.1 %s.localdomain %s' >> /mnt/etc/hosts",
-             hostname, hostname);
-    run_system_command(cmd);
+    // /etc/hostname and /etc/hosts, written in-process
+    TargetConfig cfg;
+    target_config_defaults(&cfg);
+    snprintf(cfg.hostname, sizeof(cfg.hostname), "%s", hostname);
+    if (target_config_apply(&cfg, "/mnt", TC_HOSTNAME) != 0) {
+        printf("Failed to set hostname\n");
+        return 1;
+    }
 
     printf("Hostname set to '%s'\n", hostname);
     return 0;
@@ -390,22 +250,17 @@ int set_hostname(const char *hostname) {
 int create_user(const char *username) {
     printf("\nCreating User: %s\n", username);
 
-    char cmd[256];
-
-    // Create user with home directory and wheel group
-    snprintf(cmd, sizeof(cmd), "arch-chroot /mnt useradd -m -G wheel %s", username);
-    if (run_system_command(cmd) != 0) {
+    // Account in wheel, password same as username by default, sudo for
+    // wheel - straight into passwd/shadow/group and sudoers.d
+    TargetConfig cfg;
+    target_config_defaults(&cfg);
+    if (target_config_add_user(&cfg, username, username, "wheel", "/bin/bash") != 0 ||
+        target_config_apply(&cfg, "/mnt", TC_USERS | TC_SUDOERS) != 0) {
+        target_config_clear(&cfg);
         printf("Failed to create user\n");
         return 1;
     }
-
-    // Set password (same as username by default)
-    snprintf(cmd, sizeof(cmd),
-             "echo '%s:%s' | arch-chroot /mnt chpasswd", username, username);
-    run_system_command(cmd);
-
-    // Enable sudo for wheel group
-    run_system_command("arch-chroot /mnt sed -i 's/^# %wheel ALL=(ALL:ALL) ALL/%wheel ALL=(ALL:ALL) ALL/' /etc/sudoers");
+    target_config_clear(&cfg);
 
     printf("User '%s' created with password '%s'\n", username, username);
     return 0;
@@ -418,15 +273,20 @@ int create_user(const char *username) {
 int setup_network(void) {
     printf("\nSetting up Network\n");
 
-    // Enable NetworkManager service
-    if (run_system_command("arch-chroot /mnt systemctl enable NetworkManager") != 0) {
+    ChrootSession session;
+    chroot_begin(&session, "/mnt");
+
+    // Enable NetworkManager service and the DHCP client
+    const char *nm_argv[] = {"systemctl", "enable", "NetworkManager", NULL};
+    const char *dhcp_argv[] = {"systemctl", "enable", "dhcpcd", NULL};
+    chroot_add_run(&session, nm_argv, NULL, 0);
+    chroot_add_run(&session, dhcp_argv, NULL, CHROOT_OPTIONAL);
+
+    if (chroot_commit(&session) != 0) {
         printf("Failed to enable NetworkManager\n");
         return 1;
     }
 
-    // Enable DHCP client
-    run_system_command("arch-chroot /mnt systemctl enable dhcpcd");
-
     printf("Network configured\n");
     return 0;
 }
@@ -460,17 +320,26 @@ int install_desktop(const char *desktop_type) {
         return 1;
     }
 
-    // Install desktop packages
-    snprintf(cmd, sizeof(cmd), "arch-chroot /mnt pacman -S --noconfirm %s", packages);
-    if (run_system_command(cmd) != 0) {
-        printf("Failed to install desktop packages\n");
+    // Install desktop packages and enable the display manager in one session
+    char *pacman_argv[CHROOT_MAX_ARGS];
+    snprintf(cmd, sizeof(cmd), "pacman -S --noconfirm %s", packages);
+    if (proc_split_simple(cmd, pacman_argv, CHROOT_MAX_ARGS) < 0) {
         return 1;
     }
 
+    ChrootSession session;
+    chroot_begin(&session, "/mnt");
+    chroot_add_run(&session, (const char *const *)pacman_argv, NULL, 0);
+
     // Enable display manager if not minimal
     if (strcmp(display_manager, "none") != 0) {
-        snprintf(cmd, sizeof(cmd), "arch-chroot /mnt systemctl enable %s", display_manager);
-        run_system_command(cmd);
+        const char *dm_argv[] = {"systemctl", "enable", display_manager, NULL};
+        chroot_add_run(&session, dm_argv, NULL, CHROOT_OPTIONAL);
+    }
+
+    if (chroot_commit(&session) != 0) {
+        printf("Failed to install desktop packages\n");
+        return 1;
     }
 
     printf("Desktop '%s' installed\n", desktop_type);
@@ -486,15 +355,21 @@ int install_desktop(const char *desktop_type) {
 int finalize_installation(void) {
     printf("\nFinalizing Installation\n");
 
-    // Set timezone to Moscow (default)
-    run_system_command("arch-chroot /mnt ln -sf /usr/share/zoneinfo/Europe/Moscow /etc/localtime");
-    run_system_command("arch-chroot /mnt hwclock --systohc");
-
-    // Configure locale
-    run_system_command("echo 'en_US.UTF-8 UTF-8' > /mnt/etc/locale.gen");
-    run_system_command("echo 'ru_RU.UTF-8 UTF-8' >> /mnt/etc/locale.gen");
-    run_system_command("arch-chroot /mnt locale-gen");
-    run_system_command("echo 'LANG=en_US.UTF-8' > /mnt/etc/locale.conf");
+    // Timezone Moscow (default), en_US + ru_RU locales
+    TargetConfig cfg;
+    target_config_defaults(&cfg);
+    snprintf(cfg.timezone, sizeof(cfg.timezone), "Europe/Moscow");
+    target_config_add_locale(&cfg, "ru_RU.UTF-8");
+    target_config_apply(&cfg, "/mnt", TC_TIMEZONE | TC_LOCALE);
+
+    // Clock and locale generation need the target's binaries
+    ChrootSession session;
+    chroot_begin(&session, "/mnt");
+    const char *clock_argv[] = {"hwclock", "--systohc", NULL};
+    const char *locale_argv[] = {"locale-gen", NULL};
+    chroot_add_run(&session, clock_argv, NULL, CHROOT_OPTIONAL);
+    chroot_add_run(&session, locale_argv, NULL, CHROOT_OPTIONAL);
+    chroot_commit(&session);
 
     printf("Installation finalized\n");
     return 0;
@@ -546,42 +421,44 @@ int auto_detect_internet(void) {
 int auto_configure_system(void) {
     printf("Auto-configuring system...\n");
 
-    // Set timezone to Moscow
-    printf("Setting timezone...\n");
-    system("ln -sf /usr/share/zoneinfo/Europe/Moscow /mnt/etc/localtime 2>/dev/null");
-    system("arch-chroot /mnt hwclock --systohc 2>/dev/null");
-
-    // Configure locale
-    printf("Configuring locale...\n");
-    system("echo 'en_US.UTF-8 UTF-8' > /mnt/etc/locale.gen 2>/dev/null");
-    system("echo 'ru_RU.UTF-8 UTF-8' >> /mnt/etc/locale.gen 2>/dev/null");
-    system("arch-chroot /mnt locale-gen 2>/dev/null");
-    system("echo 'LANG=en_US.UTF-8' > /mnt/etc/locale.conf 2>/dev/null");
-
-    // Set hostname
-    printf("Setting hostname...\n");
-    system("echo 'lainux' > /mnt/etc/hostname 2>/dev/null");
-
-    // Configure hosts file
-    system("echo '127.0.0.1 localhost' > /mnt/etc/hosts 2>/dev/null");
-    system("echo '::1 localhost' >> /mnt/etc/hosts 2>/dev/null");
-    system("echo '127.0.1.1 lainux.localdomain lainux' >> /mnt/etc/hosts 2>/dev/null");
+    // Timezone Moscow, en_US + ru_RU locales, hostname/hosts, default
+    // user and sudo for wheel: all generated in-process from one config
+    printf("Setting timezone, locale, hostname and user...\n");
+    TargetConfig cfg;
+    target_config_defaults(&cfg);
+    snprintf(cfg.timezone, sizeof(cfg.timezone), "Europe/Moscow");
+    target_config_add_locale(&cfg, "ru_RU.UTF-8");
+    target_config_add_user(&cfg, "lainux", "lainux", "wheel,audio,video,storage",
+                           "/bin/bash");
+    target_config_apply(&cfg, "/mnt", TC_ALL);
+    target_config_clear(&cfg);
+
+    // The rest needs the target's binaries: one chroot session, each
+    // step best effort as before
+    ChrootSession session;
+    chroot_begin(&session, "/mnt");
+    const int opt = CHROOT_OPTIONAL;
+
+    const char *clock_argv[] = {"hwclock", "--systohc", NULL};
+    const char *locale_argv[] = {"locale-gen", NULL};
+    chroot_add_run(&session, clock_argv, NULL, opt);
+    chroot_add_run(&session, locale_argv, NULL, opt);
 
     // Enable network services
     printf("Configuring network...\n");
-    system("arch-chroot /mnt systemctl enable NetworkManager 2>/dev/null");
-    system("arch-chroot /mnt systemctl enable dhcpcd 2>/dev/null");
-
-    // Create default user
-    printf("Creating user...\n");
-    system("arch-chroot /mnt useradd -m -G wheel,audio,video,storage -s /bin/bash lainux 2>/dev/null");
-    system("echo 'lainux:lainux' | arch-chroot /mnt chpasswd 2>/dev/null");
-    system("arch-chroot /mnt sed -i 's/^# %wheel ALL=(ALL:ALL) ALL/%wheel ALL=(ALL:ALL) ALL/' /etc/sudoers 2>/dev/null");
+    const char *nm_argv[] = {"systemctl", "enable", "NetworkManager", NULL};
+    const char *dhcp_argv[] = {"systemctl", "enable", "dhcpcd", NULL};
+    chroot_add_run(&session, nm_argv, NULL, opt);
+    chroot_add_run(&session, dhcp_argv, NULL, opt);
 
     // Initialize pacman keys
     printf("Setting up pacman keys...\n");
-    system("arch-chroot /mnt pacman-key --init 2>/dev/null");
-    system("arch-chroot /mnt pacman-key --populate archlinux 2>/dev/null");
+    const char *keyinit_argv[] = {"pacman-key", "--init", NULL};
+    const char *populate_argv[] = {"pacman-key", "--populate", "archlinux", NULL};
+    chroot_add_run(&session, keyinit_argv, NULL, opt);
+    chroot_add_run(&session, populate_argv, NULL, opt);
+
+    chroot_commit(&session);
 
     printf("System auto-configured\n");
     return 0;
@@ -617,10 +494,15 @@ int auto_install_packages(void) {
 
     // Install additional packages
     printf("Installing comfort packages...\n");
-    snprintf(cmd, sizeof(cmd),
-             "arch-chroot /mnt pacman -S --noconfirm %s 2>/dev/null",
-             comfort_packages);
-    system(cmd);
+    char *pacman_argv[CHROOT_MAX_ARGS];
+    snprintf(cmd, sizeof(cmd), "pacman -S --noconfirm %s", comfort_packages);
+    if (proc_split_simple(cmd, pacman_argv, CHROOT_MAX_ARGS) > 0) {
+        ChrootSession session;
+        chroot_begin(&session, "/mnt");
+        chroot_add_run(&session, (const char *const *)pacman_argv, NULL,
+                       CHROOT_OPTIONAL);
+        chroot_commit(&session);
+    }
 
     printf("Packages installed\n");
     return 0;
@@ -663,16 +545,18 @@ int turbo_install(const char *disk_name) {
         return 3;
     }
 
-    // Step 4: Generate filesystem table
-    printf("\nStep 4: Generating fstab\n");
-    system("genfstab -U /mnt >> /mnt/etc/fstab 2>/dev/null");
-
-    // Step 5: Install packages
-    printf("\nStep 5: Installing packages\n");
+    // Step 4: Install packages
+    printf("\nStep 4: Installing packages\n");
     if (auto_install_packages() != 0) {
         printf("Package installation had issues\n");
     }
 
+    // Step 5: Generate filesystem table (after pacstrap created /mnt/etc)
+    printf("\nStep 5: Generating fstab\n");
+    if (fstab_generate("/mnt", NULL, NULL) != 0) {
+        printf("fstab generation had issues\n");
+    }
+
     // Step 6: System configuration
     printf("\nStep 6: System configuration\n");
     if (auto_configure_system() != 0) {
@@ -688,18 +572,30 @@ int turbo_install(const char *disk_name) {
     // Step 8: System optimizations
     printf("\nStep 8: System optimizations\n");
 
+    // Steps 8 and 9 share one chroot session, run before unmounting
+    ChrootSession session;
+    chroot_begin(&session, "/mnt");
+
     // Create swap file
     printf("Creating swap file...\n");
-    system("arch-chroot /mnt fallocate -l 2G /swapfile 2>/dev/null || "
-           "arch-chroot /mnt dd if=/dev/zero of=/swapfile bs=1M count=2048 2>/dev/null");
-    system("arch-chroot /mnt chmod 600 /swapfile 2>/dev/null");
-    system("arch-chroot /mnt mkswap /swapfile 2>/dev/null");
-    system("arch-chroot /mnt swapon /swapfile 2>/dev/null");
-    system("echo '/swapfile none swap defaults 0 0' >> /mnt/etc/fstab 2>/dev/null");
+    const char *swapfile_argv[] = {"sh", "-c",
+                                   "fallocate -l 2G /swapfile || "
+                                   "dd if=/dev/zero of=/swapfile bs=1M count=2048",
+                                   NULL};
+    const char *chmod_argv[] = {"chmod", "600", "/swapfile", NULL};
+    const char *mkswap_argv[] = {"mkswap", "/swapfile", NULL};
+    const char *swapon_argv[] = {"swapon", "/swapfile", NULL};
+    chroot_add_run(&session, swapfile_argv, NULL, CHROOT_OPTIONAL);
+    chroot_add_run(&session, chmod_argv, NULL, CHROOT_OPTIONAL);
+    chroot_add_run(&session, mkswap_argv, NULL, CHROOT_OPTIONAL);
+    chroot_add_run(&session, swapon_argv, NULL, CHROOT_OPTIONAL);
+    const char *const swapfiles[] = {"/swapfile", NULL};
+    fstab_generate("/mnt", swapfiles, NULL);
 
     // Enable TRIM for SSD support
     printf("Enabling TRIM support...\n");
-    system("arch-chroot /mnt systemctl enable fstrim.timer 2>/dev/null");
+    const char *fstrim_argv[] = {"systemctl", "enable", "fstrim.timer", NULL};
+    chroot_add_run(&session, fstrim_argv, NULL, CHROOT_OPTIONAL);
 
     // Performance tweaks
     printf("Performance tweaks...\n");
@@ -712,7 +608,9 @@ int turbo_install(const char *disk_name) {
 
     // Step 9: Finalization
     printf("\nStep 9: Finalizing\n");
-    system("arch-chroot /mnt mkinitcpio -P 2>/dev/null");
+    const char *mkinitcpio_argv[] = {"mkinitcpio", "-P", NULL};
+    chroot_add_run(&session, mkinitcpio_argv, NULL, CHROOT_OPTIONAL);
+    chroot_commit(&session);
     system("sync");
 
     // Unmount partitions
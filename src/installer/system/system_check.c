@@ -15,9 +15,8 @@
 // Enhanced dependency check with package manager detection
 int check_dependencies() {
     const char *essential_tools[] = {
-        "arch-chroot", "pacstrap", "mkfs.fat", "mkfs.ext4",
-        "sgdisk", "mount", "umount", "wget", "curl", "grub-install",
-        "lsblk", "genfstab", "blkid", "partprobe", NULL
+        "pacstrap", "mkfs.ext4", "mount", "umount",
+        "curl", "grub-install", NULL
     };
 
     int missing = 0;
@@ -44,11 +43,11 @@ int check_dependencies() {
         log_message("Installing missing dependencies...");
 
         if (strcmp(pkg_manager, "pacman") == 0) {
-            run_command("pacman -Sy --noconfirm --needed arch-install-scripts dosfstools e2fsprogs gptfdisk grub efibootmgr", 1);
+            run_command("pacman -Sy --noconfirm --needed arch-install-scripts e2fsprogs grub efibootmgr", 1);
         } else if (strcmp(pkg_manager, "apt") == 0) {
-            run_command("apt-get update && apt-get install -y arch-install-scripts dosfstools e2fsprogs gdisk grub-efi-amd64", 1);
+            run_command("apt-get update && apt-get install -y arch-install-scripts e2fsprogs grub-efi-amd64", 1);
         } else if (strcmp(pkg_manager, "dnf") == 0 || strcmp(pkg_manager, "yum") == 0) {
-            run_command("dnf install -y arch-install-scripts dosfstools e2fsprogs gdisk grub2-efi-x64", 1);
+            run_command("dnf install -y arch-install-scripts e2fsprogs grub2-efi-x64", 1);
         }
 
         // Verify installation
@@ -149,6 +148,7 @@ long get_available_space(const char *path) {
 
 // Check system requirements
 void check_system_requirements() {
+    log_pause();
     SystemInfo info;
     get_system_info(&info);
 
@@ -204,12 +204,14 @@ void check_system_requirements() {
     mvprintw(16, 5, "Press any key to continue...");
     refresh();
     getch();
+    log_resume();
 }
 
 
 
 // Enhanced hardware information display
 void show_hardware_info() {
+    log_pause();
     SystemInfo sys_info;
     get_system_info(&sys_info);
 
@@ -336,4 +338,5 @@ void show_hardware_info() {
 
     refresh();
     getch();
+    log_resume();
 }
@@ -0,0 +1,596 @@
+/**
+ * @file target_config.c
+ * @brief generate the target's /etc from a TargetConfig
+ *
+ * All paths are resolved relative to a directory fd of the target root.
+ * Directories are opened with openat2(RESOLVE_IN_ROOT), so ".." and
+ * absolute symlinks inside the target resolve against the target root
+ * instead of the live system; files are then created, renamed and
+ * linked by their last component within that directory. Kernels before
+ * 5.6 fall back to plain openat(), which follows such symlinks.
+ */
+
+#define _GNU_SOURCE
+#include <crypt.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "target_config.h"
+#include "../utils/log_message.h"
+
+#define TC_TMP_SUFFIX ".lainux-new"
+
+/* Growable text buffer */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} TextBuf;
+
+static int buf_printf(TextBuf *b, const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        size_t room = b->cap - b->len;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->data ? b->data + b->len : NULL, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) return -1;
+        if ((size_t)n < room) {
+            b->len += (size_t)n;
+            return 0;
+        }
+        size_t cap = b->cap ? b->cap * 2 : 1024;
+        while (cap - b->len <= (size_t)n) cap *= 2;
+        char *p = realloc(b->data, cap);
+        if (!p) return -1;
+        b->data = p;
+        b->cap = cap;
+    }
+}
+
+/* Line arrays for the account databases */
+typedef struct {
+    char **v;
+    int n;
+    int cap;
+} Lines;
+
+static int lines_add(Lines *l, char *line) {
+    if (!line) return -1;
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        char **v = realloc(l->v, (size_t)cap * sizeof(*v));
+        if (!v) {
+            free(line);
+            return -1;
+        }
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->n++] = line;
+    return 0;
+}
+
+static void lines_free(Lines *l) {
+    for (int i = 0; i < l->n; i++) free(l->v[i]);
+    free(l->v);
+    memset(l, 0, sizeof(*l));
+}
+
+// Entry whose first field is name, -1 if none
+static int lines_find(const Lines *l, const char *name) {
+    size_t len = strlen(name);
+    for (int i = 0; i < l->n; i++) {
+        if (strncmp(l->v[i], name, len) == 0 && l->v[i][len] == ':') return i;
+    }
+    return -1;
+}
+
+// Copy field idx (0-based, ':' separated) of line into out
+static void get_field(const char *line, int idx, char *out, size_t out_len) {
+    const char *p = line;
+    for (int i = 0; i < idx && p; i++) {
+        p = strchr(p, ':');
+        if (p) p++;
+    }
+    size_t n = p ? strcspn(p, ":") : 0;
+    if (n >= out_len) n = out_len - 1;
+    memcpy(out, p ? p : "", n);
+    out[n] = '\0';
+}
+
+// Replace field idx of *line with value
+static int set_field(char **line, int idx, const char *value) {
+    char *p = *line;
+    for (int i = 0; i < idx; i++) {
+        p = strchr(p, ':');
+        if (!p) return -1;
+        p++;
+    }
+    size_t head = (size_t)(p - *line);
+    const char *tail = p + strcspn(p, ":");
+    char *out = NULL;
+    if (asprintf(&out, "%.*s%s%s", (int)head, *line, value, tail) < 0) return -1;
+    free(*line);
+    *line = out;
+    return 0;
+}
+
+// Add user to the member list (field 3 of group and gshadow)
+static int add_member(char **line, const char *user) {
+    char members[1024], check[1060];
+    get_field(*line, 3, members, sizeof(members));
+    snprintf(check, sizeof(check), ",%s,", members);
+    char needle[64];
+    snprintf(needle, sizeof(needle), ",%s,", user);
+    if (strstr(check, needle)) return 0;
+
+    char value[1100];
+    snprintf(value, sizeof(value), "%s%s%s", members, members[0] ? "," : "", user);
+    return set_field(line, 3, value);
+}
+
+/* Path resolution inside the target */
+
+// openat() confined to the tree below rootfd when the kernel allows it
+static int open_in_root(int rootfd, const char *rel, int flags, mode_t mode) {
+    static int no_openat2;
+    if (!no_openat2) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = (unsigned)flags;
+        how.mode = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS;
+        int fd = (int)syscall(SYS_openat2, rootfd, rel, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS) return fd;
+        no_openat2 = 1;
+    }
+    return openat(rootfd, rel, flags, mode);
+}
+
+// Directory holding rel, for *at() calls on *leaf (its last component)
+static int open_parent(int rootfd, const char *rel, const char **leaf) {
+    char dir[256];
+    const char *slash = strrchr(rel, '/');
+    *leaf = slash ? slash + 1 : rel;
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - rel) : 1, slash ? rel : ".");
+    return open_in_root(rootfd, dir, O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+}
+
+static char *read_text(int rootfd, const char *rel) {
+    int fd = open_in_root(rootfd, rel, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+
+    TextBuf b = {NULL, 0, 0};
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        if (buf_printf(&b, "%.*s", (int)n, chunk) != 0) break;
+    }
+    close(fd);
+    if (n != 0) {
+        free(b.data);
+        return NULL;
+    }
+    if (!b.data) b.data = strdup("");
+    return b.data;
+}
+
+static int load_lines(int rootfd, const char *rel, Lines *l) {
+    memset(l, 0, sizeof(*l));
+    char *text = read_text(rootfd, rel);
+    if (!text) return -1;
+    char *save = NULL;
+    for (char *line = strtok_r(text, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+        if (lines_add(l, strdup(line)) != 0) {
+            free(text);
+            lines_free(l);
+            return -1;
+        }
+    }
+    free(text);
+    return 0;
+}
+
+// Write rel atomically: temp file, fsync, rename over the old one
+static int write_atomic(int rootfd, const char *rel, const char *data,
+                        size_t len, mode_t mode) {
+    char tmp[256];
+    const char *leaf;
+    int dir = open_parent(rootfd, rel, &leaf);
+    if (dir < 0) {
+        log_message("Cannot open the directory of /%s: %s", rel, strerror(errno));
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "%s" TC_TMP_SUFFIX, leaf);
+
+    unlinkat(dir, tmp, 0);
+    int fd = openat(dir, tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+    if (fd < 0) {
+        log_message("Cannot create /%s" TC_TMP_SUFFIX ": %s", rel, strerror(errno));
+        close(dir);
+        return -1;
+    }
+
+    int rc = 0;
+    size_t off = 0;
+    while (off < len && rc == 0) {
+        ssize_t n = write(fd, data + off, len - off);
+        if (n < 0 && errno != EINTR) rc = -1;
+        if (n > 0) off += (size_t)n;
+    }
+    // umask must not loosen or tighten the intended mode
+    if (rc == 0 && (fchmod(fd, mode) != 0 || fsync(fd) != 0)) rc = -1;
+    close(fd);
+    if (rc == 0 && renameat(dir, tmp, dir, leaf) != 0) rc = -1;
+    if (rc != 0) {
+        log_message("Writing /%s failed: %s", rel, strerror(errno));
+        unlinkat(dir, tmp, 0);
+    }
+    close(dir);
+    return rc;
+}
+
+static int write_lines(int rootfd, const char *rel, const Lines *l, mode_t mode) {
+    TextBuf b = {NULL, 0, 0};
+    for (int i = 0; i < l->n; i++) {
+        if (buf_printf(&b, "%s\n", l->v[i]) != 0) {
+            free(b.data);
+            return -1;
+        }
+    }
+    int rc = write_atomic(rootfd, rel, b.data ? b.data : "", b.len, mode);
+    free(b.data);
+    return rc;
+}
+
+static int write_string(int rootfd, const char *rel, const char *text, mode_t mode) {
+    return write_atomic(rootfd, rel, text, strlen(text), mode);
+}
+
+void target_config_defaults(TargetConfig *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    snprintf(cfg->hostname, sizeof(cfg->hostname), "lainux");
+    snprintf(cfg->timezone, sizeof(cfg->timezone), "UTC");
+    snprintf(cfg->lang, sizeof(cfg->lang), "en_US.UTF-8");
+    target_config_add_locale(cfg, "en_US.UTF-8");
+    cfg->sudo_wheel = 1;
+}
+
+int target_config_add_locale(TargetConfig *cfg, const char *locale) {
+    if (cfg->locale_count >= TC_MAX_LOCALES) return -1;
+    snprintf(cfg->locales[cfg->locale_count++], sizeof(cfg->locales[0]), "%s", locale);
+    return 0;
+}
+
+int target_config_add_user(TargetConfig *cfg, const char *name,
+                           const char *password, const char *groups,
+                           const char *shell) {
+    if (cfg->user_count >= TC_MAX_USERS) return -1;
+    // Fields end up in colon separated databases
+    if (!name[0] || strpbrk(name, ":\n/ ") || (groups && strpbrk(groups, ":\n "))) {
+        log_message("Invalid user name or groups: %s", name);
+        return -1;
+    }
+    TargetUser *u = &cfg->users[cfg->user_count++];
+    snprintf(u->name, sizeof(u->name), "%s", name);
+    snprintf(u->password, sizeof(u->password), "%s", password ? password : "");
+    snprintf(u->groups, sizeof(u->groups), "%s", groups ? groups : "");
+    snprintf(u->shell, sizeof(u->shell), "%s", shell ? shell : "/bin/bash");
+    return 0;
+}
+
+void target_config_clear(TargetConfig *cfg) {
+    explicit_bzero(cfg->root_password, sizeof(cfg->root_password));
+    for (int i = 0; i < TC_MAX_USERS; i++) {
+        explicit_bzero(cfg->users[i].password, sizeof(cfg->users[i].password));
+    }
+}
+
+/* Individual files */
+
+static int apply_hostname(int rootfd, const TargetConfig *cfg) {
+    char text[256];
+    snprintf(text, sizeof(text), "%s\n", cfg->hostname);
+    if (write_string(rootfd, "etc/hostname", text, 0644) != 0) return -1;
+
+    snprintf(text, sizeof(text),
+             "127.0.0.1 localhost\n"
+             "::1 localhost\n"
+             "127.0.1.1 %s.localdomain %s\n",
+             cfg->hostname, cfg->hostname);
+    return write_string(rootfd, "etc/hosts", text, 0644);
+}
+
+static int apply_timezone(int rootfd, const TargetConfig *cfg) {
+    char zone[128], link[160];
+    snprintf(zone, sizeof(zone), "usr/share/zoneinfo/%s", cfg->timezone);
+    int zfd = open_in_root(rootfd, zone, O_PATH | O_CLOEXEC, 0);
+    if (zfd < 0) {
+        log_message("Unknown timezone %s", cfg->timezone);
+        return -1;
+    }
+    close(zfd);
+
+    int etc = open_in_root(rootfd, "etc", O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+    if (etc < 0) {
+        log_message("Cannot open /etc: %s", strerror(errno));
+        return -1;
+    }
+    // Same temp + rename dance as files: /etc/localtime is never missing
+    int rc = 0;
+    snprintf(link, sizeof(link), "/%s", zone);
+    unlinkat(etc, "localtime" TC_TMP_SUFFIX, 0);
+    if (symlinkat(link, etc, "localtime" TC_TMP_SUFFIX) != 0 ||
+        renameat(etc, "localtime" TC_TMP_SUFFIX, etc, "localtime") != 0) {
+        log_message("Cannot link /etc/localtime: %s", strerror(errno));
+        unlinkat(etc, "localtime" TC_TMP_SUFFIX, 0);
+        rc = -1;
+    }
+    close(etc);
+    return rc;
+}
+
+static int apply_locale(int rootfd, const TargetConfig *cfg) {
+    TextBuf gen = {NULL, 0, 0};
+    int rc = 0;
+
+    for (int i = 0; i < cfg->locale_count && rc == 0; i++) {
+        const char *dot = strchr(cfg->locales[i], '.');
+        rc = buf_printf(&gen, "%s %s\n", cfg->locales[i], dot ? dot + 1 : "ISO-8859-1");
+    }
+    if (rc == 0) {
+        rc = write_atomic(rootfd, "etc/locale.gen", gen.data ? gen.data : "", gen.len,
+                          0644);
+    }
+    free(gen.data);
+
+    char text[96];
+    snprintf(text, sizeof(text), "LANG=%s\n", cfg->lang);
+    if (rc == 0) rc = write_string(rootfd, "etc/locale.conf", text, 0644);
+
+    if (rc == 0 && cfg->keymap[0]) {
+        snprintf(text, sizeof(text), "KEYMAP=%s\n", cfg->keymap);
+        rc = write_string(rootfd, "etc/vconsole.conf", text, 0644);
+    }
+    return rc;
+}
+
+static int apply_sudoers(int rootfd, const TargetConfig *cfg) {
+    if (!cfg->sudo_wheel) return 0;
+    int etc = open_in_root(rootfd, "etc", O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+    if (etc >= 0) {
+        mkdirat(etc, "sudoers.d", 0750);
+        close(etc);
+    }
+    return write_string(rootfd, "etc/sudoers.d/wheel", "%wheel ALL=(ALL:ALL) ALL\n", 0440);
+}
+
+/* Accounts */
+
+static int hash_password(const char *password, char *out, size_t out_len) {
+    struct crypt_data data;
+    char salt[CRYPT_GENSALT_OUTPUT_SIZE];
+
+    // NULL entropy: libcrypt reads the salt from the kernel itself
+    if (!crypt_gensalt_rn(TC_HASH_PREFIX, 0, NULL, 0, salt, sizeof(salt)) &&
+        !crypt_gensalt_rn(TC_HASH_FALLBACK, 0, NULL, 0, salt, sizeof(salt))) {
+        return -1;
+    }
+    memset(&data, 0, sizeof(data));
+    const char *hash = crypt_r(password, salt, &data);
+    int rc = (hash && hash[0] != '*' && strlen(hash) < out_len) ? 0 : -1;
+    if (rc == 0) snprintf(out, out_len, "%s", hash);
+    explicit_bzero(&data, sizeof(data));
+    return rc;
+}
+
+static int id_used(const Lines *l, unsigned id) {
+    char field[16];
+    for (int i = 0; i < l->n; i++) {
+        get_field(l->v[i], 2, field, sizeof(field));
+        if (field[0] && strtoul(field, NULL, 10) == id) return 1;
+    }
+    return 0;
+}
+
+// Fresh home: /etc/skel contents, everything owned by the user
+static void create_home(int rootfd, const TargetUser *u, unsigned uid, unsigned gid) {
+    mkdirat(rootfd, "home", 0755);
+    int homes = open_in_root(rootfd, "home", O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+    if (homes < 0) return;
+    if (mkdirat(homes, u->name, 0700) != 0) {       // exists: leave alone
+        close(homes);
+        return;
+    }
+    fchownat(homes, u->name, uid, gid, AT_SYMLINK_NOFOLLOW);
+    int home = openat(homes, u->name, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    close(homes);
+
+    int skel = open_in_root(rootfd, "etc/skel", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+    DIR *dir = skel >= 0 && home >= 0 ? fdopendir(skel) : NULL;
+    if (!dir) {
+        if (skel >= 0) close(skel);
+        if (home >= 0) close(home);
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        struct stat st;
+        if (fstatat(skel, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+            !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        int in = openat(skel, de->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        int out = openat(home, de->d_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                         st.st_mode & 0777);
+        if (in >= 0 && out >= 0) {
+            char chunk[8192];
+            ssize_t n;
+            while ((n = read(in, chunk, sizeof(chunk))) > 0) {
+                if (write(out, chunk, (size_t)n) != n) break;
+            }
+            fchown(out, uid, gid);
+        }
+        if (in >= 0) close(in);
+        if (out >= 0) close(out);
+    }
+    closedir(dir);
+    close(home);
+}
+
+static int apply_users(int rootfd, const TargetConfig *cfg) {
+    Lines passwd, shadow, group, gshadow;
+    char hash[256], field[32];
+    int rc = -1;
+    int have_gshadow;
+
+    if (load_lines(rootfd, "etc/passwd", &passwd) != 0) {
+        log_message("Target has no /etc/passwd");
+        return -1;
+    }
+    if (load_lines(rootfd, "etc/shadow", &shadow) != 0 ||
+        load_lines(rootfd, "etc/group", &group) != 0) {
+        log_message("Target has no /etc/shadow or /etc/group");
+        lines_free(&passwd);
+        lines_free(&shadow);
+        return -1;
+    }
+    have_gshadow = load_lines(rootfd, "etc/gshadow", &gshadow) == 0;
+
+    long days = (long)(time(NULL) / 86400);
+
+    if (cfg->root_password[0]) {
+        int i = lines_find(&shadow, "root");
+        if (i < 0 || hash_password(cfg->root_password, hash, sizeof(hash)) != 0 ||
+            set_field(&shadow.v[i], 1, hash) != 0) {
+            log_message("Cannot set the root password");
+            goto out;
+        }
+        snprintf(field, sizeof(field), "%ld", days);
+        set_field(&shadow.v[i], 2, field);
+    }
+
+    for (int u = 0; u < cfg->user_count; u++) {
+        const TargetUser *user = &cfg->users[u];
+        unsigned uid, gid;
+        int i = lines_find(&passwd, user->name);
+
+        if (i >= 0) {
+            // Resumed install: keep the account, refresh password/groups
+            get_field(passwd.v[i], 2, field, sizeof(field));
+            uid = (unsigned)strtoul(field, NULL, 10);
+            get_field(passwd.v[i], 3, field, sizeof(field));
+            gid = (unsigned)strtoul(field, NULL, 10);
+        } else {
+            // User private group with the same number, like useradd
+            for (uid = TC_FIRST_UID; id_used(&passwd, uid) || id_used(&group, uid); uid++) {
+            }
+            gid = uid;
+            char *line = NULL;
+            if (asprintf(&line, "%s:x:%u:%u::/home/%s:%s", user->name, uid, gid,
+                         user->name, user->shell) < 0 ||
+                lines_add(&passwd, line) != 0) {
+                goto out;
+            }
+            if (lines_find(&group, user->name) < 0) {
+                if (asprintf(&line, "%s:x:%u:", user->name, gid) < 0 ||
+                    lines_add(&group, line) != 0) {
+                    goto out;
+                }
+                if (have_gshadow && (asprintf(&line, "%s:!::", user->name) < 0 ||
+                                     lines_add(&gshadow, line) != 0)) {
+                    goto out;
+                }
+            }
+        }
+
+        if (user->password[0]) {
+            if (hash_password(user->password, hash, sizeof(hash)) != 0) {
+                log_message("Cannot hash the password for %s", user->name);
+                goto out;
+            }
+        } else {
+            snprintf(hash, sizeof(hash), "!");
+        }
+        int s = lines_find(&shadow, user->name);
+        if (s >= 0) {
+            if (set_field(&shadow.v[s], 1, hash) != 0) goto out;
+        } else {
+            char *line = NULL;
+            if (asprintf(&line, "%s:%s:%ld:0:99999:7:::", user->name, hash, days) < 0 ||
+                lines_add(&shadow, line) != 0) {
+                goto out;
+            }
+        }
+
+        // Supplementary groups
+        char groups[128];
+        char *save = NULL;
+        snprintf(groups, sizeof(groups), "%s", user->groups);
+        for (char *g = strtok_r(groups, ",", &save); g; g = strtok_r(NULL, ",", &save)) {
+            int gi = lines_find(&group, g);
+            if (gi < 0) {
+                log_message("Group %s does not exist, skipped for %s", g, user->name);
+                continue;
+            }
+            if (add_member(&group.v[gi], user->name) != 0) goto out;
+            int gs = have_gshadow ? lines_find(&gshadow, g) : -1;
+            if (gs >= 0 && add_member(&gshadow.v[gs], user->name) != 0) goto out;
+        }
+
+        create_home(rootfd, user, uid, gid);
+        log_message("User %s (uid %u) configured", user->name, uid);
+    }
+
+    // Groups first: a passwd entry never points at a missing group
+    rc = write_lines(rootfd, "etc/group", &group, 0644);
+    if (rc == 0 && have_gshadow) rc = write_lines(rootfd, "etc/gshadow", &gshadow, 0600);
+    if (rc == 0) rc = write_lines(rootfd, "etc/passwd", &passwd, 0644);
+    if (rc == 0) rc = write_lines(rootfd, "etc/shadow", &shadow, 0600);
+
+out:
+    explicit_bzero(hash, sizeof(hash));
+    // shadow lines hold hashes only, still no reason to leave them around
+    for (int i = 0; i < shadow.n; i++) explicit_bzero(shadow.v[i], strlen(shadow.v[i]));
+    lines_free(&passwd);
+    lines_free(&shadow);
+    lines_free(&group);
+    if (have_gshadow) lines_free(&gshadow);
+    return rc;
+}
+
+int target_config_apply(const TargetConfig *cfg, const char *root, int parts) {
+    int rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootfd < 0) {
+        log_message("Cannot open target root %s: %s", root, strerror(errno));
+        return -1;
+    }
+
+    int rc = 0;
+    if ((parts & TC_HOSTNAME) && apply_hostname(rootfd, cfg) != 0) rc = -1;
+    if ((parts & TC_TIMEZONE) && apply_timezone(rootfd, cfg) != 0) rc = -1;
+    if ((parts & TC_LOCALE) && apply_locale(rootfd, cfg) != 0) rc = -1;
+    if ((parts & TC_USERS) && apply_users(rootfd, cfg) != 0) rc = -1;
+    if ((parts & TC_SUDOERS) && apply_sudoers(rootfd, cfg) != 0) rc = -1;
+
+    // Make the renames durable
+    int etc = open_in_root(rootfd, "etc", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+    if (etc >= 0) {
+        fsync(etc);
+        close(etc);
+    }
+    close(rootfd);
+    return rc;
+}
@@ -0,0 +1,63 @@
+#ifndef TARGET_CONFIG_H
+#define TARGET_CONFIG_H
+
+/*
+ * Typed writer for the target's /etc.
+ * One TargetConfig describes hostname, timezone, locales, accounts and
+ * sudo policy; target_config_apply() generates the files directly under
+ * the target root. Every file is written to a temporary name, synced
+ * and renamed into place, so a crash never leaves half a passwd behind.
+ * Accounts go straight into passwd/shadow/group/gshadow with passwords
+ * hashed by libcrypt - no useradd/chpasswd, no shell quoting.
+ */
+
+#define TC_MAX_LOCALES 4
+#define TC_MAX_USERS 4
+#define TC_FIRST_UID 1000
+#define TC_HASH_PREFIX "$y$"       // yescrypt, Arch's default
+#define TC_HASH_FALLBACK "$6$"     // sha512crypt
+
+// Parts for target_config_apply()
+#define TC_HOSTNAME 0x01   // /etc/hostname, /etc/hosts
+#define TC_TIMEZONE 0x02   // /etc/localtime -> zoneinfo
+#define TC_LOCALE   0x04   // /etc/locale.gen, /etc/locale.conf, vconsole.conf
+#define TC_USERS    0x08   // root password, accounts, home directories
+#define TC_SUDOERS  0x10   // /etc/sudoers.d/wheel
+#define TC_ALL      0x1F
+
+typedef struct {
+    char name[32];
+    char password[128];    // plain text, hashed on write; "" - locked
+    char groups[128];      // comma separated supplementary groups
+    char shell[64];
+} TargetUser;
+
+typedef struct {
+    char hostname[64];
+    char timezone[64];     // zoneinfo name, e.g. "UTC", "Europe/Moscow"
+    char locales[TC_MAX_LOCALES][32];  // locale.gen entries, "en_US.UTF-8"
+    int locale_count;
+    char lang[32];         // LANG= in locale.conf
+    char keymap[32];       // KEYMAP= in vconsole.conf, "" - skip
+    char root_password[128];           // "" - leave root as is
+    TargetUser users[TC_MAX_USERS];
+    int user_count;
+    int sudo_wheel;        // members of wheel may use sudo
+} TargetConfig;
+
+// Lainux defaults: host "lainux", UTC, en_US.UTF-8, no users
+void target_config_defaults(TargetConfig *cfg);
+
+// Append a locale (e.g. "ru_RU.UTF-8") / a user. Return 0, -1 when full
+int target_config_add_locale(TargetConfig *cfg, const char *locale);
+int target_config_add_user(TargetConfig *cfg, const char *name,
+                           const char *password, const char *groups,
+                           const char *shell);
+
+// Write the selected TC_* parts below root. Returns 0 when all succeeded
+int target_config_apply(const TargetConfig *cfg, const char *root, int parts);
+
+// Wipe passwords from cfg
+void target_config_clear(TargetConfig *cfg);
+
+#endif // target config h
@@ -7,6 +7,7 @@
 // headers
 #include "ui.h"
 #include "../locale/lang.h"
+#include "../utils/log_message.h"
 #include "../utils/run_command.h"
 
 // Initialize ncurses with error handling
@@ -42,6 +43,7 @@ void init_ncurses() {
 
 // Enhanced confirmation with timeout
 int confirm_action(const char *question, const char *required_input) {
+    log_pause();
     int max_y, max_x;
     getmaxyx(stdscr, max_y, max_x);
     WINDOW *confirm_win = newwin(8, max_x - 20, max_y/2 - 4, 10);
@@ -62,6 +64,7 @@ int confirm_action(const char *question, const char *required_input) {
 
         if (ch == 27) { // ESC
             delwin(confirm_win);
+            log_resume();
             return 0;
         }
         if (ch == '\n' || ch == '\r') { // Enter
@@ -84,6 +87,7 @@ int confirm_action(const char *question, const char *required_input) {
     }
 
     delwin(confirm_win);
+    log_resume();
     return (strcmp(input, required_input) == 0);
 }
 
@@ -92,12 +96,15 @@ int confirm_action(const char *question, const char *required_input) {
 
 // Display status message
 void display_status(const char *message) {
+    // Pipeline workers update it too: draw under the renderer's lock
+    pthread_mutex_lock(&log_mutex);
     if (status_win) {
         wclear(status_win);
         box(status_win, 0, 0);
         mvwprintw(status_win, 1, 2, " STATUS: %s", message);
         wrefresh(status_win);
     }
+    pthread_mutex_unlock(&log_mutex);
 }
 
 
@@ -128,6 +135,7 @@ void draw_progress_bar(int y, int x, int width, float progress) {
 
 // Show installation summary
 void show_summary(const char *disk) {
+    log_pause();
     clear();
 
     int max_y, max_x;
@@ -184,4 +192,5 @@ void show_summary(const char *disk) {
             break;
         }
     }
+    log_resume();
 }
@@ -0,0 +1,572 @@
+/**
+ * @file chroot_session.c
+ * @brief run a batch of configuration actions inside the target root
+ *
+ * One session replaces a series of arch-chroot calls, each of which
+ * would set up and tear down the same API mounts. The helper process
+ * owns private mount and PID namespaces, so cleanup is implicit.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chroot_session.h"
+#include "log_message.h"
+#include "process.h"
+
+#define CHROOT_PATH "/usr/local/sbin:/usr/local/bin:/usr/bin:/usr/sbin:/bin:/sbin"
+
+extern char **environ;
+
+// Result of one action, sent from the helper to the installer
+typedef struct {
+    int index;        // action index, -1 - session setup
+    int rc;
+    int err;          // errno of the failed call, 0 - see msg
+    char msg[244];    // what failed, or the command's last stderr line
+} ChrootReport;
+
+typedef struct {
+    const char *source;
+    const char *target;   // relative to the root
+    const char *fstype;
+    unsigned long flags;
+    const char *data;
+    int if_exists;        // only when the host has target too
+} ChrootMount;
+
+static const ChrootMount api_mounts[] = {
+    {"proc", "/proc", "proc", MS_NOSUID | MS_NOEXEC | MS_NODEV, NULL, 0},
+    {"sys", "/sys", "sysfs", MS_NOSUID | MS_NOEXEC | MS_NODEV | MS_RDONLY, NULL, 0},
+    {"efivarfs", "/sys/firmware/efi/efivars", "efivarfs",
+     MS_NOSUID | MS_NOEXEC | MS_NODEV, NULL, 1},
+    {"udev", "/dev", "devtmpfs", MS_NOSUID, "mode=0755", 0},
+    {"devpts", "/dev/pts", "devpts", MS_NOSUID | MS_NOEXEC, "mode=0620,gid=5", 0},
+    {"shm", "/dev/shm", "tmpfs", MS_NOSUID | MS_NODEV, "mode=1777", 0},
+    {"run", "/run", "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755", 0},
+    {"tmp", "/tmp", "tmpfs", MS_STRICTATIME | MS_NODEV | MS_NOSUID, "mode=1777", 0},
+};
+
+void chroot_begin(ChrootSession *s, const char *root) {
+    memset(s, 0, sizeof(*s));
+    snprintf(s->root, sizeof(s->root), "%s", root);
+}
+
+static ChrootAction *next_action(ChrootSession *s, ChrootActionKind kind, int flags) {
+    if (s->count >= CHROOT_MAX_ACTIONS) {
+        s->overflow = 1;
+        return NULL;
+    }
+    ChrootAction *a = &s->actions[s->count++];
+    memset(a, 0, sizeof(*a));
+    a->kind = kind;
+    a->flags = flags;
+    return a;
+}
+
+int chroot_add_run(ChrootSession *s, const char *const argv[],
+                   const char *input, int flags) {
+    int argc = 0;
+    while (argv[argc]) argc++;
+    if (argc == 0 || argc >= CHROOT_MAX_ARGS ||
+        (input && strlen(input) > CHROOT_MAX_INPUT)) {
+        s->overflow = 1;
+        return -1;
+    }
+
+    ChrootAction *a = next_action(s, CHROOT_RUN, flags);
+    if (!a) return -1;
+    for (int i = 0; i < argc; i++) {
+        a->argv[i] = strdup(argv[i]);
+    }
+    a->data = input ? strdup(input) : NULL;
+    return 0;
+}
+
+int chroot_add_write(ChrootSession *s, const char *path, const char *contents,
+                     mode_t mode, int flags) {
+    ChrootAction *a = next_action(s, CHROOT_WRITE, flags);
+    if (!a) return -1;
+    a->path = strdup(path);
+    a->data = strdup(contents);
+    a->mode = mode;
+    return 0;
+}
+
+int chroot_add_symlink(ChrootSession *s, const char *target, const char *path,
+                       int flags) {
+    ChrootAction *a = next_action(s, CHROOT_SYMLINK, flags);
+    if (!a) return -1;
+    a->path = strdup(path);
+    a->data = strdup(target);
+    return 0;
+}
+
+void chroot_discard(ChrootSession *s) {
+    for (int i = 0; i < s->count; i++) {
+        ChrootAction *a = &s->actions[i];
+        for (int j = 0; a->argv[j]; j++) free(a->argv[j]);
+        free(a->path);
+        free(a->data);
+    }
+    s->count = 0;
+    s->overflow = 0;
+}
+
+/* Helper side: everything below runs in the forked session process */
+
+// The installer is multi-threaded, so between fork() and exit the
+// session process sticks to async-signal-safe calls: no malloc, stdio,
+// setenv or log_message. All paths and the environment come prepared.
+
+#define CHROOT_API_MOUNTS (sizeof(api_mounts) / sizeof(api_mounts[0]))
+#define CHROOT_SEARCH_DIRS 6      // entries in CHROOT_PATH
+
+typedef struct {
+    char mount_path[CHROOT_API_MOUNTS][512];
+    char resolv_path[512];
+    char tmp_path[CHROOT_MAX_ACTIONS][512];     // WRITE: temp file next to path
+    char exec_path[CHROOT_MAX_ACTIONS][CHROOT_SEARCH_DIRS][256];  // RUN: argv[0]
+    char **envp;                                // environ with CHROOT_PATH
+} ChrootPlan;
+
+// Bounded strcat that only needs strlen/memcpy
+static void append(char *dst, size_t size, const char *src) {
+    size_t len = strlen(dst), n = strlen(src);
+    if (len + 1 >= size) return;
+    if (n > size - len - 1) n = size - len - 1;
+    memcpy(dst + len, src, n);
+    dst[len + n] = '\0';
+}
+
+static void report(int fd, int index, int rc, int err, const char *msg) {
+    ChrootReport r;
+    memset(&r, 0, sizeof(r));
+    r.index = index;
+    r.rc = rc;
+    r.err = err;
+    append(r.msg, sizeof(r.msg), msg ? msg : "");
+    // Well below PIPE_BUF, so records never interleave
+    if (write(fd, &r, sizeof(r)) < 0) {
+        // installer is gone, nothing to tell
+    }
+}
+
+static int setup_mounts(const ChrootPlan *plan, int fd) {
+    char msg[248];
+
+    // Nothing mounted from here on leaks to the host
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) {
+        report(fd, -1, -1, errno, "cannot make / private");
+        return -1;
+    }
+
+    for (size_t i = 0; i < CHROOT_API_MOUNTS; i++) {
+        const ChrootMount *m = &api_mounts[i];
+        const char *path = plan->mount_path[i];
+        if (m->if_exists && access(m->target, F_OK) != 0) {
+            continue;
+        }
+        mkdir(path, 0755);
+        if (mount(m->source, path, m->fstype, m->flags, m->data) == 0) {
+            continue;
+        }
+        // Restricted hosts (containers) refuse fresh instances: reuse theirs
+        if (mount(m->target, path, NULL, MS_BIND | MS_REC, NULL) != 0) {
+            int err = errno;
+            if (m->if_exists) continue;
+            msg[0] = '\0';
+            append(msg, sizeof(msg), "mount ");
+            append(msg, sizeof(msg), m->fstype);
+            append(msg, sizeof(msg), " on ");
+            append(msg, sizeof(msg), path);
+            report(fd, -1, -1, err, msg);
+            return -1;
+        }
+    }
+
+    // Host DNS for pacman and friends, unless the target manages its own
+    struct stat st;
+    const char *resolv = plan->resolv_path;
+    if (access("/etc/resolv.conf", R_OK) == 0 &&
+        (lstat(resolv, &st) != 0 || S_ISREG(st.st_mode))) {
+        int tfd = open(resolv, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (tfd >= 0) close(tfd);
+        mount("/etc/resolv.conf", resolv, NULL, MS_BIND, NULL);
+    }
+    return 0;
+}
+
+static int write_file(const ChrootAction *a, const char *tmp, int *err) {
+    size_t len = strlen(a->data);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, a->mode);
+    if (fd < 0) {
+        *err = errno;
+        return -1;
+    }
+    int rc = (write(fd, a->data, len) == (ssize_t)len && fchmod(fd, a->mode) == 0 &&
+              fsync(fd) == 0) ? 0 : -1;
+    if (rc != 0) *err = errno;
+    close(fd);
+    if (rc == 0 && rename(tmp, a->path) != 0) {
+        *err = errno;
+        rc = -1;
+    }
+    if (rc != 0) unlink(tmp);
+    return rc;
+}
+
+static long long elapsed_ms(const struct timespec *t0) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - t0->tv_sec) * 1000LL + (t.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+// Keep the last non-empty stderr line of the command in msg
+static void take_stderr(const char *buf, ssize_t n, char *line, size_t *line_len,
+                        char *msg, size_t msg_len) {
+    for (ssize_t i = 0; i < n; i++) {
+        if (buf[i] != '\n') {
+            if (*line_len + 1 < msg_len) line[(*line_len)++] = buf[i];
+            continue;
+        }
+        if (*line_len > 0) {
+            line[*line_len] = '\0';
+            msg[0] = '\0';
+            append(msg, msg_len, line);
+            *line_len = 0;
+        }
+    }
+}
+
+static int run_command(const ChrootAction *a, const char (*exec_path)[256], char **envp,
+                       char *msg, size_t msg_len, int *err) {
+    int in_fd = -1, null_fd = -1, errp[2] = {-1, -1};
+
+    if (a->data) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            *err = errno;
+            return -1;
+        }
+        // Input is capped well below the pipe size, no reader needed yet
+        if (write(fds[1], a->data, strlen(a->data)) < 0) {
+            *err = errno;
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+        close(fds[1]);
+        in_fd = fds[0];
+    } else {
+        in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (in_fd < 0 || null_fd < 0 || pipe2(errp, O_CLOEXEC) != 0) {
+        *err = errno;
+        if (in_fd >= 0) close(in_fd);
+        if (null_fd >= 0) close(null_fd);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(in_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(errp[1], STDERR_FILENO);
+        int exec_err = ENOENT;
+        for (int i = 0; i < CHROOT_SEARCH_DIRS && exec_path[i][0]; i++) {
+            execve(exec_path[i], a->argv, envp);
+            if (errno != ENOENT) exec_err = errno;
+        }
+        const char *why = exec_err == ENOENT ? ": command not found\n" : ": cannot execute\n";
+        if (write(STDERR_FILENO, a->argv[0], strlen(a->argv[0])) < 0 ||
+            write(STDERR_FILENO, why, strlen(why)) < 0) {
+            // nobody to tell
+        }
+        _exit(127);
+    }
+    int fork_err = errno;
+    close(in_fd);
+    close(null_fd);
+    close(errp[1]);
+    if (pid < 0) {
+        close(errp[0]);
+        *err = fork_err;
+        return -1;
+    }
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long long deadline = CHROOT_TIMEOUT * 1000LL;
+    char buf[1024], line[248];
+    size_t line_len = 0;
+    int status = 0, reaped = 0, kills = 0;
+
+    while (!reaped || errp[0] >= 0) {
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            reaped = 1;
+        } else if (elapsed_ms(&t0) >= deadline) {
+            kill(-pid, kills++ ? SIGKILL : SIGTERM);
+            deadline += PROC_KILL_GRACE_MS;
+        }
+
+        // Once reaped only what is already buffered is read: daemons the
+        // command started may hold stderr open
+        struct pollfd pfd = {errp[0], POLLIN, 0};
+        int nfds = errp[0] >= 0 ? 1 : 0;
+        if (poll(&pfd, nfds, reaped ? 0 : 100) <= 0 || !nfds) {
+            if (reaped) break;
+            continue;
+        }
+        ssize_t n = read(errp[0], buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(errp[0]);
+            errp[0] = -1;
+            continue;
+        }
+        take_stderr(buf, n, line, &line_len, msg, msg_len);
+    }
+    if (errp[0] >= 0) close(errp[0]);
+    if (line_len > 0) {
+        line[line_len] = '\0';
+        msg[0] = '\0';
+        append(msg, msg_len, line);
+    }
+
+    if (kills) {
+        msg[0] = '\0';
+        append(msg, msg_len, "timed out");
+        return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int run_action(const ChrootSession *s, const ChrootPlan *plan, int i,
+                      char *msg, size_t msg_len, int *err) {
+    const ChrootAction *a = &s->actions[i];
+    switch (a->kind) {
+    case CHROOT_WRITE:
+        return write_file(a, plan->tmp_path[i], err);
+
+    case CHROOT_SYMLINK:
+        if ((unlink(a->path) != 0 && errno != ENOENT) || symlink(a->data, a->path) != 0) {
+            *err = errno;
+            return -1;
+        }
+        return 0;
+
+    case CHROOT_RUN:
+        return run_command(a, plan->exec_path[i], plan->envp, msg, msg_len, err);
+    }
+    return -1;
+}
+
+static int session_main(const ChrootSession *s, const ChrootPlan *plan, int fd) {
+    char msg[248];
+
+    if (setup_mounts(plan, fd) != 0) {
+        return 1;
+    }
+    if (chroot(s->root) != 0 || chdir("/") != 0) {
+        msg[0] = '\0';
+        append(msg, sizeof(msg), "chroot ");
+        append(msg, sizeof(msg), s->root);
+        report(fd, -1, -1, errno, msg);
+        return 1;
+    }
+
+    for (int i = 0; i < s->count; i++) {
+        const ChrootAction *a = &s->actions[i];
+        int err = 0;
+        msg[0] = '\0';
+        int rc = run_action(s, plan, i, msg, sizeof(msg), &err);
+        report(fd, i, rc, err, msg);
+        if (rc != 0 && !(a->flags & CHROOT_OPTIONAL)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Session process: new namespaces, then a child that is PID 1 in them
+static void session_helper(const ChrootSession *s, const ChrootPlan *plan, int fd) {
+    if (unshare(CLONE_NEWNS) != 0) {
+        report(fd, -1, -1, errno, "unshare(CLONE_NEWNS)");
+        _exit(1);
+    }
+    if (unshare(CLONE_NEWPID) != 0) {
+        // No PID namespace: run inline, stray daemons may outlive us
+        _exit(session_main(s, plan, fd));
+    }
+
+    pid_t init = fork();
+    if (init < 0) {
+        _exit(1);
+    }
+    if (init == 0) {
+        _exit(session_main(s, plan, fd));
+    }
+    close(fd);
+
+    int status;
+    while (waitpid(init, &status, 0) < 0 && errno == EINTR) {
+    }
+    _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+/* Installer side */
+
+static const char *action_name(const ChrootAction *a) {
+    return a->kind == CHROOT_RUN ? a->argv[0] : a->path;
+}
+
+#define PLAN_PATH(dst, ...) \
+    ((size_t)snprintf(dst, sizeof(dst), __VA_ARGS__) < sizeof(dst))
+
+// Build every string the session process needs, so it never allocates
+static ChrootPlan *plan_session(const ChrootSession *s) {
+    ChrootPlan *plan = calloc(1, sizeof(*plan));
+    if (!plan) return NULL;
+
+    int ok = 1;
+    for (size_t i = 0; i < CHROOT_API_MOUNTS; i++) {
+        ok &= PLAN_PATH(plan->mount_path[i], "%s%s", s->root, api_mounts[i].target);
+    }
+    ok &= PLAN_PATH(plan->resolv_path, "%s/etc/resolv.conf", s->root);
+
+    for (int i = 0; i < s->count; i++) {
+        const ChrootAction *a = &s->actions[i];
+        if (a->kind == CHROOT_WRITE) {
+            ok &= PLAN_PATH(plan->tmp_path[i], "%s.lainux-tmp", a->path);
+        } else if (a->kind == CHROOT_RUN && strchr(a->argv[0], '/')) {
+            ok &= PLAN_PATH(plan->exec_path[i][0], "%s", a->argv[0]);
+        } else if (a->kind == CHROOT_RUN) {
+            // execvp() is not safe after fork(): resolve against CHROOT_PATH
+            const char *dir = CHROOT_PATH;
+            for (int d = 0; d < CHROOT_SEARCH_DIRS && *dir; d++) {
+                int dlen = (int)strcspn(dir, ":");
+                ok &= PLAN_PATH(plan->exec_path[i][d], "%.*s/%s", dlen, dir, a->argv[0]);
+                dir += dlen + (dir[dlen] == ':');
+            }
+        }
+    }
+    if (!ok) {
+        log_message("Chroot batch for %s has a path that is too long", s->root);
+        free(plan);
+        return NULL;
+    }
+
+    int n = 0;
+    while (environ[n]) n++;
+    plan->envp = calloc((size_t)n + 2, sizeof(char *));
+    if (!plan->envp) {
+        free(plan);
+        return NULL;
+    }
+    int j = 0;
+    plan->envp[j++] = "PATH=" CHROOT_PATH;
+    for (int i = 0; i < n; i++) {
+        if (strncmp(environ[i], "PATH=", 5) != 0) plan->envp[j++] = environ[i];
+    }
+    return plan;
+}
+
+static void plan_free(ChrootPlan *plan) {
+    if (!plan) return;
+    free(plan->envp);
+    free(plan);
+}
+
+int chroot_commit(ChrootSession *s) {
+    if (s->overflow) {
+        log_message("Chroot batch for %s is too large", s->root);
+        chroot_discard(s);
+        return -1;
+    }
+    if (s->count == 0) {
+        return 0;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    ChrootPlan *plan = plan_session(s);
+    int fds[2];
+    if (!plan || pipe2(fds, O_CLOEXEC) != 0) {
+        plan_free(plan);
+        chroot_discard(s);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        log_message("fork failed: %s", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        plan_free(plan);
+        chroot_discard(s);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        session_helper(s, plan, fds[1]);
+    }
+    close(fds[1]);
+    plan_free(plan);
+
+    ChrootReport r;
+    int done = 0, failed = 0;
+    ssize_t n;
+    while ((n = read(fds[0], &r, sizeof(r))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (n != (ssize_t)sizeof(r)) break;
+        r.msg[sizeof(r.msg) - 1] = '\0';
+        if (r.index < 0 || r.index >= s->count) {
+            log_message("Chroot %s: %s%s%s", s->root, r.msg, r.err ? ": " : "",
+                        r.err ? strerror(r.err) : "");
+            failed = 1;
+            continue;
+        }
+        done++;
+        if (r.rc != 0) {
+            const ChrootAction *a = &s->actions[r.index];
+            const char *why = r.err ? strerror(r.err) : r.msg;
+            log_message("Chroot: %s failed (%d)%s%s", action_name(a), r.rc,
+                        why[0] ? ": " : "", why);
+            if (!(a->flags & CHROOT_OPTIONAL)) failed = 1;
+        }
+    }
+    close(fds[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        failed = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    log_message("Chroot session: %d/%d actions in %.2fs", done, s->count,
+                (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    chroot_discard(s);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,66 @@
+#ifndef CHROOT_SESSION_H
+#define CHROOT_SESSION_H
+
+#include <sys/types.h>
+
+/*
+ * Batched chroot sessions.
+ * Actions are queued in memory, then chroot_commit() enters the target
+ * once: a helper process unshares its mount and PID namespaces, mounts
+ * proc/sys/dev/run/tmp under the root, chroots and runs the whole batch.
+ * File actions are done in-process, commands are spawned. When the
+ * helper exits the namespaces go away together with every mount and any
+ * stray daemon, so there is nothing to unmount afterwards.
+ */
+
+#define CHROOT_MAX_ACTIONS 48
+#define CHROOT_MAX_ARGS 16
+#define CHROOT_MAX_INPUT 4096      // stdin data for one command
+#define CHROOT_TIMEOUT 1800        // per command, seconds
+
+#define CHROOT_OPTIONAL 0x01       // failure is logged, batch continues
+
+typedef enum {
+    CHROOT_RUN = 0,
+    CHROOT_WRITE,
+    CHROOT_SYMLINK
+} ChrootActionKind;
+
+typedef struct {
+    ChrootActionKind kind;
+    int flags;
+    char *argv[CHROOT_MAX_ARGS];   // RUN: command line
+    char *path;                    // WRITE/SYMLINK: path inside the root
+    char *data;                    // RUN: stdin, WRITE: contents,
+                                   // SYMLINK: link target
+    mode_t mode;                   // WRITE: file mode
+} ChrootAction;
+
+typedef struct {
+    char root[256];
+    ChrootAction actions[CHROOT_MAX_ACTIONS];
+    int count;
+    int overflow;                  // an action did not fit, commit fails
+} ChrootSession;
+
+void chroot_begin(ChrootSession *s, const char *root);
+
+// Queue a command (argv NULL-terminated, input may be NULL)
+int chroot_add_run(ChrootSession *s, const char *const argv[],
+                   const char *input, int flags);
+// Queue writing path (inside the root) with contents, replacing it
+int chroot_add_write(ChrootSession *s, const char *path, const char *contents,
+                     mode_t mode, int flags);
+// Queue path -> target symlink, replacing an existing entry
+int chroot_add_symlink(ChrootSession *s, const char *target, const char *path,
+                       int flags);
+
+// Enter the root once and run the queued actions in order, stopping at
+// the first failed non-optional one. The queue is released either way.
+// Returns 0 when every required action succeeded.
+int chroot_commit(ChrootSession *s);
+
+// Drop queued actions without running them
+void chroot_discard(ChrootSession *s);
+
+#endif // chroot session h
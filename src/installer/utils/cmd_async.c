@@ -0,0 +1,392 @@
+/**
+ * @file cmd_async.c
+ * @brief asynchronous command executor on top of the process engine
+ *
+ * Every job owns three descriptors (stdout pipe, stderr pipe, pidfd) that
+ * live in a single epoll set. Whoever waits first becomes the poller and
+ * runs epoll_wait without the lock held; other waiters sleep on a
+ * condition variable and are woken after each batch of events. This lets
+ * the UI thread keep drawing while pacstrap, mkfs or grub-install run,
+ * and lets independent jobs overlap.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmd_async.h"
+#include "log_message.h"
+
+#define FD_OUT 0
+#define FD_ERR 1
+#define FD_PID 2
+
+// reap tick for jobs without a pidfd
+#define CMD_REAP_TICK_MS 50
+#define CMD_DRAIN_MS 200
+
+typedef enum { JOB_FREE = 0, JOB_RUNNING, JOB_DONE } JobState;
+
+typedef struct {
+    JobState state;
+    int waited;           // a cmd_wait() caller owns this job
+    pid_t pid;
+    int pidfd;
+    int out_fd;
+    int err_fd;
+    int reaped;
+    int status;
+    struct rusage ru;
+    ProcStream out;
+    ProcStream err;
+    ProcResult res;
+    int flags;
+    int timeout_sec;
+    double start;
+    double deadline;
+    double kill_deadline;
+    double drain_deadline;
+    char label[64];
+} CmdJob;
+
+static CmdJob jobs[CMD_MAX_JOBS];
+static int epoll_fd = -1;
+static int poller_active = 0;
+static pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cmd_cond;
+static pthread_once_t cmd_once = PTHREAD_ONCE_INIT;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void cmd_init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cmd_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        log_message("epoll_create1 failed: %s", strerror(errno));
+    }
+}
+
+static int watch_fd(int fd, int id, int kind) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t)id << 2) | (uint64_t)kind;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void unwatch_fd(int *fd) {
+    if (*fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, *fd, NULL);
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+int cmd_submit(const char *const argv[], const CmdOptions *opts) {
+    pthread_once(&cmd_once, cmd_init);
+    if (epoll_fd < 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&cmd_lock);
+
+    int id = -1;
+    for (int i = 0; i < CMD_MAX_JOBS; i++) {
+        if (jobs[i].state == JOB_FREE) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0) {
+        pthread_mutex_unlock(&cmd_lock);
+        log_message("Executor full (%d jobs), cannot start %s", CMD_MAX_JOBS,
+                    argv[0]);
+        return -1;
+    }
+
+    CmdJob *job = &jobs[id];
+    memset(job, 0, sizeof(*job));
+    job->pidfd = job->out_fd = job->err_fd = -1;
+    job->res.exit_code = -1;
+
+    ProcOptions def_proc = {0, 0, -1, NULL};
+    const ProcOptions *popts = opts ? &opts->proc : &def_proc;
+    job->flags = popts->flags;
+    job->timeout_sec = popts->timeout_sec;
+    snprintf(job->label, sizeof(job->label), "%s",
+             (opts && opts->label) ? opts->label : argv[0]);
+    if (opts) {
+        job->out.on_line = job->err.on_line = opts->on_line;
+        job->out.user = job->err.user = opts->user;
+    }
+
+    job->start = now_sec();
+    job->pid = proc_spawn(argv, popts, &job->out_fd, &job->err_fd);
+    if (job->pid < 0) {
+        job->state = JOB_FREE;
+        pthread_mutex_unlock(&cmd_lock);
+        return -1;
+    }
+
+    job->pidfd = proc_pidfd_open(job->pid);
+    if (job->timeout_sec > 0) {
+        job->deadline = job->start + job->timeout_sec;
+    }
+
+    watch_fd(job->out_fd, id, FD_OUT);
+    watch_fd(job->err_fd, id, FD_ERR);
+    if (job->pidfd >= 0) {
+        watch_fd(job->pidfd, id, FD_PID);
+    }
+    job->state = JOB_RUNNING;
+
+    pthread_mutex_unlock(&cmd_lock);
+    return id;
+}
+
+static void try_reap(CmdJob *job) {
+    if (job->reaped) {
+        return;
+    }
+    if (wait4(job->pid, &job->status, WNOHANG, &job->ru) == job->pid) {
+        job->reaped = 1;
+        job->drain_deadline = now_sec() + CMD_DRAIN_MS / 1000.0;
+        unwatch_fd(&job->pidfd);
+    }
+}
+
+static void finish_job(CmdJob *job) {
+    proc_stream_flush(&job->out, job->flags, 0, &job->res);
+    proc_stream_flush(&job->err, job->flags, 1, &job->res);
+
+    ProcResult *res = &job->res;
+    res->elapsed_sec = now_sec() - job->start;
+    res->peak_rss_kb = job->ru.ru_maxrss;
+    if (WIFEXITED(job->status) && !res->timed_out) {
+        res->exit_code = WEXITSTATUS(job->status);
+    } else if (WIFSIGNALED(job->status)) {
+        res->term_signal = WTERMSIG(job->status);
+    }
+    res->out = job->out.data;
+    res->out_len = job->out.len;
+    res->err = job->err.data;
+    res->err_len = job->err.len;
+    job->out.data = job->err.data = NULL;
+
+    job->state = JOB_DONE;
+}
+
+// Timers: timeouts, reap ticks without pidfd, post-exit drain windows
+static void check_timers(void) {
+    double now = now_sec();
+
+    for (int i = 0; i < CMD_MAX_JOBS; i++) {
+        CmdJob *job = &jobs[i];
+        if (job->state != JOB_RUNNING) {
+            continue;
+        }
+
+        if (!job->reaped && job->deadline > 0 && now >= job->deadline) {
+            if (!job->res.timed_out) {
+                log_message("Timeout after %ds: %s", job->timeout_sec, job->label);
+                job->res.timed_out = 1;
+                kill(-job->pid, SIGTERM);
+                job->kill_deadline = now + PROC_KILL_GRACE_MS / 1000.0;
+            } else if (now >= job->kill_deadline) {
+                kill(-job->pid, SIGKILL);
+                job->kill_deadline = now + 3600;
+            }
+        }
+
+        if (job->pidfd < 0) {
+            try_reap(job);
+        }
+
+        if (job->reaped && now >= job->drain_deadline) {
+            unwatch_fd(&job->out_fd);
+            unwatch_fd(&job->err_fd);
+        }
+
+        if (job->reaped && job->out_fd < 0 && job->err_fd < 0) {
+            finish_job(job);
+        }
+    }
+}
+
+// Milliseconds until the nearest timer, capped by limit_ms (-1 - none)
+static int next_timer_ms(int limit_ms) {
+    double now = now_sec();
+    double next = limit_ms >= 0 ? now + limit_ms / 1000.0 : 0;
+
+    for (int i = 0; i < CMD_MAX_JOBS; i++) {
+        CmdJob *job = &jobs[i];
+        if (job->state != JOB_RUNNING) {
+            continue;
+        }
+
+        double t = 0;
+        if (job->reaped) {
+            t = job->drain_deadline;
+        } else if (job->res.timed_out) {
+            t = job->kill_deadline;
+        } else if (job->deadline > 0) {
+            t = job->deadline;
+        }
+        if (job->pidfd < 0 && !job->reaped) {
+            double tick = now + CMD_REAP_TICK_MS / 1000.0;
+            if (t == 0 || tick < t) t = tick;
+        }
+
+        if (t > 0 && (next == 0 || t < next)) {
+            next = t;
+        }
+    }
+
+    if (next == 0) {
+        return -1;
+    }
+    int ms = (int)((next - now) * 1000) + 1;
+    return ms < 0 ? 0 : ms;
+}
+
+// Run one round of epoll. Called with cmd_lock held, returns with it held.
+static void pump_events(int timeout_ms) {
+    struct epoll_event events[CMD_MAX_JOBS * 3];
+    int wait_ms = next_timer_ms(timeout_ms);
+
+    poller_active = 1;
+    pthread_mutex_unlock(&cmd_lock);
+    int n = epoll_wait(epoll_fd, events, CMD_MAX_JOBS * 3, wait_ms);
+    pthread_mutex_lock(&cmd_lock);
+    poller_active = 0;
+
+    for (int i = 0; i < n; i++) {
+        int id = (int)(events[i].data.u64 >> 2);
+        int kind = (int)(events[i].data.u64 & 3);
+        CmdJob *job = &jobs[id];
+        if (job->state != JOB_RUNNING) {
+            continue;
+        }
+
+        if (kind == FD_OUT && job->out_fd >= 0) {
+            if (!proc_stream_read(job->out_fd, &job->out, job->flags, 0, &job->res)) {
+                unwatch_fd(&job->out_fd);
+            }
+        } else if (kind == FD_ERR && job->err_fd >= 0) {
+            if (!proc_stream_read(job->err_fd, &job->err, job->flags, 1, &job->res)) {
+                unwatch_fd(&job->err_fd);
+            }
+        } else if (kind == FD_PID) {
+            try_reap(job);
+        }
+    }
+
+    check_timers();
+    pthread_cond_broadcast(&cmd_cond);
+}
+
+static int collect(int id, ProcResult *res) {
+    CmdJob *job = &jobs[id];
+    int rc = job->res.exit_code;
+
+    if (res) {
+        *res = job->res;
+    } else {
+        proc_result_free(&job->res);
+    }
+    memset(job, 0, sizeof(*job));
+    job->state = JOB_FREE;
+    return rc;
+}
+
+static int valid_id(int id) {
+    return id >= 0 && id < CMD_MAX_JOBS && jobs[id].state != JOB_FREE;
+}
+
+int cmd_poll(int id, int timeout_ms, ProcResult *res) {
+    double deadline = now_sec() + (timeout_ms > 0 ? timeout_ms / 1000.0 : 0);
+
+    pthread_mutex_lock(&cmd_lock);
+    if (!valid_id(id)) {
+        pthread_mutex_unlock(&cmd_lock);
+        return -1;
+    }
+
+    int pumped = 0;
+    while (jobs[id].state == JOB_RUNNING) {
+        double now = now_sec();
+        if (pumped && now >= deadline) {
+            break;
+        }
+        int left_ms = now < deadline ? (int)((deadline - now) * 1000) + 1 : 0;
+
+        if (!poller_active) {
+            pump_events(left_ms);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = (time_t)deadline;
+            ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+            pthread_cond_timedwait(&cmd_cond, &cmd_lock, &ts);
+        }
+        pumped = 1;
+    }
+
+    int state = CMD_RUNNING;
+    if (jobs[id].state == JOB_DONE) {
+        collect(id, res);
+        state = CMD_DONE;
+    }
+    pthread_mutex_unlock(&cmd_lock);
+    return state;
+}
+
+int cmd_wait(int id, ProcResult *res) {
+    pthread_mutex_lock(&cmd_lock);
+    if (!valid_id(id)) {
+        pthread_mutex_unlock(&cmd_lock);
+        return -1;
+    }
+
+    jobs[id].waited = 1;
+    while (jobs[id].state == JOB_RUNNING) {
+        if (!poller_active) {
+            pump_events(-1);
+        } else {
+            pthread_cond_wait(&cmd_cond, &cmd_lock);
+        }
+    }
+
+    int rc = collect(id, res);
+    pthread_cond_broadcast(&cmd_cond);
+    pthread_mutex_unlock(&cmd_lock);
+    return rc;
+}
+
+double cmd_elapsed(int id) {
+    double t = -1;
+    pthread_mutex_lock(&cmd_lock);
+    if (valid_id(id)) {
+        t = now_sec() - jobs[id].start;
+    }
+    pthread_mutex_unlock(&cmd_lock);
+    return t;
+}
@@ -0,0 +1,39 @@
+#ifndef CMD_ASYNC_H
+#define CMD_ASYNC_H
+
+#include "process.h"
+
+/*
+ * Asynchronous command executor.
+ * Jobs are spawned through the process engine and multiplexed by one
+ * epoll loop (pipes + pidfd per job). Any thread may wait on any job;
+ * one waiter at a time drives epoll, the rest sleep on a condition.
+ */
+
+#define CMD_MAX_JOBS 32
+
+#define CMD_RUNNING 0
+#define CMD_DONE 1
+
+typedef struct {
+    ProcOptions proc;     // flags, timeout, stdin, cwd
+    const char *label;    // short name for logs/progress, default argv[0]
+    ProcLineFn on_line;   // per-line hook, runs under the executor lock
+    void *user;
+} CmdOptions;
+
+// Start a job. Returns job id, -1 on failure
+int cmd_submit(const char *const argv[], const CmdOptions *opts);
+
+// Wait up to timeout_ms (0 - just pump pending events) for job id.
+// Returns CMD_DONE (res filled, id released), CMD_RUNNING, or -1 for an
+// unknown id
+int cmd_poll(int id, int timeout_ms, ProcResult *res);
+
+// Block until job id finishes. Returns its exit code (see proc_run)
+int cmd_wait(int id, ProcResult *res);
+
+// Seconds since the job started, -1 for unknown id
+double cmd_elapsed(int id);
+
+#endif // cmd async h
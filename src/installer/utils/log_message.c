@@ -1,38 +1,339 @@
+/**
+ * @file log_message.c
+ * @brief lock-free installer log with a background ncurses renderer
+ *
+ * Producers claim a slot in a bounded MPSC ring (Vyukov sequence
+ * numbers), format straight into it and publish it; nothing on that path
+ * locks or touches the terminal. The render thread wakes once per frame,
+ * drains everything published, draws the batch into log_win with a single
+ * wrefresh() and appends it to the log file. Interactive screens take
+ * the terminal over with log_pause(); records queue until log_resume().
+ */
+
+#define _GNU_SOURCE
+#include <ncurses.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
-#include <pthread.h>
-#include <ncurses.h>
+
+#include "log_message.h"
 
 extern WINDOW *log_win;
 extern WINDOW *status_win;
 pthread_mutex_t log_mutex  = PTHREAD_MUTEX_INITIALIZER;
 
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+// Producer retries while the ring is full before dropping the line
+#define LOG_FULL_SPINS 2000
+
+typedef struct {
+    atomic_size_t seq;
+    time_t when;
+    char text[LOG_LINE_MAX];
+} LogSlot;
+
+static LogSlot ring[LOG_RING_SIZE];
+static atomic_size_t ring_head;      // next slot producers claim
+static size_t ring_tail;             // next slot the renderer reads
+static atomic_size_t ring_dropped;
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_t render_thread;
+static atomic_int render_running;
+static atomic_int render_stop;
+static atomic_size_t rendered;       // records consumed so far
+static FILE *log_file;
+
+// log_pause() depth and drawing state, under log_mutex
+static atomic_int paused;
+static int drawn;                    // log_win changed since its last wrefresh
+static int repaint;                  // an interactive screen covered log_win
+
+// Producers finding the ring full wake the renderer before its frame
+static pthread_mutex_t kick_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kick_cond;
+static atomic_int kicked;
+
+static void *log_render(void *arg);
+static size_t render_batch(int refresh);
+
+static void log_start(void) {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&ring[i].seq, i);
+    }
+
+    log_file = fopen(LOG_FILE, "a");
+    if (log_file) {
+        setvbuf(log_file, NULL, _IOFBF, 64 * 1024);
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&kick_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&render_thread, NULL, log_render, NULL) == 0) {
+        atomic_store(&render_running, 1);
+        atexit(log_shutdown);
+    }
+}
+
+// Claim a free slot, NULL when the ring stays full
+static LogSlot *ring_claim(size_t *pos_out) {
+    size_t pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+
+    for (int spins = 0;;) {
+        LogSlot *slot = &ring[pos & LOG_RING_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring_head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                *pos_out = pos;
+                return slot;
+            }
+        } else if (diff < 0) {
+            // Full: give the renderer a chance to catch up
+            if (!atomic_load(&render_running) || ++spins > LOG_FULL_SPINS) {
+                return NULL;
+            }
+            if (spins == 1 && !atomic_exchange(&kicked, 1)) {
+                pthread_cond_signal(&kick_cond);
+            }
+            sched_yield();
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        } else {
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        }
+    }
+}
+
 // Thread-safe logging with timestamp
 void log_message(const char *format, ...) {
-    pthread_mutex_lock(&log_mutex);
+    pthread_once(&log_once, log_start);
 
-    time_t now;
-    time(&now);
-    struct tm *tm_info = localtime(&now);
-    char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%H:%M:%S", tm_info);
+    size_t pos;
+    LogSlot *slot = ring_claim(&pos);
+    if (!slot) {
+        atomic_fetch_add_explicit(&ring_dropped, 1, memory_order_relaxed);
+        return;
+    }
 
-    char message[512];
+    slot->when = time(NULL);
     va_list args;
     va_start(args, format);
-    vsnprintf(message, sizeof(message), format, args);
+    vsnprintf(slot->text, sizeof(slot->text), format, args);
     va_end(args);
 
-    // Только если log_win создан - пишем в него
-    if (log_win) {
-        wprintw(log_win, "[%s] %s\n", timestamp, message);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    // No render thread (failed to start or already shut down): draw now
+    if (!atomic_load(&render_running)) {
+        render_batch(1);
+    }
+}
+
+static void emit(FILE *out, const char *stamp, const char *text) {
+    fprintf(out, "[%s] %s\n", stamp, text);
+}
+
+// Drain published records; returns how many were consumed.
+// refresh = 0 only queues the drawing for the next frame.
+static size_t render_batch(int refresh) {
+    size_t count = 0;
+    time_t last_when = (time_t)-1;
+    char stamp[32] = "";
+    char date[64] = "";
+
+    pthread_mutex_lock(&log_mutex);
+    // Paused: records wait in the ring until the screen is handed back
+    if (atomic_load(&paused)) {
+        pthread_mutex_unlock(&log_mutex);
+        return 0;
+    }
+    if (repaint && log_win) {
+        touchwin(log_win);
+        drawn = 1;
+    }
+    repaint = 0;
+
+    for (;;) {
+        LogSlot *slot = &ring[ring_tail & LOG_RING_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != ring_tail + 1) {
+            break;
+        }
+
+        // localtime once per distinct second, not once per line
+        if (slot->when != last_when) {
+            struct tm tm_info;
+            localtime_r(&slot->when, &tm_info);
+            strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm_info);
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm_info);
+            last_when = slot->when;
+        }
+
+        // Только если log_win создан - пишем в него
+        if (log_win) {
+            wprintw(log_win, "[%s] %s\n", stamp, slot->text);
+            drawn = 1;
+        } else {
+            // Иначе просто в stdout (для отладки)
+            emit(stdout, stamp, slot->text);
+        }
+        if (log_file) {
+            emit(log_file, date, slot->text);
+        }
+
+        atomic_store_explicit(&slot->seq, ring_tail + LOG_RING_SIZE,
+                              memory_order_release);
+        ring_tail++;
+        count++;
+    }
+
+    size_t dropped = atomic_exchange(&ring_dropped, 0);
+    if (dropped) {
+        if (log_win) {
+            wprintw(log_win, "[%s] (%zu log lines dropped)\n", stamp, dropped);
+            drawn = 1;
+        } else {
+            printf("[%s] (%zu log lines dropped)\n", stamp, dropped);
+        }
+        if (log_file) {
+            fprintf(log_file, "[%s] (%zu log lines dropped)\n", date, dropped);
+        }
+    }
+
+    if (refresh && drawn && log_win) {
         wrefresh(log_win);
-    } else {
-        // Иначе просто в stdout (для отладки)
-        printf("[%s] %s\n", timestamp, message);
+        drawn = 0;
+    } else if (count || dropped) {
         fflush(stdout);
     }
+    pthread_mutex_unlock(&log_mutex);
+
+    if (count && log_file) {
+        fflush(log_file);
+    }
+    if (count) {
+        atomic_fetch_add(&rendered, count);
+    }
+    return count;
+}
+
+static void *log_render(void *arg) {
+    (void)arg;
+    const long frame_ns = 1000000000L / LOG_RENDER_FPS;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!atomic_load(&render_stop)) {
+        next.tv_nsec += frame_ns;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+
+        // Sleep until the next frame; a kick only drains, the terminal is
+        // still refreshed once per frame at most
+        for (;;) {
+            pthread_mutex_lock(&kick_lock);
+            int rc = 0;
+            while (!atomic_load(&kicked) && !atomic_load(&render_stop) && rc == 0) {
+                rc = pthread_cond_timedwait(&kick_cond, &kick_lock, &next);
+            }
+            pthread_mutex_unlock(&kick_lock);
+            if (rc != 0 || atomic_load(&render_stop)) {
+                break;
+            }
+            atomic_store(&kicked, 0);
+            render_batch(0);
+        }
+        render_batch(1);
+    }
+    render_batch(1);
+    return NULL;
+}
+
+void log_flush(void) {
+    if (!atomic_load(&render_running) || atomic_load(&paused)) {
+        return;
+    }
+    size_t target = atomic_load(&ring_head);
+    const struct timespec tick = {0, 2000000L};
 
+    // Records are consumed in order, so waiting for the count is enough
+    while (atomic_load(&rendered) < target && !atomic_load(&render_stop)) {
+        nanosleep(&tick, NULL);
+    }
+}
+
+void log_close_window(void) {
+    log_flush();
+    pthread_mutex_lock(&log_mutex);
+    if (log_win) {
+        delwin(log_win);
+        log_win = NULL;
+    }
     pthread_mutex_unlock(&log_mutex);
 }
+
+void log_pause(void) {
+    if (atomic_load(&paused) == 0) {
+        log_flush();
+    }
+    pthread_mutex_lock(&log_mutex);
+    // The last frame may still be queued behind a kick
+    if (atomic_fetch_add(&paused, 1) == 0 && drawn && log_win) {
+        wrefresh(log_win);
+        drawn = 0;
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
+
+void log_resume(void) {
+    pthread_mutex_lock(&log_mutex);
+    if (atomic_fetch_sub(&paused, 1) == 1) {
+        repaint = 1;
+    }
+    pthread_mutex_unlock(&log_mutex);
+
+    // Draw what queued up meanwhile without waiting for the next frame
+    if (atomic_load(&render_running) && !atomic_exchange(&kicked, 1)) {
+        pthread_cond_signal(&kick_cond);
+    }
+}
+
+void log_shutdown(void) {
+    if (!atomic_exchange(&render_running, 0)) {
+        return;
+    }
+    atomic_store(&render_stop, 1);
+
+    // Called from exit paths: never hang on a renderer stuck in curses
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 500000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    if (pthread_timedjoin_np(render_thread, NULL, &deadline) != 0) {
+        pthread_detach(render_thread);
+        return;
+    }
+
+    if (log_file) {
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
@@ -3,8 +3,38 @@
 
 #include <pthread.h>
 
+/*
+ * Installer log.
+ * log_message() formats the line into a lock-free ring and returns; a
+ * render thread drains the ring, draws into log_win at most
+ * LOG_RENDER_FPS times per second and appends every record to LOG_FILE.
+ */
+
+#define LOG_RING_SIZE 2048            // records, power of two
+#define LOG_LINE_MAX 512
+#define LOG_RENDER_FPS 30
+#define LOG_FILE "/tmp/lainux-install.log"
+
 void log_message(const char *format, ...);
 
+// Block until every record logged so far is drawn and written
+void log_flush(void);
+
+// Flush, then delwin(log_win) and clear it (use instead of delwin)
+void log_close_window(void);
+
+// Draw everything logged so far, then keep the renderer off the terminal
+// until the matching log_resume(): wrap every interactive screen (menus,
+// prompts, getch loops) in the pair. Records keep queueing meanwhile.
+// Nests; a paused log_flush() returns at once.
+void log_pause(void);
+void log_resume(void);
+
+// Flush and stop the render thread (also registered with atexit)
+void log_shutdown(void);
+
+// Guards ncurses: held by the renderer while it draws, take it around
+// short drawing sequences on other threads
 extern pthread_mutex_t log_mutex;
 
 #endif
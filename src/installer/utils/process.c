@@ -0,0 +1,385 @@
+/**
+ * @file process.c
+ * @brief process engine for the installer: posix_spawn + non-blocking pipes
+ *
+ * popen() forks a full /bin/sh for every command and only gives us stdout.
+ * Here commands are argv arrays spawned directly (vfork semantics inside
+ * posix_spawn), stdout and stderr are drained separately through poll(),
+ * the child is watched through a pidfd and every run can carry a
+ * wall-clock timeout, so a hung pacstrap or grub-install no longer
+ * blocks the installer forever.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "log_message.h"
+
+extern char **environ;
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// poll tick when pidfd is unavailable (kernel < 5.3)
+#define PROC_REAP_TICK_MS 50
+// how long to keep draining pipes after the child exited
+#define PROC_DRAIN_MS 200
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int proc_pidfd_open(pid_t pid) {
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+pid_t proc_spawn(const char *const argv[], const ProcOptions *opts,
+                 int *out_fd, int *err_fd) {
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+    int null_fd = -1;
+    pid_t pid = -1;
+
+    if (!argv || !argv[0]) {
+        return -1;
+    }
+
+    if (pipe2(out_pipe, O_CLOEXEC) != 0 || pipe2(err_pipe, O_CLOEXEC) != 0) {
+        log_message("pipe2 failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    int in_fd = opts ? opts->stdin_fd : -1;
+    if (in_fd < 0) {
+        null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        in_fd = null_fd;
+    }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawnattr_init(&attr);
+
+    if (in_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+    }
+    posix_spawn_file_actions_adddup2(&fa, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, err_pipe[1], STDERR_FILENO);
+    if (opts && opts->cwd) {
+        posix_spawn_file_actions_addchdir_np(&fa, opts->cwd);
+    }
+
+    // Own process group so a timeout can take down the whole tree,
+    // default signal dispositions and an empty mask in the child
+    sigset_t def, mask;
+    sigemptyset(&mask);
+    sigemptyset(&def);
+    sigaddset(&def, SIGPIPE);
+    sigaddset(&def, SIGINT);
+    sigaddset(&def, SIGTERM);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &def);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+                  POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    int rc = posix_spawnp(&pid, argv[0], &fa, &attr, (char *const *)argv,
+                          environ);
+
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+
+    if (null_fd >= 0) {
+        close(null_fd);
+    }
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    if (rc != 0) {
+        log_message("Failed to start %s: %s", argv[0], strerror(rc));
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        return -1;
+    }
+
+    fcntl(out_pipe[0], F_SETFL, fcntl(out_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(err_pipe[0], F_SETFL, fcntl(err_pipe[0], F_GETFL) | O_NONBLOCK);
+
+    *out_fd = out_pipe[0];
+    *err_fd = err_pipe[0];
+    return pid;
+
+fail:
+    for (int i = 0; i < 2; i++) {
+        if (out_pipe[i] >= 0) close(out_pipe[i]);
+        if (err_pipe[i] >= 0) close(err_pipe[i]);
+    }
+    return -1;
+}
+
+static void stream_append(ProcStream *s, const char *buf, size_t n) {
+    if (s->len + n + 1 > s->cap) {
+        size_t cap = s->cap ? s->cap : 4096;
+        while (cap < s->len + n + 1) {
+            cap *= 2;
+        }
+        char *p = realloc(s->data, cap);
+        if (!p) {
+            return;
+        }
+        s->data = p;
+        s->cap = cap;
+    }
+    memcpy(s->data + s->len, buf, n);
+    s->len += n;
+    s->data[s->len] = '\0';
+}
+
+static void stream_emit_line(ProcStream *s, int flags, int is_err,
+                             ProcResult *res) {
+    s->line[s->line_len] = '\0';
+    if (s->line_len > 0 && s->line[s->line_len - 1] == '\r') {
+        s->line[--s->line_len] = '\0';
+    }
+
+    if (s->line_len > 0) {
+        if (s->on_line) {
+            s->on_line(s->line, is_err, s->user);
+        }
+        if (is_err) {
+            if (res) {
+                snprintf(res->last_err, sizeof(res->last_err), "%.*s",
+                         (int)sizeof(res->last_err) - 1, s->line);
+            }
+            if (flags & PROC_LOG_STDERR) {
+                log_message("! %s", s->line);
+            }
+        } else if (flags & PROC_LOG_STDOUT) {
+            log_message("%s", s->line);
+        }
+    }
+    s->line_len = 0;
+}
+
+int proc_stream_read(int fd, ProcStream *s, int flags, int is_err,
+                     ProcResult *res) {
+    char buf[4096];
+
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0) {
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            return 0;
+        }
+
+        if (flags & PROC_CAPTURE) {
+            stream_append(s, buf, (size_t)n);
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n' || s->line_len == sizeof(s->line) - 1) {
+                stream_emit_line(s, flags, is_err, res);
+                if (buf[i] == '\n') continue;
+            }
+            s->line[s->line_len++] = buf[i];
+        }
+    }
+}
+
+void proc_stream_flush(ProcStream *s, int flags, int is_err, ProcResult *res) {
+    if (s->line_len > 0) {
+        stream_emit_line(s, flags, is_err, res);
+    }
+}
+
+int proc_run(const char *const argv[], const ProcOptions *opts, ProcResult *res) {
+    ProcOptions def_opts = {0, 0, -1, NULL};
+    ProcResult local;
+    ProcStream out = {0}, err = {0};
+    int out_fd = -1, err_fd = -1;
+
+    if (!opts) opts = &def_opts;
+    if (!res) res = &local;
+    memset(res, 0, sizeof(*res));
+    res->exit_code = -1;
+
+    double start = now_sec();
+    pid_t pid = proc_spawn(argv, opts, &out_fd, &err_fd);
+    if (pid < 0) {
+        return -1;
+    }
+
+    int pidfd = proc_pidfd_open(pid);
+    double deadline = opts->timeout_sec > 0 ? start + opts->timeout_sec : 0;
+    double kill_deadline = 0;
+    double drain_deadline = 0;
+    int reaped = 0, status = 0;
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+
+    while (out_fd >= 0 || err_fd >= 0 || !reaped) {
+        double now = now_sec();
+
+        if (reaped && now >= drain_deadline) {
+            // Grandchildren still hold the pipes open; stop waiting on them
+            break;
+        }
+
+        if (!reaped && deadline > 0 && now >= deadline) {
+            if (!res->timed_out) {
+                log_message("Timeout after %ds: %s", opts->timeout_sec, argv[0]);
+                res->timed_out = 1;
+                kill(-pid, SIGTERM);
+                kill_deadline = now + PROC_KILL_GRACE_MS / 1000.0;
+            } else if (now >= kill_deadline) {
+                kill(-pid, SIGKILL);
+                kill_deadline = now + 3600;
+            }
+        }
+
+        struct pollfd pfd[3];
+        int nfds = 0, out_idx = -1, err_idx = -1, pid_idx = -1;
+        if (out_fd >= 0) {
+            out_idx = nfds;
+            pfd[nfds++] = (struct pollfd){out_fd, POLLIN, 0};
+        }
+        if (err_fd >= 0) {
+            err_idx = nfds;
+            pfd[nfds++] = (struct pollfd){err_fd, POLLIN, 0};
+        }
+        if (pidfd >= 0 && !reaped) {
+            pid_idx = nfds;
+            pfd[nfds++] = (struct pollfd){pidfd, POLLIN, 0};
+        }
+
+        int wait_ms = -1;
+        if (reaped) {
+            wait_ms = (int)((drain_deadline - now) * 1000) + 1;
+        } else {
+            if (res->timed_out) {
+                wait_ms = (int)((kill_deadline - now) * 1000) + 1;
+            } else if (deadline > 0) {
+                wait_ms = (int)((deadline - now) * 1000) + 1;
+            }
+            if (pidfd < 0 && (wait_ms < 0 || wait_ms > PROC_REAP_TICK_MS)) {
+                wait_ms = PROC_REAP_TICK_MS;
+            }
+        }
+
+        if (poll(pfd, nfds, wait_ms) < 0 && errno != EINTR) {
+            log_message("poll failed: %s", strerror(errno));
+            break;
+        }
+
+        if (out_idx >= 0 && pfd[out_idx].revents) {
+            if (!proc_stream_read(out_fd, &out, opts->flags, 0, res)) {
+                close(out_fd);
+                out_fd = -1;
+            }
+        }
+        if (err_idx >= 0 && pfd[err_idx].revents) {
+            if (!proc_stream_read(err_fd, &err, opts->flags, 1, res)) {
+                close(err_fd);
+                err_fd = -1;
+            }
+        }
+
+        if (!reaped && (pidfd < 0 || (pid_idx >= 0 && pfd[pid_idx].revents))) {
+            pid_t r = wait4(pid, &status, WNOHANG, &ru);
+            if (r == pid) {
+                reaped = 1;
+                drain_deadline = now_sec() + PROC_DRAIN_MS / 1000.0;
+            }
+        }
+    }
+
+    if (!reaped) {
+        kill(-pid, SIGKILL);
+        wait4(pid, &status, 0, &ru);
+    }
+
+    proc_stream_flush(&out, opts->flags, 0, res);
+    proc_stream_flush(&err, opts->flags, 1, res);
+
+    if (out_fd >= 0) close(out_fd);
+    if (err_fd >= 0) close(err_fd);
+    if (pidfd >= 0) close(pidfd);
+
+    res->elapsed_sec = now_sec() - start;
+    res->peak_rss_kb = ru.ru_maxrss;
+
+    if (WIFEXITED(status) && !res->timed_out) {
+        res->exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        res->term_signal = WTERMSIG(status);
+    }
+
+    if (res == &local) {
+        free(out.data);
+        free(err.data);
+    } else {
+        res->out = out.data;
+        res->out_len = out.len;
+        res->err = err.data;
+        res->err_len = err.len;
+    }
+
+    return res->exit_code;
+}
+
+void proc_result_free(ProcResult *res) {
+    if (!res) return;
+    free(res->out);
+    free(res->err);
+    res->out = res->err = NULL;
+    res->out_len = res->err_len = 0;
+}
+
+int proc_split_simple(char *cmd, char *argv[], int max_args) {
+    // Anything the shell would interpret keeps the /bin/sh path
+    if (strpbrk(cmd, "|&;<>()$`\\\"'*?[]~{}#\n")) {
+        return -1;
+    }
+
+    int argc = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(cmd, " \t", &save); tok;
+         tok = strtok_r(NULL, " \t", &save)) {
+        // VAR=value prefixes are shell syntax too
+        if (argc == 0 && strchr(tok, '=')) {
+            return -1;
+        }
+        if (argc >= max_args - 1) {
+            return -1;
+        }
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+
+    return argc > 0 ? argc : -1;
+}
@@ -0,0 +1,80 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Process engine: posix_spawn-based replacement for popen().
+ * Commands are argv arrays (no /bin/sh in between), stdout and stderr
+ * are read separately through non-blocking pipes and every run can be
+ * bounded by a wall-clock timeout.
+ */
+
+// Grace period between SIGTERM and SIGKILL once a timeout fires
+#define PROC_KILL_GRACE_MS 3000
+
+// Output handling flags
+#define PROC_LOG_STDOUT   0x01  // stream stdout lines into log_message
+#define PROC_LOG_STDERR   0x02  // stream stderr lines into log_message
+#define PROC_CAPTURE      0x04  // keep stdout/stderr in ProcResult buffers
+
+typedef struct {
+    int flags;            // PROC_* flags
+    int timeout_sec;      // 0 - no limit
+    int stdin_fd;         // fd to use as stdin, -1 - /dev/null
+    const char *cwd;      // working directory for the child, NULL - inherit
+} ProcOptions;
+
+typedef struct {
+    int exit_code;        // exit status, -1 if killed or failed to start
+    int term_signal;      // signal that terminated the child, 0 if none
+    int timed_out;        // 1 if the timeout fired
+    double elapsed_sec;   // wall-clock run time
+    long peak_rss_kb;     // ru_maxrss of the child
+    char *out;            // captured stdout (PROC_CAPTURE), NUL-terminated
+    size_t out_len;
+    char *err;            // captured stderr (PROC_CAPTURE), NUL-terminated
+    size_t err_len;
+    char last_err[256];   // last non-empty stderr line, always kept
+} ProcResult;
+
+// Called for every complete output line (is_err: line came from stderr)
+typedef void (*ProcLineFn)(const char *line, int is_err, void *user);
+
+// Line-splitting buffer for one output stream
+typedef struct {
+    char line[1024];
+    size_t line_len;
+    char *data;           // capture buffer
+    size_t len;
+    size_t cap;
+    ProcLineFn on_line;   // optional per-line hook
+    void *user;
+} ProcStream;
+
+// Spawn argv[0] (PATH lookup) with stdout/stderr connected to new pipes.
+// out_fd/err_fd receive the non-blocking, close-on-exec parent ends.
+pid_t proc_spawn(const char *const argv[], const ProcOptions *opts,
+                 int *out_fd, int *err_fd);
+
+// Drain whatever is readable on fd into stream. Returns 0 on EOF,
+// 1 if the fd is still open.
+int proc_stream_read(int fd, ProcStream *stream, int flags, int is_err,
+                     ProcResult *res);
+void proc_stream_flush(ProcStream *stream, int flags, int is_err,
+                       ProcResult *res);
+
+// Open a pidfd for pid, -1 if the kernel does not support it
+int proc_pidfd_open(pid_t pid);
+
+// Run a command to completion. Returns exit code, -1 on spawn failure,
+// timeout or abnormal termination. res may be NULL.
+int proc_run(const char *const argv[], const ProcOptions *opts, ProcResult *res);
+void proc_result_free(ProcResult *res);
+
+// Split a simple command string on whitespace. Returns argc, or -1 when
+// the string uses shell syntax and must go through /bin/sh.
+int proc_split_simple(char *cmd, char *argv[], int max_args);
+
+#endif // process h
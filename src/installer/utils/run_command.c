@@ -1,44 +1,83 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 
 #include "log_message.h"
+#include "process.h"
+#include "run_command.h"
 
+#define MAX_SIMPLE_ARGS 64
 
-// Execute command with detailed error handling
-int run_command(const char *cmd, int show_output) {
-    log_message("Executing: %s", cmd);
-
-    FILE *fp = popen(cmd, "r");
-    if (!fp) {
-        log_message("Failed to execute command");
+// Report result of a finished command
+static int finish_command(const char *name, const ProcResult *res) {
+    if (res->timed_out) {
+        log_message("%s killed after %.1fs (timeout)", name, res->elapsed_sec);
         return -1;
     }
 
-    if (show_output) {
-        char buffer[1024];
-        while (fgets(buffer, sizeof(buffer), fp)) {
-            buffer[strcspn(buffer, "\n")] = 0;
-            if (strlen(buffer) > 0) {
-                log_message("%s", buffer);
-            }
+    if (res->exit_code != 0) {
+        if (res->last_err[0]) {
+            log_message("%s: %s", name, res->last_err);
+        }
+        if (res->term_signal) {
+            log_message("Terminated by signal %d", res->term_signal);
+        } else {
+            log_message("Exit code: %d", res->exit_code);
         }
-    } else {
-        // Just consume output
-        while (fgetc(fp) != EOF);
     }
 
-    int status = pclose(fp);
-    if (WIFEXITED(status)) {
-        int exit_code = WEXITSTATUS(status);
-        if (exit_code != 0) {
-            log_message("Exit code: %d", exit_code);
+    return res->exit_code;
+}
+
+// Run argv array through the process engine
+int run_argv(const char *const argv[], int show_output, int timeout_sec) {
+    char line[512];
+    size_t off = 0;
+
+    for (int i = 0; argv[i] && off < sizeof(line); i++) {
+        off += snprintf(line + off, sizeof(line) - off, i ? " %s" : "%s", argv[i]);
+    }
+    log_message("Executing: %s", line);
+
+    ProcOptions opts = {
+        .flags = show_output ? (PROC_LOG_STDOUT | PROC_LOG_STDERR) : 0,
+        .timeout_sec = timeout_sec > 0 ? timeout_sec : RUN_COMMAND_TIMEOUT,
+        .stdin_fd = -1,
+        .cwd = NULL,
+    };
+    ProcResult res;
+    proc_run(argv, &opts, &res);
+
+    return finish_command(argv[0], &res);
+}
+
+// Execute command with detailed error handling
+int run_command(const char *cmd, int show_output) {
+    log_message("Executing: %s", cmd);
+
+    // Plain "tool arg arg" strings skip the shell entirely
+    char buf[1024];
+    char *simple[MAX_SIMPLE_ARGS];
+    const char *shell[] = {"/bin/sh", "-c", cmd, NULL};
+    const char *const *argv = shell;
+
+    if (strlen(cmd) < sizeof(buf)) {
+        strcpy(buf, cmd);
+        if (proc_split_simple(buf, simple, MAX_SIMPLE_ARGS) > 0) {
+            argv = (const char *const *)simple;
         }
-        return exit_code;
     }
 
-    return -1;
+    ProcOptions opts = {
+        .flags = show_output ? (PROC_LOG_STDOUT | PROC_LOG_STDERR) : 0,
+        .timeout_sec = RUN_COMMAND_TIMEOUT,
+        .stdin_fd = -1,
+        .cwd = NULL,
+    };
+    ProcResult res;
+    proc_run(argv, &opts, &res);
+
+    return finish_command(argv[0], &res);
 }
 
 // Run command with fallback option
@@ -1,8 +1,13 @@
 #ifndef RUN_COMMAND_H
 #define RUN_COMMAND_H
 
+// Default wall-clock limit for a single command (seconds)
+#define RUN_COMMAND_TIMEOUT 3600
+
 int run_command_with_fallback(const char *cmd, const char *fallback);
 int run_command(const char *cmd, int show_output);
+// Run an argv array directly, without /bin/sh. timeout_sec 0 - default
+int run_argv(const char *const argv[], int show_output, int timeout_sec);
 
 
 #endif // run command header
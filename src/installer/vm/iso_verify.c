@@ -0,0 +1,168 @@
+/**
+ * @file iso_verify.c
+ * @brief single-pass ISO signature and SHA-256 check
+ *
+ * The mapping is consumed window by window; each finished window is
+ * dropped with MADV_DONTNEED so a multi-GB image does not pin its pages
+ * in our address space while the kernel keeps reading ahead.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iso_verify.h"
+#include "../utils/log_message.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int digest_mapped(int fd, size_t size, EVP_MD_CTX *md) {
+    unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    int rc = 0;
+    for (size_t off = 0; off < size && rc == 0; off += ISO_VERIFY_CHUNK) {
+        size_t len = size - off < ISO_VERIFY_CHUNK ? size - off : ISO_VERIFY_CHUNK;
+        if (off + len < size) {
+            size_t ahead = size - off - len < ISO_VERIFY_CHUNK ? size - off - len
+                                                                : ISO_VERIFY_CHUNK;
+            madvise(map + off + len, ahead, MADV_WILLNEED);
+        }
+        if (EVP_DigestUpdate(md, map + off, len) != 1) rc = -1;
+        madvise(map + off, len, MADV_DONTNEED);
+    }
+    munmap(map, size);
+    return rc;
+}
+
+// Fallback for files that cannot be mapped
+static int digest_read(int fd, EVP_MD_CTX *md) {
+    void *buf;
+    if (posix_memalign(&buf, 4096, ISO_VERIFY_CHUNK) != 0) return -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    lseek(fd, 0, SEEK_SET);
+
+    int rc = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, ISO_VERIFY_CHUNK)) > 0) {
+        if (EVP_DigestUpdate(md, buf, (size_t)n) != 1) {
+            rc = -1;
+            break;
+        }
+    }
+    if (n < 0) rc = -1;
+    free(buf);
+    return rc;
+}
+
+int iso_sha256(const char *path, IsoDigest *out) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(md);
+        close(fd);
+        return -1;
+    }
+
+    double start = now_sec();
+    int rc = -1;
+    if (st.st_size > 0) rc = digest_mapped(fd, (size_t)st.st_size, md);
+    if (rc != 0) {
+        // A failed mapped pass may have fed part of the file already
+        EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+        rc = digest_read(fd, md);
+    }
+
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (rc == 0 && EVP_DigestFinal_ex(md, hash, &len) != 1) rc = -1;
+    EVP_MD_CTX_free(md);
+    close(fd);
+    if (rc != 0) return -1;
+
+    for (unsigned int i = 0; i < len && i < 32; i++) {
+        snprintf(out->sha256 + i * 2, 3, "%02x", hash[i]);
+    }
+    out->bytes = (unsigned long long)st.st_size;
+    out->seconds = now_sec() - start;
+    out->mb_per_sec = out->seconds > 0 ? out->bytes / out->seconds / 1e6 : 0;
+    return 0;
+}
+
+// First 64 hex digits of <path>.sha256 (sha256sum output), lowercased
+static int read_sidecar(const char *path, char expected[65]) {
+    char side[4096];
+    snprintf(side, sizeof(side), "%s%s", path, ISO_SHA256_SUFFIX);
+    FILE *fp = fopen(side, "r");
+    if (!fp) return -1;
+    char line[256];
+    int ok = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+    if (!ok) return -1;
+
+    for (int i = 0; i < 64; i++) {
+        if (!isxdigit((unsigned char)line[i])) return -1;
+        expected[i] = (char)tolower((unsigned char)line[i]);
+    }
+    expected[64] = '\0';
+    return 0;
+}
+
+int iso_check_header(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    unsigned char pvd[6];
+    if (fd < 0) {
+        log_message("ISO %s: cannot open", path);
+        return 0;
+    }
+    int valid = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= ISO_MIN_SIZE &&
+                pread(fd, pvd, sizeof(pvd), ISO_PVD_OFFSET - 1) == (ssize_t)sizeof(pvd) &&
+                memcmp(pvd, "\001CD001", 6) == 0;
+    close(fd);
+    if (!valid) log_message("ISO %s: no ISO 9660 volume descriptor", path);
+    return valid;
+}
+
+int iso_verify(const char *path, const char *expected_sha256, IsoDigest *out) {
+    IsoDigest local;
+    if (!out) out = &local;
+    memset(out, 0, sizeof(*out));
+
+    if (!iso_check_header(path)) return 0;
+
+    char sidecar[65];
+    if (!expected_sha256 && read_sidecar(path, sidecar) == 0) expected_sha256 = sidecar;
+
+    if (iso_sha256(path, out) != 0) {
+        log_message("ISO %s: read error while hashing", path);
+        return 0;
+    }
+    log_message("ISO %s: sha256 %s (%.1f MB/s)", path, out->sha256, out->mb_per_sec);
+
+    if (expected_sha256 && strcasecmp(out->sha256, expected_sha256) != 0) {
+        log_message("ISO %s: checksum mismatch, expected %s", path, expected_sha256);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,37 @@
+#ifndef ISO_VERIFY_H
+#define ISO_VERIFY_H
+
+/*
+ * ISO image verification.
+ * Checks the ISO 9660 primary volume descriptor and hashes the whole
+ * image in one pass: the file is mapped with MADV_SEQUENTIAL (large
+ * aligned read() chunks when it cannot be mapped) and fed to SHA-256
+ * through OpenSSL EVP, which picks the SHA-NI/AVX2 code path the CPU
+ * supports.
+ */
+
+#define ISO_VERIFY_CHUNK (8u << 20)   // digest window, multiple of readahead
+#define ISO_PVD_OFFSET 32769          // "CD001" of the primary volume descriptor
+#define ISO_MIN_SIZE 32768
+#define ISO_SHA256_SUFFIX ".sha256"   // optional sidecar, sha256sum format
+
+typedef struct {
+    char sha256[65];                  // lowercase hex
+    unsigned long long bytes;
+    double seconds;
+    double mb_per_sec;
+} IsoDigest;
+
+// SHA-256 of a whole file. Returns 0 and fills out, -1 on error
+int iso_sha256(const char *path, IsoDigest *out);
+
+// ISO 9660 primary volume descriptor only, no hashing (for images whose
+// digest is already known, e.g. from fetch_file()). Returns 1 when valid
+int iso_check_header(const char *path);
+
+// Validate an ISO image: PVD signature, then the digest compared with
+// expected_sha256, or with <path>.sha256 when that is NULL. Without any
+// reference the digest is only logged. Returns 1 when valid, 0 if not.
+int iso_verify(const char *path, const char *expected_sha256, IsoDigest *out);
+
+#endif // iso verify h
@@ -0,0 +1,434 @@
+/**
+ * @file qemu_profile.c
+ * @brief host probing and tuned QEMU command lines
+ *
+ * QEMU has no option for vCPU affinity, so placement is decided here and
+ * applied after start: with debug-threads=on the vCPU threads are named
+ * "CPU <n>/KVM" and the iothread "IO io0", which the launcher script (or
+ * the QMP supervisor, through query-cpus-fast) uses to pin them.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "qemu_profile.h"
+#include "../utils/log_message.h"
+
+#define SYS_CPU "/sys/devices/system/cpu"
+#define SYS_NODE "/sys/devices/system/node"
+#define SYS_HUGEPAGES "/sys/kernel/mm/hugepages"
+#define QEMU_PROFILE_MAX_NET_QUEUES 8
+
+static int read_long(const char *path, long *out) {
+    char buf[64];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    char *end;
+    *out = strtol(buf, &end, 10);
+    return end == buf ? -1 : 0;
+}
+
+// NUMA node of a CPU: the cpuN/nodeM link, 0 on non-NUMA kernels
+static int cpu_node(int cpu) {
+    char path[96];
+    snprintf(path, sizeof(path), SYS_CPU "/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir) return 0;
+    int node = 0;
+    struct dirent *de;
+    while ((de = readdir(dir))) {
+        if (sscanf(de->d_name, "node%d", &node) == 1) break;
+    }
+    closedir(dir);
+    return node;
+}
+
+static int kernel_has_io_uring(void) {
+#ifdef __NR_io_uring_setup
+    // struct io_uring_params is 120 bytes; zeroed means default setup
+    unsigned char params[120];
+    memset(params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, 1, params);
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int qemu_host_probe(QemuHost *host) {
+    long package_core[QEMU_PROFILE_MAX_CPUS];
+    int ids[QEMU_PROFILE_MAX_CPUS];
+    int count = 0;
+
+    memset(host, 0, sizeof(*host));
+    DIR *dir = opendir(SYS_CPU);
+    if (!dir) return -1;
+    struct dirent *de;
+    while ((de = readdir(dir)) && count < QEMU_PROFILE_MAX_CPUS) {
+        int cpu;
+        char tail;
+        if (sscanf(de->d_name, "cpu%d%c", &cpu, &tail) != 1) continue;
+        char path[128];
+        long online = 1;
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/online", cpu);
+        read_long(path, &online);     // cpu0 usually has no online file
+        if (online) ids[count++] = cpu;
+    }
+    closedir(dir);
+    if (count == 0) return -1;
+
+    // readdir order is arbitrary; CPUs are placed in numeric order
+    for (int i = 1; i < count; i++) {
+        int v = ids[i], j = i;
+        while (j > 0 && ids[j - 1] > v) {
+            ids[j] = ids[j - 1];
+            j--;
+        }
+        ids[j] = v;
+    }
+
+    for (int i = 0; i < count; i++) {
+        char path[128];
+        long core = ids[i], package = 0;
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/core_id", ids[i]);
+        read_long(path, &core);
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/physical_package_id", ids[i]);
+        read_long(path, &package);
+
+        long key = (package << 20) | core;
+        int c = 0;
+        while (c < host->cores && package_core[c] != key) c++;
+        if (c == host->cores) package_core[host->cores++] = key;
+
+        host->cpu_id[i] = ids[i];
+        host->core_of[i] = c;
+        host->node_of[i] = cpu_node(ids[i]);
+        if (host->node_of[i] + 1 > host->nodes) host->nodes = host->node_of[i] + 1;
+    }
+    host->cpus = count;
+
+    int fd = open("/dev/kvm", O_RDWR | O_CLOEXEC);
+    if (fd >= 0) {
+        host->kvm = 1;
+        close(fd);
+    }
+    host->vhost_net = access("/dev/vhost-net", F_OK) == 0;
+    host->io_uring = kernel_has_io_uring();
+    return 0;
+}
+
+// Free pages of one size on a node, falling back to the global pool
+static long free_hugepages(int node, unsigned kb) {
+    char path[128];
+    long free_pages = 0;
+    snprintf(path, sizeof(path), SYS_NODE "/node%d/hugepages/hugepages-%ukB/free_hugepages",
+             node, kb);
+    if (read_long(path, &free_pages) == 0) return free_pages;
+    snprintf(path, sizeof(path), SYS_HUGEPAGES "/hugepages-%ukB/free_hugepages", kb);
+    return read_long(path, &free_pages) == 0 ? free_pages : 0;
+}
+
+static int add_arg(QemuProfile *p, const char *fmt, ...) {
+    if (p->argc >= QEMU_PROFILE_MAX_ARGS) return -1;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(p->store + p->used, sizeof(p->store) - p->used, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= sizeof(p->store) - p->used) return -1;
+    p->argv[p->argc++] = p->store + p->used;
+    p->argv[p->argc] = NULL;
+    p->used += n + 1;
+    return 0;
+}
+
+// QEMU option values escape a comma by doubling it
+static void escape_commas(const char *in, char *out, size_t size) {
+    size_t n = 0;
+    for (; *in && n + 2 < size; in++) {
+        if (*in == ',') out[n++] = ',';
+        out[n++] = *in;
+    }
+    out[n] = '\0';
+}
+
+// O_DIRECT works on the image's filesystem (cache=none needs it)
+static int direct_io_ok(const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd >= 0) {
+        close(fd);
+        return 1;
+    }
+    return errno != EINVAL;
+}
+
+// One vCPU per physical core of the node with the most cores. The first
+// core is left to the iothread and the host.
+static void place_vcpus(const QemuHost *host, int want, QemuProfile *p) {
+    int cores_per_node[64] = {0};
+    int seen[QEMU_PROFILE_MAX_CPUS] = {0};
+    int candidates[QEMU_PROFILE_MAX_CPUS];
+    int count = 0;
+
+    for (int i = 0; i < host->cpus; i++) {
+        if (host->node_of[i] >= 0 && host->node_of[i] < 64 && !seen[host->core_of[i]]) {
+            seen[host->core_of[i]] = 1;
+            cores_per_node[host->node_of[i]]++;
+        }
+    }
+    int node = 0;
+    for (int n = 1; n < host->nodes && n < 64; n++) {
+        if (cores_per_node[n] > cores_per_node[node]) node = n;
+    }
+
+    memset(seen, 0, sizeof(seen));
+    for (int i = 0; i < host->cpus; i++) {
+        if (host->node_of[i] == node && !seen[host->core_of[i]]) {
+            seen[host->core_of[i]] = 1;
+            candidates[count++] = host->cpu_id[i];
+        }
+    }
+
+    int spare = count > 1 ? count - 1 : 1;
+    p->vcpus = want > 0 ? want : (spare < QEMU_PROFILE_DEFAULT_VCPUS ? spare
+                                                                     : QEMU_PROFILE_DEFAULT_VCPUS);
+    if (p->vcpus > QEMU_PROFILE_MAX_VCPUS) p->vcpus = QEMU_PROFILE_MAX_VCPUS;
+    p->node = host->nodes > 1 ? node : -1;
+    p->iothread_cpu = count > 1 ? candidates[0] : -1;
+
+    // Pin only when every vCPU gets a core of its own
+    int pinned = count > 1 && p->vcpus <= count - 1;
+    for (int i = 0; i < p->vcpus; i++) p->pin[i] = pinned ? candidates[1 + i] : -1;
+}
+
+int qemu_profile_build(const QemuHost *host, const QemuProfileOptions *opt,
+                       QemuProfile *p) {
+    char disk[1024], iso[1024];
+    int rc = 0;
+
+    if (!opt->disk_path || !opt->disk_format) return -1;
+    memset(p, 0, sizeof(*p));
+    place_vcpus(host, opt->vcpus, p);
+    int memory = opt->memory_mb > 0 ? opt->memory_mb : QEMU_PROFILE_DEFAULT_MEMORY;
+    int node = p->node >= 0 ? p->node : 0;
+
+    // Largest page size with enough free pages for all of guest RAM. Shared
+    // VMs all get the same plain RAM block, so a saved state loads in any
+    if (opt->shared) {
+        for (int i = 0; i < p->vcpus; i++) p->pin[i] = -1;
+        p->iothread_cpu = -1;
+        p->node = -1;
+    } else if (memory % 1024 == 0 && free_hugepages(node, 1048576) >= memory / 1024) {
+        p->hugepage_kb = 1048576;
+    } else if (free_hugepages(node, 2048) >= memory / 2) {
+        p->hugepage_kb = 2048;
+    }
+
+    rc |= add_arg(p, QEMU_PROFILE_BINARY);
+    rc |= add_arg(p, "-name");
+    rc |= add_arg(p, "%s,debug-threads=on", opt->name ? opt->name : "lainux-vm");
+    rc |= add_arg(p, "-accel");
+    rc |= add_arg(p, host->kvm ? "kvm" : "tcg,thread=multi");
+    rc |= add_arg(p, "-cpu");
+    rc |= add_arg(p, host->kvm ? "host" : "max");
+    rc |= add_arg(p, "-smp");
+    rc |= add_arg(p, "%d,sockets=1,cores=%d,threads=1", p->vcpus, p->vcpus);
+    rc |= add_arg(p, "-m");
+    rc |= add_arg(p, "%dM", memory);
+
+    // Guest RAM: hugepages and/or bound to the vCPUs' node
+    if (p->hugepage_kb || p->node >= 0) {
+        char bind[48] = "";
+        if (p->node >= 0) snprintf(bind, sizeof(bind), ",host-nodes=%d,policy=bind", p->node);
+        rc |= add_arg(p, "-object");
+        if (p->hugepage_kb) {
+            rc |= add_arg(p, "memory-backend-memfd,id=mem0,size=%dM,hugetlb=on,"
+                             "hugetlbsize=%uk,prealloc=on%s",
+                          memory, p->hugepage_kb, bind);
+        } else {
+            rc |= add_arg(p, "memory-backend-ram,id=mem0,size=%dM%s", memory, bind);
+        }
+        rc |= add_arg(p, "-machine");
+        rc |= add_arg(p, "q35,memory-backend=mem0");
+    } else {
+        rc |= add_arg(p, "-machine");
+        rc |= add_arg(p, "q35");
+    }
+
+    if (opt->firmware_code) {
+        escape_commas(opt->firmware_code, disk, sizeof(disk));
+        rc |= add_arg(p, "-drive");
+        rc |= add_arg(p, "if=pflash,format=raw,unit=0,readonly=on,file=%s", disk);
+        if (opt->firmware_vars) {
+            escape_commas(opt->firmware_vars, disk, sizeof(disk));
+            rc |= add_arg(p, "-drive");
+            rc |= add_arg(p, "if=pflash,format=raw,unit=1,file=%s", disk);
+        }
+    }
+
+    // Disk on its own iothread, bypassing the host page cache
+    int direct = direct_io_ok(opt->disk_path);
+    const char *aio = host->io_uring ? "io_uring" : direct ? "native" : "threads";
+    escape_commas(opt->disk_path, disk, sizeof(disk));
+    rc |= add_arg(p, "-object");
+    rc |= add_arg(p, "iothread,id=io0");
+    rc |= add_arg(p, "-drive");
+    rc |= add_arg(p, "file=%s,format=%s,if=none,id=disk0,cache=%s,aio=%s,"
+                     "discard=unmap,detect-zeroes=unmap",
+                  disk, opt->disk_format, direct ? "none" : "writeback", aio);
+    rc |= add_arg(p, "-device");
+    if (opt->bus == QEMU_DISK_VIRTIO_SCSI) {
+        rc |= add_arg(p, "virtio-scsi-pci,id=scsi0,iothread=io0,num_queues=%d", p->vcpus);
+        rc |= add_arg(p, "-device");
+        rc |= add_arg(p, "scsi-hd,drive=disk0,bus=scsi0.0,bootindex=1");
+    } else {
+        rc |= add_arg(p, "virtio-blk-pci,drive=disk0,iothread=io0,num-queues=%d,bootindex=1",
+                      p->vcpus);
+    }
+
+    // An empty disk is not bootable, so the CD takes over until installed
+    if (opt->iso_path) {
+        escape_commas(opt->iso_path, iso, sizeof(iso));
+        rc |= add_arg(p, "-drive");
+        rc |= add_arg(p, "file=%s,media=cdrom,if=none,id=cd0,readonly=on", iso);
+        rc |= add_arg(p, "-device");
+        rc |= add_arg(p, "ide-cd,drive=cd0,bootindex=2");
+    }
+
+    int queues = p->vcpus < QEMU_PROFILE_MAX_NET_QUEUES ? p->vcpus : QEMU_PROFILE_MAX_NET_QUEUES;
+    if (opt->tap) {
+        rc |= add_arg(p, "-netdev");
+        rc |= add_arg(p, "tap,id=net0,ifname=%s,script=no,downscript=no,vhost=%s,queues=%d",
+                      opt->tap, host->vhost_net ? "on" : "off", queues);
+        rc |= add_arg(p, "-device");
+        rc |= add_arg(p, "virtio-net-pci,netdev=net0,mq=on,vectors=%d", 2 * queues + 2);
+    } else {
+        // slirp has a single queue
+        rc |= add_arg(p, "-netdev");
+        rc |= add_arg(p, "user,id=net0");
+        rc |= add_arg(p, "-device");
+        rc |= add_arg(p, "virtio-net-pci,netdev=net0");
+    }
+
+    rc |= add_arg(p, "-device");
+    rc |= add_arg(p, "virtio-rng-pci");
+    rc |= add_arg(p, "-rtc");
+    rc |= add_arg(p, "base=utc");
+    if (opt->kind == QEMU_PROFILE_HEADLESS) {
+        rc |= add_arg(p, "-nographic");
+    } else {
+        rc |= add_arg(p, "-vga");
+        rc |= add_arg(p, "virtio");
+        rc |= add_arg(p, "-device");
+        rc |= add_arg(p, "qemu-xhci");
+        rc |= add_arg(p, "-device");
+        rc |= add_arg(p, "usb-tablet");
+    }
+    if (opt->qmp_socket) {
+        rc |= add_arg(p, "-qmp");
+        rc |= add_arg(p, "unix:%s,server=on,wait=off", opt->qmp_socket);
+    }
+    if (opt->incoming) {
+        rc |= add_arg(p, "-incoming");
+        rc |= add_arg(p, "%s", opt->incoming);
+    }
+    if (rc != 0) {
+        log_message("VM profile: too many arguments");
+        return -1;
+    }
+
+    char hp[32] = "no hugepages";
+    if (p->hugepage_kb) {
+        snprintf(hp, sizeof(hp), "%u%c hugepages",
+                 p->hugepage_kb >= 1048576 ? p->hugepage_kb >> 20 : p->hugepage_kb >> 10,
+                 p->hugepage_kb >= 1048576 ? 'G' : 'M');
+    }
+    snprintf(p->summary, sizeof(p->summary),
+             "%d vCPUs %s, %dM RAM (%s), %s %s cache=%s, %s net, %s, %s",
+             p->vcpus, p->pin[0] >= 0 ? "pinned" : "floating", memory, hp,
+             opt->bus == QEMU_DISK_VIRTIO_SCSI ? "virtio-scsi" : "virtio-blk", aio,
+             direct ? "none" : "writeback", opt->tap ? "multiqueue tap" : "user",
+             opt->kind == QEMU_PROFILE_HEADLESS ? "headless" : "desktop",
+             opt->firmware_code ? "UEFI" : "BIOS");
+    log_message("VM profile: %s", p->summary);
+    return 0;
+}
+
+static void put_quoted(FILE *fp, const char *s) {
+    fputc('\'', fp);
+    for (; *s; s++) {
+        if (*s == '\'') fputs("'\\''", fp);
+        else fputc(*s, fp);
+    }
+    fputc('\'', fp);
+}
+
+int qemu_profile_write_script(const QemuProfile *p, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        log_message("VM profile: cannot write %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "#!/bin/bash\n");
+    fprintf(fp, "# Lainux VM launcher, generated for this host\n");
+    fprintf(fp, "# %s\n\n", p->summary);
+
+    int pinned = p->iothread_cpu >= 0;
+    for (int i = 0; i < p->vcpus; i++) pinned |= p->pin[i] >= 0;
+
+    // QEMU is exec'd below and keeps this PID; the helper pins its threads
+    if (pinned) {
+        fprintf(fp, "pin_threads() {\n");
+        fprintf(fp, "  command -v taskset >/dev/null || return\n");
+        fprintf(fp, "  for i in $(seq 50); do\n");
+        fprintf(fp, "    grep -qs '^CPU 0/' /proc/$1/task/*/comm && break\n");
+        fprintf(fp, "    sleep 0.2\n");
+        fprintf(fp, "  done\n");
+        fprintf(fp, "  for t in /proc/$1/task/*; do\n");
+        fprintf(fp, "    case \"$(cat $t/comm 2>/dev/null)\" in\n");
+        for (int i = 0; i < p->vcpus; i++) {
+            if (p->pin[i] >= 0) {
+                fprintf(fp, "      \"CPU %d/\"*) taskset -pc %d ${t##*/} ;;\n", i, p->pin[i]);
+            }
+        }
+        if (p->iothread_cpu >= 0) {
+            fprintf(fp, "      \"IO io0\") taskset -pc %d ${t##*/} ;;\n", p->iothread_cpu);
+        }
+        fprintf(fp, "    esac\n");
+        fprintf(fp, "  done >/dev/null\n");
+        fprintf(fp, "}\n\n");
+        fprintf(fp, "pin_threads $$ &\n");
+    }
+
+    // One option per line, with its value
+    fprintf(fp, "exec ");
+    put_quoted(fp, p->argv[0]);
+    for (int i = 1; i < p->argc; i++) {
+        fprintf(fp, " \\\n  ");
+        put_quoted(fp, p->argv[i]);
+        if (p->argv[i][0] == '-' && i + 1 < p->argc && p->argv[i + 1][0] != '-') {
+            fputc(' ', fp);
+            put_quoted(fp, p->argv[++i]);
+        }
+    }
+    fprintf(fp, " \\\n  \"$@\"\n");
+
+    int rc = fclose(fp) == 0 ? chmod(path, 0755) : -1;
+    if (rc != 0) log_message("VM profile: cannot finish %s", path);
+    return rc;
+}
@@ -0,0 +1,91 @@
+#ifndef QEMU_PROFILE_H
+#define QEMU_PROFILE_H
+
+/*
+ * QEMU launch profiles tuned to the host.
+ * qemu_host_probe() reads the CPU topology, NUMA nodes, free hugepages,
+ * KVM, vhost-net and io_uring support from sysfs/devfs. From that
+ * qemu_profile_build() derives one command line: vCPUs placed one per
+ * physical core of a single NUMA node (pinned once QEMU is up), guest
+ * memory from hugepages bound to that node, the disk on virtio-blk or
+ * virtio-scsi served by a dedicated iothread with cache=none and
+ * io_uring (native AIO as fallback), and multiqueue virtio-net with vhost
+ * on a tap device. The headless profile replaces the display with
+ * -nographic for CI runs. Shared profiles skip the host-exclusive tuning
+ * so test clones can run side by side and restore each other's state.
+ */
+
+#define QEMU_PROFILE_BINARY "qemu-system-x86_64"
+#define QEMU_PROFILE_MAX_CPUS 512          // host logical CPUs considered
+#define QEMU_PROFILE_MAX_VCPUS 64
+#define QEMU_PROFILE_DEFAULT_VCPUS 4
+#define QEMU_PROFILE_DEFAULT_MEMORY 4096   // MB
+#define QEMU_PROFILE_MAX_ARGS 96
+#define QEMU_PROFILE_STORE 8192            // bytes for all argument strings
+
+typedef struct {
+    int cpus;                              // online logical CPUs seen
+    int cores;                             // physical cores
+    int nodes;                             // NUMA nodes with CPUs
+    int kvm;                               // /dev/kvm can be opened
+    int vhost_net;                         // /dev/vhost-net exists
+    int io_uring;                          // the kernel accepts io_uring_setup
+    int cpu_id[QEMU_PROFILE_MAX_CPUS];     // logical CPU number
+    int core_of[QEMU_PROFILE_MAX_CPUS];    // dense physical core index
+    int node_of[QEMU_PROFILE_MAX_CPUS];
+} QemuHost;
+
+typedef enum {
+    QEMU_PROFILE_DESKTOP = 0,              // virtio-vga window
+    QEMU_PROFILE_HEADLESS,                 // -nographic, serial on stdio
+} QemuProfileKind;
+
+typedef enum {
+    QEMU_DISK_VIRTIO_BLK = 0,
+    QEMU_DISK_VIRTIO_SCSI,
+} QemuDiskBus;
+
+typedef struct {
+    QemuProfileKind kind;
+    const char *name;                      // VM name, NULL - "lainux-vm"
+    const char *disk_path;
+    const char *disk_format;               // "qcow2" or "raw"
+    const char *iso_path;                  // NULL - boot from the disk
+    int memory_mb;                         // 0 - QEMU_PROFILE_DEFAULT_MEMORY
+    int vcpus;                             // 0 - sized from the host
+    QemuDiskBus bus;
+    const char *tap;                       // NULL - user networking, one queue
+    const char *qmp_socket;                // NULL - no QMP monitor
+    int shared;                            // one of several VMs on the host: no
+                                           // pinning, hugepages or node binding
+    const char *firmware_code;             // OVMF code image, NULL - SeaBIOS
+    const char *firmware_vars;             // writable copy of the OVMF variables
+    const char *incoming;                  // -incoming URI, NULL - cold boot
+} QemuProfileOptions;
+
+typedef struct {
+    char *argv[QEMU_PROFILE_MAX_ARGS + 1]; // NULL-terminated, points into store
+    int argc;
+    char store[QEMU_PROFILE_STORE];
+    int used;
+    int vcpus;
+    int pin[QEMU_PROFILE_MAX_VCPUS];       // host CPU per vCPU, -1 - unpinned
+    int iothread_cpu;                      // host CPU for io0, -1 - unpinned
+    int node;                              // NUMA node used, -1 - none bound
+    unsigned hugepage_kb;                  // page size backing memory, 0 - none
+    char summary[256];
+} QemuProfile;
+
+// Fill host from sysfs. Returns 0, -1 when no CPU topology is readable
+int qemu_host_probe(QemuHost *host);
+
+// Derive a command line for opt on host. Returns 0, -1 on bad options or
+// when the argument storage overflowed
+int qemu_profile_build(const QemuHost *host, const QemuProfileOptions *opt,
+                       QemuProfile *out);
+
+// Write an executable launcher: QEMU is exec'd in the foreground while a
+// helper pins the vCPU and iothread threads. Returns 0 on success
+int qemu_profile_write_script(const QemuProfile *profile, const char *path);
+
+#endif // qemu profile h
@@ -0,0 +1,296 @@
+/**
+ * @file qmp.c
+ * @brief line-based QMP client over a UNIX socket
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "qmp.h"
+#include "../utils/log_message.h"
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Take one complete line out of the buffer, NULL if there is none yet
+static char *take_line(Qmp *q) {
+    char *nl = q->len ? memchr(q->buf, '\n', q->len) : NULL;
+    if (!nl) return NULL;
+    size_t n = (size_t)(nl - q->buf);
+    char *line = malloc(n + 1);
+    if (!line) return NULL;
+    memcpy(line, q->buf, n);
+    line[n] = '\0';
+    if (n > 0 && line[n - 1] == '\r') line[n - 1] = '\0';
+    q->len -= n + 1;
+    memmove(q->buf, nl + 1, q->len);
+    return line;
+}
+
+// Receive what is available, waiting at most timeout_ms. -1 on EOF/error
+static int fill(Qmp *q, int timeout_ms) {
+    struct pollfd pfd = {q->fd, POLLIN, 0};
+    int rc = poll(&pfd, 1, timeout_ms);
+    if (rc < 0 && errno == EINTR) return 0;
+    if (rc <= 0) return rc;
+
+    if (q->cap - q->len < 4096) {
+        size_t cap = q->cap ? q->cap * 2 : 16384;
+        char *p = realloc(q->buf, cap);
+        if (!p) return -1;
+        q->buf = p;
+        q->cap = cap;
+    }
+    ssize_t n = recv(q->fd, q->buf + q->len, q->cap - q->len, 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+    if (n <= 0) return -1;
+    q->len += (size_t)n;
+    return 1;
+}
+
+static int is_event(const char *line) {
+    return strncmp(line, "{\"return\"", 9) != 0 && strncmp(line, "{\"error\"", 8) != 0 &&
+           strstr(line, "\"event\":") != NULL;
+}
+
+static void dispatch_event(Qmp *q, const char *line) {
+    char name[64] = "";
+    qmp_json_string(line, line + strlen(line), "event", name, sizeof(name));
+    if (q->on_event) q->on_event(name, line, q->user);
+}
+
+// Next line that is not an event; events met on the way are dispatched
+static char *read_reply(Qmp *q, int timeout_ms) {
+    long long deadline = now_ms() + timeout_ms;
+    for (;;) {
+        char *line;
+        while ((line = take_line(q))) {
+            if (!is_event(line)) return line;
+            dispatch_event(q, line);
+            free(line);
+        }
+        long long left = deadline - now_ms();
+        if (left <= 0 || fill(q, (int)left) < 0) return NULL;
+    }
+}
+
+int qmp_connect(Qmp *q, const char *path, int timeout_ms) {
+    struct sockaddr_un addr;
+    QmpEventFn on_event = q->on_event;
+    void *user = q->user;
+
+    memset(q, 0, sizeof(*q));
+    q->fd = -1;
+    q->on_event = on_event;
+    q->user = user;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+
+    long long deadline = now_ms() + timeout_ms;
+    for (;;) {
+        q->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (q->fd < 0) return -1;
+        if (connect(q->fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) break;
+        int err = errno;
+        close(q->fd);
+        q->fd = -1;
+        if ((err != ENOENT && err != ECONNREFUSED) || now_ms() >= deadline) {
+            log_message("QMP: cannot connect to %s: %s", path, strerror(err));
+            return -1;
+        }
+        usleep(50000);
+    }
+
+    char *greeting = read_reply(q, timeout_ms);
+    int ok = greeting && strstr(greeting, "\"QMP\"") != NULL;
+    free(greeting);
+    if (!ok || qmp_execute(q, "{\"execute\": \"qmp_capabilities\"}", NULL, QMP_TIMEOUT_MS) != 0) {
+        log_message("QMP: handshake on %s failed", path);
+        qmp_close(q);
+        return -1;
+    }
+    return 0;
+}
+
+int qmp_execute(Qmp *q, const char *json, char **reply, int timeout_ms) {
+    if (reply) *reply = NULL;
+    if (q->fd < 0) return -1;
+    if (send_all(q->fd, json, strlen(json)) != 0 || send_all(q->fd, "\n", 1) != 0) {
+        log_message("QMP: send failed: %s", strerror(errno));
+        return -1;
+    }
+
+    char *line = read_reply(q, timeout_ms);
+    if (!line) {
+        log_message("QMP: no reply to %s", json);
+        return -1;
+    }
+    if (strncmp(line, "{\"error\"", 8) == 0) {
+        char desc[256] = "unknown error";
+        qmp_json_string(line, line + strlen(line), "desc", desc, sizeof(desc));
+        log_message("QMP: %s: %s", json, desc);
+        free(line);
+        return -1;
+    }
+    if (reply) *reply = line;
+    else free(line);
+    return 0;
+}
+
+int qmp_hmp(Qmp *q, const char *command_line, int timeout_ms) {
+    char json[512], *reply = NULL, out[256] = "";
+    snprintf(json, sizeof(json),
+             "{\"execute\": \"human-monitor-command\", "
+             "\"arguments\": {\"command-line\": \"%s\"}}",
+             command_line);
+    if (qmp_execute(q, json, &reply, timeout_ms) != 0) return -1;
+
+    const char *end = reply + strlen(reply);
+    qmp_json_string(reply, end, "return", out, sizeof(out));
+    free(reply);
+    // Output ends in an escaped "\r\n"; nothing else means success
+    size_t n = strlen(out);
+    while (n >= 2 && out[n - 2] == '\\' && (out[n - 1] == 'n' || out[n - 1] == 'r')) {
+        out[n -= 2] = '\0';
+    }
+    if (out[0]) {
+        log_message("QMP: %s: %s", command_line, out);
+        return -1;
+    }
+    return 0;
+}
+
+void qmp_pump(Qmp *q) {
+    if (q->fd < 0) return;
+    int rc;
+    while ((rc = fill(q, 0)) > 0) {
+    }
+    // QEMU went away; stop polling a socket that stays readable at EOF
+    if (rc < 0) {
+        close(q->fd);
+        q->fd = -1;
+    }
+    char *line;
+    while ((line = take_line(q))) {
+        if (is_event(line)) dispatch_event(q, line);
+        free(line);
+    }
+}
+
+void qmp_close(Qmp *q) {
+    if (q->fd >= 0) close(q->fd);
+    q->fd = -1;
+    free(q->buf);
+    q->buf = NULL;
+    q->len = q->cap = 0;
+}
+
+/* JSON scanning */
+
+// Position right after "key": within [p, end), NULL if absent
+static const char *after_key(const char *p, const char *end, const char *key) {
+    size_t klen = strlen(key);
+    while (p && p + klen + 3 <= end) {
+        const char *hit = memmem(p, (size_t)(end - p), key, klen);
+        if (!hit || hit + klen + 2 > end) return NULL;
+        if (hit > p && hit[-1] == '"' && hit[klen] == '"') {
+            const char *v = hit + klen + 1;
+            while (v < end && (*v == ' ' || *v == '\t')) v++;
+            if (v < end && *v == ':') {
+                v++;
+                while (v < end && (*v == ' ' || *v == '\t')) v++;
+                return v;
+            }
+        }
+        p = hit + klen;
+    }
+    return NULL;
+}
+
+int qmp_json_number(const char *obj, const char *end, const char *key, long long *out) {
+    const char *v = after_key(obj, end, key);
+    if (!v || v >= end) return -1;
+    char *stop;
+    long long n = strtoll(v, &stop, 10);
+    if (stop == v) return -1;
+    *out = n;
+    return 0;
+}
+
+int qmp_json_string(const char *obj, const char *end, const char *key, char *out,
+                    size_t size) {
+    const char *v = after_key(obj, end, key);
+    if (!v || v >= end || *v != '"') return -1;
+    size_t n = 0;
+    for (v++; v < end && *v != '"'; v++) {
+        if (*v == '\\' && v + 1 < end) {
+            if (n + 2 < size) {
+                out[n++] = *v;
+                out[n++] = v[1];
+            }
+            v++;
+            continue;
+        }
+        if (n + 1 < size) out[n++] = *v;
+    }
+    out[n] = '\0';
+    return 0;
+}
+
+// End of the object starting at p ('{'), skipping strings
+static const char *object_end(const char *p) {
+    int depth = 0, in_string = 0;
+    for (; *p; p++) {
+        if (in_string) {
+            if (*p == '\\' && p[1]) p++;
+            else if (*p == '"') in_string = 0;
+            continue;
+        }
+        if (*p == '"') in_string = 1;
+        else if (*p == '{') depth++;
+        else if (*p == '}' && --depth == 0) return p + 1;
+    }
+    return NULL;
+}
+
+int qmp_json_next(const char *line, const char *key, const char **cursor,
+                  const char **obj, const char **end) {
+    const char *p = *cursor;
+    if (!p) {
+        p = after_key(line, line + strlen(line), key);
+        if (!p || *p != '[') return 0;
+        p++;
+    }
+    while (*p == ' ' || *p == ',' || *p == '\n') p++;
+    if (*p != '{') return 0;
+    const char *e = object_end(p);
+    if (!e) return 0;
+    *obj = p;
+    *end = e;
+    *cursor = e;
+    return 1;
+}
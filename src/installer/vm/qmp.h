@@ -0,0 +1,58 @@
+#ifndef QMP_H
+#define QMP_H
+
+#include <stddef.h>
+
+/*
+ * Minimal QMP client.
+ * QEMU sends one JSON object per line over the UNIX socket: a greeting,
+ * then replies ("return" / "error") in request order with asynchronous
+ * "event" objects interleaved. Commands here are synchronous; events
+ * seen while waiting are handed to the event callback. The scanners
+ * below read the flat JSON QEMU produces without a full parser.
+ */
+
+#define QMP_TIMEOUT_MS 5000
+#define QMP_CONNECT_TIMEOUT_MS 10000   // QEMU creates the socket at startup
+
+typedef void (*QmpEventFn)(const char *event, const char *line, void *user);
+
+typedef struct {
+    int fd;
+    char *buf;                         // bytes received, not yet a full line
+    size_t len, cap;
+    QmpEventFn on_event;
+    void *user;
+} Qmp;
+
+// Connect to path (retrying until it appears or timeout_ms passes) and
+// negotiate capabilities. Returns 0 on success
+int qmp_connect(Qmp *q, const char *path, int timeout_ms);
+
+// Send a command object and wait for its reply. On success returns 0 and,
+// if reply is not NULL, the malloc'd reply line. A QMP error is logged
+// with its description and returns -1, as do I/O errors and timeouts.
+int qmp_execute(Qmp *q, const char *json, char **reply, int timeout_ms);
+
+// Run an HMP command (savevm, loadvm...) through human-monitor-command.
+// HMP reports failures as text, so any output counts as an error.
+int qmp_hmp(Qmp *q, const char *command_line, int timeout_ms);
+
+// Read and dispatch pending events without blocking
+void qmp_pump(Qmp *q);
+
+void qmp_close(Qmp *q);
+
+// Number after "key": inside [obj, end). Returns 0 when found
+int qmp_json_number(const char *obj, const char *end, const char *key, long long *out);
+
+// String after "key": (escapes kept as is). Returns 0 when found
+int qmp_json_string(const char *obj, const char *end, const char *key, char *out,
+                    size_t size);
+
+// Step through the objects of the array after "key": in line. Pass
+// *cursor = NULL first; returns 1 with [*obj, *end) set, 0 when done.
+int qmp_json_next(const char *line, const char *key, const char **cursor,
+                  const char **obj, const char **end);
+
+#endif // qmp h
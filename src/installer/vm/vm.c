@@ -16,134 +16,35 @@
 #include <ncurses.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <openssl/sha.h>
+#include <unistd.h>
 #include "../include/installer.h"
-#include <assert.h>
+#include "../utils/log_message.h"
+#include "iso_verify.h"
+#include "vm_disk.h"
+#include "qemu_profile.h"
+#include "vm_supervisor.h"
+#include "vm_testloop.h"
+#include "../network_connection/fetch.h"
 extern WINDOW *log_win;
 extern WINDOW *status_win;
 
 // links for download iso
 #define ISO_LINKS "https://github.com/wienton/Lainux/releases/download/lainuxiso/lainuxiso-2025.12.25-x86_64.iso"
-
-/*
-
-        ISO image validation and integrity check function.
-        We check using SHA256.
-        We also check the file size.
-        Basic function
-
-*/
-// validate checksum by sys command sha256sum
-int validate_check_sum(const char* path) {
-    // check pointer
-    assert(path != NULL);
-
-    char command[1024];
-    snprintf(command, sizeof(command), "sha256sum \"%s\"", path);
-
-    printf("Executing: %s\n", command);
-
-    // executing
-    int status = system(command);
-
-   // 0 true success, 1 false
-    if (!status) {
-        fprintf(stderr, "Checksum verification failed or command not found.\n");
-        return 1; // callback error
-    }
-
-    printf("Checksum validation successful.\n");
-    return 0; // success
-}
-
-
-int validate_iso_image_with_output(const char *path, const char *expected_sha256) {
-    if (!path) {
-        printf("Invalid ISO image.\n");
-        return 0;
-    }
-
-    // Check file existence and size
-    struct stat st;
-    if (stat(path, &st) != 0) {
-        printf("size of ISO image invalid.\n");
-        return 0;
-    }
-
-    if (!S_ISREG(st.st_mode) || st.st_size < 32768) {
-        printf("Invalid ISO image.\n");
-        return 0;
-    }
-
-    // Validate ISO 9660 Primary Volume Descriptor
-    FILE *fp = fopen(path, "rb");
-    if (!fp) {
-        printf("Invalid ISO image.\n");
-        return 0;
-    }
-
-    if (fseek(fp, 32769, SEEK_SET) != 0) {
-        fclose(fp);
-        printf("Invalid ISO image.\n");
-        return 0;
-    }
-
-    unsigned char pvd[7];
-    if (fread(pvd, 1, 7, fp) != 7) {
-        fclose(fp);
-        printf("Invalid ISO image.\n");
-        return 0;
-    }
-    fclose(fp);
-
-    if (!(pvd[0] == 0x01 &&
-          pvd[1] == 'C' &&
-          pvd[2] == 'D' &&
-          pvd[3] == '0' &&
-          pvd[4] == '0' &&
-          pvd[5] == '1')) {
-        printf("Invalid ISO image.\n");
-        return 0;
-    }
-
-    // If SHA-256 is provided, compute and compare
-    if (expected_sha256) {
-        unsigned char hash[SHA256_DIGEST_LENGTH];
-        char hash_str[65]; // 64 hex chars + null terminator
-
-        fp = fopen(path, "rb");
-        if (!fp) {
-            printf("Invalid ISO image.\n");
-            return 0;
-        }
-
-        SHA256_CTX sha256;
-        SHA256_Init(&sha256);
-
-        unsigned char buffer[8192];
-        size_t bytes;
-        while ((bytes = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-            SHA256_Update(&sha256, buffer, bytes);
-        }
-        fclose(fp);
-
-        SHA256_Final(hash, &sha256);
-
-        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-            sprintf(hash_str + (i * 2), "%02x", hash[i]);
-        }
-        hash_str[64] = '\0';
-
-        if (strcmp(hash_str, expected_sha256) != 0) {
-            printf("Invalid ISO image.\n");
-            return 0;
-        }
-    }
-
-    printf("Valid ISO image.\n");
-    return 1;
-}
-
+// overrides ISO_LINKS, e.g. a local mirror or test server
+#define ISO_LINKS_ENV "LAINUX_ISO_URL"
+
+// generated launchers (see qemu_profile.h)
+#define VM_SCRIPT "install-lainux-vm.sh"
+#define VM_SCRIPT_CI "install-lainux-vm-ci.sh"
+#define VM_TAP_ENV "LAINUX_VM_TAP"      // tap device for multiqueue networking
+#define VM_BUS_ENV "LAINUX_VM_BUS"      // "scsi" for virtio-scsi instead of virtio-blk
+#define VM_QMP_SOCKET "/tmp/lainux-vm-%d.qmp"  // per installer PID
+
+// VM disk image; "raw" in VM_DISK_ENV trades qcow2 features for raw speed
+#define VM_DISK_ENV "LAINUX_VM_DISK"
+#define VM_DISK_QCOW2 "lainux-vm.qcow2"
+#define VM_DISK_RAW "lainux-vm.img"
+#define VM_DISK_CLUSTER (64u << 10)
 
 void print_iso_size(const char *path)
 {
@@ -162,6 +63,20 @@ void print_iso_size(const char *path)
 }
 
 
+// Download progress goes to the status line of the TUI
+static void download_progress(unsigned long long done, unsigned long long total,
+                              double mb_per_sec, void *arg) {
+    (void)arg;
+    char msg[128];
+    if (total > 0) {
+        snprintf(msg, sizeof(msg), "ISO: %.1f / %.1f MB (%.0f%%, %.1f MB/s)", done / 1048576.0,
+                 total / 1048576.0, done * 100.0 / total, mb_per_sec);
+    } else {
+        snprintf(msg, sizeof(msg), "ISO: %.1f MB (%.1f MB/s)", done / 1048576.0, mb_per_sec);
+    }
+    display_status(msg);
+}
+
 int download_iso(const char* iso_links) {
     if (iso_links == NULL || strlen(iso_links) == 0) {
 
@@ -172,21 +87,35 @@ int download_iso(const char* iso_links) {
 
     printf("Download ISO file from: '%s'\n", iso_links);
 
-    char command[512];
-    char* end_input = "lainux.iso";
-    snprintf(command, sizeof(command), "wget --show-progress -O %p %s",end_input,  iso_links);
-    int result = system(command);
+    const char* end_input = "lainux.iso";
+    // SHA-256 is computed while the data arrives, no second pass afterwards
+    FetchOptions opts = {NULL, download_progress, NULL, 0};
+    FetchResult fetched;
+    // parallel ranges; an interrupted download resumes on the next call
+    int result = fetch_file(iso_links, end_input, &opts, &fetched);
 
     if (result == 0) {
 
         log_message("\n[Success] ISO downloaded successfully.\n");
-        validate_iso_image_with_output(iso_links, NULL);
-        validate_check_sum(end_input);
+        if (!iso_check_header(end_input)) {
+            printf("Invalid ISO image.\n");
+            return -1;
+        }
+        printf("Valid ISO image.\n");
+        printf("SHA-256: %s (%.1f MB/s)\n", fetched.sha256, fetched.mb_per_sec);
+
+        // sidecar: check_qemu_dependencies() reuses the image while it matches
+        char sidecar[256];
+        snprintf(sidecar, sizeof(sidecar), "%s%s", end_input, ISO_SHA256_SUFFIX);
+        FILE *fp = fopen(sidecar, "w");
+        if (fp) {
+            fprintf(fp, "%s  %s\n", fetched.sha256, end_input);
+            fclose(fp);
+        }
 
     } else {
 
-        log_message("\n[Error] Failed to download ISO. Code: %d\n", result);
-        validate_check_sum(end_input);
+        log_message("\n[Error] Failed to download ISO from %s\n", iso_links);
 
     }
 
@@ -195,28 +124,27 @@ int download_iso(const char* iso_links) {
 
 // Check QEMU dependencies
 int check_qemu_dependencies() {
-    const char *qemu_tools[] = {
-        "qemu-system-x86_64", "qemu-img",
-        NULL
-    };
-
     // github.com/releases/ iso Lainux, check macro
-    const char* links_iso = ISO_LINKS;
+    const char* links_iso = getenv(ISO_LINKS_ENV) ? getenv(ISO_LINKS_ENV) : ISO_LINKS;
     const char* end_output = "lainux.iso";
-    unsigned result_installation = download_iso(links_iso);
 
-    int result_checksum = validate_check_sum(end_output);
-
-    if(!result_checksum) {
-        fprintf(stderr, "error check sum 256 '%s'\n", end_output);
+    // An earlier complete download left its digest next to the image:
+    // reuse the image when it still matches, download it again otherwise
+    char sidecar[256];
+    snprintf(sidecar, sizeof(sidecar), "%s%s", end_output, ISO_SHA256_SUFFIX);
+    if (file_exists(end_output) && file_exists(sidecar) && iso_verify(end_output, NULL, NULL)) {
+        log_message("Reusing verified %s", end_output);
         print_iso_size(end_output);
-        return -1;
+        return check_qemu_tools();
     }
 
+    // downloads the image, hashing it on the fly
+    unsigned result_installation = download_iso(links_iso);
+
     if(result_installation) {
 
         fprintf(stderr, "result installation(%d) error, code: %d\n", result_installation,  errno);
-        print_iso_size("lainux.iso");
+        print_iso_size(end_output);
         return -1;
 
     }
@@ -224,8 +152,17 @@ int check_qemu_dependencies() {
 
 
     log_message("iso from '%s' download successfully\n", links_iso);
-    print_iso_size("lainux.iso");
+    print_iso_size(end_output);
+
+    return check_qemu_tools();
+}
 
+// QEMU binaries only, installed through the package manager if missing
+int check_qemu_tools() {
+    const char *qemu_tools[] = {
+        "qemu-system-x86_64",
+        NULL
+    };
 
     int missing = 0;
     for (int i = 0; qemu_tools[i] != NULL; i++) {
@@ -264,6 +201,17 @@ int check_qemu_dependencies() {
     return (missing == 0);
 }
 
+// Disk settings: qcow2 unless LAINUX_VM_DISK=raw
+static VmDiskOptions vm_disk_options(const char **path) {
+    const char *env = getenv(VM_DISK_ENV);
+    VmDiskOptions opt = {VMDISK_QCOW2, VMDISK_DEFAULT_SIZE, VM_DISK_CLUSTER,
+                         VMDISK_PREALLOC_FALLOC, VMDISK_COMPRESS_ZSTD, NULL};
+
+    if (env && strcmp(env, "raw") == 0) opt.format = VMDISK_RAW;
+    *path = opt.format == VMDISK_RAW ? VM_DISK_RAW : VM_DISK_QCOW2;
+    return opt;
+}
+
 // Create virtual disk
 void create_virtual_disk() {
     log_message("Creating virtual disk image...");
@@ -276,14 +224,51 @@ void create_virtual_disk() {
         return;
     }
 
-    // Create 20GB qcow2 disk image with compression
-    run_command("qemu-img create -f qcow2 -o compression_type=zlib lainux-vm.qcow2 20G", 1);
+    // 20GB image, metadata and data allocated up front so guest writes
+    // during the install never stop to grow the file
+    const char *path;
+    VmDiskOptions opt = vm_disk_options(&path);
+    if (vm_disk_create(path, &opt) != 0) {
+        log_message("Failed to create virtual disk %s", path);
+        return;
+    }
+
+    log_message("Virtual disk created: %s", path);
+}
+
+// Headless profile spawned directly, serial console in log_win
+static void run_supervised_vm(const char *iso_path) {
+    const char *disk_path;
+    VmDiskOptions disk = vm_disk_options(&disk_path);
+    QemuHost host;
+    if (qemu_host_probe(&host) != 0) {
+        return;
+    }
 
-    log_message("Virtual disk created: lainux-vm.qcow2");
+    char qmp_path[64];
+    snprintf(qmp_path, sizeof(qmp_path), VM_QMP_SOCKET, (int)getpid());
+    const char *bus = getenv(VM_BUS_ENV);
+    QemuProfileOptions opts = {QEMU_PROFILE_HEADLESS, "Lainux-VM", disk_path,
+                               vm_disk_format_name(disk.format), iso_path,
+                               QEMU_PROFILE_DEFAULT_MEMORY, 0,
+                               bus && strcmp(bus, "scsi") == 0 ? QEMU_DISK_VIRTIO_SCSI
+                                                               : QEMU_DISK_VIRTIO_BLK,
+                               getenv(VM_TAP_ENV), qmp_path, 0, NULL, NULL, NULL};
+    static QemuProfile profile;
+    static VmSupervisor sup;
+    if (qemu_profile_build(&host, &opts, &profile) != 0) {
+        return;
+    }
+    if (vm_sup_start(&sup, &profile, qmp_path) != 0) {
+        display_status("Failed to start QEMU, see the log");
+        return;
+    }
+    vm_sup_console(&sup, disk_path);
 }
 
 // Install on virtual machine
 void install_on_virtual_machine() {
+    log_pause();
     clear();
 
 
@@ -304,6 +289,7 @@ void install_on_virtual_machine() {
     char confirm[2];
     mvgetnstr(11, 40, confirm, sizeof(confirm));
     noecho();
+    log_resume();
 
     if (confirm[0] != 'y' && confirm[0] != 'Y') {
         return;
@@ -313,10 +299,12 @@ void install_on_virtual_machine() {
     int max_y, max_x;
     getmaxyx(stdscr, max_y, max_x);
 
+    pthread_mutex_lock(&log_mutex);
     log_win = newwin(max_y - 10, max_x - 10, 5, 5);
     scrollok(log_win, TRUE);
     box(log_win, 0, 0);
     wrefresh(log_win);
+    pthread_mutex_unlock(&log_mutex);
 
     log_message("Starting virtual machine installation...");
 
@@ -336,8 +324,7 @@ void install_on_virtual_machine() {
     // Check QEMU dependencies
     if (!check_qemu_dependencies()) {
         log_message("Failed to install QEMU dependencies");
-        delwin(log_win);
-        log_win = NULL;
+        log_close_window();
         return;
     }
 
@@ -346,8 +333,7 @@ void install_on_virtual_machine() {
         log_message("Warning: No network connectivity");
         if (!confirm_action("Continue without network?", "CONTINUE")) {
             log_message("VM installation cancelled");
-            delwin(log_win);
-            log_win = NULL;
+            log_close_window();
             return;
         }
     }
@@ -355,8 +341,7 @@ void install_on_virtual_machine() {
 
     // TODO: correct download ISO file from link
     // Select ISO file
-    delwin(log_win);
-    log_win = NULL;
+    log_close_window();
 
     char iso_path[MAX_PATH];
     select_iso_file(iso_path, sizeof(iso_path));
@@ -367,17 +352,23 @@ void install_on_virtual_machine() {
     }
 
     // Recreate log window
+    pthread_mutex_lock(&log_mutex);
     log_win = newwin(max_y - 10, max_x - 10, 5, 5);
     scrollok(log_win, TRUE);
     box(log_win, 0, 0);
     wrefresh(log_win);
+    pthread_mutex_unlock(&log_mutex);
 
     log_message("Selected ISO: %s", iso_path);
 
     if (!file_exists(iso_path)) {
         log_message("ISO file not found: %s", iso_path);
-        delwin(log_win);
-        log_win = NULL;
+        log_close_window();
+        return;
+    }
+    if (!iso_verify(iso_path, NULL, NULL)) {
+        log_message("ISO %s failed verification", iso_path);
+        log_close_window();
         return;
     }
 
@@ -389,10 +380,22 @@ void install_on_virtual_machine() {
 
     log_message("Virtual machine setup complete!");
 
-    delwin(log_win);
-    log_win = NULL;
+    log_close_window();
+
+    // Optionally boot it right here under the QMP supervisor
+    log_pause();
+    clear();
+    mvprintw(4, 10, "Start the VM now under the installer? (y/N): ");
+    echo();
+    mvgetnstr(4, 56, confirm, sizeof(confirm));
+    noecho();
+    log_resume();
+    if (confirm[0] == 'y' || confirm[0] == 'Y') {
+        run_supervised_vm(iso_path);
+    }
 
     // Show completion message
+    log_pause();
     clear();
 
     attron(A_BOLD | COLOR_PAIR(1));
@@ -403,29 +406,33 @@ void install_on_virtual_machine() {
 
     mvprintw(7, 25, "Files created in current directory:");
     attron(COLOR_PAIR(2));
-    mvprintw(8, 30, "lainux-vm.qcow2        - 20GB virtual disk");
-    mvprintw(9, 30, "install-lainux-vm.sh   - VM startup script");
-    mvprintw(10, 30, "VM-README.txt         - Instructions");
+    const char *disk_path;
+    VmDiskOptions disk = vm_disk_options(&disk_path);
+    mvprintw(8, 30, "%-22s - 20GB virtual disk", disk_path);
+    mvprintw(9, 30, "%-22s - VM startup script", VM_SCRIPT);
+    mvprintw(10, 30, "%-22s - headless (CI) variant", VM_SCRIPT_CI);
+    mvprintw(11, 30, "VM-README.txt          - Instructions");
     attroff(COLOR_PAIR(2));
 
-    mvprintw(12, 25, "To start the virtual machine:");
+    mvprintw(13, 25, "To start the virtual machine:");
     attron(A_BOLD);
-    mvprintw(13, 30, "sudo ./install-lainux-vm.sh");
+    mvprintw(14, 30, "sudo ./%s", VM_SCRIPT);
     attroff(A_BOLD);
 
-    mvprintw(15, 25, "VM Specifications:");
-    mvprintw(16, 30, "CPU: 4 cores (or available cores)");
-    mvprintw(17, 30, "RAM: 4GB");
-    mvprintw(18, 30, "Disk: 20GB (qcow2 format)");
-    mvprintw(19, 30, "ISO: %s", iso_path);
+    mvprintw(16, 25, "VM Specifications:");
+    mvprintw(17, 30, "CPU: up to 4 cores, pinned when the host has spare cores");
+    mvprintw(18, 30, "RAM: 4GB (hugepages when available)");
+    mvprintw(19, 30, "Disk: 20GB (%s format)", vm_disk_format_name(disk.format));
+    mvprintw(20, 30, "ISO: %s", iso_path);
 
     attron(COLOR_PAIR(4) | A_BOLD);
-    mvprintw(21, 25, "Note: Run with sudo for best performance");
+    mvprintw(22, 25, "Note: Run with sudo for best performance");
     attroff(COLOR_PAIR(4) | A_BOLD);
 
-    mvprintw(23, 25, "Press any key to return to menu...");
+    mvprintw(24, 25, "Press any key to return to menu...");
     refresh();
     getch();
+    log_resume();
 }
 
 
@@ -434,76 +441,53 @@ void install_on_virtual_machine() {
 // Setup QEMU virtual machine
 void setup_qemu_vm(const char *iso_path) {
     log_message("Setting up QEMU virtual machine...");
+    const char *disk_path;
+    VmDiskOptions disk = vm_disk_options(&disk_path);
 
-    // Create installation script
-    FILE *script = fopen("install-lainux-vm.sh", "w");
-    if (script) {
-        fprintf(script, "#!/bin/bash\n");
-        fprintf(script, "# Lainux VM Installation Script\n");
-        fprintf(script, "# Generated on: %s", ctime(&(time_t){time(NULL)}));
-        fprintf(script, "\n");
-        fprintf(script, "echo 'Starting Lainux VM installation...'\n");
-        fprintf(script, "echo 'ISO: %s'\n", iso_path);
-        fprintf(script, "\n");
-
-        // Check for KVM support
-        fprintf(script, "KVM_SUPPORT=$(grep -E '(vmx|svm)' /proc/cpuinfo 2>/dev/null | head -1)\n");
-        fprintf(script, "if [ -n \"$KVM_SUPPORT\" ]; then\n");
-        fprintf(script, "  echo 'KVM acceleration available'\n");
-        fprintf(script, "  ACCEL=\"-enable-kvm -cpu host\"\n");
-        fprintf(script, "else\n");
-        fprintf(script, "  echo 'Running without KVM acceleration'\n");
-        fprintf(script, "  ACCEL=\"-cpu qemu64\"\n");
-        fprintf(script, "fi\n");
-        fprintf(script, "\n");
-
-        // Check if running as root
-        fprintf(script, "if [ \"$EUID\" -ne 0 ]; then\n");
-        fprintf(script, "  echo 'Warning: Not running as root. Some features may be limited.'\n");
-        fprintf(script, "fi\n");
-        fprintf(script, "\n");
-
-        // VM configuration
-        fprintf(script, "# VM Configuration\n");
-        fprintf(script, "MEMORY=\"4096\"\n");
-        fprintf(script, "CORES=\"$(nproc)\"\n");
-        fprintf(script, "if [ \"$CORES\" -gt 4 ]; then\n");
-        fprintf(script, "  CORES=\"4\"\n");
-        fprintf(script, "fi\n");
-        fprintf(script, "\n");
-        fprintf(script, "echo \"Starting VM with ${CORES} cores and ${MEMORY}MB RAM\"\n");
-        fprintf(script, "\n");
-
-        // Start VM command
-        fprintf(script, "qemu-system-x86_64 \\\n");
-        fprintf(script, "  $ACCEL \\\n");
-        fprintf(script, "  -m $MEMORY \\\n");
-        fprintf(script, "  -smp $CORES \\\n");
-        fprintf(script, "  -drive file=lainux-vm.qcow2,format=qcow2 \\\n");
-        fprintf(script, "  -cdrom \"%s\" \\\n", iso_path);
-        fprintf(script, "  -boot order=d \\\n");
-        fprintf(script, "  -netdev user,id=net0 \\\n");
-        fprintf(script, "  -device virtio-net,netdev=net0 \\\n");
-        fprintf(script, "  -vga virtio \\\n");
-        fprintf(script, "  -display sdl,gl=on \\\n");
-        fprintf(script, "  -usb \\\n");
-        fprintf(script, "  -device usb-tablet \\\n");
-        fprintf(script, "  -soundhw hda \\\n");
-        fprintf(script, "  -rtc base=utc \\\n");
-        fprintf(script, "  -name \"Lainux-VM\"\n");
-
-        fclose(script);
-        run_command("chmod +x install-lainux-vm.sh", 0);
+    // Launchers tuned to this host: desktop window and headless for CI
+    QemuHost host;
+    if (qemu_host_probe(&host) != 0) {
+        log_message("Cannot read the host CPU topology");
+        return;
+    }
+    const char *bus = getenv(VM_BUS_ENV);
+    QemuProfileOptions opts = {QEMU_PROFILE_DESKTOP, "Lainux-VM", disk_path,
+                               vm_disk_format_name(disk.format), iso_path,
+                               QEMU_PROFILE_DEFAULT_MEMORY, 0,
+                               bus && strcmp(bus, "scsi") == 0 ? QEMU_DISK_VIRTIO_SCSI
+                                                               : QEMU_DISK_VIRTIO_BLK,
+                               getenv(VM_TAP_ENV), NULL, 0, NULL, NULL, NULL};
+    QemuProfile profile;
+    if (qemu_profile_build(&host, &opts, &profile) != 0 ||
+        qemu_profile_write_script(&profile, VM_SCRIPT) != 0) {
+        log_message("Failed to write %s", VM_SCRIPT);
+        return;
+    }
+    opts.kind = QEMU_PROFILE_HEADLESS;
+    if (qemu_profile_build(&host, &opts, &profile) != 0 ||
+        qemu_profile_write_script(&profile, VM_SCRIPT_CI) != 0) {
+        log_message("Failed to write %s", VM_SCRIPT_CI);
     }
 
     // Create README file
-    script = fopen("VM-README.txt", "w");
+    FILE *script = fopen("VM-README.txt", "w");
     if (script) {
         fprintf(script, "Lainux Virtual Machine Installation\n");
         fprintf(script, "====================================\n\n");
         fprintf(script, "Files created:\n");
-        fprintf(script, "1. lainux-vm.qcow2    - Virtual disk (20GB)\n");
-        fprintf(script, "2. install-lainux-vm.sh - Installation script\n\n");
+        fprintf(script, "1. %-19s - Virtual disk (20GB, %s)\n", disk_path,
+                vm_disk_format_name(disk.format));
+        fprintf(script, "2. %s - Installation script\n", VM_SCRIPT);
+        fprintf(script, "3. %s - Same VM without a window (serial console, CI)\n\n",
+                VM_SCRIPT_CI);
+        fprintf(script, "Both scripts are generated for this host: vCPUs are pinned to\n");
+        fprintf(script, "physical cores, memory uses hugepages when enough are free, and\n");
+        fprintf(script, "the disk runs on virtio with its own I/O thread. Set %s=<tap>\n",
+                VM_TAP_ENV);
+        fprintf(script, "before setup for multiqueue vhost networking on a tap device.\n\n");
+        fprintf(script, "The installer can also run the headless VM itself: the serial\n");
+        fprintf(script, "console shows in its log window and QMP drives savevm/loadvm\n");
+        fprintf(script, "snapshots, so test cycles restore a booted guest in seconds.\n\n");
         fprintf(script, "To start the virtual machine:\n");
         fprintf(script, "  sudo ./install-lainux-vm.sh\n\n");
         fprintf(script, "Recommended settings:\n");
@@ -519,3 +503,82 @@ void setup_qemu_vm(const char *iso_path) {
 
     log_message("VM setup complete. Scripts created.");
 }
+
+// Starter matrix for the test loop
+static void write_test_matrix(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return;
+    fprintf(fp, "# Lainux VM test matrix: one test per line, \"name: command\".\n");
+    fprintf(fp, "# Each command runs in the live ISO's shell on a fresh clone, once per\n");
+    fprintf(fp, "# firmware mode (%s=bios,uefi), and passes when it exits 0.\n",
+            VMTEST_FIRMWARE_ENV);
+    fprintf(fp, "smoke: uname -a && lsblk\n");
+    fclose(fp);
+    log_message("Created a sample test matrix: %s", path);
+}
+
+// Installer regression runs on snapshot clones (see vm_testloop.h)
+void run_vm_test_loop() {
+    static VmTestPlan plan;
+    VmTestSummary summary;
+
+    log_pause();
+    clear();
+    attron(A_BOLD | COLOR_PAIR(1));
+    mvprintw(2, 10, "VM TEST LOOP");
+    attroff(A_BOLD | COLOR_PAIR(1));
+    mvprintw(4, 10, "The live ISO is booted once per firmware mode and saved at its shell;");
+    mvprintw(5, 10, "every test then runs in a throwaway clone restored from that state.");
+
+    const char *matrix = getenv(VMTEST_MATRIX_ENV);
+    if (!matrix) matrix = VMTEST_MATRIX;
+    if (!file_exists(matrix)) write_test_matrix(matrix);
+    if (vm_test_load(matrix, &plan) <= 0) {
+        mvprintw(7, 10, "No tests in %s. Press any key...", matrix);
+        refresh();
+        getch();
+        log_resume();
+        return;
+    }
+    mvprintw(7, 10, "%d test(s) from %s, firmware:%s%s", plan.count, matrix,
+             plan.firmware[VMTEST_BIOS] ? " bios" : "",
+             plan.firmware[VMTEST_UEFI] ? " uefi" : "");
+    int run = confirm_action("Run the test matrix?", "RUN");
+    log_resume();
+    if (!run) {
+        return;
+    }
+
+    char iso_path[MAX_PATH];
+    select_iso_file(iso_path, sizeof(iso_path));
+    if (iso_path[0] == '\0' || !file_exists(iso_path)) {
+        return;
+    }
+    plan.iso_path = iso_path;
+
+    int max_y, max_x;
+    getmaxyx(stdscr, max_y, max_x);
+    pthread_mutex_lock(&log_mutex);
+    clear();
+    refresh();
+    log_win = newwin(max_y - 10, max_x - 10, 5, 5);
+    scrollok(log_win, TRUE);
+    box(log_win, 0, 0);
+    wrefresh(log_win);
+    pthread_mutex_unlock(&log_mutex);
+
+    // The ISO was picked above: no download, only the QEMU binaries
+    if (!iso_verify(iso_path, NULL, NULL)) {
+        log_message("ISO %s failed verification", iso_path);
+    } else if (!check_qemu_tools()) {
+        log_message("Failed to install QEMU dependencies");
+    } else {
+        vm_test_run(&plan, &summary);
+    }
+    log_message("Overlays and console logs of failed tests are kept in %s/", VMTEST_DIR);
+    log_message("Press any key to return to menu...");
+    log_pause();
+    getch();
+    log_resume();
+    log_close_window();
+}
@@ -3,9 +3,11 @@
 
 
 int check_qemu_dependencies();
+int check_qemu_tools();
 void create_virtual_disk();
 void install_on_virtual_machine();
 void setup_qemu_vm(const char *iso_path);
+void run_vm_test_loop();
 
 
 #endif // vm h
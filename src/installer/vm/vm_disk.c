@@ -0,0 +1,291 @@
+/**
+ * @file vm_disk.c
+ * @brief qcow2 and raw image writer for the VM install
+ *
+ * Layout of a qcow2 image made here, in clusters:
+ *   header | refcount table | refcount blocks | L1 | L2 tables | data
+ * The L2 tables and data exist only with preallocation. Data clusters
+ * follow guest order, so a guest's sequential I/O stays sequential on the
+ * host, and every refcount is 1 (no snapshots yet), which lets L1 and L2
+ * entries carry the COPIED flag.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vm_disk.h"
+#include "../utils/log_message.h"
+
+#define QCOW2_MAGIC 0x514649fbu                // "QFI\xfb"
+#define QCOW2_VERSION 3
+#define QCOW2_REFCOUNT_ORDER 4                 // 16-bit refcounts
+#define QCOW2_OFLAG_COPIED (1ULL << 63)
+#define QCOW2_INCOMPAT_COMPRESSION (1ULL << 3)
+#define QCOW2_HEADER_LEN 104
+#define QCOW2_HEADER_LEN_COMPRESSION 112       // adds compression_type, padded
+#define QCOW2_COMPRESSION_ZSTD 1
+#define QCOW2_EXT_BACKING_FORMAT 0xe2792acau
+
+typedef struct {
+    uint64_t cs;                               // cluster size in bytes
+    unsigned bits;
+    uint64_t guest_clusters;
+    uint64_t l1_size;                          // L1 entries
+    uint64_t l1_clusters;
+    uint64_t l2_count;                         // preallocated L2 tables
+    uint64_t data_clusters;                    // preallocated data clusters
+    uint64_t rb_count;                         // refcount blocks
+    uint64_t rt_clusters;                      // refcount table clusters
+    uint64_t total;                            // clusters in use
+    uint64_t rt_off, rb_off, l1_off, l2_off, data_off;  // first cluster of each
+} Qcow2Layout;
+
+static void put_be16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (24 - 8 * i));
+}
+
+static void put_be64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (56 - 8 * i));
+}
+
+static uint64_t div_up(uint64_t a, uint64_t b) {
+    return (a + b - 1) / b;
+}
+
+static int write_at(int fd, const void *buf, size_t len, uint64_t off) {
+    const unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, (off_t)off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        off += (uint64_t)n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// The refcount blocks count themselves and the table, so iterate to a
+// fixed point; it settles after one or two rounds
+static void qcow2_layout(Qcow2Layout *l, uint64_t size, unsigned bits, int prealloc) {
+    memset(l, 0, sizeof(*l));
+    l->bits = bits;
+    l->cs = 1ULL << bits;
+
+    uint64_t per_l2 = l->cs / 8;
+    uint64_t per_rb = l->cs * 8 / (1u << QCOW2_REFCOUNT_ORDER);
+    uint64_t per_rt = l->cs / 8;
+
+    l->guest_clusters = div_up(size, l->cs);
+    l->l1_size = div_up(l->guest_clusters, per_l2);
+    if (l->l1_size == 0) l->l1_size = 1;
+    l->l1_clusters = div_up(l->l1_size * 8, l->cs);
+    if (prealloc) {
+        l->l2_count = l->l1_size;
+        l->data_clusters = l->guest_clusters;
+    }
+
+    l->rb_count = 1;
+    l->rt_clusters = 1;
+    for (;;) {
+        l->total = 1 + l->rt_clusters + l->rb_count + l->l1_clusters + l->l2_count +
+                   l->data_clusters;
+        uint64_t rb = div_up(l->total, per_rb);
+        uint64_t rt = div_up(rb, per_rt);
+        if (rb == l->rb_count && rt == l->rt_clusters) break;
+        l->rb_count = rb;
+        l->rt_clusters = rt;
+    }
+
+    l->rt_off = 1;
+    l->rb_off = l->rt_off + l->rt_clusters;
+    l->l1_off = l->rb_off + l->rb_count;
+    l->l2_off = l->l1_off + l->l1_clusters;
+    l->data_off = l->l2_off + l->l2_count;
+}
+
+static int qcow2_write(int fd, const Qcow2Layout *l, const VmDiskOptions *opt) {
+    unsigned char *buf = calloc(1, l->cs);
+    if (!buf) return -1;
+    int rc = 0;
+
+    // Header; the zeros after it double as the end-of-extensions marker
+    int zstd = opt->compression == VMDISK_COMPRESS_ZSTD;
+    put_be32(buf + 0, QCOW2_MAGIC);
+    put_be32(buf + 4, QCOW2_VERSION);
+    put_be32(buf + 20, l->bits);
+    put_be64(buf + 24, opt->size);
+    put_be32(buf + 36, (uint32_t)l->l1_size);
+    put_be64(buf + 40, l->l1_off * l->cs);
+    put_be64(buf + 48, l->rt_off * l->cs);
+    put_be32(buf + 56, (uint32_t)l->rt_clusters);
+    put_be64(buf + 72, zstd ? QCOW2_INCOMPAT_COMPRESSION : 0);
+    put_be32(buf + 96, QCOW2_REFCOUNT_ORDER);
+    put_be32(buf + 100, zstd ? QCOW2_HEADER_LEN_COMPRESSION : QCOW2_HEADER_LEN);
+    if (zstd) buf[104] = QCOW2_COMPRESSION_ZSTD;
+
+    // Backing format extension, end marker, then the backing file name
+    if (opt->backing) {
+        uint32_t off = zstd ? QCOW2_HEADER_LEN_COMPRESSION : QCOW2_HEADER_LEN;
+        size_t name_len = strlen(opt->backing);
+        put_be32(buf + off, QCOW2_EXT_BACKING_FORMAT);
+        put_be32(buf + off + 4, 5);
+        memcpy(buf + off + 8, "qcow2", 5);
+        off += 8 + 8 + 8;
+        put_be64(buf + 8, off);
+        put_be32(buf + 16, (uint32_t)name_len);
+        memcpy(buf + off, opt->backing, name_len);
+    }
+    rc = write_at(fd, buf, l->cs, 0);
+
+    // Refcount table, one cluster at a time
+    uint64_t per_cluster = l->cs / 8;
+    for (uint64_t c = 0; rc == 0 && c < l->rt_clusters; c++) {
+        memset(buf, 0, l->cs);
+        for (uint64_t i = 0; i < per_cluster; i++) {
+            uint64_t rb = c * per_cluster + i;
+            if (rb >= l->rb_count) break;
+            put_be64(buf + i * 8, (l->rb_off + rb) * l->cs);
+        }
+        rc = write_at(fd, buf, l->cs, (l->rt_off + c) * l->cs);
+    }
+
+    // Refcount blocks: 1 for every cluster in use
+    uint64_t per_rb = l->cs / 2;
+    for (uint64_t b = 0; rc == 0 && b < l->rb_count; b++) {
+        memset(buf, 0, l->cs);
+        for (uint64_t i = 0; i < per_rb && b * per_rb + i < l->total; i++) {
+            put_be16(buf + i * 2, 1);
+        }
+        rc = write_at(fd, buf, l->cs, (l->rb_off + b) * l->cs);
+    }
+
+    // L1, then the L2 tables it points to
+    for (uint64_t c = 0; rc == 0 && c < l->l1_clusters; c++) {
+        memset(buf, 0, l->cs);
+        for (uint64_t i = 0; l->l2_count && i < per_cluster; i++) {
+            uint64_t l2 = c * per_cluster + i;
+            if (l2 >= l->l2_count) break;
+            put_be64(buf + i * 8, ((l->l2_off + l2) * l->cs) | QCOW2_OFLAG_COPIED);
+        }
+        rc = write_at(fd, buf, l->cs, (l->l1_off + c) * l->cs);
+    }
+    for (uint64_t t = 0; rc == 0 && t < l->l2_count; t++) {
+        memset(buf, 0, l->cs);
+        for (uint64_t i = 0; i < per_cluster; i++) {
+            uint64_t g = t * per_cluster + i;
+            if (g >= l->guest_clusters) break;
+            put_be64(buf + i * 8, ((l->data_off + g) * l->cs) | QCOW2_OFLAG_COPIED);
+        }
+        rc = write_at(fd, buf, l->cs, (l->l2_off + t) * l->cs);
+    }
+
+    free(buf);
+    return rc;
+}
+
+// Reserve [off, off + len); a filesystem without fallocate keeps it
+// sparse, any other error (ENOSPC, EIO) fails the image
+static int reserve(int fd, uint64_t off, uint64_t len) {
+    if (len == 0) return 0;
+    if (fallocate(fd, 0, (off_t)off, (off_t)len) == 0) return 0;
+    if (errno != EOPNOTSUPP) return -1;
+    log_message("VM disk: fallocate not supported, image stays sparse");
+    return 0;
+}
+
+static int valid_cluster(unsigned cs) {
+    return cs >= VMDISK_CLUSTER_MIN && cs <= VMDISK_CLUSTER_MAX && (cs & (cs - 1)) == 0;
+}
+
+int vm_disk_create(const char *path, const VmDiskOptions *opt) {
+    char tmp[4096];
+    unsigned cs = opt->cluster_size ? opt->cluster_size : VMDISK_CLUSTER_DEFAULT;
+
+    if (opt->size == 0 || (opt->format == VMDISK_QCOW2 && !valid_cluster(cs))) {
+        log_message("VM disk: invalid size or cluster size %u", cs);
+        return -1;
+    }
+    // Preallocated clusters would hide the backing file's data; the name
+    // has to fit in the header cluster after the header and extensions
+    if (opt->backing && (opt->format != VMDISK_QCOW2 || opt->prealloc != VMDISK_PREALLOC_OFF ||
+                         strlen(opt->backing) + QCOW2_HEADER_LEN_COMPRESSION + 24 > cs ||
+                         strlen(opt->backing) > 1023)) {
+        log_message("VM disk: cannot make %s an overlay of %s", path, opt->backing);
+        return -1;
+    }
+
+    // Built under a temporary name so a failed run never leaves a
+    // half-written image behind the real one
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_message("VM disk: cannot create %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+
+    int rc;
+    uint64_t file_size;
+    if (opt->format == VMDISK_RAW) {
+        file_size = opt->size;
+        rc = ftruncate(fd, (off_t)file_size);
+        if (rc == 0 && opt->prealloc == VMDISK_PREALLOC_FALLOC) rc = reserve(fd, 0, file_size);
+    } else {
+        unsigned bits = (unsigned)__builtin_ctz(cs);
+        Qcow2Layout l;
+        qcow2_layout(&l, opt->size, bits, opt->prealloc != VMDISK_PREALLOC_OFF);
+        file_size = l.total * l.cs;
+        rc = qcow2_write(fd, &l, opt);
+        if (rc == 0) rc = ftruncate(fd, (off_t)file_size);
+        if (rc == 0 && opt->prealloc == VMDISK_PREALLOC_FALLOC) {
+            rc = reserve(fd, l.data_off * l.cs, l.data_clusters * l.cs);
+        }
+    }
+    if (rc == 0) rc = fsync(fd);
+    if (rc != 0) log_message("VM disk: writing %s failed: %s", tmp, strerror(errno));
+    close(fd);
+
+    if (rc == 0 && rename(tmp, path) != 0) {
+        log_message("VM disk: cannot rename %s: %s", tmp, strerror(errno));
+        rc = -1;
+    }
+    if (rc != 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    if (opt->backing) {
+        log_message("VM disk: %s, overlay of %s", path, opt->backing);
+        return 0;
+    }
+    log_message("VM disk: %s, %s, %llu MB, cluster %u bytes, preallocation %s%s", path,
+                vm_disk_format_name(opt->format), opt->size >> 20,
+                opt->format == VMDISK_QCOW2 ? cs : 0,
+                vm_disk_prealloc_name(opt->prealloc),
+                opt->format == VMDISK_QCOW2 && opt->compression == VMDISK_COMPRESS_ZSTD
+                    ? ", zstd" : "");
+    return 0;
+}
+
+const char *vm_disk_format_name(VmDiskFormat format) {
+    return format == VMDISK_RAW ? "raw" : "qcow2";
+}
+
+const char *vm_disk_prealloc_name(VmDiskPrealloc prealloc) {
+    switch (prealloc) {
+    case VMDISK_PREALLOC_METADATA: return "metadata";
+    case VMDISK_PREALLOC_FALLOC: return "falloc";
+    default: return "off";
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef VM_DISK_H
+#define VM_DISK_H
+
+/*
+ * Virtual disk creation without qemu-img.
+ * Writes a qcow2 v3 image directly: header, refcount table and blocks,
+ * L1 and (with preallocation) every L2 table, laid out so guest clusters
+ * map linearly onto one run of host clusters. Cluster size, the zstd
+ * compression type and the preallocation mode are configurable; a plain
+ * raw image can be made instead when qcow2 features are not needed.
+ * An image with a backing file starts empty and reads through to it:
+ * a cheap, throwaway overlay over a shared base.
+ */
+
+#define VMDISK_DEFAULT_SIZE (20ULL << 30)
+#define VMDISK_CLUSTER_DEFAULT (64u << 10)   // qemu's default; COW-friendly
+#define VMDISK_CLUSTER_MIN 512
+#define VMDISK_CLUSTER_MAX (2u << 20)
+
+typedef enum {
+    VMDISK_QCOW2 = 0,
+    VMDISK_RAW,
+} VmDiskFormat;
+
+typedef enum {
+    VMDISK_PREALLOC_OFF = 0,      // metadata grows on first write
+    VMDISK_PREALLOC_METADATA,     // all L2 tables and mappings, sparse data
+    VMDISK_PREALLOC_FALLOC,       // metadata plus fallocate() of the data
+} VmDiskPrealloc;
+
+typedef enum {
+    VMDISK_COMPRESS_ZLIB = 0,     // no compression type field (any qemu)
+    VMDISK_COMPRESS_ZSTD,         // qemu 5.1+, for compressed clusters
+} VmDiskCompression;
+
+typedef struct {
+    VmDiskFormat format;
+    unsigned long long size;      // guest size in bytes
+    unsigned cluster_size;        // qcow2 only, power of two, 0 - default
+    VmDiskPrealloc prealloc;
+    VmDiskCompression compression;
+    const char *backing;          // qcow2 overlay on this qcow2 image, NULL - none.
+                                  // Needs prealloc off; relative to the overlay
+} VmDiskOptions;
+
+// Create (or replace) the image at path. Returns 0 on success, -1 on error
+int vm_disk_create(const char *path, const VmDiskOptions *opt);
+
+// Name for qemu's format= option: "qcow2" or "raw"
+const char *vm_disk_format_name(VmDiskFormat format);
+
+const char *vm_disk_prealloc_name(VmDiskPrealloc prealloc);
+
+#endif // vm disk h
@@ -0,0 +1,575 @@
+/**
+ * @file vm_supervisor.c
+ * @brief runs QEMU under the installer and drives it over QMP
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vm_supervisor.h"
+#include "../utils/log_message.h"
+
+extern WINDOW *log_win;
+
+#define VMSUP_QUIT_SECONDS 5
+#define VMSUP_PANEL_ROWS (6 + VMSUP_MAX_DISKS)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Guest consoles paint with ANSI escapes; keep only printable text
+static void serial_line(const char *line, int is_err, void *user) {
+    VmSupervisor *sup = user;
+    char clean[1024];
+    size_t n = 0;
+
+    for (const char *p = line; *p && n < sizeof(clean) - 1; p++) {
+        if (*p == '\033') {
+            if (p[1] == '[') {
+                p += 2;
+                while (*p && !(*p >= '@' && *p <= '~')) p++;
+            } else if (p[1]) {
+                p++;
+            }
+            if (!*p) break;
+            continue;
+        }
+        if ((unsigned char)*p < ' ' && *p != '\t') continue;
+        clean[n++] = *p;
+    }
+    clean[n] = '\0';
+    if (n == 0) return;
+
+    if (is_err) log_message("QEMU: %s", clean);
+    else if (sup->on_serial) sup->on_serial(clean, 0, sup->serial_user);
+    else log_message("| %s", clean);
+}
+
+static void on_event(const char *event, const char *line, void *user) {
+    (void)line;
+    (void)user;
+    if (strcmp(event, "RTC_CHANGE") == 0) return;
+    log_message("VM event: %s", event);
+}
+
+static void reap(VmSupervisor *sup, int options) {
+    int status;
+    if (!sup->running) return;
+    if (waitpid(sup->pid, &status, options) != sup->pid) return;
+    sup->running = 0;
+    sup->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    if (WIFSIGNALED(status)) {
+        log_message("QEMU killed by signal %d", WTERMSIG(status));
+    } else {
+        log_message("QEMU exited with code %d", sup->exit_code);
+    }
+}
+
+// Drain pipes after exit and release everything but the stats
+static void finish(VmSupervisor *sup) {
+    if (sup->out_fd >= 0) {
+        proc_stream_read(sup->out_fd, &sup->out, 0, 0, NULL);
+        proc_stream_flush(&sup->out, 0, 0, NULL);
+        close(sup->out_fd);
+        sup->out_fd = -1;
+    }
+    if (sup->err_fd >= 0) {
+        proc_stream_read(sup->err_fd, &sup->err, 0, 1, NULL);
+        proc_stream_flush(&sup->err, 0, 1, NULL);
+        close(sup->err_fd);
+        sup->err_fd = -1;
+    }
+    if (sup->in_fd >= 0) {
+        close(sup->in_fd);
+        sup->in_fd = -1;
+    }
+    qmp_close(&sup->qmp);
+    unlink(sup->qmp_path);
+}
+
+static void kill_qemu(VmSupervisor *sup) {
+    if (!sup->running) return;
+    kill(-sup->pid, SIGKILL);
+    reap(sup, 0);
+}
+
+static void pin(int tid, int cpu, const char *what) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+        log_message("Cannot pin %s (thread %d) to CPU %d: %s", what, tid, cpu,
+                    strerror(errno));
+    }
+}
+
+// Learn the vCPU thread IDs for the stats panel and pin what the profile
+// placed; the launcher script does the same with taskset
+static void pin_threads(VmSupervisor *sup) {
+    char *reply = NULL;
+    const char *cursor = NULL, *obj, *end;
+
+    if (qmp_execute(&sup->qmp, "{\"execute\": \"query-cpus-fast\"}", &reply,
+                    QMP_TIMEOUT_MS) == 0) {
+        while (qmp_json_next(reply, "return", &cursor, &obj, &end)) {
+            long long idx, tid;
+            if (qmp_json_number(obj, end, "cpu-index", &idx) != 0 ||
+                qmp_json_number(obj, end, "thread-id", &tid) != 0 || idx < 0 ||
+                idx >= QEMU_PROFILE_MAX_VCPUS) {
+                continue;
+            }
+            sup->stats.thread[idx] = (int)tid;
+            if (idx >= sup->stats.vcpus) sup->stats.vcpus = (int)idx + 1;
+            if (idx < sup->profile.vcpus && sup->profile.pin[idx] >= 0) {
+                pin((int)tid, sup->profile.pin[idx], "vCPU");
+            }
+        }
+        free(reply);
+    }
+
+    if (sup->profile.iothread_cpu < 0) return;
+    cursor = NULL;
+    if (qmp_execute(&sup->qmp, "{\"execute\": \"query-iothreads\"}", &reply,
+                    QMP_TIMEOUT_MS) == 0) {
+        while (qmp_json_next(reply, "return", &cursor, &obj, &end)) {
+            char id[32];
+            long long tid;
+            if (qmp_json_string(obj, end, "id", id, sizeof(id)) == 0 &&
+                strcmp(id, "io0") == 0 && qmp_json_number(obj, end, "thread-id", &tid) == 0) {
+                pin((int)tid, sup->profile.iothread_cpu, "iothread");
+            }
+        }
+        free(reply);
+    }
+}
+
+int vm_sup_start(VmSupervisor *sup, const QemuProfile *profile, const char *qmp_path) {
+    int serial_input = sup->serial_input;
+    ProcLineFn on_serial = sup->on_serial;
+    void *serial_user = sup->serial_user;
+
+    memset(sup, 0, sizeof(*sup));
+    sup->serial_input = serial_input;
+    sup->on_serial = on_serial;
+    sup->serial_user = serial_user;
+    sup->out_fd = sup->err_fd = sup->in_fd = -1;
+    sup->qmp.fd = -1;
+    sup->exit_code = -1;
+    sup->profile = *profile;
+    // argv points into the profile's own store
+    for (int i = 0; i < profile->argc; i++) {
+        sup->profile.argv[i] = sup->profile.store + (profile->argv[i] - profile->store);
+    }
+    snprintf(sup->qmp_path, sizeof(sup->qmp_path), "%s", qmp_path);
+    unlink(sup->qmp_path);
+
+    sup->out.on_line = serial_line;
+    sup->out.user = sup;
+    sup->err.on_line = serial_line;
+    sup->err.user = sup;
+    sup->qmp.on_event = on_event;
+    sup->qmp.user = sup;
+
+    // -nographic reads the console from stdin. A socket rather than a pipe,
+    // so typing after QEMU died fails with EPIPE instead of raising SIGPIPE
+    ProcOptions opts = {0, 0, -1, NULL};
+    int in[2] = {-1, -1};
+    if (serial_input) {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, in) != 0) return -1;
+        opts.stdin_fd = in[0];
+        sup->in_fd = in[1];
+    }
+    sup->pid = proc_spawn((const char *const *)sup->profile.argv, &opts, &sup->out_fd,
+                          &sup->err_fd);
+    if (in[0] >= 0) close(in[0]);
+    if (sup->pid < 0) {
+        if (sup->in_fd >= 0) close(sup->in_fd);
+        sup->in_fd = -1;
+        log_message("Cannot start %s: %s", sup->profile.argv[0], strerror(errno));
+        return -1;
+    }
+    sup->running = 1;
+    sup->stats.started_at = now_sec();
+    log_message("QEMU started, pid %d: %s", (int)sup->pid, sup->profile.summary);
+
+    // QEMU binds the socket while starting up; connect fails fast if it dies
+    if (qmp_connect(&sup->qmp, sup->qmp_path, QMP_CONNECT_TIMEOUT_MS) != 0) {
+        reap(sup, WNOHANG);
+        kill_qemu(sup);
+        finish(sup);
+        return -1;
+    }
+    pin_threads(sup);
+    return 0;
+}
+
+int vm_sup_pump(VmSupervisor *sup, int timeout_ms) {
+    struct pollfd fds[3];
+    int n = 0;
+
+    if (!sup->running) return 0;
+    if (sup->out_fd >= 0) fds[n++] = (struct pollfd){sup->out_fd, POLLIN, 0};
+    if (sup->err_fd >= 0) fds[n++] = (struct pollfd){sup->err_fd, POLLIN, 0};
+    if (sup->qmp.fd >= 0) fds[n++] = (struct pollfd){sup->qmp.fd, POLLIN, 0};
+
+    if (poll(fds, (nfds_t)n, timeout_ms) > 0) {
+        if (sup->out_fd >= 0 && !proc_stream_read(sup->out_fd, &sup->out, 0, 0, NULL)) {
+            proc_stream_flush(&sup->out, 0, 0, NULL);
+            close(sup->out_fd);
+            sup->out_fd = -1;
+        }
+        if (sup->err_fd >= 0 && !proc_stream_read(sup->err_fd, &sup->err, 0, 1, NULL)) {
+            proc_stream_flush(&sup->err, 0, 1, NULL);
+            close(sup->err_fd);
+            sup->err_fd = -1;
+        }
+        qmp_pump(&sup->qmp);
+    }
+
+    reap(sup, WNOHANG);
+    if (!sup->running) finish(sup);
+    return sup->running;
+}
+
+// Pump until QEMU exits or seconds pass
+static void wait_exit(VmSupervisor *sup, int seconds) {
+    double deadline = now_sec() + seconds;
+    while (vm_sup_pump(sup, 200) && now_sec() < deadline) {
+    }
+}
+
+int vm_sup_stop(VmSupervisor *sup, int grace_sec) {
+    if (sup->running && grace_sec > 0 &&
+        qmp_execute(&sup->qmp, "{\"execute\": \"system_powerdown\"}", NULL,
+                    QMP_TIMEOUT_MS) == 0) {
+        log_message("Waiting up to %ds for the guest to power off...", grace_sec);
+        wait_exit(sup, grace_sec);
+    }
+    if (sup->running &&
+        qmp_execute(&sup->qmp, "{\"execute\": \"quit\"}", NULL, QMP_TIMEOUT_MS) == 0) {
+        wait_exit(sup, VMSUP_QUIT_SECONDS);
+    }
+    if (sup->running) {
+        log_message("QEMU did not exit, killing it");
+        kill_qemu(sup);
+    }
+    finish(sup);
+    return sup->exit_code == 0 ? 0 : -1;
+}
+
+int vm_sup_type(VmSupervisor *sup, const char *text) {
+    size_t len = strlen(text);
+    if (sup->in_fd < 0) return -1;
+    while (len > 0) {
+        ssize_t n = send(sup->in_fd, text, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        text += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int vm_sup_pause(VmSupervisor *sup) {
+    return qmp_execute(&sup->qmp, "{\"execute\": \"stop\"}", NULL, QMP_TIMEOUT_MS);
+}
+
+int vm_sup_resume(VmSupervisor *sup) {
+    return qmp_execute(&sup->qmp, "{\"execute\": \"cont\"}", NULL, QMP_TIMEOUT_MS);
+}
+
+int vm_sup_snapshot(VmSupervisor *sup, const char *overlay_path) {
+    char json[1024];
+    if (strpbrk(overlay_path, "\"\\")) return -1;
+    snprintf(json, sizeof(json),
+             "{\"execute\": \"blockdev-snapshot-sync\", \"arguments\": "
+             "{\"device\": \"disk0\", \"snapshot-file\": \"%s\", \"format\": \"qcow2\"}}",
+             overlay_path);
+
+    double start = now_sec();
+    if (qmp_execute(&sup->qmp, json, NULL, QMP_TIMEOUT_MS) != 0) return -1;
+    sup->overlays++;
+    log_message("Disk snapshot: writes now go to %s (%.2fs)", overlay_path,
+                now_sec() - start);
+    return 0;
+}
+
+// Tags end up inside a JSON string and an HMP command line
+static int valid_tag(const char *tag) {
+    if (!tag[0]) return 0;
+    for (const char *p = tag; *p; p++) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9') || *p == '-' || *p == '_' || *p == '.')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int hmp_snapshot(VmSupervisor *sup, const char *verb, const char *tag) {
+    char cmd[128];
+    if (!valid_tag(tag)) {
+        log_message("Invalid snapshot tag: %s", tag);
+        return -1;
+    }
+    snprintf(cmd, sizeof(cmd), "%s %s", verb, tag);
+
+    double start = now_sec();
+    if (qmp_hmp(&sup->qmp, cmd, VMSUP_SNAPSHOT_TIMEOUT_MS) != 0) return -1;
+    log_message("%s %s done in %.1fs", verb, tag, now_sec() - start);
+    return 0;
+}
+
+int vm_sup_savevm(VmSupervisor *sup, const char *tag) {
+    return hmp_snapshot(sup, "savevm", tag);
+}
+
+int vm_sup_loadvm(VmSupervisor *sup, const char *tag) {
+    return hmp_snapshot(sup, "loadvm", tag);
+}
+
+int vm_sup_save_state(VmSupervisor *sup, const char *path) {
+    char json[1024], *reply = NULL, status[32] = "";
+    // exec: works on every QEMU version; the path goes through /bin/sh
+    if (strpbrk(path, "\"\\'")) return -1;
+    snprintf(json, sizeof(json),
+             "{\"execute\": \"migrate\", \"arguments\": {\"uri\": \"exec:cat > '%s'\"}}",
+             path);
+
+    double start = now_sec();
+    if (vm_sup_pause(sup) != 0 || qmp_execute(&sup->qmp, json, NULL, QMP_TIMEOUT_MS) != 0) {
+        return -1;
+    }
+    while (now_sec() - start < VMSUP_SNAPSHOT_TIMEOUT_MS / 1000.0) {
+        vm_sup_pump(sup, 100);
+        if (qmp_execute(&sup->qmp, "{\"execute\": \"query-migrate\"}", &reply,
+                        QMP_TIMEOUT_MS) != 0) {
+            return -1;
+        }
+        qmp_json_string(reply, reply + strlen(reply), "status", status, sizeof(status));
+        free(reply);
+        if (strcmp(status, "completed") == 0) {
+            log_message("VM state saved to %s in %.1fs", path, now_sec() - start);
+            return 0;
+        }
+        if (strcmp(status, "failed") == 0 || strcmp(status, "cancelled") == 0) break;
+    }
+    log_message("Saving VM state to %s failed (%s)", path, status[0] ? status : "timeout");
+    return -1;
+}
+
+// utime + stime of one thread, in clock ticks
+static int thread_ticks(pid_t pid, int tid, unsigned long long *ticks) {
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", (int)pid, tid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+
+    // Fields after the command name: state is 3rd, utime/stime 14th/15th
+    char *p = strrchr(buf, ')');
+    unsigned long long utime, stime;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                     &utime, &stime) != 2) {
+        return -1;
+    }
+    *ticks = utime + stime;
+    return 0;
+}
+
+static void sample_blockstats(VmSupervisor *sup, double dt) {
+    char *reply = NULL;
+    const char *cursor = NULL, *obj, *end;
+    VmStats *st = &sup->stats;
+
+    if (qmp_execute(&sup->qmp, "{\"execute\": \"query-blockstats\"}", &reply,
+                    QMP_TIMEOUT_MS) != 0) {
+        return;
+    }
+    int count = 0;
+    while (count < VMSUP_MAX_DISKS && qmp_json_next(reply, "return", &cursor, &obj, &end)) {
+        VmBlockStats cur = {0};
+        long long v;
+        if (qmp_json_string(obj, end, "device", cur.device, sizeof(cur.device)) != 0 ||
+            !cur.device[0]) {
+            continue;
+        }
+        // "stats" precedes "parent", so the first match is the device's own
+        if (qmp_json_number(obj, end, "rd_bytes", &v) == 0) cur.rd_bytes = (unsigned long long)v;
+        if (qmp_json_number(obj, end, "wr_bytes", &v) == 0) cur.wr_bytes = (unsigned long long)v;
+        if (qmp_json_number(obj, end, "rd_operations", &v) == 0) cur.rd_ops = (unsigned long long)v;
+        if (qmp_json_number(obj, end, "wr_operations", &v) == 0) cur.wr_ops = (unsigned long long)v;
+
+        const VmBlockStats *prev = count < st->disks ? &st->disk[count] : NULL;
+        if (prev && dt > 0 && strcmp(prev->device, cur.device) == 0 &&
+            cur.rd_bytes >= prev->rd_bytes && cur.wr_bytes >= prev->wr_bytes) {
+            cur.rd_mbps = (double)(cur.rd_bytes - prev->rd_bytes) / dt / (1024.0 * 1024.0);
+            cur.wr_mbps = (double)(cur.wr_bytes - prev->wr_bytes) / dt / (1024.0 * 1024.0);
+            cur.rd_iops = (double)(cur.rd_ops - prev->rd_ops) / dt;
+            cur.wr_iops = (double)(cur.wr_ops - prev->wr_ops) / dt;
+        }
+        st->disk[count++] = cur;
+    }
+    st->disks = count;
+    free(reply);
+}
+
+int vm_sup_sample(VmSupervisor *sup) {
+    VmStats *st = &sup->stats;
+    char *reply = NULL;
+
+    if (!sup->running) return -1;
+    double now = now_sec();
+    double dt = st->sampled_at > 0 ? now - st->sampled_at : 0;
+
+    if (qmp_execute(&sup->qmp, "{\"execute\": \"query-status\"}", &reply,
+                    QMP_TIMEOUT_MS) != 0) {
+        return -1;
+    }
+    qmp_json_string(reply, reply + strlen(reply), "status", st->status, sizeof(st->status));
+    free(reply);
+
+    sample_blockstats(sup, dt);
+
+    long hz = sysconf(_SC_CLK_TCK);
+    for (int i = 0; i < st->vcpus; i++) {
+        unsigned long long ticks;
+        if (!st->thread[i] || thread_ticks(sup->pid, st->thread[i], &ticks) != 0) continue;
+        st->busy[i] = dt > 0 && hz > 0 && ticks >= st->ticks[i]
+                          ? (double)(ticks - st->ticks[i]) / (double)hz / dt * 100.0
+                          : 0;
+        st->ticks[i] = ticks;
+    }
+    st->sampled_at = now;
+    return 0;
+}
+
+void vm_sup_draw(const VmSupervisor *sup, WINDOW *win) {
+    const VmStats *st = &sup->stats;
+    int rows, cols;
+    getmaxyx(win, rows, cols);
+    (void)rows;
+
+    werase(win);
+    box(win, 0, 0);
+    int up = (int)(now_sec() - st->started_at);
+    wattron(win, A_BOLD);
+    mvwprintw(win, 1, 2, "QEMU pid %d  %-10s  up %02d:%02d:%02d  overlays %d", (int)sup->pid,
+              sup->running ? (st->status[0] ? st->status : "starting") : "exited",
+              up / 3600, up / 60 % 60, up % 60, sup->overlays);
+    wattroff(win, A_BOLD);
+
+    // vCPU load, as many as fit on one line
+    int x = 2;
+    mvwprintw(win, 2, x, "vCPU busy:");
+    x += 11;
+    for (int i = 0; i < st->vcpus && x + 10 < cols; i++) {
+        mvwprintw(win, 2, x, "%d:%3.0f%%", i, st->busy[i]);
+        x += 9;
+    }
+
+    mvwprintw(win, 3, 2, "%-10s %10s %8s %10s %8s %12s", "device", "read MB/s", "IOPS",
+              "write MB/s", "IOPS", "total r/w MB");
+    for (int i = 0; i < st->disks; i++) {
+        const VmBlockStats *d = &st->disk[i];
+        mvwprintw(win, 4 + i, 2, "%-10s %10.1f %8.0f %10.1f %8.0f %6llu/%llu", d->device,
+                  d->rd_mbps, d->rd_iops, d->wr_mbps, d->wr_iops, d->rd_bytes >> 20,
+                  d->wr_bytes >> 20);
+    }
+
+    mvwprintw(win, 4 + VMSUP_MAX_DISKS, 2,
+              "[s] savevm  [l] loadvm  [x] disk snapshot  [p] pause/resume  [q] stop");
+    wnoutrefresh(win);
+    doupdate();
+}
+
+int vm_sup_console(VmSupervisor *sup, const char *disk_path) {
+    int max_y, max_x;
+    getmaxyx(stdscr, max_y, max_x);
+
+    // The render thread may be drawing: swap log_win under its lock
+    pthread_mutex_lock(&log_mutex);
+    clear();
+    refresh();
+    WINDOW *panel = newwin(VMSUP_PANEL_ROWS, max_x - 4, 1, 2);
+    nodelay(panel, TRUE);
+    keypad(panel, TRUE);
+    log_win = newwin(max_y - VMSUP_PANEL_ROWS - 2, max_x - 4, VMSUP_PANEL_ROWS + 1, 2);
+    scrollok(log_win, TRUE);
+    wrefresh(log_win);
+    pthread_mutex_unlock(&log_mutex);
+
+    log_message("Guest serial console below. Snapshot tag: %s", VMSUP_DEFAULT_TAG);
+
+    double next_sample = 0;
+    int paused = 0;
+    while (vm_sup_pump(sup, 100)) {
+        if (now_sec() >= next_sample) {
+            vm_sup_sample(sup);
+            next_sample = now_sec() + VMSUP_SAMPLE_MS / 1000.0;
+            pthread_mutex_lock(&log_mutex);
+            vm_sup_draw(sup, panel);
+            pthread_mutex_unlock(&log_mutex);
+        }
+
+        pthread_mutex_lock(&log_mutex);
+        int ch = wgetch(panel);
+        pthread_mutex_unlock(&log_mutex);
+
+        char overlay[4096];
+        switch (ch) {
+        case 's':
+            vm_sup_savevm(sup, VMSUP_DEFAULT_TAG);
+            break;
+        case 'l':
+            vm_sup_loadvm(sup, VMSUP_DEFAULT_TAG);
+            break;
+        case 'x':
+            snprintf(overlay, sizeof(overlay), "%s.snap%d.qcow2", disk_path,
+                     sup->overlays + 1);
+            vm_sup_snapshot(sup, overlay);
+            break;
+        case 'p':
+            if ((paused ? vm_sup_resume(sup) : vm_sup_pause(sup)) == 0) paused = !paused;
+            break;
+        case 'q':
+            vm_sup_stop(sup, VMSUP_POWERDOWN_SECONDS);
+            break;
+        default:
+            break;
+        }
+        if (ch != ERR) next_sample = 0;
+    }
+
+    pthread_mutex_lock(&log_mutex);
+    vm_sup_draw(sup, panel);
+    pthread_mutex_unlock(&log_mutex);
+    log_message("Press any key to continue...");
+    log_pause();
+    nodelay(panel, FALSE);
+    wgetch(panel);
+    log_resume();
+
+    log_close_window();
+    pthread_mutex_lock(&log_mutex);
+    delwin(panel);
+    clear();
+    refresh();
+    pthread_mutex_unlock(&log_mutex);
+    return sup->exit_code;
+}
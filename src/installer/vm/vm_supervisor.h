@@ -0,0 +1,111 @@
+#ifndef VM_SUPERVISOR_H
+#define VM_SUPERVISOR_H
+
+#include <ncurses.h>
+#include <sys/types.h>
+
+#include "qemu_profile.h"
+#include "qmp.h"
+#include "../utils/process.h"
+
+/*
+ * In-process QEMU supervisor.
+ * vm_sup_start() spawns the headless profile directly (no launcher
+ * script), connects to its QMP socket and pins the vCPU and iothread
+ * threads it finds through query-cpus-fast / query-iothreads. The guest
+ * serial console (QEMU stdout) is streamed into log_win line by line.
+ * Snapshots are either external (blockdev-snapshot-sync to a new qcow2
+ * overlay) or internal savevm/loadvm, which restores a booted guest in
+ * seconds between test cycles; vm_sup_save_state() writes that state to
+ * a file any number of clones can start from. vm_sup_console() ties it
+ * together in a TUI with a stats panel fed by query-blockstats and
+ * per-thread CPU time.
+ */
+
+#define VMSUP_MAX_DISKS 4
+#define VMSUP_POWERDOWN_SECONDS 30         // ACPI shutdown before quit/kill
+#define VMSUP_SNAPSHOT_TIMEOUT_MS 120000   // savevm/migration write all guest RAM
+#define VMSUP_SAMPLE_MS 1000
+#define VMSUP_DEFAULT_TAG "lainux-test"
+
+typedef struct {
+    char device[32];
+    unsigned long long rd_bytes, wr_bytes;
+    unsigned long long rd_ops, wr_ops;
+    double rd_mbps, wr_mbps;               // since the previous sample
+    double rd_iops, wr_iops;
+} VmBlockStats;
+
+typedef struct {
+    int vcpus;
+    int thread[QEMU_PROFILE_MAX_VCPUS];    // host TID of each vCPU
+    unsigned long long ticks[QEMU_PROFILE_MAX_VCPUS];  // utime + stime
+    double busy[QEMU_PROFILE_MAX_VCPUS];   // % of one host CPU
+    VmBlockStats disk[VMSUP_MAX_DISKS];
+    int disks;
+    char status[32];                       // query-status: running, paused...
+    double sampled_at;                     // monotonic seconds, 0 - never
+    double started_at;
+} VmStats;
+
+typedef struct {
+    // Set before vm_sup_start, kept by it
+    int serial_input;                      // give the guest console a pipe
+    ProcLineFn on_serial;                  // console lines go here, not the log
+    void *serial_user;
+
+    pid_t pid;
+    int out_fd, err_fd;
+    int in_fd;                             // console input, -1 - /dev/null
+    ProcStream out, err;
+    Qmp qmp;
+    char qmp_path[108];
+    QemuProfile profile;
+    VmStats stats;
+    int running;                           // QEMU process alive
+    int exit_code;                         // once reaped, -1 if killed
+    int overlays;                          // external snapshots taken
+} VmSupervisor;
+
+// Spawn profile (built with qmp_socket = qmp_path), connect QMP and pin
+// threads. Returns 0 on success; on failure QEMU is killed and reaped.
+int vm_sup_start(VmSupervisor *sup, const QemuProfile *profile, const char *qmp_path);
+
+// Wait up to timeout_ms for serial output, stderr or QMP events and
+// handle them. Returns 1 while QEMU runs, 0 once it has exited
+int vm_sup_pump(VmSupervisor *sup, int timeout_ms);
+
+// ACPI powerdown, then quit after grace_sec, then SIGKILL. Always reaps.
+// grace_sec 0 skips the powerdown for VMs that are thrown away
+int vm_sup_stop(VmSupervisor *sup, int grace_sec);
+
+// Type text on the guest serial console (needs serial_input)
+int vm_sup_type(VmSupervisor *sup, const char *text);
+
+int vm_sup_pause(VmSupervisor *sup);
+int vm_sup_resume(VmSupervisor *sup);
+
+// External snapshot: disk0 continues in a new qcow2 overlay on top of
+// the current image, which becomes a read-only backing file
+int vm_sup_snapshot(VmSupervisor *sup, const char *overlay_path);
+
+// Internal snapshots of disk and RAM (qcow2 only)
+int vm_sup_savevm(VmSupervisor *sup, const char *tag);
+int vm_sup_loadvm(VmSupervisor *sup, const char *tag);
+
+// Pause the guest and migrate its RAM and device state into path, for
+// -incoming on other VMs with the same command line. Returns 0 once done
+int vm_sup_save_state(VmSupervisor *sup, const char *path);
+
+// Refresh sup->stats from QMP and /proc. Returns 0 on success
+int vm_sup_sample(VmSupervisor *sup);
+
+// Draw the stats panel into win (caller holds log_mutex)
+void vm_sup_draw(const VmSupervisor *sup, WINDOW *win);
+
+// Interactive loop until QEMU exits or the user stops it. Creates
+// log_win for the serial console; overlays are named after disk_path.
+// Returns QEMU's exit code
+int vm_sup_console(VmSupervisor *sup, const char *disk_path);
+
+#endif // vm supervisor h
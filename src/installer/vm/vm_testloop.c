@@ -0,0 +1,471 @@
+/**
+ * @file vm_testloop.c
+ * @brief installer test matrix on clones of a booted live ISO
+ *
+ * A base is three files in VMTEST_DIR: base-<fw>.qcow2 (the empty disk the
+ * live system saw), base-<fw>.state (its migrated RAM and devices) and,
+ * for UEFI, base-<fw>.vars. base-<fw>.key records what the state was made
+ * from; QEMU only loads a state into an identical machine, so any change
+ * there rebuilds the base. Clones get <test>-<fw>.qcow2 over the base
+ * disk and a copy of the vars, and log their console to <test>-<fw>.log.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vm_testloop.h"
+#include "vm_disk.h"
+#include "vm_supervisor.h"
+#include "../utils/log_message.h"
+
+// What the live shell prints when asked; the typed command itself never
+// contains these strings, only its output does
+#define VMTEST_READY "LAINUX-READY"
+#define VMTEST_PROBE "printf 'LAINUX-%s\\n' READY\n"
+#define VMTEST_RC "LAINUX-RC="
+#define VMTEST_PROBE_DELAY 20        // seconds of boot before probing the shell
+#define VMTEST_PROBE_EVERY 5
+#define VMTEST_TICK_MS 50
+
+// Code and variable store templates, as packaged by the usual distros
+static const char *const ovmf_paths[][2] = {
+    {"/usr/share/edk2/x64/OVMF_CODE.4m.fd", "/usr/share/edk2/x64/OVMF_VARS.4m.fd"},
+    {"/usr/share/edk2-ovmf/x64/OVMF_CODE.fd", "/usr/share/edk2-ovmf/x64/OVMF_VARS.fd"},
+    {"/usr/share/OVMF/OVMF_CODE_4M.fd", "/usr/share/OVMF/OVMF_VARS_4M.fd"},
+    {"/usr/share/OVMF/OVMF_CODE.fd", "/usr/share/OVMF/OVMF_VARS.fd"},
+    {"/usr/share/edk2/ovmf/OVMF_CODE.fd", "/usr/share/edk2/ovmf/OVMF_VARS.fd"},
+};
+
+typedef struct {
+    VmTestFirmware fw;
+    int ready;
+    const char *code;                // OVMF code, NULL for BIOS
+    char disk[PATH_MAX];
+    char backing[PATH_MAX];          // absolute disk path for overlays
+    char state[PATH_MAX];
+    char vars[PATH_MAX];
+    char incoming[PATH_MAX + 16];
+} VmTestBase;
+
+typedef struct {
+    int active;
+    int slot;
+    const VmTestCase *test;
+    const VmTestBase *base;
+    int typed;                       // command sent to the shell
+    int rc;                          // reported exit status, -1 - none yet
+    double started, next_poll;
+    char overlay[PATH_MAX];
+    char vars[PATH_MAX];
+    char log[PATH_MAX];
+    char qmp[64];
+    FILE *console;
+    VmSupervisor sup;
+    QemuProfile profile;
+} VmTestJob;
+
+static VmTestBase bases[VMTEST_FIRMWARES];
+static VmTestJob jobs[VMTEST_MAX_JOBS];
+static QemuProfile base_profile;
+static VmSupervisor base_sup;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+const char *vm_test_firmware_name(VmTestFirmware fw) {
+    return fw == VMTEST_UEFI ? "uefi" : "bios";
+}
+
+static int copy_file(const char *src, const char *dst) {
+    char buf[65536];
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return -1;
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    ssize_t n;
+    int rc = 0;
+    while (rc == 0 && (n = read(in, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno != EINTR) rc = -1;
+            continue;
+        }
+        if (write(out, buf, (size_t)n) != n) rc = -1;
+    }
+    close(in);
+    if (close(out) != 0) rc = -1;
+    return rc;
+}
+
+static const char *find_ovmf(const char **vars) {
+    for (size_t i = 0; i < sizeof(ovmf_paths) / sizeof(ovmf_paths[0]); i++) {
+        if (access(ovmf_paths[i][0], R_OK) == 0 && access(ovmf_paths[i][1], R_OK) == 0) {
+            *vars = ovmf_paths[i][1];
+            return ovmf_paths[i][0];
+        }
+    }
+    return NULL;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    size_t n = strlen(s);
+    while (n > 0 && isspace((unsigned char)s[n - 1])) s[--n] = '\0';
+    return s;
+}
+
+int vm_test_load(const char *path, VmTestPlan *plan) {
+    char line[1024];
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    plan->count = 0;
+    while (fgets(line, sizeof(line), fp) && plan->count < VMTEST_MAX_TESTS) {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *colon = strchr(line, ':');
+        if (!colon) continue;
+        *colon = '\0';
+        char *name = trim(line), *command = trim(colon + 1);
+        if (!name[0] || !command[0]) continue;
+        // Names become file names; 0x01 would reach QEMU's console mux
+        if (strpbrk(name, "/ '") || strchr(command, '\001')) {
+            log_message("VM tests: skipping malformed test '%s'", name);
+            continue;
+        }
+        VmTestCase *t = &plan->tests[plan->count++];
+        snprintf(t->name, sizeof(t->name), "%s", name);
+        snprintf(t->command, sizeof(t->command), "%s", command);
+    }
+    fclose(fp);
+
+    // By default UEFI runs wherever OVMF is installed; asked for, it must be
+    const char *fw = getenv(VMTEST_FIRMWARE_ENV), *vars;
+    plan->firmware[VMTEST_BIOS] = !fw || strstr(fw, "bios") != NULL;
+    plan->firmware[VMTEST_UEFI] = fw ? strstr(fw, "uefi") != NULL : find_ovmf(&vars) != NULL;
+    return plan->count;
+}
+
+// Everything a saved state depends on
+static void base_key(const QemuHost *host, const VmTestPlan *plan, const VmTestBase *base,
+                     char *key, size_t size) {
+    struct stat st = {0};
+    stat(plan->iso_path, &st);
+    snprintf(key, size, "iso=%s size=%lld mtime=%lld kvm=%d memory=%d vcpus=%d firmware=%s\n",
+             plan->iso_path, (long long)st.st_size, (long long)st.st_mtime, host->kvm,
+             VMTEST_MEMORY, VMTEST_VCPUS, base->code ? base->code : "seabios");
+}
+
+static int key_matches(const char *path, const char *key) {
+    char buf[PATH_MAX + 256] = "";
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+    return strcmp(buf, key) == 0;
+}
+
+static void build_options(const VmTestPlan *plan, const VmTestBase *base, const char *name,
+                          const char *disk, const char *vars, const char *qmp,
+                          const char *incoming, QemuProfileOptions *opt) {
+    memset(opt, 0, sizeof(*opt));
+    opt->kind = QEMU_PROFILE_HEADLESS;
+    opt->name = name;
+    opt->disk_path = disk;
+    opt->disk_format = "qcow2";
+    opt->iso_path = plan->iso_path;
+    opt->memory_mb = VMTEST_MEMORY;
+    opt->vcpus = VMTEST_VCPUS;
+    opt->bus = QEMU_DISK_VIRTIO_BLK;
+    opt->qmp_socket = qmp;
+    opt->shared = 1;
+    opt->firmware_code = base->code;
+    opt->firmware_vars = base->code ? vars : NULL;
+    opt->incoming = incoming;
+}
+
+static void base_serial(const char *line, int is_err, void *user) {
+    (void)is_err;
+    VmTestBase *base = user;
+    if (strncmp(line, VMTEST_READY, strlen(VMTEST_READY)) == 0) base->ready = 1;
+}
+
+// Boot the live ISO once and keep it as a state file at its first prompt
+static int prepare_base(const QemuHost *host, const VmTestPlan *plan, VmTestBase *base) {
+    const char *fw = vm_test_firmware_name(base->fw);
+    const char *vars_template = NULL;
+    char key[PATH_MAX + 256], key_path[PATH_MAX], tmp[PATH_MAX + 8], qmp[64];
+
+    if (base->fw == VMTEST_UEFI && !(base->code = find_ovmf(&vars_template))) {
+        log_message("VM tests: UEFI requested but no OVMF firmware found");
+        return -1;
+    }
+    snprintf(base->disk, sizeof(base->disk), "%s/base-%s.qcow2", VMTEST_DIR, fw);
+    snprintf(base->state, sizeof(base->state), "%s/base-%s.state", VMTEST_DIR, fw);
+    snprintf(base->vars, sizeof(base->vars), "%s/base-%s.vars", VMTEST_DIR, fw);
+    snprintf(key_path, sizeof(key_path), "%s/base-%s.key", VMTEST_DIR, fw);
+    snprintf(base->incoming, sizeof(base->incoming), "exec:cat '%s'", base->state);
+    base_key(host, plan, base, key, sizeof(key));
+
+    if (access(base->state, R_OK) == 0 && access(base->disk, R_OK) == 0 &&
+        key_matches(key_path, key)) {
+        log_message("VM tests: reusing the %s base", fw);
+    } else {
+        VmDiskOptions disk = {VMDISK_QCOW2, VMDISK_DEFAULT_SIZE, VMDISK_CLUSTER_DEFAULT,
+                              VMDISK_PREALLOC_OFF, VMDISK_COMPRESS_ZSTD, NULL};
+        unlink(key_path);
+        if (vm_disk_create(base->disk, &disk) != 0) return -1;
+        if (base->code && copy_file(vars_template, base->vars) != 0) {
+            log_message("VM tests: cannot copy %s: %s", vars_template, strerror(errno));
+            return -1;
+        }
+
+        log_message("VM tests: booting the live ISO for the %s base...", fw);
+        QemuProfileOptions opt;
+        snprintf(qmp, sizeof(qmp), "/tmp/lainux-test-%d-base.qmp", (int)getpid());
+        build_options(plan, base, "lainux-test-base", base->disk, base->vars, qmp, NULL, &opt);
+        if (qemu_profile_build(host, &opt, &base_profile) != 0) return -1;
+
+        base->ready = 0;
+        base_sup.serial_input = 1;
+        base_sup.on_serial = base_serial;
+        base_sup.serial_user = base;
+        if (vm_sup_start(&base_sup, &base_profile, qmp) != 0) return -1;
+
+        // Keep asking until the live system's shell answers
+        double start = now_sec(), next_probe = start + VMTEST_PROBE_DELAY;
+        while (!base->ready && vm_sup_pump(&base_sup, 200) &&
+               now_sec() - start < VMTEST_BOOT_SECONDS) {
+            if (now_sec() >= next_probe) {
+                vm_sup_type(&base_sup, VMTEST_PROBE);
+                next_probe = now_sec() + VMTEST_PROBE_EVERY;
+            }
+        }
+        if (!base->ready) {
+            log_message("VM tests: no shell on the %s serial console after %.0fs "
+                        "(does the ISO boot with console=ttyS0?)", fw, now_sec() - start);
+            vm_sup_stop(&base_sup, 0);
+            return -1;
+        }
+        log_message("VM tests: %s live shell up after %.0fs", fw, now_sec() - start);
+
+        snprintf(tmp, sizeof(tmp), "%s.tmp", base->state);
+        int rc = vm_sup_save_state(&base_sup, tmp);
+        vm_sup_stop(&base_sup, 0);
+        if (rc != 0 || rename(tmp, base->state) != 0) {
+            unlink(tmp);
+            return -1;
+        }
+        FILE *fp = fopen(key_path, "w");
+        if (fp) {
+            fputs(key, fp);
+            fclose(fp);
+        }
+    }
+
+    if (!realpath(base->disk, base->backing)) return -1;
+    return 0;
+}
+
+static void job_serial(const char *line, int is_err, void *user) {
+    (void)is_err;
+    VmTestJob *job = user;
+    if (job->console) fprintf(job->console, "%s\n", line);
+
+    const char *rc = strstr(line, VMTEST_RC);
+    if (rc && isdigit((unsigned char)rc[strlen(VMTEST_RC)])) {
+        job->rc = atoi(rc + strlen(VMTEST_RC));
+    }
+}
+
+static void job_cleanup(VmTestJob *job, int keep) {
+    if (job->console) fclose(job->console);
+    job->console = NULL;
+    if (!keep) {
+        unlink(job->overlay);
+        unlink(job->log);
+        if (job->base->code) unlink(job->vars);
+    }
+    job->active = 0;
+}
+
+static int job_start(VmTestJob *job, const QemuHost *host, const VmTestPlan *plan,
+                     const VmTestCase *test, const VmTestBase *base) {
+    const char *fw = vm_test_firmware_name(base->fw);
+    char name[64];
+
+    job->test = test;
+    job->base = base;
+    job->typed = 0;
+    job->rc = -1;
+    snprintf(job->overlay, sizeof(job->overlay), "%s/%s-%s.qcow2", VMTEST_DIR, test->name, fw);
+    snprintf(job->vars, sizeof(job->vars), "%s/%s-%s.vars", VMTEST_DIR, test->name, fw);
+    snprintf(job->log, sizeof(job->log), "%s/%s-%s.log", VMTEST_DIR, test->name, fw);
+    snprintf(job->qmp, sizeof(job->qmp), "/tmp/lainux-test-%d-%d.qmp", (int)getpid(),
+             job->slot);
+    snprintf(name, sizeof(name), "lainux-test-%d", job->slot);
+
+    // Same size as the base; all reads fall through to it until written
+    VmDiskOptions disk = {VMDISK_QCOW2, VMDISK_DEFAULT_SIZE, VMDISK_CLUSTER_DEFAULT,
+                          VMDISK_PREALLOC_OFF, VMDISK_COMPRESS_ZSTD, base->backing};
+    if (vm_disk_create(job->overlay, &disk) != 0) return -1;
+    if (base->code && copy_file(base->vars, job->vars) != 0) {
+        unlink(job->overlay);
+        return -1;
+    }
+    job->active = 1;
+    job->console = fopen(job->log, "w");
+
+    QemuProfileOptions opt;
+    build_options(plan, base, name, job->overlay, job->vars, job->qmp, base->incoming, &opt);
+    job->sup.serial_input = 1;
+    job->sup.on_serial = job_serial;
+    job->sup.serial_user = job;
+    if (qemu_profile_build(host, &opt, &job->profile) != 0 ||
+        vm_sup_start(&job->sup, &job->profile, job->qmp) != 0) {
+        job_cleanup(job, 0);
+        return -1;
+    }
+    job->started = now_sec();
+    job->next_poll = 0;
+    log_message("VM tests: %s [%s] started in slot %d", test->name, fw, job->slot);
+    return 0;
+}
+
+// Advance one clone. Returns 1 while it runs, else 0 with *passed set
+static int job_step(VmTestJob *job, int *passed) {
+    const char *fw = vm_test_firmware_name(job->base->fw);
+    double elapsed = now_sec() - job->started;
+    int alive = vm_sup_pump(&job->sup, 0);
+
+    // The clone resumes by itself once the incoming state is loaded
+    if (alive && !job->typed && now_sec() >= job->next_poll) {
+        job->next_poll = now_sec() + 0.2;
+        if (vm_sup_sample(&job->sup) == 0 && strcmp(job->sup.stats.status, "running") == 0) {
+            char line[sizeof(job->test->command) + 64];
+            snprintf(line, sizeof(line), "( %s ); echo %s$?\n", job->test->command, VMTEST_RC);
+            vm_sup_type(&job->sup, line);
+            job->typed = 1;
+            log_message("VM tests: %s [%s] state loaded in %.1fs", job->test->name, fw,
+                        elapsed);
+        }
+    }
+    if (alive && job->rc < 0 && elapsed < VMTEST_TIMEOUT_SECONDS) return 1;
+
+    // Nothing in the clone is worth keeping but its verdict
+    vm_sup_stop(&job->sup, 0);
+    *passed = job->rc == 0;
+    if (*passed) {
+        log_message("VM tests: PASS %s [%s] in %.0fs", job->test->name, fw, elapsed);
+    } else {
+        log_message("VM tests: FAIL %s [%s]: %s; kept %s and %s", job->test->name, fw,
+                    job->rc > 0 ? "non-zero exit"
+                    : alive     ? "timed out"
+                                : "QEMU exited",
+                    job->overlay, job->log);
+    }
+    job_cleanup(job, !*passed);
+    return 0;
+}
+
+// Clones that fit: VMTEST_VCPUS cores and VMTEST_MEMORY (plus QEMU's
+// own overhead) each
+static int auto_jobs(const QemuHost *host) {
+    long long avail_kb = 0;
+    char line[256];
+    FILE *fp = fopen("/proc/meminfo", "r");
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "MemAvailable: %lld kB", &avail_kb) == 1) break;
+        }
+        fclose(fp);
+    }
+    int by_cpu = host->cores / VMTEST_VCPUS;
+    int by_mem = (int)(avail_kb / ((VMTEST_MEMORY + 512) * 1024LL));
+    int n = by_cpu < by_mem ? by_cpu : by_mem;
+    return n < 1 ? 1 : n;
+}
+
+int vm_test_run(const VmTestPlan *plan, VmTestSummary *summary) {
+    QemuHost host;
+    double start = now_sec();
+
+    memset(summary, 0, sizeof(*summary));
+    if (qemu_host_probe(&host) != 0) return -1;
+    if (mkdir(VMTEST_DIR, 0755) != 0 && errno != EEXIST) {
+        log_message("VM tests: cannot create %s: %s", VMTEST_DIR, strerror(errno));
+        return -1;
+    }
+
+    int parallel = plan->jobs > 0 ? plan->jobs : auto_jobs(&host);
+    const char *env = getenv(VMTEST_JOBS_ENV);
+    if (env && atoi(env) > 0) parallel = atoi(env);
+    if (parallel > VMTEST_MAX_JOBS) parallel = VMTEST_MAX_JOBS;
+
+    // Bases first; a mode without one fails all of its tests
+    int queued[VMTEST_FIRMWARES] = {0};
+    for (int fw = 0; fw < VMTEST_FIRMWARES; fw++) {
+        if (!plan->firmware[fw]) continue;
+        memset(&bases[fw], 0, sizeof(bases[fw]));
+        bases[fw].fw = (VmTestFirmware)fw;
+        if (prepare_base(&host, plan, &bases[fw]) == 0) {
+            queued[fw] = 1;
+        } else {
+            summary->failed += plan->count;
+        }
+    }
+    log_message("VM tests: %d test(s), up to %d clone(s) at once (%.0fs of setup)",
+                plan->count, parallel, now_sec() - start);
+
+    int fw = 0, next = 0, running = 0;
+    for (;;) {
+        // Fill free slots from the (firmware, test) queue
+        for (int s = 0; s < parallel; s++) {
+            while (fw < VMTEST_FIRMWARES && (!queued[fw] || next >= plan->count)) {
+                fw++;
+                next = 0;
+            }
+            if (jobs[s].active || fw >= VMTEST_FIRMWARES) continue;
+            jobs[s].slot = s;
+            if (job_start(&jobs[s], &host, plan, &plan->tests[next], &bases[fw]) == 0) {
+                running++;
+            } else {
+                log_message("VM tests: FAIL %s [%s]: clone did not start",
+                            plan->tests[next].name, vm_test_firmware_name(fw));
+                summary->failed++;
+            }
+            next++;
+        }
+        if (running == 0 && fw >= VMTEST_FIRMWARES) break;
+
+        for (int s = 0; s < parallel; s++) {
+            int passed;
+            if (!jobs[s].active || job_step(&jobs[s], &passed)) continue;
+            running--;
+            if (passed) summary->passed++;
+            else summary->failed++;
+        }
+        struct timespec ts = {0, VMTEST_TICK_MS * 1000000L};
+        nanosleep(&ts, NULL);
+    }
+
+    summary->seconds = now_sec() - start;
+    log_message("VM tests: %d passed, %d failed in %.0fs", summary->passed, summary->failed,
+                summary->seconds);
+    return summary->failed == 0 ? 0 : -1;
+}
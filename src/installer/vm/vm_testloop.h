@@ -0,0 +1,64 @@
+#ifndef VM_TESTLOOP_H
+#define VM_TESTLOOP_H
+
+/*
+ * Snapshot-based installer regression runs.
+ * For each firmware mode the live ISO is booted once on an empty qcow2
+ * base; as soon as its shell answers on the serial console the whole VM
+ * (RAM and devices) is migrated into a state file and QEMU quits. Every
+ * test then starts a clone from that state (-incoming) on a throwaway
+ * qcow2 overlay of the base, types its command, reads the exit status
+ * back from the console and deletes the overlay when it passed. Bases
+ * are reused until the ISO or the VM shape changes, and clones of
+ * the matrix run side by side.
+ */
+
+#define VMTEST_DIR "vm-test"                    // bases, states, overlays, logs
+#define VMTEST_MATRIX "vm-tests.txt"
+#define VMTEST_MATRIX_ENV "LAINUX_VM_TESTS"     // overrides VMTEST_MATRIX
+#define VMTEST_FIRMWARE_ENV "LAINUX_VM_FIRMWARE" // "bios", "uefi" or "bios,uefi"
+#define VMTEST_JOBS_ENV "LAINUX_VM_JOBS"        // clones at once
+#define VMTEST_MAX_TESTS 64
+#define VMTEST_MAX_JOBS 16
+#define VMTEST_MEMORY 2048                      // MB per clone
+#define VMTEST_VCPUS 2
+#define VMTEST_BOOT_SECONDS 600                 // live ISO to a shell
+#define VMTEST_TIMEOUT_SECONDS 1800             // per test
+
+typedef enum {
+    VMTEST_BIOS = 0,
+    VMTEST_UEFI,
+    VMTEST_FIRMWARES,
+} VmTestFirmware;
+
+typedef struct {
+    char name[32];
+    char command[512];                          // run by the live shell
+} VmTestCase;
+
+typedef struct {
+    const char *iso_path;
+    VmTestCase tests[VMTEST_MAX_TESTS];
+    int count;
+    int firmware[VMTEST_FIRMWARES];             // modes to run the tests under
+    int jobs;                                   // 0 - sized from host CPUs and RAM
+} VmTestPlan;
+
+typedef struct {
+    int passed;
+    int failed;
+    double seconds;
+} VmTestSummary;
+
+// Read "name: command" lines ('#' starts a comment) into plan->tests and
+// the firmware modes from VMTEST_FIRMWARE_ENV. Returns the test count,
+// -1 if path cannot be read
+int vm_test_load(const char *path, VmTestPlan *plan);
+
+// Run every test under every selected firmware mode. Returns 0 when all
+// of them passed
+int vm_test_run(const VmTestPlan *plan, VmTestSummary *summary);
+
+const char *vm_test_firmware_name(VmTestFirmware fw);
+
+#endif // vm testloop h